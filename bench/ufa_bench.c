@@ -0,0 +1,795 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Benchmarks for UFA. Generates synthetic repositories and measures the     */
+/* main operations, printing one JSON object per line.                        */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "core/data.h"
+#include "core/repo.h"
+#include "util/list.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/stats.h"
+#include "util/string.h"
+#include "json/jsonrpc_api.h"
+#include "json/jsonrpc_server.h"
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+static char *program_name    = "";
+static char *program_version = "0.1";
+
+/**
+ * Parameters of synthetic repositories and benchmarks
+ */
+struct bench_options {
+	long files;             /* files per repository */
+	long tags;              /* distinct tags */
+	long max_tags;          /* max tags per file */
+	double zipf;            /* exponent of Zipf distribution of tags */
+	long attrs;             /* attributes per file */
+	long cardinality;       /* distinct values per attribute */
+	long repos;             /* repositories (for search fan-out) */
+	long iterations;        /* iterations of each read benchmark */
+	long seed;
+	bool keep;              /* keep generated repositories */
+	bool batch;             /* generate each repository in a transaction */
+	bool trigram;           /* create trigram index (wildcard patterns) */
+	const char *backend;    /* storage backend of repositories */
+};
+
+/**
+ * Durations (usec) of operations of a benchmark
+ */
+struct bench_result {
+	const char *name;
+	uint64_t *samples;
+	size_t count;
+	size_t capacity;
+	unsigned long errors;
+	const char *server; /* JSON-RPC server measured (NULL if none) */
+};
+
+static struct bench_options options = {
+	.files       = 1000,
+	.tags        = 100,
+	.max_tags    = 8,
+	.zipf        = 1.0,
+	.attrs       = 2,
+	.cardinality = 20,
+	.repos       = 3,
+	.iterations  = 200,
+	.seed        = 42,
+	.keep        = false,
+	.batch       = false,
+	.trigram     = false,
+	.backend     = "sqlite",
+};
+
+/** Cumulative distribution of tag popularity (Zipf) */
+static double *tag_cdf = NULL;
+
+static uint64_t rand_state = 0;
+
+static ufa_jsonrpc_server_t *server = NULL;
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS - DECLARATION                                          */
+/* ========================================================================== */
+
+static void print_usage(FILE *stream);
+static uint64_t next_rand();
+static long rand_range(long n);
+static void init_zipf(long n, double s);
+static long zipf_tag();
+static char *tag_name(long tag);
+static char *file_path(const char *repo_dir, long file);
+
+static void result_begin(struct bench_result *r, const char *name);
+static void result_add(struct bench_result *r, uint64_t start, bool failed);
+static void result_print(struct bench_result *r);
+
+static bool generate_repo(const char *repo_dir, struct bench_result *settag,
+			  struct bench_result *setattr);
+static struct ufa_list *random_tags(long max);
+static void bench_repo_search(const ufa_repo_t *repo);
+static void bench_wildcard(const ufa_repo_t *repo);
+static void bench_files_with_tags(const ufa_repo_t *repo);
+static void bench_fuse_ops(const ufa_repo_t *repo, const char *repo_dir);
+static void bench_data_search(struct ufa_list *repo_dirs);
+static void bench_jsonrpc(const char *repo_dir);
+static void *start_server(void *arg);
+static void remove_repo(const char *repo_dir);
+
+
+/* ========================================================================== */
+/* MAIN FUNCTION                                                              */
+/* ========================================================================== */
+
+int main(int argc, char *argv[])
+{
+	program_name = argv[0];
+
+	int exit_status = EX_OK;
+	bool error_usage = false;
+	char base_dir[] = "/tmp/ufa-bench-XXXXXX";
+	struct ufa_list *repo_dirs = NULL;
+	ufa_repo_t *repo = NULL;
+	struct ufa_error *error = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, ":f:t:m:z:a:c:r:i:s:l:B:kbThv")) != -1
+	       && !error_usage) {
+		switch (opt) {
+		case 'f':
+			error_usage = !ufa_str_to_long(optarg, &options.files);
+			break;
+		case 't':
+			error_usage = !ufa_str_to_long(optarg, &options.tags);
+			break;
+		case 'm':
+			error_usage =
+			    !ufa_str_to_long(optarg, &options.max_tags);
+			break;
+		case 'z':
+			error_usage = !ufa_str_to_double(optarg, &options.zipf);
+			break;
+		case 'a':
+			error_usage = !ufa_str_to_long(optarg, &options.attrs);
+			break;
+		case 'c':
+			error_usage =
+			    !ufa_str_to_long(optarg, &options.cardinality);
+			break;
+		case 'r':
+			error_usage = !ufa_str_to_long(optarg, &options.repos);
+			break;
+		case 'i':
+			error_usage =
+			    !ufa_str_to_long(optarg, &options.iterations);
+			break;
+		case 's':
+			error_usage = !ufa_str_to_long(optarg, &options.seed);
+			break;
+		case 'k':
+			options.keep = true;
+			break;
+		case 'b':
+			options.batch = true;
+			break;
+		case 'T':
+			options.trigram = true;
+			break;
+		case 'B':
+			options.backend = optarg;
+			error_usage =
+			    !ufa_repo_set_default_backend(optarg, &error);
+			ufa_error_print_and_free(error);
+			error = NULL;
+			break;
+		case 'l':
+			ufa_log_setlevel(ufa_log_level_from_str(optarg));
+			break;
+		case 'v':
+			printf("%s\n", program_version);
+			goto end;
+		case 'h':
+			print_usage(stdout);
+			goto end;
+		default:
+			error_usage = true;
+		}
+	}
+
+	if (error_usage || options.files < 1 || options.tags < 1
+	    || options.max_tags < 1 || options.repos < 1
+	    || options.cardinality < 1 || options.iterations < 1) {
+		print_usage(stderr);
+		exit_status = EX_USAGE;
+		goto end;
+	}
+
+	if (mkdtemp(base_dir) == NULL) {
+		perror("mkdtemp");
+		exit_status = EX_CANTCREAT;
+		goto end;
+	}
+
+	rand_state = (uint64_t) options.seed * 2654435761u + 1;
+	init_zipf(options.tags, options.zipf);
+
+	printf("{ \"bench\" : \"config\", \"version\" : \"%s\", "
+	       "\"files\" : %ld, \"tags\" : %ld, \"max_tags\" : %ld, "
+	       "\"zipf\" : %.2f, \"attrs\" : %ld, \"cardinality\" : %ld, "
+	       "\"repos\" : %ld, \"iterations\" : %ld, \"seed\" : %ld, "
+	       "\"trigram\" : %s, \"backend\" : \"%s\", \"dir\" : \"%s\" }\n",
+	       program_version, options.files, options.tags, options.max_tags,
+	       options.zipf, options.attrs, options.cardinality, options.repos,
+	       options.iterations, options.seed,
+	       options.trigram ? "true" : "false", options.backend, base_dir);
+	fflush(stdout);
+
+	// Generating repositories
+	struct bench_result settag, setattr;
+	result_begin(&settag, "repo.settag");
+	result_begin(&setattr, "repo.setattr");
+	for (long r = 0; r < options.repos; r++) {
+		char *dir = ufa_str_sprintf("%s/repo%ld", base_dir, r);
+		repo_dirs = ufa_list_append2(repo_dirs, dir, ufa_free);
+		if (!generate_repo(dir, &settag, &setattr)) {
+			exit_status = EXIT_FAILURE;
+			goto end;
+		}
+	}
+	result_print(&settag);
+	result_print(&setattr);
+
+	// Benchmarks on first repository
+	const char *first_dir = (const char *) repo_dirs->data;
+	repo = ufa_repo_init(first_dir, &error);
+	if (error) {
+		ufa_error_print_and_free(error);
+		exit_status = EXIT_FAILURE;
+		goto end;
+	}
+	bench_repo_search(repo);
+	bench_wildcard(repo);
+	bench_files_with_tags(repo);
+	bench_fuse_ops(repo, first_dir);
+	bench_data_search(repo_dirs);
+	bench_jsonrpc(first_dir);
+
+end:
+	ufa_repo_free(repo);
+	ufa_data_close();
+	if (repo_dirs != NULL && !options.keep) {
+		for (UFA_LIST_EACH(i, repo_dirs)) {
+			remove_repo((const char *) i->data);
+		}
+		rmdir(base_dir);
+	}
+	ufa_list_free(repo_dirs);
+	ufa_free(tag_cdf);
+	return exit_status;
+}
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+static void print_usage(FILE *stream)
+{
+	fprintf(stream, "\nUsage: %s [OPTIONS]\n", program_name);
+	fprintf(stream,
+		"\nGenerate synthetic repositories and benchmark UFA "
+		"operations.\nResults are printed as one JSON object per "
+		"line.\n");
+	fprintf(stream,
+		"\nOPTIONS\n"
+		"  -h\t\tPrint this help and quit\n"
+		"  -v\t\tPrint version information and quit\n"
+		"  -f FILES\tFiles per repository (default: 1000)\n"
+		"  -t TAGS\tDistinct tags (default: 100)\n"
+		"  -m MAX\tMax tags per file (default: 8)\n"
+		"  -z S\t\tExponent of Zipf distribution of tags (default: 1.0)\n"
+		"  -a ATTRS\tAttributes per file (default: 2)\n"
+		"  -c VALUES\tDistinct values per attribute (default: 20)\n"
+		"  -r REPOS\tRepositories, for search fan-out (default: 3)\n"
+		"  -i ITER\tIterations of each read benchmark (default: 200)\n"
+		"  -s SEED\tSeed for random numbers (default: 42)\n"
+		"  -k\t\tKeep generated repositories\n"
+		"  -b\t\tGenerate each repository in one transaction "
+		"(for large\n\t\trepositories, e.g. -f 500000 -a 2)\n"
+		"  -T\t\tCreate trigram index of attribute values\n"
+		"  -B BACKEND\tStorage backend of repositories: sqlite, memory\n"
+		"\t\t(default: sqlite)\n"
+		"  -l LOG_LEVEL\tLog levels: debug, info, warn, error, fatal\n"
+		"\n");
+}
+
+/**
+ * xorshift64* (same sequence on every platform for a given seed)
+ */
+static uint64_t next_rand()
+{
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+	return rand_state * 2685821657736338717ULL;
+}
+
+static long rand_range(long n)
+{
+	return (long) (next_rand() % (uint64_t) n);
+}
+
+static void init_zipf(long n, double s)
+{
+	tag_cdf = ufa_calloc(n, sizeof *tag_cdf);
+	double sum = 0;
+	for (long i = 0; i < n; i++) {
+		sum += 1.0 / pow(i + 1, s);
+		tag_cdf[i] = sum;
+	}
+	for (long i = 0; i < n; i++) {
+		tag_cdf[i] /= sum;
+	}
+}
+
+/**
+ * Tag chosen with Zipf distribution (tag 0 is the most popular)
+ */
+static long zipf_tag()
+{
+	double u = (next_rand() >> 11) * (1.0 / 9007199254740992.0);
+	long low = 0, high = options.tags - 1;
+	while (low < high) {
+		long mid = (low + high) / 2;
+		if (tag_cdf[mid] < u) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+static char *tag_name(long tag)
+{
+	return ufa_str_sprintf("tag%04ld", tag);
+}
+
+static char *file_path(const char *repo_dir, long file)
+{
+	return ufa_str_sprintf("%s/file%07ld", repo_dir, file);
+}
+
+static void result_begin(struct bench_result *r, const char *name)
+{
+	memset(r, 0, sizeof *r);
+	r->name = name;
+}
+
+static void result_add(struct bench_result *r, uint64_t start, bool failed)
+{
+	uint64_t now = ufa_stats_now();
+	if (r->count == r->capacity) {
+		r->capacity = (r->capacity == 0) ? 1024 : r->capacity * 2;
+		r->samples =
+		    ufa_realloc(r->samples, r->capacity * sizeof *r->samples);
+	}
+	r->samples[r->count++] = now - start;
+	if (failed) {
+		r->errors++;
+	}
+}
+
+static int compare_uint64(const void *a, const void *b)
+{
+	uint64_t x = *((const uint64_t *) a);
+	uint64_t y = *((const uint64_t *) b);
+	return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const struct bench_result *r, double p)
+{
+	size_t index = (size_t) ceil(p * r->count);
+	index = (index == 0) ? 0 : index - 1;
+	return r->samples[index];
+}
+
+/**
+ * Prints result as JSON and frees samples
+ */
+static void result_print(struct bench_result *r)
+{
+	if (r->count == 0) {
+		return;
+	}
+	qsort(r->samples, r->count, sizeof *r->samples, compare_uint64);
+
+	uint64_t total = 0;
+	for (size_t i = 0; i < r->count; i++) {
+		total += r->samples[i];
+	}
+	// time spent in the operations only (not in generating input)
+	double seconds = total / 1000000.0;
+
+	printf("{ \"bench\" : \"%s\", \"ops\" : %zu, \"errors\" : %lu, "
+	       "\"seconds\" : %.6f, \"ops_per_sec\" : %.1f, "
+	       "\"mean_us\" : %.1f, \"p50_us\" : %lu, \"p90_us\" : %lu, "
+	       "\"p99_us\" : %lu, \"max_us\" : %lu%s%s%s }\n",
+	       r->name, r->count, r->errors, seconds,
+	       (seconds > 0) ? r->count / seconds : 0.0,
+	       (double) total / r->count,
+	       (unsigned long) percentile(r, 0.50),
+	       (unsigned long) percentile(r, 0.90),
+	       (unsigned long) percentile(r, 0.99),
+	       (unsigned long) r->samples[r->count - 1],
+	       (r->server != NULL) ? ", \"server\" : \"" : "",
+	       (r->server != NULL) ? r->server : "",
+	       (r->server != NULL) ? "\"" : "");
+	fflush(stdout);
+
+	ufa_free(r->samples);
+	r->samples = NULL;
+	r->count = r->capacity = 0;
+}
+
+/**
+ * Creates a repository with empty files, setting tags (Zipf) and attributes
+ * on each file through repo.h
+ */
+static bool generate_repo(const char *repo_dir, struct bench_result *settag,
+			  struct bench_result *setattr)
+{
+	struct ufa_error *error = NULL;
+
+	if (!ufa_util_mkdir(repo_dir, &error)) {
+		ufa_error_print_and_free(error);
+		return false;
+	}
+	ufa_repo_t *repo = ufa_repo_init(repo_dir, &error);
+	if (error) {
+		ufa_error_print_and_free(error);
+		return false;
+	}
+	if (options.trigram) {
+		ufa_repo_set_trigram_index(repo, true, &error);
+	}
+	if (options.batch) {
+		ufa_repo_begin(repo, &error);
+	}
+	if (error) {
+		ufa_error_print_and_free(error);
+		ufa_repo_free(repo);
+		return false;
+	}
+
+	for (long f = 0; f < options.files; f++) {
+		char *filepath = file_path(repo_dir, f);
+		int fd = open(filepath, O_WRONLY | O_CREAT, 0600);
+		if (fd != -1) {
+			close(fd);
+		}
+
+		long num_tags = 1 + rand_range(options.max_tags);
+		for (long t = 0; t < num_tags; t++) {
+			char *tag = tag_name(zipf_tag());
+			uint64_t start = ufa_stats_now();
+			ufa_repo_settag(repo, filepath, tag, &error);
+			result_add(settag, start, error != NULL);
+			ufa_error_free(error);
+			error = NULL;
+			ufa_free(tag);
+		}
+
+		for (long a = 0; a < options.attrs; a++) {
+			char *attr = ufa_str_sprintf("attr%ld", a);
+			char *value = ufa_str_sprintf(
+			    "value%ld", rand_range(options.cardinality));
+			uint64_t start = ufa_stats_now();
+			ufa_repo_setattr(repo, filepath, attr, value, &error);
+			result_add(setattr, start, error != NULL);
+			ufa_error_free(error);
+			error = NULL;
+			ufa_free(attr);
+			ufa_free(value);
+		}
+		ufa_free(filepath);
+	}
+
+	if (options.batch) {
+		ufa_repo_commit(repo, &error);
+		ufa_error_print_and_free(error);
+	}
+	ufa_repo_free(repo);
+	return error == NULL;
+}
+
+/**
+ * List with 1 to max tags (Zipf)
+ */
+static struct ufa_list *random_tags(long max)
+{
+	struct ufa_list *tags = NULL;
+	long num_tags = 1 + rand_range(max);
+	for (long t = 0; t < num_tags; t++) {
+		tags = ufa_list_append2(tags, tag_name(zipf_tag()), ufa_free);
+	}
+	return tags;
+}
+
+static void bench_repo_search(const ufa_repo_t *repo)
+{
+	struct bench_result tags_result, attrs_result;
+	result_begin(&tags_result, "repo.search.tags");
+	for (long i = 0; i < options.iterations; i++) {
+		struct ufa_error *error = NULL;
+		struct ufa_list *tags = random_tags(2);
+		uint64_t start = ufa_stats_now();
+		struct ufa_list *result =
+		    ufa_repo_search(repo, NULL, tags, &error);
+		result_add(&tags_result, start, error != NULL);
+		ufa_error_free(error);
+		ufa_list_free(result);
+		ufa_list_free(tags);
+	}
+	result_print(&tags_result);
+
+	if (options.attrs == 0) {
+		return;
+	}
+	result_begin(&attrs_result, "repo.search.attrs");
+	for (long i = 0; i < options.iterations; i++) {
+		struct ufa_error *error = NULL;
+		char *attr = ufa_str_sprintf("attr%ld",
+					     rand_range(options.attrs));
+		char *value = ufa_str_sprintf(
+		    "value%ld", rand_range(options.cardinality));
+		struct ufa_list *filter = ufa_list_append2(
+		    NULL, ufa_repo_filterattr_new(attr, value, UFA_REPO_EQUAL),
+		    (ufa_list_free_fn_t) ufa_repo_filterattr_free);
+		struct ufa_list *tags = random_tags(1);
+		uint64_t start = ufa_stats_now();
+		struct ufa_list *result =
+		    ufa_repo_search(repo, filter, tags, &error);
+		result_add(&attrs_result, start, error != NULL);
+		ufa_error_free(error);
+		ufa_list_free(result);
+		ufa_list_free(tags);
+		ufa_list_free(filter);
+		ufa_free(attr);
+		ufa_free(value);
+	}
+	result_print(&attrs_result);
+}
+
+/**
+ * Attribute search by UFA_REPO_WILDCARD, one benchmark for each kind of
+ * pattern: prefix (index attribute_value), without letters (GLOB), and
+ * infix (LIKE, or trigram index with -T)
+ */
+static void bench_wildcard(const ufa_repo_t *repo)
+{
+	const char *names[] = {"repo.search.prefix", "repo.search.glob",
+			       "repo.search.infix"};
+	const char *formats[] = {"value%ld*", "*%ld", "*lue%ld*"};
+
+	if (options.attrs == 0) {
+		return;
+	}
+	for (size_t p = 0; p < sizeof names / sizeof names[0]; p++) {
+		struct bench_result result;
+		result_begin(&result, names[p]);
+		for (long i = 0; i < options.iterations; i++) {
+			struct ufa_error *error = NULL;
+			char *attr = ufa_str_sprintf(
+			    "attr%ld", rand_range(options.attrs));
+			char *pattern = ufa_str_sprintf(
+			    formats[p], rand_range(options.cardinality));
+			struct ufa_list *filter = ufa_list_append2(
+			    NULL,
+			    ufa_repo_filterattr_new(attr, pattern,
+						    UFA_REPO_WILDCARD),
+			    (ufa_list_free_fn_t) ufa_repo_filterattr_free);
+			uint64_t start = ufa_stats_now();
+			struct ufa_list *files =
+			    ufa_repo_search(repo, filter, NULL, &error);
+			result_add(&result, start, error != NULL);
+			ufa_error_free(error);
+			ufa_list_free(files);
+			ufa_list_free(filter);
+			ufa_free(pattern);
+			ufa_free(attr);
+		}
+		result_print(&result);
+	}
+}
+
+/**
+ * Files with tags (get_files_with_tags), through ufa_repo_listfiles with a
+ * path of tags, as done by ufafs
+ */
+static void bench_files_with_tags(const ufa_repo_t *repo)
+{
+	struct bench_result result;
+	result_begin(&result, "repo.files_with_tags");
+	for (long i = 0; i < options.iterations; i++) {
+		struct ufa_error *error = NULL;
+		struct ufa_list *tags = random_tags(3);
+		char *joined = ufa_str_join_list(tags, "/", NULL, NULL);
+		char *path = ufa_str_sprintf("/%s", joined);
+
+		uint64_t start = ufa_stats_now();
+		struct ufa_list *files = ufa_repo_listfiles(repo, path, &error);
+		result_add(&result, start, error != NULL);
+
+		ufa_error_free(error);
+		ufa_list_free(files);
+		ufa_free(path);
+		ufa_free(joined);
+		ufa_list_free(tags);
+	}
+	result_print(&result);
+}
+
+/**
+ * Repo calls made by readdir and getattr of ufafs
+ */
+static void bench_fuse_ops(const ufa_repo_t *repo, const char *repo_dir)
+{
+	struct bench_result readdir_result, getattr_result;
+
+	result_begin(&readdir_result, "ufafs.readdir");
+	for (long i = 0; i < options.iterations; i++) {
+		struct ufa_error *error = NULL;
+		char *tag = tag_name(zipf_tag());
+		char *path = ufa_str_sprintf("/%s", tag);
+		uint64_t start = ufa_stats_now();
+		struct ufa_list *files = ufa_repo_listfiles(repo, path, &error);
+		result_add(&readdir_result, start, error != NULL);
+		ufa_error_free(error);
+		ufa_list_free(files);
+		ufa_free(path);
+		ufa_free(tag);
+	}
+	result_print(&readdir_result);
+
+	result_begin(&getattr_result, "ufafs.getattr");
+	for (long i = 0; i < options.iterations; i++) {
+		char *tag = tag_name(zipf_tag());
+		char *path = NULL;
+		if (i % 2 == 0) {
+			path = ufa_str_sprintf("/%s/file%07ld", tag,
+					       rand_range(options.files));
+		} else {
+			path = ufa_str_sprintf("/%s", tag);
+		}
+		uint64_t start = ufa_stats_now();
+		char *real = ufa_repo_get_realfilepath(repo, path, NULL);
+		bool found = (real != NULL) || ufa_repo_isatag(repo, path, NULL);
+		result_add(&getattr_result, start, !found);
+		ufa_free(real);
+		ufa_free(path);
+		ufa_free(tag);
+	}
+	result_print(&getattr_result);
+}
+
+static void bench_data_search(struct ufa_list *repo_dirs)
+{
+	struct bench_result result;
+	result_begin(&result, "data.search");
+	for (long i = 0; i < options.iterations; i++) {
+		struct ufa_error *error = NULL;
+		struct ufa_list *tags = random_tags(2);
+		uint64_t start = ufa_stats_now();
+		struct ufa_list *files =
+		    ufa_data_search(repo_dirs, NULL, tags, false, &error);
+		result_add(&result, start, error != NULL);
+		ufa_error_free(error);
+		ufa_list_free(files);
+		ufa_list_free(tags);
+	}
+	result_print(&result);
+}
+
+/**
+ * JSON-RPC round trips. The server listens on a fixed socket, so a running
+ * server (ufad) is used if there is one, and its results are marked
+ * "server" : "external"; otherwise a server is started in this process
+ * ("server" : "in-process").
+ */
+static void bench_jsonrpc(const char *repo_dir)
+{
+	pthread_t thread_server;
+	bool own_server = false;
+	struct ufa_error *error = NULL;
+
+	ufa_jsonrpc_api_t *api = ufa_jsonrpc_api_init(&error);
+	if (api == NULL) {
+		ufa_error_free(error);
+		error = NULL;
+		server = ufa_jsonrpc_server_new();
+		// connections are accepted once it listens, before it starts
+		if (!ufa_jsonrpc_server_listen(server, &error)
+		    || pthread_create(&thread_server, NULL, start_server, NULL)
+			   != 0) {
+			ufa_error_print_and_free(error);
+			ufa_jsonrpc_server_free(server);
+			server = NULL;
+			return;
+		}
+		own_server = true;
+		api = ufa_jsonrpc_api_init(&error);
+		ufa_error_print_and_free(error);
+		error = NULL;
+	}
+	const char *server_kind = own_server ? "in-process" : "external";
+
+	if (api != NULL) {
+		struct bench_result gettags, search;
+		result_begin(&gettags, "rpc.gettags");
+		gettags.server = server_kind;
+		for (long i = 0; i < options.iterations; i++) {
+			struct ufa_list *tags = NULL;
+			char *filepath =
+			    file_path(repo_dir, rand_range(options.files));
+			uint64_t start = ufa_stats_now();
+			bool ok = ufa_jsonrpc_api_gettags(api, filepath, &tags,
+							  &error);
+			result_add(&gettags, start, !ok);
+			ufa_error_free(error);
+			error = NULL;
+			ufa_list_free(tags);
+			ufa_free(filepath);
+		}
+		result_print(&gettags);
+
+		struct ufa_list *repo_dirs = ufa_list_append(NULL, (char *) repo_dir);
+		result_begin(&search, "rpc.search");
+		search.server = server_kind;
+		for (long i = 0; i < options.iterations; i++) {
+			struct ufa_list *tags = random_tags(2);
+			uint64_t start = ufa_stats_now();
+			struct ufa_list *files = ufa_jsonrpc_api_search(
+			    api, repo_dirs, NULL, tags, false, &error);
+			result_add(&search, start, error != NULL);
+			ufa_error_free(error);
+			error = NULL;
+			ufa_list_free(files);
+			ufa_list_free(tags);
+		}
+		result_print(&search);
+		ufa_list_free(repo_dirs);
+		ufa_jsonrpc_api_close(api, NULL);
+	}
+
+	if (own_server) {
+		ufa_jsonrpc_server_stop(server, NULL);
+		pthread_join(thread_server, NULL);
+		ufa_jsonrpc_server_free(server);
+		server = NULL;
+	}
+}
+
+static void *start_server(void *arg)
+{
+	ufa_jsonrpc_server_start(server, NULL);
+	return NULL;
+}
+
+static void remove_repo(const char *repo_dir)
+{
+	for (long f = 0; f < options.files; f++) {
+		char *filepath = file_path(repo_dir, f);
+		unlink(filepath);
+		ufa_free(filepath);
+	}
+	char *db = ufa_util_joinpath(repo_dir, "repo.sqlite", NULL);
+	char *indicator = ufa_util_joinpath(repo_dir, ".ufarepo", NULL);
+	unlink(db);
+	unlink(indicator);
+	rmdir(repo_dir);
+	ufa_free(db);
+	ufa_free(indicator);
+}
@@ -45,16 +45,22 @@ __appname__ = "ufa-nautilus"
 __app_disp_name__ = "UFA Nautilus"
 __website__ = "https://github.com/henriquetft/ufa"
 
+import ctypes
+import ctypes.util
 import subprocess
 import traceback
 import shlex
 import sys
 import shutil
 import os.path
+import time
 from urllib.parse import unquote
 from subprocess import Popen, TimeoutExpired
 from gi.repository import Nautilus, GObject
 
+# Seconds during which the tags read for a folder are reused
+CACHE_SECONDS = 2
+
 
 def log(message):
     """ Log message to the console """
@@ -284,18 +290,230 @@ class UFACommand:
                                                          shlex.quote(value)))
 
 
+class UFAClient:
+    """ Calls ufad through libufa-client (one connection for all calls) """
+    ABI_VERSION = 1
+
+    def __init__(self):
+        self.lib = None
+        self.client = None
+        name = ctypes.util.find_library("ufa-client") or "libufa-client.so.1"
+        try:
+            lib = ctypes.CDLL(name)
+        except OSError:
+            return
+        if lib.ufa_client_abi_version() != self.ABI_VERSION:
+            log(f"{name}: unsupported version")
+            return
+        self._declare(lib)
+        lib.ufa_client_set_log_level(b"off")
+        self.lib = lib
+
+    @staticmethod
+    def _declare(lib):
+        p, s, i = ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t
+        decls = {
+            "ufa_client_open": (p, []),
+            "ufa_client_error": (s, [p]),
+            "ufa_client_gettags_many": (p, [p, s, ctypes.POINTER(s), i]),
+            "ufa_client_getattr_many": (p, [p, s, ctypes.POINTER(s), i]),
+            "ufa_client_listtags": (p, [p, s]),
+            "ufa_client_settag": (ctypes.c_int, [p, s, s]),
+            "ufa_client_unsettag": (ctypes.c_int, [p, s, s]),
+            "ufa_client_inserttag": (ctypes.c_int, [p, s, s]),
+            "ufa_client_setattr": (ctypes.c_int, [p, s, s, s]),
+            "ufa_client_result_count": (i, [p]),
+            "ufa_client_result_path": (s, [p, i]),
+            "ufa_client_result_size": (i, [p, i]),
+            "ufa_client_result_name": (s, [p, i, i]),
+            "ufa_client_result_value": (s, [p, i, i]),
+            "ufa_client_result_free": (None, [p]),
+            "ufa_client_set_log_level": (None, [s]),
+        }
+        for func, (restype, argtypes) in decls.items():
+            getattr(lib, func).restype = restype
+            getattr(lib, func).argtypes = argtypes
+
+    def is_ok(self):
+        """ Checks whether the library was found """
+        return self.lib is not None
+
+    def _client(self):
+        if self.client is None:
+            self.client = self.lib.ufa_client_open()
+            if not self.client:
+                self.client = None
+                raise Exception("UFA daemon (ufad) is not running")
+        return self.client
+
+    def _error(self):
+        msg = self.lib.ufa_client_error(self.client)
+        return msg.decode('utf-8') if msg else "unknown error"
+
+    def _call(self, func, *args):
+        ret = func(self._client(), *[a.encode('utf-8') for a in args])
+        if ret != 0:
+            raise Exception(self._error())
+
+    def _result(self, result, attrs):
+        """ Converts a result to a dict path -> tags (or dict of attrs) """
+        if not result:
+            raise Exception(self._error())
+        lib = self.lib
+        ret = {}
+        for i in range(lib.ufa_client_result_count(result)):
+            path = lib.ufa_client_result_path(result, i).decode('utf-8')
+            size = lib.ufa_client_result_size(result, i)
+            names = [lib.ufa_client_result_name(result, i, j).decode('utf-8')
+                     for j in range(size)]
+            if attrs:
+                values = [lib.ufa_client_result_value(result, i, j).decode('utf-8')
+                          for j in range(size)]
+                ret[path] = dict(zip(names, values))
+            else:
+                ret[path] = names
+        lib.ufa_client_result_free(result)
+        return ret
+
+    def _many(self, func, folder, paths, attrs):
+        paths = paths or []
+        array = (ctypes.c_char_p * len(paths))(*[p.encode('utf-8') for p in paths])
+        folder = folder.encode('utf-8') if folder is not None else None
+        return self._result(func(self._client(), folder, array, len(paths)),
+                            attrs)
+
+    def gettags_many(self, folder=None, paths=None):
+        """ Returns dict path -> tags of files with tags """
+        return self._many(self.lib.ufa_client_gettags_many, folder, paths,
+                          False)
+
+    def getattr_many(self, folder=None, paths=None):
+        """ Returns dict path -> dict of attributes of files with attributes """
+        return self._many(self.lib.ufa_client_getattr_many, folder, paths,
+                          True)
+
+    def listtags(self, repo):
+        result = self.lib.ufa_client_listtags(self._client(),
+                                              repo.encode('utf-8'))
+        return self._result(result, False).get(repo, [])
+
+    def settag(self, filepath, tag):
+        self._call(self.lib.ufa_client_settag, filepath, tag)
+
+    def unsettag(self, filepath, tag):
+        self._call(self.lib.ufa_client_unsettag, filepath, tag)
+
+    def inserttag(self, repo, tag):
+        self._call(self.lib.ufa_client_inserttag, repo, tag)
+
+    def setattr(self, filepath, attr, value):
+        self._call(self.lib.ufa_client_setattr, filepath, attr, value)
+
+
+class UFALibCommand:
+    """ Same as UFACommand using libufa-client instead of the CLI """
+
+    def __init__(self, client):
+        self.client = client
+
+    def is_ok(self):
+        return self.client.is_ok()
+
+    def get_all_tags(self, repo):
+        return self.client.listtags(repo)
+
+    def get_tags_for_file(self, repo, filepath):
+        return self.client.gettags_many(paths=[filepath]).get(filepath, [])
+
+    def set_tags_for_file(self, repo, filepath, tag_list):
+        for tag in tag_list:
+            self.client.settag(filepath, tag)
+
+    def unset_tags_for_file(self, repo, filepath, tag_list):
+        for tag in tag_list:
+            self.client.unsettag(filepath, tag)
+
+    def create_tag(self, repo, tagname):
+        self.client.inserttag(repo, tagname)
+
+    def get_attrs_for_file(self, repo, filepath):
+        attrs = self.client.getattr_many(paths=[filepath]).get(filepath, {})
+        return [f"{attr}\t{value}" for attr, value in attrs.items()]
+
+    def get_attr_value_for_file(self, repo, filepath, attribute):
+        attrs = self.client.getattr_many(paths=[filepath]).get(filepath, {})
+        return attrs.get(attribute, "")
+
+    def set_attr_value_for_file(self, repo, filepath, attr, value):
+        self.client.setattr(filepath, attr, value)
+
+
+def new_command():
+    """ Uses libufa-client if it is installed, otherwise the CLI """
+    client = UFAClient()
+    if client.is_ok():
+        log("libufa-client found")
+        return UFALibCommand(client)
+    ufatag = shutil.which("ufatag")
+    ufaattr = shutil.which("ufaattr")
+    log(f"UFATAG CLI found.....: {ufatag}")
+    log(f"UFAATTR CLI found....: {ufaattr}")
+    return UFACommand(ufatag, ufaattr)
+
+
+def file_path(file):
+    """ Local path of a Nautilus file """
+    return unquote(str(file.get_uri()).split("file://")[1])
+
+
+class TagsColumnProvider(GObject.GObject, Nautilus.ColumnProvider,
+                         Nautilus.InfoProvider):
+    """
+    Column with the tags of files. Tags of all files of a folder are read
+    with a single request (libufa-client is required).
+    """
+
+    def __init__(self):
+        self.client = UFAClient()
+        self.cache = {}  # folder -> (time, dict path -> tags)
+
+    def get_columns(self):
+        return (Nautilus.Column(name="UFA::tags_column",
+                                attribute="ufa_tags",
+                                label="Tags",
+                                description="UFA tags of the file"),)
+
+    def tags_of_folder(self, folder):
+        now = time.monotonic()
+        cached = self.cache.get(folder)
+        if cached is None or now - cached[0] > CACHE_SECONDS:
+            cached = (now, self.client.gettags_many(folder=folder))
+            self.cache[folder] = cached
+        return cached[1]
+
+    def update_file_info(self, file):
+        if not self.client.is_ok() or file.get_uri_scheme() != 'file':
+            return
+        filepath = file_path(file)
+        folder = os.path.dirname(filepath)
+        if not os.path.isfile(os.path.join(folder, ".ufarepo")):
+            return
+        try:
+            tags = self.tags_of_folder(folder).get(filepath, [])
+        except Exception as e:
+            log(f"Error reading tags of {folder}: {e}")
+            return
+        file.add_string_attribute("ufa_tags", ", ".join(tags))
+
+
 class MenuProvider(GObject.GObject, Nautilus.MenuProvider):
 
     def __init__(self):
-        ufatag = shutil.which("ufatag")
-        ufaattr = shutil.which("ufaattr")
-        log(f"UFATAG CLI found.....: {ufatag}")
-        log(f"UFAATTR CLI found....: {ufaattr}")
-        self.cmd = UFACommand(ufatag, ufaattr)
+        self.cmd = new_command()
 
     def is_cli_ok(self):
         if not self.cmd.is_ok():
-            log("UFA command line utilities not found no PATH")
+            log("libufa-client or UFA command line utilities not found")
             return False
         if not Commands.is_ok():
             log("zenit not found on PATH")
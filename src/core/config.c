@@ -203,6 +203,20 @@ end:
 	return NULL;
 }
 
+char *ufa_config_getslowlogfilepath(struct ufa_error **error)
+{
+	if (!check_and_create_config_dir(error)) {
+		return NULL;
+	}
+
+	char *cfg_dir = ufa_util_config_dir(CONFIG_DIR_NAME);
+	char *logfile =
+	    ufa_util_joinpath(cfg_dir, SLOW_QUERY_LOG_FILE_NAME, NULL);
+	ufa_free(cfg_dir);
+
+	return logfile;
+}
+
 
 /* ========================================================================== */
 /* AUXILIARY FUNCTIONS                                                        */
@@ -17,6 +17,7 @@
 #define CONFIG_DIR_NAME             "ufa"
 #define DIRS_FILE_NAME              "dirs"
 #define LOG_FILE_NAME               "ufad.log"
+#define SLOW_QUERY_LOG_FILE_NAME    "slow_queries.log"
 #define DIRS_FILE_DEFAULT_STRING    "# UFA repository folders\n\n"
 
 
@@ -59,5 +60,13 @@ bool ufa_config_remove_dir(const char *dir, struct ufa_error **error);
  */
 char *ufa_config_getlogfilepath(struct ufa_error **error);
 
+/**
+ * Get path of slow query log file
+ *
+ * @param error pointer to pointer to error structure
+ * @return A newly-allocated string containing path to slow query log file
+ */
+char *ufa_config_getslowlogfilepath(struct ufa_error **error);
+
 
 #endif /* UFA_CONFIG_H_ */
\ No newline at end of file
@@ -12,28 +12,159 @@
 #include "util/hashtable.h"
 #include "core/config.h"
 #include "core/repo.h"
+#include "core/query.h"
 #include "util/misc.h"
 #include "util/string.h"
 #include "util/logging.h"
+#include "util/stats.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 
 /* ========================================================================== */
 /* VARIABLES AND DEFINITIONS                                                  */
 /* ========================================================================== */
 
-/** Maps WD -> filename */
-static ufa_hashtable_t *repos = NULL;
+/** Number of shards of the registry of open repositories */
+#define REGISTRY_SHARDS 16
+
+/** Interval between sweeps of idle repositories (usec) */
+#define SWEEP_INTERVAL (60 * 1000000UL)
+
+/**
+ * An open repository in the registry. The registry holds one reference
+ * to 'repo'; each caller of get_repo holds another one until it is done.
+ */
+struct registry_entry {
+	ufa_repo_t *repo;
+	uint64_t last_used; /* ufa_stats_now() of last get_repo */
+};
+
+/**
+ * Open repositories are spread over shards (by hash of the repository dir),
+ * so threads using different repositories do not contend for a lock.
+ */
+struct registry_shard {
+	pthread_mutex_t mutex;
+	ufa_hashtable_t *repos; /* repository dir -> struct registry_entry */
+};
+
+static struct registry_shard registry[REGISTRY_SHARDS];
+
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+
+/** Number of repositories in the registry */
+static unsigned long open_repos = 0;
+
+static unsigned long max_open_repos = UFA_DATA_DEFAULT_MAX_OPEN_REPOS;
+
+/** Idle time to close a repository (usec; 0: never, < 0: when unused) */
+static int64_t idle_timeout = UFA_DATA_DEFAULT_IDLE_MS * 1000L;
+
+static uint64_t last_sweep = 0;
+
+/**
+ * Maps directory -> repository dir, so that finding the repository of a
+ * file does not need to access the file system.
+ */
+static ufa_hashtable_t *dir_cache = NULL;
+
+static pthread_mutex_t dir_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * A batch of changes (see ufa_data_begin_batch). The reference to 'repo' is
+ * kept until the batch ends, when the changes are reported to the listener.
+ */
+struct batch {
+	ufa_repo_t *repo;
+	struct ufa_list *changes; /* struct change */
+};
+
+/** Change not reported yet */
+struct change {
+	enum ufa_data_change change;
+	char *path;
+	char *path2;
+};
+
+/** Maps directory -> struct batch */
+static ufa_hashtable_t *batches = NULL;
+
+static pthread_mutex_t batches_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static ufa_data_listener_fn_t listener = NULL;
+static void *listener_data = NULL;
 
 /* ========================================================================== */
 /* AUXILIARY FUNCTIONS - DECLARATION                                          */
 /* ========================================================================== */
 
 static void add_set(ufa_hashtable_t *set, const char *str);
-static void  init_repo_hashtable();
+static void init_registry();
+static struct registry_shard *shard_of(const char *repodir);
+static void entry_free(struct registry_entry *entry);
+static void evict(bool force_idle);
 static ufa_repo_t *get_repo_for_file(const char *filepath, struct ufa_error **error);
 static ufa_repo_t *get_repo(const char *repodir, struct ufa_error **error);
+static ufa_repo_t *get_repo_for_dir(const char *dir, struct ufa_error **error);
+static void notify(enum ufa_data_change change, const char *path,
+		   const char *path2);
+static void batch_free(struct batch *batch);
+static void change_free(struct change *change);
+
+/** ufa_repo_gettags_many or ufa_repo_getattr_many */
+typedef ufa_hashtable_t *(*get_many_fn_t)(const ufa_repo_t *repo,
+					  struct ufa_list *filenames,
+					  struct ufa_error **error);
+
+static ufa_hashtable_t *get_many(const char *dir,
+				 struct ufa_list *filepaths,
+				 get_many_fn_t get_fn,
+				 struct ufa_error **error);
+static bool get_many_dir(const char *dir,
+			 struct ufa_list *filenames,
+			 get_many_fn_t get_fn,
+			 ufa_hashtable_t *result,
+			 struct ufa_error **error);
+
+/** Search on a repository (ufa_repo_query_page or search_tags_attrs) */
+typedef struct ufa_list *(*search_fn_t)(const ufa_repo_t *repo,
+					const void *args,
+					const struct ufa_repo_page *page,
+					char **last_key,
+					struct ufa_error **error);
+
+/** Arguments of search_tags_attrs */
+struct search_args {
+	struct ufa_list *filter_attr;
+	struct ufa_list *tags;
+};
+
+static struct ufa_list *search_repos(struct ufa_list *repo_dirs,
+				     bool include_repo_from_config,
+				     search_fn_t search_fn,
+				     const void *args,
+				     const struct ufa_repo_page *page,
+				     char **cursor,
+				     struct ufa_error **error);
+static struct ufa_list *search_tags_attrs(const ufa_repo_t *repo,
+					  const struct search_args *args,
+					  const struct ufa_repo_page *page,
+					  char **last_key,
+					  struct ufa_error **error);
+static struct ufa_list *repos_to_search(struct ufa_list *repo_dirs,
+					bool include_repo_from_config,
+					struct ufa_error **error);
+static int compare_str(const void *a, const void *b);
+static int compare_facets(const void *a, const void *b);
+static struct ufa_list *sort_list(struct ufa_list *list,
+				  int (*compare)(const void *, const void *));
+static char *facet_key(const struct ufa_repo_facet *facet);
+static char *cursor_new(const char *repodir, const char *key);
+static bool cursor_parse(const char *cursor, char **repodir, char **key);
 
 /* ========================================================================== */
 /* FUNCTIONS FROM data.h                                                      */
@@ -44,12 +175,138 @@ bool ufa_data_init_repo(const char *repository, struct ufa_error **error)
 	ufa_return_val_iferror(error, false);
 
 	ufa_repo_t *repo = get_repo(repository, error);
+	ufa_repo_free(repo);
 	return (repo != NULL);
 }
 
 void ufa_data_close()
 {
-	ufa_hashtable_free(repos);
+	ufa_data_invalidate_cache(NULL);
+
+	pthread_once(&registry_once, init_registry);
+	for (int i = 0; i < REGISTRY_SHARDS; i++) {
+		pthread_mutex_lock(&registry[i].mutex);
+		int size = ufa_hashtable_size(registry[i].repos);
+		ufa_hashtable_clear(registry[i].repos);
+		__atomic_sub_fetch(&open_repos, size, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&registry[i].mutex);
+	}
+}
+
+void ufa_data_set_listener(ufa_data_listener_fn_t listener_fn,
+			   void *user_data)
+{
+	listener = listener_fn;
+	listener_data = user_data;
+}
+
+void ufa_data_set_repo_limits(unsigned long max_open, long idle_ms)
+{
+	__atomic_store_n(&max_open_repos, (max_open > 0) ? max_open : 1,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&idle_timeout, (int64_t) idle_ms * 1000,
+			 __ATOMIC_RELAXED);
+	evict(false);
+}
+
+void ufa_data_evict_idle()
+{
+	evict(true);
+}
+
+unsigned long ufa_data_open_repos()
+{
+	return __atomic_load_n(&open_repos, __ATOMIC_RELAXED);
+}
+
+void ufa_data_invalidate_cache(const char *path)
+{
+	pthread_mutex_lock(&dir_cache_mutex);
+	if (dir_cache == NULL) {
+		goto end;
+	}
+	if (path == NULL) {
+		ufa_hashtable_clear(dir_cache);
+		goto end;
+	}
+
+	// removes path and every directory below it
+	size_t len = strlen(path);
+	struct ufa_list *dirs = ufa_hashtable_keys(dir_cache);
+	for (UFA_LIST_EACH(i, dirs)) {
+		char *dir = (char *) i->data;
+		if (strncmp(dir, path, len) == 0
+		    && (dir[len] == '\0' || dir[len] == '/')) {
+			ufa_debug("Removing '%s' from dir cache", dir);
+			ufa_hashtable_remove(dir_cache, dir);
+		}
+	}
+	ufa_list_free(dirs);
+end:
+	pthread_mutex_unlock(&dir_cache_mutex);
+}
+
+bool ufa_data_begin_batch(const char *dir, struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+
+	pthread_mutex_lock(&batches_mutex);
+	bool open = (batches != NULL && ufa_hashtable_has_key(batches, dir));
+	pthread_mutex_unlock(&batches_mutex);
+	if (open) {
+		ufa_error_new(error, UFA_ERROR_ARGS,
+			      "a batch is already open for '%s'", dir);
+		return false;
+	}
+
+	ufa_repo_t *repo = get_repo_for_dir(dir, error);
+	if (repo == NULL) {
+		return false;
+	}
+	if (!ufa_repo_begin(repo, error)) {
+		ufa_repo_free(repo);
+		return false;
+	}
+
+	struct batch *batch = ufa_malloc(sizeof *batch);
+	batch->repo = repo;
+	batch->changes = NULL;
+
+	pthread_mutex_lock(&batches_mutex);
+	if (batches == NULL) {
+		batches = ufa_hashtable_new((ufa_hash_fn_t) ufa_str_hash,
+					    (ufa_hash_equal_fn_t) ufa_str_equals,
+					    ufa_free, NULL);
+	}
+	ufa_hashtable_put(batches, ufa_str_dup(dir), batch);
+	pthread_mutex_unlock(&batches_mutex);
+	return true;
+}
+
+bool ufa_data_end_batch(const char *dir, struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+
+	struct batch *batch = NULL;
+	pthread_mutex_lock(&batches_mutex);
+	if (batches != NULL) {
+		batch = ufa_hashtable_steal(batches, dir);
+	}
+	pthread_mutex_unlock(&batches_mutex);
+
+	if (batch == NULL) {
+		ufa_error_new(error, UFA_ERROR_INTERNAL, "no batch for '%s'", dir);
+		return false;
+	}
+	bool ret = ufa_repo_commit(batch->repo, error);
+	if (ret) {
+		for (UFA_LIST_EACH(i, batch->changes)) {
+			struct change *c = i->data;
+			notify(c->change, c->path, c->path2);
+		}
+	}
+	batch_free(batch);
+	return ret;
 }
 
 struct ufa_list *ufa_data_gettags(const char *filepath,
@@ -62,7 +319,9 @@ struct ufa_list *ufa_data_gettags(const char *filepath,
 		return false;
 	}
 
-	return ufa_repo_gettags(repo, filepath, error);
+	struct ufa_list *ret = ufa_repo_gettags(repo, filepath, error);
+	ufa_repo_free(repo);
+	return ret;
 }
 
 bool ufa_data_settag(const char *filepath,
@@ -75,7 +334,12 @@ bool ufa_data_settag(const char *filepath,
 	if (repo == NULL) {
 		return false;
 	}
-	return ufa_repo_settag(repo, filepath, tag, error);
+	bool ret = ufa_repo_settag(repo, filepath, tag, error);
+	ufa_repo_free(repo);
+	if (ret) {
+		notify(UFA_DATA_CHANGE_TAGS, filepath, NULL);
+	}
+	return ret;
 }
 
 bool ufa_data_unsettag(const char *filepath,
@@ -88,7 +352,12 @@ bool ufa_data_unsettag(const char *filepath,
 	if (repo == NULL) {
 		return false;
 	}
-	return ufa_repo_unsettag(repo, filepath, tag, error);
+	bool ret = ufa_repo_unsettag(repo, filepath, tag, error);
+	ufa_repo_free(repo);
+	if (ret) {
+		notify(UFA_DATA_CHANGE_TAGS, filepath, NULL);
+	}
+	return ret;
 }
 
 bool ufa_data_cleartags(const char *filepath,
@@ -100,7 +369,12 @@ bool ufa_data_cleartags(const char *filepath,
 	if (repo == NULL) {
 		return false;
 	}
-	return ufa_repo_cleartags(repo, filepath, error);
+	bool ret = ufa_repo_cleartags(repo, filepath, error);
+	ufa_repo_free(repo);
+	if (ret) {
+		notify(UFA_DATA_CHANGE_TAGS, filepath, NULL);
+	}
+	return ret;
 }
 
 
@@ -116,6 +390,7 @@ int ufa_data_inserttag(const char *repodir,
 		goto end;
 	}
 	ret = ufa_repo_inserttag(repo, tag, error);
+	ufa_repo_free(repo);
 end:
 	return ret;
 }
@@ -132,6 +407,7 @@ struct ufa_list *ufa_data_listtags(const char *repodir,
 		goto end;
 	}
 	ret = ufa_repo_listtags(repo, error);
+	ufa_repo_free(repo);
 end:
 	return ret;
 }
@@ -148,7 +424,12 @@ bool ufa_data_setattr(const char *filepath,
 	if (repo == NULL) {
 		return false;
 	}
-	return ufa_repo_setattr(repo, filepath, attribute, value, error);
+	bool ret = ufa_repo_setattr(repo, filepath, attribute, value, error);
+	ufa_repo_free(repo);
+	if (ret) {
+		notify(UFA_DATA_CHANGE_ATTRS, filepath, NULL);
+	}
+	return ret;
 }
 
 bool ufa_data_unsetattr(const char *filepath,
@@ -161,7 +442,12 @@ bool ufa_data_unsetattr(const char *filepath,
 	if (repo == NULL) {
 		return false;
 	}
-	return ufa_repo_unsetattr(repo, filepath, attribute, error);
+	bool ret = ufa_repo_unsetattr(repo, filepath, attribute, error);
+	ufa_repo_free(repo);
+	if (ret) {
+		notify(UFA_DATA_CHANGE_ATTRS, filepath, NULL);
+	}
+	return ret;
 }
 
 // returns list of ufa_repo_attr_t
@@ -176,10 +462,25 @@ struct ufa_list *ufa_data_getattr(const char *filepath,
 		goto end;
 	}
 	ret = ufa_repo_getattr(repo, filepath, error);
+	ufa_repo_free(repo);
 end:
 	return ret;
 }
 
+ufa_hashtable_t *ufa_data_gettags_many(const char *dir,
+				       struct ufa_list *filepaths,
+				       struct ufa_error **error)
+{
+	return get_many(dir, filepaths, ufa_repo_gettags_many, error);
+}
+
+ufa_hashtable_t *ufa_data_getattr_many(const char *dir,
+				       struct ufa_list *filepaths,
+				       struct ufa_error **error)
+{
+	return get_many(dir, filepaths, ufa_repo_getattr_many, error);
+}
+
 
 struct ufa_list *ufa_data_search(struct ufa_list *repo_dirs,
 				 struct ufa_list *filter_attr,
@@ -187,68 +488,104 @@ struct ufa_list *ufa_data_search(struct ufa_list *repo_dirs,
 				 bool include_repo_from_config,
 				 struct ufa_error **error)
 {
-	ufa_return_val_iferror(error, NULL);
+	return ufa_data_search_page(repo_dirs, filter_attr, tags,
+				    include_repo_from_config, NULL, NULL,
+				    error);
+}
 
-	ufa_debug(__func__);
+struct ufa_list *ufa_data_search_page(struct ufa_list *repo_dirs,
+				      struct ufa_list *filter_attr,
+				      struct ufa_list *tags,
+				      bool include_repo_from_config,
+				      const struct ufa_repo_page *page,
+				      char **cursor,
+				      struct ufa_error **error)
+{
+	struct search_args args = {.filter_attr = filter_attr, .tags = tags};
+	return search_repos(repo_dirs, include_repo_from_config,
+			    (search_fn_t) search_tags_attrs, &args, page,
+			    cursor, error);
+}
 
-	struct ufa_list *list_repo = NULL;
-	struct ufa_list *ret = NULL;
-	struct ufa_list *result_tmp = NULL;
+struct ufa_list *ufa_data_query(struct ufa_list *repo_dirs,
+				const struct ufa_query *query,
+				bool include_repo_from_config,
+				struct ufa_error **error)
+{
+	return ufa_data_query_page(repo_dirs, query, include_repo_from_config,
+				   NULL, NULL, error);
+}
 
-	ufa_hashtable_t *set = UFA_HASHTABLE_STRING();
-	for (UFA_LIST_EACH(i, repo_dirs)) {
-		char *str = (char *) i->data;
-		if (ufa_repo_isrepo(str)) {
-			add_set(set, str);
-		} else {
-			ufa_error("'%s' is not a repository", str);
-		}
-	}
+struct ufa_list *ufa_data_query_page(struct ufa_list *repo_dirs,
+				     const struct ufa_query *query,
+				     bool include_repo_from_config,
+				     const struct ufa_repo_page *page,
+				     char **cursor,
+				     struct ufa_error **error)
+{
+	return search_repos(repo_dirs, include_repo_from_config,
+			    (search_fn_t) ufa_repo_query_page, query, page,
+			    cursor, error);
+}
 
-	ufa_debug("Include repo from config? %d", include_repo_from_config);
-	if (include_repo_from_config) {
-		struct ufa_list *list_dirs_cfg = ufa_config_dirs(false, error);
-		if (list_dirs_cfg == NULL && *error) {
-			goto end;
-		}
-		for (UFA_LIST_EACH(i, list_dirs_cfg)) {
-			add_set(set, i->data);
-		}
-		ufa_list_free(list_dirs_cfg);
-	}
+struct ufa_list *ufa_data_facets(struct ufa_list *repo_dirs,
+				 struct ufa_list *filter_attr,
+				 struct ufa_list *tags,
+				 bool include_repo_from_config,
+				 bool attrs,
+				 struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+
+	struct ufa_list *result = NULL;
+	ufa_hashtable_t *table = ufa_hashtable_new(
+	    (ufa_hash_fn_t) ufa_str_hash, (ufa_hash_equal_fn_t) ufa_str_equals,
+	    ufa_free, (ufa_hash_free_fn_t) ufa_repo_facet_free);
 
-	list_repo = ufa_hashtable_keys(set);
+	struct ufa_list *list_repo =
+	    repos_to_search(repo_dirs, include_repo_from_config, error);
+	if_goto(*error, end);
 
 	for (UFA_LIST_EACH(i, list_repo)) {
-		char *repo_folder = (char *) i->data;
-		ufa_debug("Searching in: %s", repo_folder);
-		ufa_repo_t *repo = get_repo(repo_folder, error);
+		ufa_repo_t *repo = get_repo(i->data, error);
 		if_goto(*error, end);
-
-		result_tmp = ufa_repo_search(repo, filter_attr, tags, error);
+		struct ufa_list *facets =
+		    ufa_repo_facets(repo, filter_attr, tags, attrs, error);
+		ufa_repo_free(repo);
 		if_goto(*error, end);
 
-		char *repo_path = ufa_repo_getrepopath(repo);
-
-		// concatenate repo_path
-		for (UFA_LIST_EACH(i, result_tmp)) {
-			char *file = (char *) i->data;
-			ret = ufa_list_append2(
-			    ret, ufa_util_joinpath(repo_path, file, NULL),
-			    ufa_free);
+		// counts of the same tag or value in other repositories are
+		// added up
+		for (UFA_LIST_EACH(j, facets)) {
+			struct ufa_repo_facet *facet = j->data;
+			char *key = facet_key(facet);
+			struct ufa_repo_facet *sum =
+			    ufa_hashtable_get(table, key);
+			if (sum != NULL) {
+				sum->count += facet->count;
+				ufa_free(key);
+			} else {
+				ufa_hashtable_put(table, key, facet);
+				j->data = NULL;
+			}
 		}
+		ufa_list_free_full(facets,
+				   (ufa_list_free_fn_t) ufa_repo_facet_free);
+	}
 
-		// free resources
-		ufa_free(repo_path);
-		ufa_list_free(result_tmp);
-		result_tmp = NULL;
+	struct ufa_list *keys = ufa_hashtable_keys(table);
+	for (UFA_LIST_EACH(i, keys)) {
+		result = ufa_list_append2(
+		    result, ufa_hashtable_steal(table, i->data),
+		    (ufa_list_free_fn_t) ufa_repo_facet_free);
 	}
+	ufa_list_free(keys);
+	result = sort_list(result, compare_facets);
 
 end:
-	ufa_list_free(list_repo);
-	ufa_list_free_full(result_tmp, ufa_free);
-	ufa_hashtable_free(set);
-	return ret;
+	ufa_list_free_full(list_repo, ufa_free);
+	ufa_hashtable_free(table);
+	return result;
 }
 
 bool ufa_data_removefile(const char *filepath, struct ufa_error **error)
@@ -258,15 +595,62 @@ bool ufa_data_removefile(const char *filepath, struct ufa_error **error)
 	ufa_debug("Removing '%s'", filepath);
 
 	char *dir = ufa_util_dirname(filepath);
-	ufa_repo_t *repo = get_repo_for_file(dir, error);
+	ufa_repo_t *repo = get_repo_for_dir(dir, error);
 	ufa_free(dir);
 	if (repo == NULL) {
 		return false;
 	}
-	return ufa_repo_removefile(repo, filepath, error);
+	bool ret = ufa_repo_removefile(repo, filepath, error);
+	ufa_repo_free(repo);
+	if (ret) {
+		notify(UFA_DATA_CHANGE_REMOVED, filepath, NULL);
+	}
+	return ret;
 }
 
-static ufa_repo_t *get_repo_for_dir(const char *dir, struct ufa_error **error);
+bool ufa_data_updatefile(const char *filepath, struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+
+	char *dir = ufa_util_dirname(filepath);
+	ufa_repo_t *repo = get_repo_for_dir(dir, error);
+	ufa_free(dir);
+	if (repo == NULL) {
+		return false;
+	}
+	bool ret = ufa_repo_updatefile(repo, filepath, error);
+	ufa_repo_free(repo);
+	return ret;
+}
+
+bool ufa_data_rescan(const char *dir,
+		     int *renamed,
+		     int *removed,
+		     struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+
+	ufa_debug("Rescanning '%s'", dir);
+
+	ufa_repo_t *repo = get_repo_for_dir(dir, error);
+	if (repo == NULL) {
+		return false;
+	}
+	int count_renamed = 0;
+	int count_removed = 0;
+	bool ret = ufa_repo_sync(repo, &count_renamed, &count_removed, error);
+	ufa_repo_free(repo);
+	if (count_renamed > 0 || count_removed > 0) {
+		notify(UFA_DATA_CHANGE_RESCAN, dir, NULL);
+	}
+	if (renamed != NULL) {
+		*renamed = count_renamed;
+	}
+	if (removed != NULL) {
+		*removed = count_removed;
+	}
+	return ret;
+}
 
 bool ufa_data_renamefile(const char *oldfilepath,
 			 const char *newfilepath,
@@ -278,6 +662,7 @@ bool ufa_data_renamefile(const char *oldfilepath,
 
 	char *olddir = NULL;
 	bool ret = false;
+	ufa_repo_t *repo_old = NULL;
 
 	ufa_repo_t *repo_new = get_repo_for_file(newfilepath, error);
 	if (repo_new == NULL) {
@@ -285,15 +670,20 @@ bool ufa_data_renamefile(const char *oldfilepath,
 	}
 
 	olddir = ufa_util_dirname(oldfilepath);
-	ufa_repo_t *repo_old = get_repo_for_dir(olddir, error);
+	repo_old = get_repo(olddir, error);
 	if (repo_old == NULL) {
 		goto end;
 	}
 
 	ret = ufa_repo_renamefile(repo_old, repo_new, oldfilepath, newfilepath,
 	error);
+	if (ret) {
+		notify(UFA_DATA_CHANGE_RENAMED, oldfilepath, newfilepath);
+	}
 
 end:
+	ufa_repo_free(repo_new);
+	ufa_repo_free(repo_old);
 	ufa_free(olddir);
 	return ret;
 }
@@ -303,6 +693,287 @@ end:
 /* AUXILIARY FUNCTIONS                                                        */
 /* ========================================================================== */
 
+/**
+ * Runs a search with search_fn on each repository of 'repo_dirs' (and of the
+ * config file if 'include_repo_from_config'), in order of path, and joins
+ * the results: a sorted page is sorted in each repository, not across them.
+ * With a page limit, a repository is searched for the files left to fill the
+ * page, and the cursor of the next page has the repository and the key of
+ * its last file (see cursor_new).
+ *
+ * @return List of paths of the files found
+ */
+static struct ufa_list *search_repos(struct ufa_list *repo_dirs,
+				     bool include_repo_from_config,
+				     search_fn_t search_fn,
+				     const void *args,
+				     const struct ufa_repo_page *page,
+				     char **cursor,
+				     struct ufa_error **error)
+{
+	if (cursor != NULL) {
+		*cursor = NULL;
+	}
+	ufa_return_val_iferror(error, NULL);
+
+	ufa_debug(__func__);
+
+	struct ufa_list *list_repo = NULL;
+	struct ufa_list *ret = NULL;
+	struct ufa_list *result_tmp = NULL;
+	char *after_repo = NULL;
+	char *after_key = NULL;
+	char *last_key = NULL;
+
+	const struct ufa_repo_page all = {.sort = UFA_REPO_SORT_NONE};
+	page = (page != NULL) ? page : &all;
+	if (page->after != NULL
+	    && !cursor_parse(page->after, &after_repo, &after_key)) {
+		ufa_error_new(error, UFA_ERROR_ARGS, "invalid cursor: '%s'",
+			      page->after);
+		goto end;
+	}
+
+	uint64_t start = ufa_stats_now();
+	list_repo = repos_to_search(repo_dirs, include_repo_from_config, error);
+	if_goto(*error, end);
+	ufa_repo_explain_add(NULL, "repositories", start,
+			     ufa_list_size(list_repo));
+
+	struct ufa_repo_page repo_page = *page;
+	int left = page->limit;
+
+	for (UFA_LIST_EACH(i, list_repo)) {
+		char *repo_folder = (char *) i->data;
+
+		// repositories before the cursor were in previous pages
+		if (after_repo != NULL && strcmp(repo_folder, after_repo) < 0) {
+			continue;
+		}
+		bool same = (after_repo != NULL
+			     && ufa_str_equals(repo_folder, after_repo));
+		repo_page.after = same ? after_key : NULL;
+		repo_page.limit = left;
+
+		ufa_debug("Searching in: %s", repo_folder);
+		start = ufa_stats_now();
+		ufa_repo_t *repo = get_repo(repo_folder, error);
+		if_goto(*error, end);
+		ufa_repo_explain_add(repo_folder, "open", start, 0);
+
+		ufa_free(last_key);
+		result_tmp = search_fn(repo, args, &repo_page, &last_key, error);
+		char *repo_path = ufa_repo_getrepopath(repo);
+		ufa_repo_free(repo);
+		if (*error) {
+			ufa_free(repo_path);
+			goto end;
+		}
+
+		// concatenate repo_path
+		int count = 0;
+		for (UFA_LIST_EACH(i, result_tmp)) {
+			char *file = (char *) i->data;
+			ret = ufa_list_append2(
+			    ret, ufa_util_joinpath(repo_path, file, NULL),
+			    ufa_free);
+			count++;
+		}
+
+		// free resources
+		ufa_free(repo_path);
+		ufa_list_free(result_tmp);
+		result_tmp = NULL;
+
+		if (page->limit > 0 && (left -= count) <= 0) {
+			if (cursor != NULL && last_key != NULL) {
+				*cursor = cursor_new(repo_folder, last_key);
+			}
+			break;
+		}
+	}
+
+end:
+	ufa_free(after_repo);
+	ufa_free(after_key);
+	ufa_free(last_key);
+	ufa_list_free_full(list_repo, ufa_free);
+	ufa_list_free_full(result_tmp, ufa_free);
+	return ret;
+}
+
+static struct ufa_list *search_tags_attrs(const ufa_repo_t *repo,
+					  const struct search_args *args,
+					  const struct ufa_repo_page *page,
+					  char **last_key,
+					  struct ufa_error **error)
+{
+	return ufa_repo_search_page(repo, args->filter_attr, args->tags, page,
+				    last_key, error);
+}
+
+static int compare_str(const void *a, const void *b)
+{
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/**
+ * Repositories of repo_dirs (and of the config file, if
+ * include_repo_from_config), without duplicates, in order of path.
+ *
+ * @return List of new strings
+ */
+static struct ufa_list *repos_to_search(struct ufa_list *repo_dirs,
+					bool include_repo_from_config,
+					struct ufa_error **error)
+{
+	ufa_hashtable_t *set = UFA_HASHTABLE_STRING();
+	struct ufa_list *list_repo = NULL;
+
+	for (UFA_LIST_EACH(i, repo_dirs)) {
+		char *str = (char *) i->data;
+		if (ufa_repo_isrepo(str)) {
+			add_set(set, str);
+		} else {
+			ufa_error("'%s' is not a repository", str);
+		}
+	}
+
+	ufa_debug("Include repo from config? %d", include_repo_from_config);
+	if (include_repo_from_config) {
+		struct ufa_list *list_dirs_cfg = ufa_config_dirs(false, error);
+		if (list_dirs_cfg == NULL && *error) {
+			goto end;
+		}
+		for (UFA_LIST_EACH(i, list_dirs_cfg)) {
+			add_set(set, i->data);
+		}
+		ufa_list_free(list_dirs_cfg);
+	}
+
+	struct ufa_list *keys = ufa_hashtable_keys(set);
+	for (UFA_LIST_EACH(i, keys)) {
+		list_repo = ufa_list_append2(list_repo, ufa_str_dup(i->data),
+					     ufa_free);
+	}
+	ufa_list_free(keys);
+	list_repo = sort_list(list_repo, compare_str);
+
+end:
+	ufa_hashtable_free(set);
+	return list_repo;
+}
+
+static int compare_facets(const void *a, const void *b)
+{
+	const struct ufa_repo_facet *f1 = *(struct ufa_repo_facet *const *) a;
+	const struct ufa_repo_facet *f2 = *(struct ufa_repo_facet *const *) b;
+
+	// tags (without value) first
+	if ((f1->value == NULL) != (f2->value == NULL)) {
+		return (f1->value == NULL) ? -1 : 1;
+	}
+	int c = strcmp(f1->name, f2->name);
+	if (c == 0 && f1->value != NULL) {
+		c = strcmp(f1->value, f2->value);
+	}
+	return c;
+}
+
+/**
+ * Sorts the elements of a list (the nodes of 'list' are replaced).
+ *
+ * @return Sorted list
+ */
+static struct ufa_list *sort_list(struct ufa_list *list,
+				  int (*compare)(const void *, const void *))
+{
+	size_t count = ufa_list_size(list);
+	if (count < 2) {
+		return list;
+	}
+
+	void **array = ufa_malloc(count * sizeof *array);
+	size_t n = 0;
+	ufa_list_free_fn_t free_fn = list->free_func;
+	for (UFA_LIST_EACH(i, list)) {
+		array[n++] = i->data;
+		i->free_func = NULL;
+	}
+	qsort(array, count, sizeof *array, compare);
+
+	struct ufa_list *sorted = NULL;
+	for (size_t i = 0; i < count; i++) {
+		sorted = ufa_list_append2(sorted, array[i], free_fn);
+	}
+	ufa_free(array);
+	ufa_list_free(list);
+	return sorted;
+}
+
+/**
+ * Key of a tag or attribute value in the table of ufa_data_facets.
+ */
+static char *facet_key(const struct ufa_repo_facet *facet)
+{
+	if (facet->value == NULL) {
+		return ufa_str_sprintf("t%s", facet->name);
+	}
+	return ufa_str_sprintf("a%zu:%s%s", strlen(facet->name), facet->name,
+			       facet->value);
+}
+
+/**
+ * Cursor of a page of search results: "<length of repodir>:<repodir><key>"
+ * in hexadecimal, so that it is a plain string wherever it is passed.
+ *
+ * @return New string
+ */
+static char *cursor_new(const char *repodir, const char *key)
+{
+	char *str = ufa_str_sprintf("%zu:%s%s", strlen(repodir), repodir, key);
+	size_t len = strlen(str);
+	char *cursor = ufa_malloc(2 * len + 1);
+	for (size_t i = 0; i < len; i++) {
+		sprintf(cursor + 2 * i, "%02x", (unsigned char) str[i]);
+	}
+	cursor[2 * len] = '\0';
+	ufa_free(str);
+	return cursor;
+}
+
+/**
+ * Splits a cursor (see cursor_new) into new strings.
+ *
+ * @return false if the cursor is not valid
+ */
+static bool cursor_parse(const char *cursor, char **repodir, char **key)
+{
+	size_t len = strlen(cursor);
+	if (len % 2 != 0 || strspn(cursor, "0123456789abcdef") != len) {
+		return false;
+	}
+
+	char *str = ufa_malloc(len / 2 + 1);
+	for (size_t i = 0; i < len / 2; i++) {
+		unsigned int byte;
+		sscanf(cursor + 2 * i, "%2x", &byte);
+		str[i] = (char) byte;
+	}
+	str[len / 2] = '\0';
+
+	char *end = NULL;
+	unsigned long dir_len = strtoul(str, &end, 10);
+	bool valid = (end != str && *end == ':' && strlen(str) == len / 2
+		      && dir_len <= strlen(end + 1));
+	if (valid) {
+		*repodir = ufa_str_sprintf("%.*s", (int) dir_len, end + 1);
+		*key = ufa_str_dup(end + 1 + dir_len);
+	}
+	ufa_free(str);
+	return valid;
+}
+
 static void add_set(ufa_hashtable_t *set, const char *str)
 {
 	ufa_debug("Adding repo to search: %s", str);
@@ -321,17 +992,85 @@ static void add_set(ufa_hashtable_t *set, const char *str)
 }
 
 
-static void init_repo_hashtable()
+/**
+ * Reports a change to the listener, or adds it to the batch of the
+ * directory of 'path' (reported when the batch ends).
+ */
+static void notify(enum ufa_data_change change, const char *path,
+		   const char *path2)
+{
+	if (listener == NULL) {
+		return;
+	}
+
+	bool in_batch = false;
+	char *dir = ufa_util_dirname(path);
+	pthread_mutex_lock(&batches_mutex);
+	struct batch *batch = (batches != NULL) ? ufa_hashtable_get(batches, dir)
+						: NULL;
+	if (batch != NULL) {
+		struct change *c = ufa_malloc(sizeof *c);
+		c->change = change;
+		c->path = ufa_str_dup(path);
+		c->path2 = (path2 != NULL) ? ufa_str_dup(path2) : NULL;
+		batch->changes = ufa_list_append2(
+		    batch->changes, c, (ufa_list_free_fn_t) change_free);
+		in_batch = true;
+	}
+	pthread_mutex_unlock(&batches_mutex);
+	ufa_free(dir);
+
+	if (!in_batch) {
+		listener(listener_data, change, path, path2);
+	}
+}
+
+static void batch_free(struct batch *batch)
+{
+	ufa_repo_free(batch->repo);
+	ufa_list_free(batch->changes);
+	ufa_free(batch);
+}
+
+static void change_free(struct change *change)
+{
+	ufa_free(change->path);
+	ufa_free(change->path2);
+	ufa_free(change);
+}
+
+static void init_registry()
+{
+	for (int i = 0; i < REGISTRY_SHARDS; i++) {
+		pthread_mutex_init(&registry[i].mutex, NULL);
+		registry[i].repos = ufa_hashtable_new(
+		    (ufa_hash_fn_t) ufa_str_hash,
+		    (ufa_hash_equal_fn_t) ufa_str_equals, ufa_free,
+		    (ufa_hash_free_fn_t) entry_free);
+	}
+}
+
+
+static struct registry_shard *shard_of(const char *repodir)
 {
-	if (repos == NULL) {
-		repos = ufa_hashtable_new((ufa_hash_fn_t) ufa_str_hash,
-					  (ufa_hash_equal_fn_t) ufa_str_equals,
-					  ufa_free,
-					  (ufa_hash_free_fn_t) ufa_repo_free);
+	return &registry[((unsigned int) ufa_str_hash(repodir))
+			 % REGISTRY_SHARDS];
+}
+
+
+static void entry_free(struct registry_entry *entry)
+{
+	if (entry != NULL) {
+		ufa_repo_free(entry->repo);
+		ufa_free(entry);
 	}
 }
 
 
+/**
+ * Returns a new reference to the repository in 'repodir' (to be released
+ * with ufa_repo_free), opening it if it is not in the registry.
+ */
 static ufa_repo_t *get_repo(const char *repodir, struct ufa_error **error)
 {
 	ufa_return_val_iferror(error, NULL);
@@ -339,30 +1078,263 @@ static ufa_repo_t *get_repo(const char *repodir, struct ufa_error **error)
 	if (!repodir) {
 		return NULL; // TODO is this correct ?
 	}
-	init_repo_hashtable();
-	ufa_repo_t *repo = (ufa_repo_t *) ufa_hashtable_get(repos, repodir);
-	if (repo == NULL) {
+	pthread_once(&registry_once, init_registry);
+
+	bool opened = false;
+	ufa_repo_t *repo = NULL;
+	struct registry_shard *shard = shard_of(repodir);
+
+	// the lock is kept while opening, so a repo is never opened twice
+	pthread_mutex_lock(&shard->mutex);
+	struct registry_entry *entry =
+	    (struct registry_entry *) ufa_hashtable_get(shard->repos, repodir);
+	if (entry == NULL) {
 		repo = ufa_repo_init(repodir, error);
-		ufa_hashtable_put(repos, ufa_str_dup(repodir), repo);
+		if (repo != NULL) {
+			entry = ufa_malloc(sizeof *entry);
+			entry->repo = repo;
+			ufa_hashtable_put(shard->repos, ufa_str_dup(repodir),
+					  entry);
+			__atomic_add_fetch(&open_repos, 1, __ATOMIC_RELAXED);
+			opened = true;
+		}
+	}
+	if (entry != NULL) {
+		entry->last_used = ufa_stats_now();
+		repo = ufa_repo_ref(entry->repo);
+	}
+	pthread_mutex_unlock(&shard->mutex);
+
+	if (opened) {
+		evict(false);
 	}
 	return repo;
 }
 
 
+/**
+ * Closes repositories idle for longer than idle timeout and, if there are
+ * still more than max open repositories, the least recently used ones.
+ * Repositories in use by other threads are never closed: otherwise the
+ * next get_repo would open a second connection to the same database, and
+ * SQLite fails (SQLITE_BUSY) when two connections write at the same time.
+ *
+ * @param force_idle Sweep idle repositories even if the last sweep was
+ * less than SWEEP_INTERVAL ago
+ */
+static void evict(bool force_idle)
+{
+	pthread_once(&registry_once, init_registry);
+
+	uint64_t now = ufa_stats_now();
+	int64_t timeout = __atomic_load_n(&idle_timeout, __ATOMIC_RELAXED);
+	uint64_t last = __atomic_load_n(&last_sweep, __ATOMIC_RELAXED);
+
+	if (timeout != 0 && (force_idle || now - last > SWEEP_INTERVAL)) {
+		__atomic_store_n(&last_sweep, now, __ATOMIC_RELAXED);
+		for (int i = 0; i < REGISTRY_SHARDS; i++) {
+			struct registry_shard *shard = &registry[i];
+			pthread_mutex_lock(&shard->mutex);
+			struct ufa_list *dirs = ufa_hashtable_keys(shard->repos);
+			for (UFA_LIST_EACH(d, dirs)) {
+				struct registry_entry *entry =
+				    ufa_hashtable_get(shard->repos, d->data);
+				bool idle = (timeout < 0
+					     || now - entry->last_used
+						    > (uint64_t) timeout);
+				if (idle && ufa_repo_refcount(entry->repo) == 1) {
+					ufa_debug("Closing idle repo '%s'",
+						  (char *) d->data);
+					ufa_hashtable_remove(shard->repos,
+							     d->data);
+					__atomic_sub_fetch(&open_repos, 1,
+							   __ATOMIC_RELAXED);
+				}
+			}
+			ufa_list_free(dirs);
+			pthread_mutex_unlock(&shard->mutex);
+		}
+	}
+
+	while (__atomic_load_n(&open_repos, __ATOMIC_RELAXED)
+	       > __atomic_load_n(&max_open_repos, __ATOMIC_RELAXED)) {
+		// find least recently used repository
+		int lru_shard = -1;
+		char *lru_dir = NULL;
+		uint64_t lru_time = UINT64_MAX;
+		for (int i = 0; i < REGISTRY_SHARDS; i++) {
+			struct registry_shard *shard = &registry[i];
+			pthread_mutex_lock(&shard->mutex);
+			struct ufa_list *dirs = ufa_hashtable_keys(shard->repos);
+			for (UFA_LIST_EACH(d, dirs)) {
+				struct registry_entry *entry =
+				    ufa_hashtable_get(shard->repos, d->data);
+				if (entry->last_used < lru_time
+				    && ufa_repo_refcount(entry->repo) == 1) {
+					lru_time = entry->last_used;
+					lru_shard = i;
+					ufa_free(lru_dir);
+					lru_dir = ufa_str_dup(d->data);
+				}
+			}
+			ufa_list_free(dirs);
+			pthread_mutex_unlock(&shard->mutex);
+		}
+		if (lru_dir == NULL) {
+			break;
+		}
+
+		struct registry_shard *shard = &registry[lru_shard];
+		pthread_mutex_lock(&shard->mutex);
+		struct registry_entry *entry =
+		    ufa_hashtable_get(shard->repos, lru_dir);
+		// skip if it was used (or closed) meanwhile
+		if (entry != NULL && entry->last_used == lru_time
+		    && ufa_repo_refcount(entry->repo) == 1) {
+			ufa_debug("Closing least recently used repo '%s'",
+				  lru_dir);
+			ufa_hashtable_remove(shard->repos, lru_dir);
+			__atomic_sub_fetch(&open_repos, 1, __ATOMIC_RELAXED);
+		}
+		pthread_mutex_unlock(&shard->mutex);
+		ufa_free(lru_dir);
+	}
+}
+
+
+/**
+ * Implementation of ufa_data_*_many functions. Files are grouped by
+ * directory, so each repository is queried once.
+ */
+static ufa_hashtable_t *get_many(const char *dir,
+				 struct ufa_list *filepaths,
+				 get_many_fn_t get_fn,
+				 struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+
+	ufa_hashtable_t *result = UFA_HASHTABLE_STRING();
+
+	// dir -> list of file names (files of 'dir' are all included anyway)
+	ufa_hashtable_t *groups = UFA_HASHTABLE_STRING();
+	for (UFA_LIST_EACH(i, filepaths)) {
+		char *filedir = ufa_util_dirname(i->data);
+		if (dir != NULL && ufa_str_equals(filedir, dir)) {
+			ufa_free(filedir);
+			continue;
+		}
+		// prepended (the order of the names does not matter), taking
+		// the list out because its head changes
+		struct ufa_list *names = ufa_hashtable_steal(groups, filedir);
+		names = ufa_list_prepend2(names, ufa_util_getfilename(i->data),
+					  ufa_free);
+		ufa_hashtable_put_full(groups, filedir, names, ufa_free,
+				       (ufa_hash_free_fn_t) ufa_list_free);
+	}
+
+	if (dir != NULL) {
+		get_many_dir(dir, NULL, get_fn, result, error);
+	}
+
+	struct ufa_list *dirs = ufa_hashtable_keys(groups);
+	for (UFA_LIST_EACH(i, dirs)) {
+		if_goto(HAS_ERROR(error), end);
+		get_many_dir(i->data, ufa_hashtable_get(groups, i->data),
+			     get_fn, result, error);
+	}
+
+end:
+	ufa_list_free(dirs);
+	ufa_hashtable_free(groups);
+	if (HAS_ERROR(error)) {
+		ufa_hashtable_free(result);
+		result = NULL;
+	}
+	return result;
+}
+
+/**
+ * Gets data of files of 'dir' (all of them if 'filenames' is NULL) and puts
+ * it in 'result' by file path. Directories without repository have no data.
+ */
+static bool get_many_dir(const char *dir,
+			 struct ufa_list *filenames,
+			 get_many_fn_t get_fn,
+			 ufa_hashtable_t *result,
+			 struct ufa_error **error)
+{
+	struct ufa_error *error_repo = NULL;
+	ufa_repo_t *repo = get_repo_for_dir(dir, &error_repo);
+	if (repo == NULL) {
+		if (error_repo != NULL && error_repo->code != UFA_ERROR_FILE) {
+			ufa_error_new(error, error_repo->code, "%s",
+				      error_repo->message);
+		}
+		ufa_error_free(error_repo);
+		return !HAS_ERROR(error);
+	}
+
+	ufa_hashtable_t *table = get_fn(repo, filenames, error);
+	ufa_repo_free(repo);
+	if (table == NULL) {
+		return false;
+	}
+
+	// moving lists to result, keyed by path
+	struct ufa_list *names = ufa_hashtable_keys(table);
+	for (UFA_LIST_EACH(i, names)) {
+		char *path = ufa_util_joinpath(dir, i->data, NULL);
+		struct ufa_list *list = ufa_hashtable_steal(table, i->data);
+		ufa_hashtable_put_full(result, path, list, ufa_free,
+				       (ufa_hash_free_fn_t) ufa_list_free);
+	}
+	ufa_list_free(names);
+	ufa_hashtable_free(table);
+	return true;
+}
+
 static ufa_repo_t *get_repo_for_file(const char *filepath, struct ufa_error **error)
 {
 	ufa_return_val_iferror(error, NULL);
 
-	char *s = ufa_repo_getrepofolderfor(filepath, error);
-	ufa_repo_t *ret = get_repo(s, error);
-	ufa_free(s);
+	char *dir = ufa_util_dirname(filepath);
+	ufa_repo_t *ret = get_repo_for_dir(dir, error);
+	ufa_free(dir);
 	return ret;
 }
 
+/**
+ * Repository of the files in 'dir' (a new reference). Only the first call
+ * for each directory looks for the repository in the file system; the
+ * result is cached until ufa_data_invalidate_cache is called for that
+ * directory.
+ */
 static ufa_repo_t *get_repo_for_dir(const char *dir, struct ufa_error **error)
 {
 	ufa_return_val_iferror(error, NULL);
 
-	ufa_repo_t *ret = get_repo(dir, error);
+	pthread_mutex_lock(&dir_cache_mutex);
+	if (dir_cache == NULL) {
+		dir_cache = UFA_HASHTABLE_STRING();
+	}
+	char *repodir = ufa_hashtable_get(dir_cache, dir);
+	if (repodir != NULL) {
+		repodir = ufa_str_dup(repodir);
+	}
+	pthread_mutex_unlock(&dir_cache_mutex);
+
+	bool cached = (repodir != NULL);
+	if (!cached) {
+		repodir = ufa_repo_getrepofolderfor(dir, error);
+	}
+	ufa_repo_t *ret = get_repo(repodir, error);
+
+	if (ret != NULL && !cached) {
+		pthread_mutex_lock(&dir_cache_mutex);
+		ufa_hashtable_put(dir_cache, ufa_str_dup(dir),
+				  ufa_str_dup(repodir));
+		pthread_mutex_unlock(&dir_cache_mutex);
+	}
+	ufa_free(repodir);
 	return ret;
-}
\ No newline at end of file
+}
@@ -12,13 +12,107 @@
 #define UFA_DATA_H_
 
 #include "util/error.h"
+#include "util/hashtable.h"
 #include "util/list.h"
 #include <stdbool.h>
 
+struct ufa_query;
+struct ufa_repo_page;
+
+/** Default max number of repositories kept open */
+#define UFA_DATA_DEFAULT_MAX_OPEN_REPOS 64
+
+/** Default time after which an unused repository is closed (ms) */
+#define UFA_DATA_DEFAULT_IDLE_MS (600 * 1000L)
+
+/** Changes reported to the listener (see ufa_data_set_listener) */
+enum ufa_data_change {
+	UFA_DATA_CHANGE_TAGS    = 1, /* tags of 'path' changed */
+	UFA_DATA_CHANGE_ATTRS   = 2, /* attributes of 'path' changed */
+	UFA_DATA_CHANGE_REMOVED = 3, /* 'path' removed from its repository */
+	UFA_DATA_CHANGE_RENAMED = 4, /* 'path' renamed to 'path2' */
+	UFA_DATA_CHANGE_RESCAN  = 5  /* any file under 'path' (a directory)
+					may have changed */
+};
+
+/**
+ * Function called after a change made by this module. 'path2' is NULL
+ * except for UFA_DATA_CHANGE_RENAMED.
+ */
+typedef void (*ufa_data_listener_fn_t)(void *user_data,
+				       enum ufa_data_change change,
+				       const char *path,
+				       const char *path2);
+
 bool ufa_data_init_repo(const char *repository, struct ufa_error **error);
 
 void ufa_data_close();
 
+/**
+ * Sets limits of open repositories. Repositories are opened on demand and
+ * kept open for next calls; when there are more than 'max_open' open, the
+ * least recently used are closed. Repositories not used for 'idle_ms'
+ * are closed too (0 disables it; a negative value closes them as soon as
+ * they are not in use). Repositories in use are not closed, so 'max_open'
+ * may be exceeded while they are in use. All functions in this module are
+ * thread-safe.
+ *
+ * @param max_open Max open repositories (at least 1)
+ * @param idle_ms Idle time to close a repository, in milliseconds
+ */
+void ufa_data_set_repo_limits(unsigned long max_open, long idle_ms);
+
+/**
+ * Closes repositories that are idle now (see ufa_data_set_repo_limits).
+ * This also happens periodically when repositories are opened.
+ */
+void ufa_data_evict_idle();
+
+/**
+ * Number of repositories currently open by this module.
+ */
+unsigned long ufa_data_open_repos();
+
+/**
+ * Discards cached repositories of directories. Must be called when the
+ * repository of a directory may have changed (e.g. directory moved or
+ * removed, repository added or removed from config).
+ *
+ * @param path Directory (also discards directories below it), or NULL to
+ * discard the whole cache
+ */
+void ufa_data_invalidate_cache(const char *path);
+
+/**
+ * Sets the function called after each change of tags or attributes of files,
+ * whoever made it (a client or the file monitor). It is called by the thread
+ * that made the change, so it must not block. Changes in a batch are reported
+ * when the batch ends. Must be set before this module is used by other
+ * threads.
+ *
+ * @param listener Listener function (NULL to remove it)
+ * @param user_data Passed to listener
+ */
+void ufa_data_set_listener(ufa_data_listener_fn_t listener, void *user_data);
+
+/**
+ * Starts a batch of changes to the repository of 'dir': changes made by
+ * this module until ufa_data_end_batch are applied in a single transaction.
+ * Other threads using the repository wait until the batch ends, which must
+ * be done by the thread that started it.
+ *
+ * @param dir Directory in a repository
+ * @param error Pointer to pointer to error structure (UFA_ERROR_ARGS if a
+ * batch is already open for 'dir')
+ * @return true if batch was started
+ */
+bool ufa_data_begin_batch(const char *dir, struct ufa_error **error);
+
+/**
+ * Ends (commits) a batch started with ufa_data_begin_batch.
+ */
+bool ufa_data_end_batch(const char *dir, struct ufa_error **error);
+
 struct ufa_list *ufa_data_listtags(const char *repodir,
 				   struct ufa_error **error);
 
@@ -48,6 +142,80 @@ struct ufa_list *ufa_data_search(struct ufa_list *repo_dirs,
 				 bool include_repo_from_config,
 				 struct ufa_error **error);
 
+/**
+ * Same as ufa_data_search, returning a page of the files found. The
+ * repositories are searched in order of path, each one sorted as the page
+ * (see struct ufa_repo_page), and the search stops when the page is full.
+ * The sort is per repository: the files of a repository come after those of
+ * the previous one, whatever their keys.
+ * Listing and opening the repositories are stages of the search recorded by
+ * ufa_repo_explain_begin.
+ *
+ * @param page Sort, limit and position of the page, where 'after' is the
+ * cursor returned by the previous page (NULL: first page); or NULL for all
+ * the files
+ * @param cursor If not NULL, where to store the cursor of the next page
+ * (NULL if the page is not full or not sorted)
+ * @param error Pointer to pointer to error structure (UFA_ERROR_ARGS for an
+ * invalid page)
+ * @return List of paths of the files found
+ */
+struct ufa_list *ufa_data_search_page(struct ufa_list *repo_dirs,
+				      struct ufa_list *filter_attr,
+				      struct ufa_list *tags,
+				      bool include_repo_from_config,
+				      const struct ufa_repo_page *page,
+				      char **cursor,
+				      struct ufa_error **error);
+
+/**
+ * Searches files with a query (see query.h) on each repository.
+ *
+ * @param repo_dirs Repositories
+ * @param query Syntax tree of the query
+ * @param include_repo_from_config Whether to also search the repositories
+ * of the config file
+ * @param error Pointer to pointer to error structure
+ * @return List of paths of the files found
+ */
+struct ufa_list *ufa_data_query(struct ufa_list *repo_dirs,
+				const struct ufa_query *query,
+				bool include_repo_from_config,
+				struct ufa_error **error);
+
+/**
+ * Same as ufa_data_query, returning a page of the files found (see
+ * ufa_data_search_page).
+ */
+struct ufa_list *ufa_data_query_page(struct ufa_list *repo_dirs,
+				     const struct ufa_query *query,
+				     bool include_repo_from_config,
+				     const struct ufa_repo_page *page,
+				     char **cursor,
+				     struct ufa_error **error);
+
+/**
+ * Counts the tags and attribute values of the files found by a search on
+ * each repository (see ufa_repo_facets), adding up the counts of all of
+ * them.
+ *
+ * @param repo_dirs Repositories
+ * @param filter_attr Filter of attributes (list of struct
+ * ufa_repo_filterattr)
+ * @param tags Tags of the files (not counted)
+ * @param include_repo_from_config Whether to also search the repositories
+ * of the config file
+ * @param attrs Whether to also count the attribute values
+ * @param error Pointer to pointer to error structure
+ * @return List of struct ufa_repo_facet, in the order of ufa_repo_facets
+ */
+struct ufa_list *ufa_data_facets(struct ufa_list *repo_dirs,
+				 struct ufa_list *filter_attr,
+				 struct ufa_list *tags,
+				 bool include_repo_from_config,
+				 bool attrs,
+				 struct ufa_error **error);
+
 bool ufa_data_setattr(const char *filepath,
 		      const char *attribute,
 		      const char *value,
@@ -61,8 +229,52 @@ bool ufa_data_unsetattr(const char *filepath,
 struct ufa_list *ufa_data_getattr(const char *filepath,
 				  struct ufa_error **error);
 
+/**
+ * Gets the tags of the files of 'dir' and of the files in 'filepaths' (either
+ * may be NULL). Files in directories without repository have no tags.
+ *
+ * @param dir Directory
+ * @param filepaths List of file paths
+ * @param error Pointer to pointer to error structure
+ * @return Hashtable mapping file path -> list of tags (files without tags
+ * are not included)
+ */
+ufa_hashtable_t *ufa_data_gettags_many(const char *dir,
+				       struct ufa_list *filepaths,
+				       struct ufa_error **error);
+
+/**
+ * Same as ufa_data_gettags_many for attributes.
+ *
+ * @return Hashtable mapping file path -> list of struct ufa_repo_attr
+ */
+ufa_hashtable_t *ufa_data_getattr_many(const char *dir,
+				       struct ufa_list *filepaths,
+				       struct ufa_error **error);
+
 bool ufa_data_removefile(const char *filepath, struct ufa_error **error);
 
+/**
+ * Updates the file in its repository after it was modified (see
+ * ufa_repo_updatefile).
+ */
+bool ufa_data_updatefile(const char *filepath, struct ufa_error **error);
+
+/**
+ * Synchronizes the repository of 'dir' with the directory contents (used
+ * when changes were not monitored). See ufa_repo_sync.
+ *
+ * @param dir Repository directory
+ * @param renamed Where to store the number of files renamed (or NULL)
+ * @param removed Where to store the number of files removed (or NULL)
+ * @param error Pointer to pointer to error structure
+ * @return true if repository was synchronized
+ */
+bool ufa_data_rescan(const char *dir,
+		     int *renamed,
+		     int *removed,
+		     struct ufa_error **error);
+
 bool ufa_data_renamefile(const char *oldfilepath,
 			 const char *newfilepath,
 			 struct ufa_error **error);
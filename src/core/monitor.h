@@ -14,10 +14,16 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#define UFA_MONITOR_DEFAULT_READ_BUFFER (256 * 1024)
+#define UFA_MONITOR_DEFAULT_MAX_QUEUED  65536
+
 enum ufa_monitor_event {
 	UFA_MONITOR_MOVE       = 1,
 	UFA_MONITOR_DELETE     = 2,
-	UFA_MONITOR_CLOSEWRITE = 4
+	UFA_MONITOR_CLOSEWRITE = 4,
+	/* Events were lost (target1 is the watched dir). Always sent to every
+	 * watcher, whatever events it was added for */
+	UFA_MONITOR_OVERFLOW   = 8
 };
 
 struct ufa_event {
@@ -30,9 +36,26 @@ struct ufa_event {
 
 typedef void (*ufa_monitor_event_fn_t)(const struct ufa_event *);
 
+/**
+ * Called with the watcher and its directory before/after a batch of events.
+ */
+typedef void (*ufa_monitor_batch_fn_t)(int watcher, const char *dir);
+
 
 bool ufa_monitor_init();
 
+/**
+ * Sets the size of the buffer used to read events from the kernel and the
+ * max number of events waiting to be applied. When the limit is reached,
+ * events are no longer read and the kernel queue may overflow (see
+ * UFA_MONITOR_OVERFLOW). Must be called before ufa_monitor_init.
+ *
+ * @param read_buffer Size (bytes) of read buffer
+ * @param max_queued_events Max events waiting to be applied
+ * @return true if limits were set
+ */
+bool ufa_monitor_set_limits(size_t read_buffer, unsigned long max_queued_events);
+
 bool ufa_monitor_stop();
 
 bool ufa_monitor_wait();
@@ -41,6 +64,21 @@ int ufa_monitor_add_watcher(const char *filepath,
 			    enum ufa_monitor_event events,
 			    ufa_monitor_event_fn_t callback);
 
+/**
+ * Events are applied (callbacks are invoked) by a worker thread, in
+ * batches: events of a watcher queued meanwhile are coalesced (e.g. a chain
+ * of moves of a file becomes a single move) and passed to the callback
+ * between calls to 'begin' and 'end'.
+ *
+ * @param watcher Watcher returned by ufa_monitor_add_watcher
+ * @param begin Function called before a batch (or NULL)
+ * @param end Function called after a batch (or NULL)
+ * @return true if hooks were set; false if watcher does not exist
+ */
+bool ufa_monitor_set_batch_hooks(int watcher,
+				 ufa_monitor_batch_fn_t begin,
+				 ufa_monitor_batch_fn_t end);
+
 bool ufa_monitor_remove_watcher(int watcher);
 
 void ufa_event_tostr(enum ufa_monitor_event event, char *buf, size_t n);
@@ -12,9 +12,11 @@
 #include "util/hashtable.h"
 #include "util/logging.h"
 #include "util/misc.h"
+#include "util/stats.h"
 #include "util/string.h"
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <sys/inotify.h>
 #include <sys/types.h>
@@ -22,6 +24,7 @@
 #include <pthread.h>
 #include <assert.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <semaphore.h>
 
 /* ========================================================================== */
@@ -29,15 +32,38 @@
 /* ========================================================================== */
 
 #define EVENT_SIZE       (sizeof (struct inotify_event))
-#define BUF_LEN          (1024 * (EVENT_SIZE + 16))
 #define VALID_FD(fd)     (fd >= 0)
 
+/** Max events taken from queue and applied as a batch */
+#define MAX_BATCH        4096
+
+/** Time (ms) to wait for the other half of a move before it is taken as a
+ * move to/from outside the watched dirs */
+#define MOVE_TIMEOUT_MS  100
+
+/** Max unpaired move events kept waiting (oldest are flushed first) */
+#define MAX_BUFFERED_MOVES 1024
+
 
 static int inotify        = -1;
 static int efd            = -1;
+static int tfd            = -1;
+
+/** Size of buffer used to read inotify events */
+static size_t read_buffer_size = UFA_MONITOR_DEFAULT_READ_BUFFER;
+
+/** Max events waiting in queue (event loop waits for the worker when the
+ * queue is full, so inotify queue may overflow) */
+static unsigned long max_queued = UFA_MONITOR_DEFAULT_MAX_QUEUED;
 
 static sem_t end_reading;
 
+/** Set by event loop thread when it is running (ufa_monitor_init waits for
+ * it) */
+static bool loop_ready                 = false;
+static pthread_mutex_t ready_mutex     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready_cond       = PTHREAD_COND_INITIALIZER;
+
 /** Maps filename -> WD */
 static ufa_hashtable_t *table_filename  = NULL;
 
@@ -47,12 +73,77 @@ static ufa_hashtable_t *table           = NULL;
 /** Maps WD -> ufa_monitor_callback_t */
 static ufa_hashtable_t *callbacks       = NULL;
 
-/** Event cookie (uint32_t) -> inotify_event* */
+/** Event cookie (uint32_t) -> struct buffered_move* */
 static ufa_hashtable_t *buffered_events = NULL;
 
+/** Maps WD -> struct batch_hooks */
+static ufa_hashtable_t *hooks           = NULL;
+
+/** Half of a move waiting for its pair (same cookie) */
+struct buffered_move {
+	uint64_t expires;
+	struct inotify_event *event;
+	struct buffered_move *prev;
+	struct buffered_move *next;
+};
+
+/**
+ * Buffered moves (FIFO) in order of arrival, which is also the order of
+ * their deadlines: the head is the next one to flush
+ */
+static struct buffered_move *moves_head = NULL;
+static struct buffered_move *moves_tail = NULL;
+
+/** Deadline the timerfd is armed for (0 if disarmed) */
+static uint64_t timer_deadline = 0;
+
 /** Event loop thread */
 static pthread_t events_loop_thread;
 
+/**
+ * Functions called by the worker before and after each batch of events of
+ * a watcher
+ */
+struct batch_hooks {
+	ufa_monitor_batch_fn_t begin;
+	ufa_monitor_batch_fn_t end;
+};
+
+/**
+ * Event waiting in queue to be applied by the worker. Everything the worker
+ * needs is copied here, so it does not access the tables above.
+ */
+struct queued_event {
+	struct ufa_event *event;
+	int watcher;
+	char *dir;
+	ufa_monitor_event_fn_t callback;
+	struct batch_hooks hooks;
+	uint64_t queued_at;
+	bool dropped;   /* removed by coalescing */
+	struct queued_event *next;
+};
+
+/** Queue of events (FIFO) from event loop thread to worker thread */
+static struct queued_event *queue_head = NULL;
+static struct queued_event *queue_tail = NULL;
+static unsigned long queue_size        = 0;
+static bool queue_closed               = false;
+static pthread_mutex_t queue_mutex     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond       = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full   = PTHREAD_COND_INITIALIZER;
+
+/** Events produced by the event loop thread not yet put in queue */
+static struct queued_event *pending_head = NULL;
+static struct queued_event *pending_tail = NULL;
+
+/** Worker thread (applies events) */
+static pthread_t worker_thread;
+
+/** Guards table, table_filename, callbacks and hooks (changed by watcher
+ * functions while the event loop thread reads them) */
+static pthread_mutex_t watchers_mutex  = PTHREAD_MUTEX_INITIALIZER;
+
 
 /* ========================================================================== */
 /* AUXILIARY FUNCTIONS - DECLARATION                                          */
@@ -69,9 +160,23 @@ static struct ufa_event *free_ufa_event(struct ufa_event *uevent);
 static int to_inotify_mask(enum ufa_monitor_event events);
 static void mask_to_str(unsigned int mask, char *str);
 static void log_inotify_event(const struct inotify_event *event);
+static const char *event_metric(enum ufa_monitor_event event);
 static void process_ufa_event(struct ufa_event *uevent);
+static void enqueue_pending_events();
+static void free_queued_event(struct queued_event *item);
+static struct queued_event *coalesce(struct queued_event *batch);
+static void apply_batch(struct queued_event *batch);
+static void *loop_apply_events(void *arg);
 static void handle_inotify_delete(struct inotify_event *event);
 static void handle_inotify_closewrite(struct inotify_event *event);
+static void handle_inotify_overflow();
+static void free_buffered_move(struct buffered_move *move);
+static void buffer_move(const struct inotify_event *event, size_t size);
+static void remove_buffered_move(struct buffered_move *move);
+static void handle_unpaired_move(const struct inotify_event *event);
+static void flush_buffered_moves(bool all);
+static void flush_oldest_move();
+static void arm_move_timer();
 static void handle_inotify_moved(const struct inotify_event *event_from,
 				 const struct inotify_event *event_to);
 static void read_inotify_events();
@@ -103,6 +208,15 @@ bool ufa_monitor_init()
 	efd = eventfd(0, 0);
 	if (efd == -1) {
 		ufa_error("eventfd: %s", strerror(errno));
+		close_and_free_state();
+		return false;
+	}
+
+	// creating timerfd to flush unpaired moves
+	tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (tfd == -1) {
+		ufa_error("timerfd_create: %s", strerror(errno));
+		close_and_free_state();
 		return false;
 	}
 
@@ -113,30 +227,68 @@ bool ufa_monitor_init()
 	buffered_events = ufa_hashtable_new((ufa_hash_fn_t) uint32_hash,
 	                                    (ufa_hash_equal_fn_t) uint32_equals,
 	                                    ufa_free,
-	                                    ufa_free);
+	                                    (ufa_hash_free_fn_t) free_buffered_move);
 	callbacks       = ufa_hashtable_new((ufa_hash_fn_t) int_hash,
 				            (ufa_hash_equal_fn_t) int_equals,
 				            ufa_free,
 				            NULL);
+	hooks           = ufa_hashtable_new((ufa_hash_fn_t) int_hash,
+				            (ufa_hash_equal_fn_t) int_equals,
+				            ufa_free,
+				            ufa_free);
 
 	table_filename  = UFA_HASHTABLE_STRING();
 
-	// Start thread
-	int ret = pthread_create(&events_loop_thread,
+	// Start worker thread and then event loop thread
+	queue_closed = false;
+	int ret = pthread_create(&worker_thread,
 				 NULL,
-				 loop_read_events,
+				 loop_apply_events,
 				 NULL);
-	if (ret < 0) {
-		ufa_error("pthread_create: %s", strerror(errno));
+	if (ret != 0) {
+		ufa_error("pthread_create: %s", strerror(ret));
+		close_and_free_state();
+		return false;
+	}
+
+	sem_init(&end_reading, 0, 0);
+	loop_ready = false;
+	ret = pthread_create(&events_loop_thread,
+			     NULL,
+			     loop_read_events,
+			     NULL);
+	if (ret != 0) {
+		ufa_error("pthread_create: %s", strerror(ret));
+		pthread_mutex_lock(&queue_mutex);
+		queue_closed = true;
+		pthread_cond_signal(&queue_cond);
+		pthread_mutex_unlock(&queue_mutex);
+		pthread_join(worker_thread, NULL);
+		sem_destroy(&end_reading);
 		close_and_free_state();
 	} else {
-		sleep(1);
+		pthread_mutex_lock(&ready_mutex);
+		while (!loop_ready) {
+			pthread_cond_wait(&ready_cond, &ready_mutex);
+		}
+		pthread_mutex_unlock(&ready_mutex);
 	}
 
 	return !ret;
 }
 
 
+bool ufa_monitor_set_limits(size_t read_buffer, unsigned long max_queued_events)
+{
+	ufa_return_val_if(is_started(), false);
+	ufa_return_val_if(read_buffer < EVENT_SIZE + NAME_MAX + 1, false);
+	ufa_return_val_if(max_queued_events == 0, false);
+
+	read_buffer_size = read_buffer;
+	max_queued = max_queued_events;
+	return true;
+}
+
 bool ufa_monitor_stop()
 {
 	ufa_return_val_ifnot(is_started(), false);
@@ -180,6 +332,7 @@ int ufa_monitor_add_watcher(const char *filepath,
 
 	int wd = -1;
 	int mask;
+	pthread_mutex_lock(&watchers_mutex);
 	int *p = ufa_hashtable_get(table_filename, filepath);
 	if (p) {
 		ufa_debug("%s already watched", filepath);
@@ -199,13 +352,33 @@ int ufa_monitor_add_watcher(const char *filepath,
 	ufa_hashtable_put(table_filename, ufa_str_dup(filepath),
 			  ufa_int_dup(wd));
 end:
+	pthread_mutex_unlock(&watchers_mutex);
 	return wd;
 
 error_inotify:
+	pthread_mutex_unlock(&watchers_mutex);
 	ufa_error("inotify_add_watch: %s", strerror(errno));
 	return wd;
 }
 
+bool ufa_monitor_set_batch_hooks(int watcher,
+				 ufa_monitor_batch_fn_t begin,
+				 ufa_monitor_batch_fn_t end)
+{
+	ufa_return_val_ifnot(is_started(), false);
+
+	pthread_mutex_lock(&watchers_mutex);
+	bool is_ok = ufa_hashtable_has_key(table, &watcher);
+	if (is_ok) {
+		struct batch_hooks *h = ufa_malloc(sizeof *h);
+		h->begin = begin;
+		h->end = end;
+		ufa_hashtable_put(hooks, ufa_int_dup(watcher), h);
+	}
+	pthread_mutex_unlock(&watchers_mutex);
+	return is_ok;
+}
+
 bool ufa_monitor_remove_watcher(int watcher)
 {
 	ufa_return_val_ifnot(is_started(), false);
@@ -220,12 +393,23 @@ bool ufa_monitor_remove_watcher(int watcher)
 
 	ufa_debug("Removed watcher %d", watcher);
 
+	pthread_mutex_lock(&watchers_mutex);
 	char *filename = ufa_hashtable_get(table, &watcher);
 	assert(filename != NULL);
 	ufa_hashtable_remove(table_filename, filename);
 	ufa_hashtable_remove(table, &watcher);
-	ufa_hashtable_remove(buffered_events, &watcher);
+	// its buffered moves can no longer be resolved to a path
+	struct buffered_move *move = moves_head;
+	while (move != NULL) {
+		struct buffered_move *next = move->next;
+		if (move->event->wd == watcher) {
+			remove_buffered_move(move);
+		}
+		move = next;
+	}
 	ufa_hashtable_remove(callbacks, &watcher);
+	ufa_hashtable_remove(hooks, &watcher);
+	pthread_mutex_unlock(&watchers_mutex);
 
 end:
 	return is_ok;
@@ -247,6 +431,9 @@ void ufa_event_tostr(enum ufa_monitor_event event, char *buf, size_t n)
 	if (event & UFA_MONITOR_DELETE && used < n) {
 		strncat(buf, "DELETE ", n - used);
 	}
+	if (event & UFA_MONITOR_OVERFLOW && strlen(buf) < n - 1) {
+		strncat(buf, "OVERFLOW ", n - strlen(buf) - 1);
+	}
 	if (buf[strlen(buf)-1] == ' ') {
 		buf[strlen(buf)-1] = '\0';
 	}
@@ -259,7 +446,7 @@ void ufa_event_tostr(enum ufa_monitor_event event, char *buf, size_t n)
 
 static void close_and_free_state()
 {
-	ufa_debug("Closing inotify and eventfd file descriptor");
+	ufa_debug("Closing inotify, eventfd and timerfd file descriptors");
 	if (VALID_FD(inotify)) {
 		close(inotify);
 		inotify = -1;
@@ -268,6 +455,10 @@ static void close_and_free_state()
 		close(efd);
 		efd = -1;
 	}
+	if (VALID_FD(tfd)) {
+		close(tfd);
+		tfd = -1;
+	}
 
 	ufa_debug("Destroying hashtable state");
 	ufa_hashtable_free(table_filename);
@@ -276,8 +467,13 @@ static void close_and_free_state()
 	table = NULL;
 	ufa_hashtable_free(callbacks);
 	callbacks = NULL;
+	ufa_hashtable_free(hooks);
+	hooks = NULL;
 	ufa_hashtable_free(buffered_events);
 	buffered_events = NULL;
+	moves_head = NULL;
+	moves_tail = NULL;
+	timer_deadline = 0;
 }
 
 static bool is_started()
@@ -397,6 +593,29 @@ static void log_inotify_event(const struct inotify_event *event)
 }
 
 
+/**
+ * Name of metric (see util/stats.h) for an event type
+ */
+static const char *event_metric(enum ufa_monitor_event event)
+{
+	switch (event) {
+	case UFA_MONITOR_MOVE:
+		return "monitor.move";
+	case UFA_MONITOR_DELETE:
+		return "monitor.delete";
+	case UFA_MONITOR_CLOSEWRITE:
+		return "monitor.closewrite";
+	case UFA_MONITOR_OVERFLOW:
+		return "monitor.overflow";
+	default:
+		return "monitor.other";
+	}
+}
+
+/**
+ * Adds an event to the pending events, to be put in the queue of the worker
+ * thread by enqueue_pending_events
+ */
 static void process_ufa_event(struct ufa_event *uevent)
 {
 	int watcher = 0;
@@ -407,15 +626,250 @@ static void process_ufa_event(struct ufa_event *uevent)
 	}
 	// TODO Invoke callback for 2 watchers if they are different?
 
-	// Invoke callback
 	ufa_monitor_event_fn_t func = ufa_hashtable_get(callbacks, &watcher);
-	if (func != NULL) {
-		ufa_debug("Invoking callback for %d: %p\n", watcher, func);
-		func(uevent);
-		ufa_debug("Callback exited");
+	if (func == NULL) {
+		free_ufa_event(uevent);
+		return;
+	}
+
+	struct queued_event *item = ufa_calloc(1, sizeof *item);
+	item->event = uevent;
+	item->watcher = watcher;
+	item->dir = ufa_str_dup(ufa_hashtable_get(table, &watcher));
+	item->callback = func;
+	struct batch_hooks *h = ufa_hashtable_get(hooks, &watcher);
+	if (h != NULL) {
+		item->hooks = *h;
+	}
+	item->queued_at = ufa_stats_now();
+
+	if (pending_tail == NULL) {
+		pending_head = item;
+	} else {
+		pending_tail->next = item;
+	}
+	pending_tail = item;
+}
+
+/**
+ * Moves pending events to the queue of the worker thread, waiting while the
+ * queue is full. Must not be called holding watchers_mutex (callbacks may
+ * add/remove watchers).
+ */
+static void enqueue_pending_events()
+{
+	pthread_mutex_lock(&queue_mutex);
+	while (pending_head != NULL) {
+		while (queue_size >= max_queued && !queue_closed) {
+			pthread_cond_wait(&queue_not_full, &queue_mutex);
+		}
+		struct queued_event *item = pending_head;
+		pending_head = item->next;
+		item->next = NULL;
+		if (queue_tail == NULL) {
+			queue_head = item;
+		} else {
+			queue_tail->next = item;
+		}
+		queue_tail = item;
+		queue_size++;
+		pthread_cond_signal(&queue_cond);
+	}
+	pending_tail = NULL;
+	pthread_mutex_unlock(&queue_mutex);
+}
+
+
+static void free_queued_event(struct queued_event *item)
+{
+	free_ufa_event(item->event);
+	ufa_free(item->dir);
+	ufa_free(item);
+}
+
+
+/**
+ * Removes events that cancel each other out:
+ *   - moves of the same file are collapsed (a -> b, b -> c  =>  a -> c);
+ *   - a file moved and then deleted is just deleted (a -> b, del b  =>  del a);
+ *   - a file moved in and then deleted/moved out is dropped.
+ * Other events keep their order.
+ *
+ * @return Coalesced list of events
+ */
+static struct queued_event *coalesce(struct queued_event *batch)
+{
+	// current path of a file -> event that moved the file there
+	ufa_hashtable_t *moved = ufa_hashtable_new(
+	    (ufa_hash_fn_t) ufa_str_hash, (ufa_hash_equal_fn_t) ufa_str_equals,
+	    NULL, NULL);
+
+	for (struct queued_event *item = batch; item; item = item->next) {
+		struct ufa_event *e = item->event;
+		struct queued_event *prev = NULL;
+		if (e->target1 != NULL) {
+			prev = ufa_hashtable_get(moved, e->target1);
+		}
+
+		if (e->event == UFA_MONITOR_OVERFLOW) {
+			// events were lost, nothing is known about moved files
+			ufa_hashtable_clear(moved);
+		} else if (prev != NULL && e->event == UFA_MONITOR_MOVE) {
+			struct ufa_event *p = prev->event;
+			ufa_hashtable_remove(moved, p->target2);
+			ufa_free(p->target2);
+			p->target2 = e->target2;
+			p->watcher2 = e->watcher2;
+			e->target2 = NULL;
+			item->dropped = true;
+
+			if (p->target2 == NULL && p->target1 == NULL) {
+				// moved in and out
+				prev->dropped = true;
+			} else if (p->target2 == NULL) {
+				// moved out
+			} else if (p->target1 != NULL
+				   && ufa_str_equals(p->target1, p->target2)) {
+				// moved back
+				prev->dropped = true;
+			} else {
+				ufa_hashtable_put(moved, p->target2, prev);
+			}
+		} else if (prev != NULL && e->event == UFA_MONITOR_DELETE) {
+			struct ufa_event *p = prev->event;
+			ufa_hashtable_remove(moved, p->target2);
+			ufa_free(p->target2);
+			p->target2 = NULL;
+			p->watcher2 = 0;
+			if (p->target1 == NULL) {
+				prev->dropped = true;
+			} else {
+				p->event = UFA_MONITOR_DELETE;
+			}
+			item->dropped = true;
+		} else if (e->event == UFA_MONITOR_MOVE && e->target2 != NULL) {
+			ufa_hashtable_put(moved, e->target2, item);
+		} else if (e->target1 != NULL) {
+			// do not collapse moves across other events
+			ufa_hashtable_remove(moved, e->target1);
+		}
+	}
+	ufa_hashtable_free(moved);
+
+	struct queued_event *head = NULL;
+	struct queued_event **tail = &head;
+	struct queued_event *next = NULL;
+	for (struct queued_event *item = batch; item; item = next) {
+		next = item->next;
+		if (item->dropped) {
+			free_queued_event(item);
+		} else {
+			item->next = NULL;
+			*tail = item;
+			tail = &item->next;
+		}
+	}
+	return head;
+}
+
+
+/**
+ * Applies a batch of events. Events of each watcher are applied together,
+ * between calls to its batch hooks (e.g. in a single transaction).
+ */
+static void apply_batch(struct queued_event *batch)
+{
+	uint64_t start = ufa_stats_now();
+	batch = coalesce(batch);
+
+	while (batch != NULL) {
+		int watcher = batch->watcher;
+		struct batch_hooks h = batch->hooks;
+		char *dir = batch->dir;
+
+		if (h.begin) {
+			h.begin(watcher, dir);
+		}
+		for (struct queued_event *item = batch; item; item = item->next) {
+			if (item->watcher != watcher) {
+				continue;
+			}
+			ufa_debug("Invoking callback for %d: %p\n", watcher,
+				  item->callback);
+			uint64_t start_event = ufa_stats_now();
+			item->callback(item->event);
+			ufa_stats_record(event_metric(item->event->event),
+					 start_event, false);
+			ufa_stats_record("monitor.queue_wait", item->queued_at,
+					 false);
+		}
+		if (h.end) {
+			h.end(watcher, dir);
+		}
+
+		// remove events of watcher (batch->dir is freed last)
+		struct queued_event *rest = NULL;
+		struct queued_event **tail = &rest;
+		struct queued_event *next = NULL;
+		struct queued_event *first = batch;
+		for (struct queued_event *item = batch->next; item;
+		     item = next) {
+			next = item->next;
+			if (item->watcher == watcher) {
+				free_queued_event(item);
+			} else {
+				item->next = NULL;
+				*tail = item;
+				tail = &item->next;
+			}
+		}
+		free_queued_event(first);
+		batch = rest;
 	}
 
-	free_ufa_event(uevent);
+	ufa_stats_record("monitor.batch", start, false);
+}
+
+
+/**
+ * Worker thread: takes events from queue and applies them in batches
+ */
+static void *loop_apply_events(void *arg)
+{
+	ufa_debug("Starting worker ...");
+	while (true) {
+		pthread_mutex_lock(&queue_mutex);
+		while (queue_head == NULL && !queue_closed) {
+			pthread_cond_wait(&queue_cond, &queue_mutex);
+		}
+		if (queue_head == NULL) {
+			pthread_mutex_unlock(&queue_mutex);
+			break;
+		}
+
+		// queue depth is recorded as a "duration" in monitor.queue
+		ufa_stats_add("monitor.queue", queue_size, false);
+
+		struct queued_event *batch = queue_head;
+		struct queued_event *last = queue_head;
+		unsigned long n = 1;
+		while (last->next != NULL && n < MAX_BATCH) {
+			last = last->next;
+			n++;
+		}
+		queue_head = last->next;
+		if (queue_head == NULL) {
+			queue_tail = NULL;
+		}
+		last->next = NULL;
+		queue_size -= n;
+		pthread_cond_signal(&queue_not_full);
+		pthread_mutex_unlock(&queue_mutex);
+
+		apply_batch(batch);
+	}
+	ufa_debug("Exiting %s", __func__);
+	return NULL;
 }
 
 
@@ -434,6 +888,23 @@ static void handle_inotify_delete(struct inotify_event *event)
 	process_ufa_event(uevent);
 }
 
+/**
+ * Events were lost. Every watcher receives an overflow event.
+ */
+static void handle_inotify_overflow()
+{
+	ufa_warn("Inotify queue overflow. Events were lost");
+	struct ufa_list *watchers = ufa_hashtable_keys(table);
+	for (UFA_LIST_EACH(i, watchers)) {
+		int wd = *((int *) i->data);
+		char *dir = ufa_hashtable_get(table, &wd);
+		process_ufa_event(new_ufa_event(UFA_MONITOR_OVERFLOW,
+						wd, 0,
+						ufa_str_dup(dir), NULL));
+	}
+	ufa_list_free(watchers);
+}
+
 static void handle_inotify_closewrite(struct inotify_event *event)
 {
 	// ufa_debug("Close write event");
@@ -449,6 +920,117 @@ static void handle_inotify_closewrite(struct inotify_event *event)
 	process_ufa_event(uevent);
 }
 
+static void free_buffered_move(struct buffered_move *move)
+{
+	if (move != NULL) {
+		ufa_free(move->event);
+		ufa_free(move);
+	}
+}
+
+/**
+ * Keeps half of a move until its pair arrives or its deadline passes
+ */
+static void buffer_move(const struct inotify_event *event, size_t size)
+{
+	if (ufa_hashtable_size(buffered_events) >= MAX_BUFFERED_MOVES) {
+		flush_oldest_move();
+	}
+	struct buffered_move *move = ufa_malloc(sizeof *move);
+	move->expires = ufa_stats_now() + MOVE_TIMEOUT_MS * 1000;
+	move->event = ufa_malloc(size);
+	memcpy(move->event, event, size);
+	move->prev = moves_tail;
+	move->next = NULL;
+	if (moves_tail != NULL) {
+		moves_tail->next = move;
+	} else {
+		moves_head = move;
+	}
+	moves_tail = move;
+	ufa_hashtable_put(buffered_events, uint32_dup(event->cookie), move);
+}
+
+/**
+ * Removes a buffered move from the FIFO and from buffered_events (which
+ * frees it)
+ */
+static void remove_buffered_move(struct buffered_move *move)
+{
+	if (move->prev != NULL) {
+		move->prev->next = move->next;
+	} else {
+		moves_head = move->next;
+	}
+	if (move->next != NULL) {
+		move->next->prev = move->prev;
+	} else {
+		moves_tail = move->prev;
+	}
+	ufa_hashtable_remove(buffered_events, &(move->event->cookie));
+}
+
+static void handle_unpaired_move(const struct inotify_event *event)
+{
+	ufa_debug(".Unpaired event: %p\n", event);
+	if (event->mask & IN_MOVED_FROM) {
+		handle_inotify_moved(event, NULL);
+	} else if (event->mask & IN_MOVED_TO) {
+		handle_inotify_moved(NULL, event);
+	}
+}
+
+/**
+ * Handles buffered moves whose deadline has passed (or all of them, if 'all'
+ * is true) as moves to/from outside.
+ */
+static void flush_buffered_moves(bool all)
+{
+	uint64_t now = (moves_head != NULL) ? ufa_stats_now() : 0;
+	while (moves_head != NULL && (all || moves_head->expires <= now)) {
+		ufa_debug("Handling unpaired event of cookie %u",
+			  moves_head->event->cookie);
+		handle_unpaired_move(moves_head->event);
+		remove_buffered_move(moves_head);
+	}
+}
+
+static void flush_oldest_move()
+{
+	if (moves_head != NULL) {
+		ufa_warn("Too many unpaired moves. Flushing cookie %u",
+			 moves_head->event->cookie);
+		handle_unpaired_move(moves_head->event);
+		remove_buffered_move(moves_head);
+	}
+}
+
+/**
+ * Sets timerfd to expire at the earliest deadline of buffered moves, the
+ * one of the oldest (or disarms it if there is none). Nothing is done if it
+ * is already armed for that deadline.
+ */
+static void arm_move_timer()
+{
+	uint64_t earliest = (moves_head != NULL) ? moves_head->expires : 0;
+	if (earliest == timer_deadline) {
+		return;
+	}
+	timer_deadline = earliest;
+
+	struct itimerspec spec = { 0 };
+	if (earliest > 0) {
+		uint64_t now = ufa_stats_now();
+		// zero would disarm the timer
+		uint64_t usec = (earliest > now) ? earliest - now : 1;
+		spec.it_value.tv_sec = usec / 1000000;
+		spec.it_value.tv_nsec = (usec % 1000000) * 1000;
+	}
+	if (timerfd_settime(tfd, 0, &spec, NULL) == -1) {
+		ufa_error("timerfd_settime: %s", strerror(errno));
+	}
+}
+
 static void handle_inotify_moved(const struct inotify_event *event_from,
 				 const struct inotify_event *event_to)
 {
@@ -502,14 +1084,15 @@ static void read_inotify_events()
 {
 	ufa_debug("Reading inotify events...");
 
-	char buf[BUF_LEN];
+	char *buf = ufa_malloc(read_buffer_size);
 	int len, i = 0;
 
-	len = read(inotify, buf, BUF_LEN);
+	len = read(inotify, buf, read_buffer_size);
 	if (len < 0) {
 		ufa_error("read inotify: %s", strerror(errno));
 	} else if (len == 0) {
 		ufa_warn("inotify end of file");
+		ufa_free(buf);
 		return;
 	}
 
@@ -521,20 +1104,20 @@ static void read_inotify_events()
 
 		if ((event->mask & IN_MOVE) && event->cookie) {
 			log_inotify_event(event);
-			struct inotify_event *prev =
+			struct buffered_move *prev =
 			    ufa_hashtable_get(buffered_events,
 					      &(event->cookie));
 			if (prev == NULL) {
-				void *event2 = ufa_malloc(total_size);
-				memcpy(event2, &buf[i], total_size);
-				ufa_hashtable_put(buffered_events,
-						  uint32_dup(event->cookie),
-						  event2);
+				buffer_move(event, total_size);
+			} else if (prev->event->mask & IN_MOVED_FROM) {
+				handle_inotify_moved(prev->event, event);
+				remove_buffered_move(prev);
 			} else {
-				handle_inotify_moved(prev, event);
-				ufa_hashtable_remove(buffered_events,
-						     &(event->cookie));
+				handle_inotify_moved(event, prev->event);
+				remove_buffered_move(prev);
 			}
+		} else if (event->mask & IN_Q_OVERFLOW) {
+			handle_inotify_overflow();
 		} else if (event->mask & IN_DELETE) {
 			log_inotify_event(event);
 			handle_inotify_delete(event);
@@ -545,24 +1128,30 @@ static void read_inotify_events()
 
 		i += EVENT_SIZE + event->len;
 	}
+	ufa_free(buf);
 }
 
 
 static void *loop_read_events(void *arg)
 {
-	sem_init(&end_reading, 0, 0);
-
 	bool reading = true;
 	ufa_debug("Starting event loop ...");
 
 	fd_set rfds;
 	int retval;
-	int maxfd = (inotify > efd ? inotify : efd) + 1;
+	int maxfd = (inotify > efd ? inotify : efd);
+	maxfd = (maxfd > tfd ? maxfd : tfd) + 1;
+
+	pthread_mutex_lock(&ready_mutex);
+	loop_ready = true;
+	pthread_cond_signal(&ready_cond);
+	pthread_mutex_unlock(&ready_mutex);
 
 	while (reading) {
 		FD_ZERO(&rfds);
 		FD_SET(inotify, &rfds);
 		FD_SET(efd, &rfds);
+		FD_SET(tfd, &rfds);
 
 		ufa_debug("Waiting fds ready for reading...");
 		retval = select(maxfd, &rfds, NULL, NULL, NULL);
@@ -581,30 +1170,35 @@ static void *loop_read_events(void *arg)
 		}
 
 		// reading from inotify fd
+		pthread_mutex_lock(&watchers_mutex);
 		if (FD_ISSET(inotify, &rfds)) {
 			read_inotify_events();
-			struct ufa_list *values =
-			    ufa_hashtable_values(buffered_events);
-			if (values == NULL) {
-				continue;
-			}
+		}
 
-			ufa_debug("Handling unpaired events ...");
-			for (UFA_LIST_EACH(i, values)) {
-				struct inotify_event *element = i->data;
-				ufa_debug(".Unpaired event: %p\n", element);
-				if (element->mask & IN_MOVED_FROM) {
-					handle_inotify_moved(element, NULL);
-				} else if (element->mask & IN_MOVED_TO) {
-					handle_inotify_moved(NULL, element);
-				}
+		// moves not paired until their deadline are moves to/from
+		// outside the watched dirs
+		if (FD_ISSET(tfd, &rfds)) {
+			uint64_t expirations;
+			if (read(tfd, &expirations, sizeof expirations) < 0) {
+				ufa_error("read timerfd: %s", strerror(errno));
 			}
-
-			ufa_list_free(values);
-			ufa_hashtable_clear(buffered_events);
+			// expired: it is no longer armed
+			timer_deadline = 0;
 		}
+		flush_buffered_moves(!reading);
+		arm_move_timer();
+		pthread_mutex_unlock(&watchers_mutex);
+
+		enqueue_pending_events();
 	}
 
+	// waits for worker to apply remaining events
+	pthread_mutex_lock(&queue_mutex);
+	queue_closed = true;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_mutex);
+	pthread_join(worker_thread, NULL);
+
 	close_and_free_state();
 
 	sem_post(&end_reading);
@@ -0,0 +1,470 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Implementation of the query language (query.h).                            */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "core/query.h"
+#include "core/errors.h"
+#include "util/misc.h"
+#include "util/string.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+/** State of the parser (recursive descent, see grammar in query.h) */
+struct parser {
+	const char *str;         /* query */
+	const char *pos;         /* next character to read */
+	int depth;               /* nested operators */
+	int predicates;          /* predicates read */
+	struct ufa_error **error;
+};
+
+static const char *keywords[] = {"AND", "OR", "NOT"};
+
+/* Operators of attributes, longest first (see parse_predicate) */
+static const struct {
+	const char *str;
+	enum ufa_repo_matchmode matchmode;
+} operators[] = {
+	{"~~", UFA_REPO_FULLTEXT},
+	{"~=", UFA_REPO_WILDCARD},
+	{"<=", UFA_REPO_LE},
+	{">=", UFA_REPO_GE},
+	{"<", UFA_REPO_LT},
+	{">", UFA_REPO_GT},
+	{"=", UFA_REPO_EQUAL},
+};
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS - DECLARATION                                          */
+/* ========================================================================== */
+
+static struct ufa_query *parse_or(struct parser *p);
+static struct ufa_query *parse_and(struct parser *p);
+static struct ufa_query *parse_not(struct parser *p);
+static struct ufa_query *parse_predicate(struct parser *p);
+static char *read_word(struct parser *p, bool attr_name);
+static bool read_keyword(struct parser *p, const char *keyword);
+static bool at_keyword(struct parser *p, const char *keyword);
+static void skip_spaces(struct parser *p);
+static bool is_word_char(char c, bool attr_name);
+static int count_words(const char *str);
+static void syntax_error(struct parser *p, const char *format, ...);
+static struct ufa_query *new_node(enum ufa_query_type type,
+				  struct ufa_query *left,
+				  struct ufa_query *right);
+static char *quote_word(const char *word, bool attr_name, bool force);
+static const char *operator_str(enum ufa_repo_matchmode matchmode);
+
+/* ========================================================================== */
+/* FUNCTIONS FROM query.h                                                     */
+/* ========================================================================== */
+
+struct ufa_query *ufa_query_parse(const char *str, struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+
+	struct parser p = {
+	    .str = str, .pos = str, .depth = 0, .predicates = 0, .error = error};
+
+	struct ufa_query *query = parse_or(&p);
+	if (query == NULL) {
+		return NULL;
+	}
+
+	skip_spaces(&p);
+	if (*p.pos != '\0') {
+		syntax_error(&p, "unexpected '%c'", *p.pos);
+		ufa_query_free(query);
+		return NULL;
+	}
+	return query;
+}
+
+char *ufa_query_tostr(const struct ufa_query *query)
+{
+	if (query == NULL) {
+		return ufa_str_dup("");
+	}
+
+	char *str = NULL;
+	char *left = NULL;
+	char *right = NULL;
+	switch (query->type) {
+	case UFA_QUERY_TAG:
+		str = quote_word(query->name, false, false);
+		break;
+	case UFA_QUERY_ATTR:
+		left = quote_word(query->name, true, false);
+		if (query->value == NULL) {
+			str = ufa_str_sprintf("@%s", left);
+		} else {
+			// a range is quoted when compared as text
+			right = quote_word(query->value, false,
+					   query->matchmode == UFA_REPO_EQUAL
+					       && ufa_repo_isrange(query->value));
+			str = ufa_str_sprintf("@%s%s%s", left,
+					      operator_str(query->matchmode),
+					      right);
+		}
+		break;
+	case UFA_QUERY_NOT:
+		left = ufa_query_tostr(query->left);
+		str = ufa_str_sprintf("(NOT %s)", left);
+		break;
+	case UFA_QUERY_AND:
+	case UFA_QUERY_OR:
+		left = ufa_query_tostr(query->left);
+		right = ufa_query_tostr(query->right);
+		str = ufa_str_sprintf(
+		    "(%s %s %s)", left,
+		    (query->type == UFA_QUERY_AND) ? "AND" : "OR", right);
+		break;
+	}
+	ufa_free(left);
+	ufa_free(right);
+	return str;
+}
+
+int ufa_query_count_predicates(const struct ufa_query *query)
+{
+	if (query == NULL) {
+		return 0;
+	}
+	if (query->type == UFA_QUERY_TAG || query->type == UFA_QUERY_ATTR) {
+		return 1;
+	}
+	return ufa_query_count_predicates(query->left)
+	       + ufa_query_count_predicates(query->right);
+}
+
+void ufa_query_free(struct ufa_query *query)
+{
+	if (query != NULL) {
+		ufa_free(query->name);
+		ufa_free(query->value);
+		ufa_query_free(query->left);
+		ufa_query_free(query->right);
+		ufa_free(query);
+	}
+}
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+static struct ufa_query *parse_or(struct parser *p)
+{
+	struct ufa_query *left = parse_and(p);
+	while (left != NULL && read_keyword(p, "OR")) {
+		struct ufa_query *right = parse_and(p);
+		if (right == NULL) {
+			ufa_query_free(left);
+			return NULL;
+		}
+		left = new_node(UFA_QUERY_OR, left, right);
+	}
+	return left;
+}
+
+static struct ufa_query *parse_and(struct parser *p)
+{
+	struct ufa_query *left = parse_not(p);
+	while (left != NULL) {
+		skip_spaces(p);
+		// AND is optional: operands side by side are ANDed
+		if (*p->pos == '\0' || *p->pos == ')' || at_keyword(p, "OR")) {
+			break;
+		}
+		read_keyword(p, "AND");
+		struct ufa_query *right = parse_not(p);
+		if (right == NULL) {
+			ufa_query_free(left);
+			return NULL;
+		}
+		left = new_node(UFA_QUERY_AND, left, right);
+	}
+	return left;
+}
+
+static struct ufa_query *parse_not(struct parser *p)
+{
+	struct ufa_query *query = NULL;
+
+	if (++p->depth > UFA_QUERY_MAX_DEPTH) {
+		syntax_error(p, "too many nested expressions (max %d)",
+			     UFA_QUERY_MAX_DEPTH);
+		return NULL;
+	}
+
+	skip_spaces(p);
+	if (read_keyword(p, "NOT")) {
+		struct ufa_query *operand = parse_not(p);
+		if (operand != NULL) {
+			query = new_node(UFA_QUERY_NOT, operand, NULL);
+		}
+	} else if (*p->pos == '(') {
+		p->pos++;
+		query = parse_or(p);
+		skip_spaces(p);
+		if (query != NULL && *p->pos != ')') {
+			syntax_error(p, "expected ')'");
+			ufa_query_free(query);
+			query = NULL;
+		} else if (query != NULL) {
+			p->pos++;
+		}
+	} else {
+		query = parse_predicate(p);
+	}
+
+	p->depth--;
+	return query;
+}
+
+static struct ufa_query *parse_predicate(struct parser *p)
+{
+	if (*p->pos == '\0') {
+		syntax_error(p, "expected tag or attribute");
+		return NULL;
+	}
+	if (*p->pos == ')' || at_keyword(p, "AND") || at_keyword(p, "OR")) {
+		syntax_error(p, "expected tag or attribute");
+		return NULL;
+	}
+	if (++p->predicates > UFA_QUERY_MAX_PREDICATES) {
+		syntax_error(p, "too many tags and attributes (max %d)",
+			     UFA_QUERY_MAX_PREDICATES);
+		return NULL;
+	}
+
+	bool is_attr = (*p->pos == '@');
+	if (is_attr) {
+		p->pos++;
+	}
+	char *name = read_word(p, is_attr);
+	if (name == NULL) {
+		return NULL;
+	}
+
+	struct ufa_query *query = new_node(
+	    is_attr ? UFA_QUERY_ATTR : UFA_QUERY_TAG, NULL, NULL);
+	query->name = name;
+	query->matchmode = UFA_REPO_EQUAL;
+	if (!is_attr) {
+		return query;
+	}
+
+	const char *after_name = p->pos;
+	skip_spaces(p);
+	size_t op = 0;
+	size_t count_op = sizeof operators / sizeof operators[0];
+	while (op < count_op && !ufa_str_startswith(p->pos, operators[op].str)) {
+		op++;
+	}
+	if (op == count_op) {
+		// only the presence of the attribute
+		p->pos = after_name;
+		return query;
+	}
+	query->matchmode = operators[op].matchmode;
+	p->pos += strlen(operators[op].str);
+
+	skip_spaces(p);
+	bool quoted = (*p->pos == '"');
+	query->value = read_word(p, false);
+	if (query->value == NULL) {
+		ufa_query_free(query);
+		return NULL;
+	}
+	if (query->matchmode == UFA_REPO_EQUAL && !quoted
+	    && ufa_repo_isrange(query->value)) {
+		query->matchmode = UFA_REPO_BETWEEN;
+	}
+	if (query->matchmode == UFA_REPO_FULLTEXT) {
+		int words = count_words(query->value);
+		if (words > 1) {
+			p->predicates += words - 1;
+		}
+		if (p->predicates > UFA_QUERY_MAX_PREDICATES) {
+			syntax_error(p, "too many tags, attributes and words "
+					"(max %d)",
+				     UFA_QUERY_MAX_PREDICATES);
+			ufa_query_free(query);
+			return NULL;
+		}
+	}
+	return query;
+}
+
+/**
+ * Reads a word (bare or in double quotes).
+ *
+ * @return New string, or NULL (with error) if there is no word at position
+ */
+static char *read_word(struct parser *p, bool attr_name)
+{
+	if (*p->pos != '"') {
+		const char *start = p->pos;
+		while (is_word_char(*p->pos, attr_name)) {
+			p->pos++;
+		}
+		if (p->pos == start) {
+			syntax_error(p, "expected %s",
+				     attr_name ? "attribute" : "word");
+			return NULL;
+		}
+		return ufa_str_sprintf("%.*s", (int) (p->pos - start), start);
+	}
+
+	const char *start = p->pos++;
+	char *word = ufa_malloc(strlen(start));
+	size_t len = 0;
+	for (; *p->pos != '"'; p->pos++) {
+		if (*p->pos == '\\'
+		    && (p->pos[1] == '"' || p->pos[1] == '\\')) {
+			p->pos++;
+		} else if (*p->pos == '\0') {
+			p->pos = start;
+			syntax_error(p, "unterminated string");
+			ufa_free(word);
+			return NULL;
+		}
+		word[len++] = *p->pos;
+	}
+	p->pos++;
+	word[len] = '\0';
+	return word;
+}
+
+/**
+ * Reads 'keyword' if it is the next word (after spaces).
+ */
+static bool read_keyword(struct parser *p, const char *keyword)
+{
+	skip_spaces(p);
+	if (at_keyword(p, keyword)) {
+		p->pos += strlen(keyword);
+		return true;
+	}
+	return false;
+}
+
+static bool at_keyword(struct parser *p, const char *keyword)
+{
+	size_t len = strlen(keyword);
+	return strncmp(p->pos, keyword, len) == 0
+	       && !is_word_char(p->pos[len], false);
+}
+
+static void skip_spaces(struct parser *p)
+{
+	while (isspace((unsigned char) *p->pos)) {
+		p->pos++;
+	}
+}
+
+static bool is_word_char(char c, bool attr_name)
+{
+	if (c == '\0' || isspace((unsigned char) c) || c == '(' || c == ')'
+	    || c == '"') {
+		return false;
+	}
+	return !attr_name || (c != '=' && c != '~' && c != '<' && c != '>');
+}
+
+/**
+ * Counts the words of a full-text value (separated by spaces).
+ */
+static int count_words(const char *str)
+{
+	int count = 0;
+	bool in_word = false;
+	for (const char *c = str; *c != '\0'; c++) {
+		bool space = isspace((unsigned char) *c);
+		if (!space && !in_word) {
+			count++;
+		}
+		in_word = !space;
+	}
+	return count;
+}
+
+static void syntax_error(struct parser *p, const char *format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	char *msg = ufa_str_vprintf(format, ap);
+	va_end(ap);
+
+	ufa_error_new(p->error, UFA_ERROR_ARGS,
+		      "invalid query at position %d: %s",
+		      (int) (p->pos - p->str) + 1, msg);
+	ufa_free(msg);
+}
+
+static struct ufa_query *new_node(enum ufa_query_type type,
+				  struct ufa_query *left,
+				  struct ufa_query *right)
+{
+	struct ufa_query *node = ufa_calloc(1, sizeof *node);
+	node->type = type;
+	node->left = left;
+	node->right = right;
+	return node;
+}
+
+/**
+ * Returns a copy of 'word', in double quotes if 'force' or if it would not be
+ * read as the same word otherwise.
+ */
+static char *quote_word(const char *word, bool attr_name, bool force)
+{
+	bool quote = (force || *word == '\0' || *word == '@');
+	for (const char *c = word; *c && !quote; c++) {
+		quote = !is_word_char(*c, attr_name);
+	}
+	for (size_t i = 0; i < sizeof keywords / sizeof keywords[0]; i++) {
+		quote = quote || ufa_str_equals(word, keywords[i]);
+	}
+	if (!quote) {
+		return ufa_str_dup(word);
+	}
+
+	char *str = ufa_malloc(2 * strlen(word) + 3);
+	size_t len = 0;
+	str[len++] = '"';
+	for (const char *c = word; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			str[len++] = '\\';
+		}
+		str[len++] = *c;
+	}
+	str[len++] = '"';
+	str[len] = '\0';
+	return str;
+}
+
+static const char *operator_str(enum ufa_repo_matchmode matchmode)
+{
+	if (matchmode == UFA_REPO_BETWEEN) {
+		return "=";
+	}
+	for (size_t i = 0; i < sizeof operators / sizeof operators[0]; i++) {
+		if (operators[i].matchmode == matchmode) {
+			return operators[i].str;
+		}
+	}
+	return "=";
+}
@@ -0,0 +1,102 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Definitions for the query language (search expressions)                    */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#ifndef UFA_QUERY_H_
+#define UFA_QUERY_H_
+
+#include "core/repo.h"
+#include "util/error.h"
+
+/*
+ * Grammar of a query:
+ *
+ *   query     := or
+ *   or        := and { "OR" and }
+ *   and       := not { [ "AND" ] not }
+ *   not       := "NOT" not | "(" or ")" | predicate
+ *   predicate := word                   file has tag 'word'
+ *              | "@" word               file has attribute 'word'
+ *              | "@" word "=" word      attribute equals value
+ *              | "@" word "~=" word     attribute matches value ('*' is any)
+ *              | "@" word "~~" word     attribute has all the words of value
+ *                                       (full text, "word*" is a prefix)
+ *              | "@" word op word       attribute compared to value, where
+ *                                       op is "<", "<=", ">" or ">="
+ *
+ * A word is a sequence of characters other than space, '(', ')' and '"'
+ * (and, in attribute names, '=', '~', '<' and '>'), or a string in double
+ * quotes (where \" and \\ are escaped). Operators are upper case; a tag
+ * named e.g. "OR" must be quoted.
+ *
+ * Comparisons are by the type of the value (see ufa_repo_attrtype_of). A
+ * bare value "low..high" after "=" is a range (UFA_REPO_BETWEEN) if both
+ * limits are numbers or both are timestamps.
+ *
+ * E.g.: (math OR physics) AND NOT @year=2020..2022 AND @title~="*calculus*"
+ *       AND @added>=2024-01-01 AND @abstract~~"integral calc*"
+ */
+
+/** Max of SQL arguments bound by a predicate: the attribute and a range, the
+ * bounds of a prefix, or a trigram filter and a pattern. A full-text value
+ * binds one per word (without full-text index), so each word beyond the
+ * first counts as another predicate */
+#define UFA_QUERY_MAX_PREDICATE_ARGS 3
+
+/** Max of predicates of a query, so that its SQL arguments stay within the
+ * 999 of older SQLite versions, leaving some for paging */
+#define UFA_QUERY_MAX_PREDICATES (960 / UFA_QUERY_MAX_PREDICATE_ARGS)
+
+/** Max of nested operators and parentheses of a query */
+#define UFA_QUERY_MAX_DEPTH 64
+
+enum ufa_query_type {
+	UFA_QUERY_TAG = 0,
+	UFA_QUERY_ATTR,
+	UFA_QUERY_AND,
+	UFA_QUERY_OR,
+	UFA_QUERY_NOT,
+};
+
+/** Node of the syntax tree of a query */
+struct ufa_query {
+	enum ufa_query_type type;
+	char *name;                        /* tag or attribute */
+	char *value;                       /* attribute value (or NULL: any) */
+	enum ufa_repo_matchmode matchmode; /* how 'value' is compared */
+	struct ufa_query *left;            /* operand of AND, OR and NOT */
+	struct ufa_query *right;           /* second operand of AND and OR */
+};
+
+/**
+ * Parses a query.
+ *
+ * @param str Query
+ * @param error Pointer to pointer to error structure (UFA_ERROR_ARGS with
+ * the position of a syntax error)
+ * @return Syntax tree (free with ufa_query_free), or NULL on error
+ */
+struct ufa_query *ufa_query_parse(const char *str, struct ufa_error **error);
+
+/**
+ * Converts a query to a string, with every operation in parentheses (the
+ * result parses to the same query).
+ *
+ * @return New string
+ */
+char *ufa_query_tostr(const struct ufa_query *query);
+
+/**
+ * Number of predicates (tags and attributes) of a query.
+ */
+int ufa_query_count_predicates(const struct ufa_query *query);
+
+void ufa_query_free(struct ufa_query *query);
+
+#endif /* UFA_QUERY_H_ */
@@ -0,0 +1,810 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Implementation of repo module (repo.h): dispatch to storage backends.      */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "core/repo.h"
+#include "core/repo_backend.h"
+#include "util/error.h"
+#include "util/list.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/stats.h"
+#include "util/string.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+/** Records the time spent on a repo operation (metric "repo.<op>") */
+#define stats_record(op, start, error)                                         \
+	ufa_stats_record("repo." op, start, HAS_ERROR(error))
+
+/** Storage backends, by name (see ufa_repo_init_backend) */
+static const struct ufa_repo_backend *backends[] = {
+	&ufa_repo_sqlite_backend,
+	&ufa_repo_memory_backend,
+	NULL
+};
+
+/** Backend of ufa_repo_init (see ufa_repo_set_default_backend) */
+static const struct ufa_repo_backend *default_backend =
+    &ufa_repo_sqlite_backend;
+
+/** Stages of searches recorded by the current thread (see
+ * ufa_repo_explain_begin), in reverse order */
+static __thread bool explain_enabled         = false;
+static __thread struct ufa_list *explain_stages = NULL;
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS - DECLARATION                                          */
+/* ========================================================================== */
+
+static const struct ufa_repo_backend *find_backend(const char *name,
+						   struct ufa_error **error);
+static bool indicator_file_matches(const char *filepath,
+				   const char *repository);
+static void create_repo_indicator_file(const char *repo,
+				       struct ufa_error **error);
+static void lock_repo(const ufa_repo_t *repo);
+static void unlock_repo(const ufa_repo_t *repo);
+
+/* ========================================================================== */
+/* FUNCTIONS FROM repo.h                                                      */
+/* ========================================================================== */
+
+ufa_repo_t *ufa_repo_init(const char *repository, struct ufa_error **error)
+{
+	return ufa_repo_init_backend(repository, NULL, error);
+}
+
+ufa_repo_t *ufa_repo_init_backend(const char *repository,
+				  const char *backend,
+				  struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+
+	ufa_repo_t *repo = NULL;
+	char *repo_abs = NULL;
+
+	const struct ufa_repo_backend *impl =
+	    (backend != NULL)
+		? find_backend(backend, error)
+		: __atomic_load_n(&default_backend, __ATOMIC_ACQUIRE);
+	if (impl == NULL) {
+		goto end;
+	}
+
+	repo_abs = ufa_util_abspath(repository);
+	if (!ufa_util_isdir(repo_abs)) {
+		ufa_error_new(error, UFA_ERROR_NOTDIR, "%s is not a dir",
+			      repository);
+		goto end;
+	}
+
+	ufa_debug("Initializing repo '%s' (backend: %s)", repo_abs, impl->name);
+	repo = impl->open(repo_abs, error);
+	ufa_goto_iferror(error, end);
+
+	repo->backend = impl;
+	repo->repository_path = ufa_str_dup(repo_abs);
+	repo->refs = 1;
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&repo->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	create_repo_indicator_file(repo_abs, error);
+
+end:
+	ufa_free(repo_abs);
+	return repo;
+}
+
+bool ufa_repo_set_default_backend(const char *backend,
+				  struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+
+	const struct ufa_repo_backend *impl = find_backend(backend, error);
+	if (impl == NULL) {
+		return false;
+	}
+	__atomic_store_n(&default_backend, impl, __ATOMIC_RELEASE);
+	return true;
+}
+
+struct ufa_list *ufa_repo_backends()
+{
+	struct ufa_list *names = NULL;
+	for (int i = 0; backends[i] != NULL; i++) {
+		names = ufa_list_append(names, backends[i]->name);
+	}
+	return names;
+}
+
+const char *ufa_repo_backend_name(const ufa_repo_t *repo)
+{
+	ufa_return_val_ifnot(repo, NULL);
+	return repo->backend->name;
+}
+
+char *ufa_repo_getrepopath(const ufa_repo_t *repo)
+{
+	ufa_return_val_ifnot(repo, NULL);
+	return ufa_str_dup(repo->repository_path);
+}
+
+struct ufa_list *ufa_repo_listtags(const ufa_repo_t *repo,
+				   struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	struct ufa_list *tags = repo->backend->listtags(repo, error);
+	unlock_repo(repo);
+	stats_record("listtags", start, error);
+	return tags;
+}
+
+struct ufa_list *ufa_repo_listfiles(const ufa_repo_t *repo,
+				    const char *dirpath,
+				    struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	struct ufa_list *files = repo->backend->listfiles(repo, dirpath, error);
+	unlock_repo(repo);
+	stats_record("listfiles", start, error);
+	return files;
+}
+
+struct ufa_list *ufa_repo_gettags(const ufa_repo_t *repo,
+				  const char *filepath,
+				  struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	struct ufa_list *tags = repo->backend->gettags(repo, filepath, error);
+	unlock_repo(repo);
+	stats_record("gettags", start, error);
+	return tags;
+}
+
+ufa_hashtable_t *ufa_repo_gettags_many(const ufa_repo_t *repo,
+				       struct ufa_list *filenames,
+				       struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	ufa_hashtable_t *result =
+	    repo->backend->gettags_many(repo, filenames, error);
+	unlock_repo(repo);
+	stats_record("gettags_many", start, error);
+	return result;
+}
+
+bool ufa_repo_settag(const ufa_repo_t *repo,
+		     const char *filepath,
+		     const char *tag,
+		     struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	bool status = repo->backend->settag(repo, filepath, tag, error);
+	unlock_repo(repo);
+	stats_record("settag", start, error);
+	return status;
+}
+
+bool ufa_repo_cleartags(const ufa_repo_t *repo,
+			const char *filepath,
+			struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	bool status = repo->backend->cleartags(repo, filepath, error);
+	unlock_repo(repo);
+	stats_record("cleartags", start, error);
+	return status;
+}
+
+bool ufa_repo_unsettag(const ufa_repo_t *repo,
+		       const char *filepath,
+		       const char *tag,
+		       struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	bool status = repo->backend->unsettag(repo, filepath, tag, error);
+	unlock_repo(repo);
+	stats_record("unsettag", start, error);
+	return status;
+}
+
+/**
+ * Negative values on error
+ */
+int ufa_repo_inserttag(const ufa_repo_t *repo,
+		       const char *tag,
+		       struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, -1);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	int tag_id = repo->backend->inserttag(repo, tag, error);
+	unlock_repo(repo);
+	stats_record("inserttag", start, error);
+	return tag_id;
+}
+
+bool ufa_repo_isatag(const ufa_repo_t *repo,
+		     const char *path,
+		     struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	lock_repo(repo);
+	bool ret = repo->backend->isatag(repo, path, error);
+	unlock_repo(repo);
+	return ret;
+}
+
+char *ufa_repo_get_realfilepath(const ufa_repo_t *repo,
+				const char *path,
+				struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+	/* FIXME remove error? */
+	// FIXME check if filepath is in repo?
+	char *result = NULL;
+	char *last_part = ufa_util_getfilename(path);
+
+	char *filepath = ufa_util_joinpath(repo->repository_path,
+					   last_part,
+					   NULL);
+
+	if (ufa_util_isfile(filepath)) {
+		result = filepath;
+	} else {
+		ufa_free(filepath);
+		result = NULL;
+	}
+
+	ufa_free(last_part);
+	return result;
+}
+
+struct ufa_list *ufa_repo_search(const ufa_repo_t *repo,
+				 struct ufa_list *filter_attr,
+				 struct ufa_list *tags,
+				 struct ufa_error **error)
+{
+	return ufa_repo_search_page(repo, filter_attr, tags, NULL, NULL, error);
+}
+
+struct ufa_list *ufa_repo_search_page(const ufa_repo_t *repo,
+				      struct ufa_list *filter_attr,
+				      struct ufa_list *tags,
+				      const struct ufa_repo_page *page,
+				      char **last_key,
+				      struct ufa_error **error)
+{
+	if (last_key != NULL) {
+		*last_key = NULL;
+	}
+	ufa_return_val_iferror(error, NULL);
+	ufa_debug("%s: %s", __func__, repo->repository_path);
+
+	uint64_t start = ufa_stats_now();
+	struct ufa_list *result = NULL;
+	if (ufa_list_size(tags) == 0 && ufa_list_size(filter_attr) == 0) {
+		ufa_error_new(error, UFA_ERROR_ARGS,
+			      "you must search for tags or attributes");
+	} else {
+		lock_repo(repo);
+		result = repo->backend->search_page(repo, filter_attr, tags,
+						    page, last_key, error);
+		unlock_repo(repo);
+	}
+	stats_record("search", start, error);
+	return result;
+}
+
+struct ufa_list *ufa_repo_query(const ufa_repo_t *repo,
+				const struct ufa_query *query,
+				struct ufa_error **error)
+{
+	return ufa_repo_query_page(repo, query, NULL, NULL, error);
+}
+
+struct ufa_list *ufa_repo_query_page(const ufa_repo_t *repo,
+				     const struct ufa_query *query,
+				     const struct ufa_repo_page *page,
+				     char **last_key,
+				     struct ufa_error **error)
+{
+	if (last_key != NULL) {
+		*last_key = NULL;
+	}
+	ufa_return_val_iferror(error, NULL);
+
+	uint64_t start = ufa_stats_now();
+	struct ufa_list *result = NULL;
+	if (query == NULL) {
+		ufa_error_new(error, UFA_ERROR_ARGS, "empty query");
+	} else {
+		lock_repo(repo);
+		result = repo->backend->query_page(repo, query, page, last_key,
+						   error);
+		unlock_repo(repo);
+	}
+	stats_record("query", start, error);
+	return result;
+}
+
+struct ufa_list *ufa_repo_facets(const ufa_repo_t *repo,
+				 struct ufa_list *filter_attr,
+				 struct ufa_list *tags,
+				 bool attrs,
+				 struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	struct ufa_list *result =
+	    repo->backend->facets(repo, filter_attr, tags, attrs, error);
+	unlock_repo(repo);
+	stats_record("facets", start, error);
+	return result;
+}
+
+bool ufa_repo_setattr(const ufa_repo_t *repo,
+		      const char *filepath,
+		      const char *attribute,
+		      const char *value,
+		      struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	bool status =
+	    repo->backend->setattr(repo, filepath, attribute, value, error);
+	unlock_repo(repo);
+	stats_record("setattr", start, error);
+	return status;
+}
+
+bool ufa_repo_unsetattr(const ufa_repo_t *repo,
+			const char *filepath,
+			const char *attribute,
+			struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	bool status =
+	    repo->backend->unsetattr(repo, filepath, attribute, error);
+	unlock_repo(repo);
+	stats_record("unsetattr", start, error);
+	return status;
+}
+
+struct ufa_list *ufa_repo_getattr(const ufa_repo_t *repo,
+				  const char *filepath,
+				  struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	struct ufa_list *attrs = repo->backend->getattr(repo, filepath, error);
+	unlock_repo(repo);
+	stats_record("getattr", start, error);
+	return attrs;
+}
+
+ufa_hashtable_t *ufa_repo_getattr_many(const ufa_repo_t *repo,
+				       struct ufa_list *filenames,
+				       struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	ufa_hashtable_t *result =
+	    repo->backend->getattr_many(repo, filenames, error);
+	unlock_repo(repo);
+	stats_record("getattr_many", start, error);
+	return result;
+}
+
+bool ufa_repo_begin(ufa_repo_t *repo, struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	// the lock is kept until ufa_repo_commit, so other threads neither
+	// write in the transaction nor read changes not committed
+	lock_repo(repo);
+	if (repo->in_transaction) {
+		ufa_error_new(error, UFA_ERROR_ARGS,
+			      "a transaction is already open on '%s'",
+			      repo->repository_path);
+		unlock_repo(repo);
+		return false;
+	}
+	bool status = repo->backend->begin(repo, error);
+	if (status) {
+		repo->in_transaction = true;
+	} else {
+		unlock_repo(repo);
+	}
+	return status;
+}
+
+bool ufa_repo_commit(ufa_repo_t *repo, struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	lock_repo(repo);
+	if (!repo->in_transaction) {
+		ufa_error_new(error, UFA_ERROR_ARGS,
+			      "no transaction open on '%s'",
+			      repo->repository_path);
+		unlock_repo(repo);
+		return false;
+	}
+	// the transaction ends even if commit fails (it is rolled back)
+	bool status = repo->backend->commit(repo, error);
+	repo->in_transaction = false;
+	unlock_repo(repo);
+	unlock_repo(repo); // locked by ufa_repo_begin
+	return status;
+}
+
+bool ufa_repo_set_trigram_index(ufa_repo_t *repo, bool enabled,
+				struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	lock_repo(repo);
+	bool status = repo->backend->set_trigram_index(repo, enabled, error);
+	unlock_repo(repo);
+	return status;
+}
+
+bool ufa_repo_has_trigram_index(const ufa_repo_t *repo)
+{
+	lock_repo(repo);
+	bool ret = repo->backend->has_trigram_index(repo);
+	unlock_repo(repo);
+	return ret;
+}
+
+bool ufa_repo_set_fulltext_index(ufa_repo_t *repo, bool enabled,
+				 struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	lock_repo(repo);
+	bool status = repo->backend->set_fulltext_index(repo, enabled, error);
+	unlock_repo(repo);
+	return status;
+}
+
+bool ufa_repo_has_fulltext_index(const ufa_repo_t *repo)
+{
+	lock_repo(repo);
+	bool ret = repo->backend->has_fulltext_index(repo);
+	unlock_repo(repo);
+	return ret;
+}
+
+ufa_repo_t *ufa_repo_ref(ufa_repo_t *repo)
+{
+	if (repo != NULL) {
+		__atomic_add_fetch(&repo->refs, 1, __ATOMIC_RELAXED);
+	}
+	return repo;
+}
+
+int ufa_repo_refcount(const ufa_repo_t *repo)
+{
+	ufa_return_val_ifnot(repo, 0);
+	return __atomic_load_n(&repo->refs, __ATOMIC_ACQUIRE);
+}
+
+void ufa_repo_free(ufa_repo_t *repo)
+{
+	if (repo != NULL
+	    && __atomic_sub_fetch(&repo->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		ufa_free(repo->repository_path);
+		pthread_mutex_destroy(&repo->lock);
+		repo->backend->close(repo);
+	}
+}
+
+bool ufa_repo_removefile(const ufa_repo_t *repo,
+			 const char *filepath,
+			 struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	bool status = repo->backend->removefile(repo, filepath, error);
+	unlock_repo(repo);
+	stats_record("removefile", start, error);
+	return status;
+}
+
+bool ufa_repo_updatefile(const ufa_repo_t *repo,
+			 const char *filepath,
+			 struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	bool status = repo->backend->updatefile(repo, filepath, error);
+	unlock_repo(repo);
+	stats_record("updatefile", start, error);
+	return status;
+}
+
+bool ufa_repo_sync(const ufa_repo_t *repo,
+		   int *renamed,
+		   int *removed,
+		   struct ufa_error **error)
+{
+	if (renamed != NULL) {
+		*renamed = 0;
+	}
+	if (removed != NULL) {
+		*removed = 0;
+	}
+	ufa_return_val_iferror(error, false);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo);
+	bool status = repo->backend->sync(repo, renamed, removed, error);
+	unlock_repo(repo);
+	stats_record("sync", start, error);
+	return status;
+}
+
+bool ufa_repo_renamefile(const ufa_repo_t *repo_old,
+			 const ufa_repo_t *repo_new,
+			 const char *oldfilepath,
+			 const char *newfilepath,
+			 struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	uint64_t start = ufa_stats_now();
+	lock_repo(repo_new);
+	bool status = repo_new->backend->renamefile(repo_old, repo_new,
+						    oldfilepath, newfilepath,
+						    error);
+	unlock_repo(repo_new);
+	stats_record("renamefile", start, error);
+	return status;
+}
+
+struct ufa_repo_filterattr *
+ufa_repo_filterattr_new(const char *attribute, const char *value,
+			enum ufa_repo_matchmode match_mode)
+{
+	struct ufa_repo_filterattr *ptr = ufa_calloc(1, sizeof *ptr);
+	ptr->attribute = ufa_str_dup(attribute);
+	ptr->value = (value == NULL) ? NULL : ufa_str_dup(value);
+	ptr->matchmode = match_mode;
+	return ptr;
+}
+
+void ufa_repo_filterattr_free(struct ufa_repo_filterattr *filter)
+{
+	if (filter != NULL) {
+		ufa_free(filter->attribute);
+		ufa_free(filter->value);
+		ufa_free(filter);
+	}
+}
+
+void ufa_repo_attr_free(struct ufa_repo_attr *attr)
+{
+	if (attr) {
+		ufa_free(attr->attribute);
+		ufa_free(attr->value);
+		ufa_free(attr);
+	}
+}
+
+void ufa_repo_facet_free(struct ufa_repo_facet *facet)
+{
+	if (facet) {
+		ufa_free(facet->name);
+		ufa_free(facet->value);
+		ufa_free(facet);
+	}
+}
+
+void ufa_repo_explain_free(struct ufa_repo_explain *explain)
+{
+	if (explain) {
+		ufa_free(explain->repository);
+		ufa_free(explain->stage);
+		ufa_free(explain->sql);
+		ufa_list_free_full(explain->plan, ufa_free);
+		ufa_free(explain);
+	}
+}
+
+void ufa_repo_explain_begin()
+{
+	ufa_list_free(explain_stages);
+	explain_stages = NULL;
+	explain_enabled = true;
+}
+
+void ufa_repo_explain_add(const char *repository, const char *stage,
+			  uint64_t start, long rows)
+{
+	ufa_repo_explain_record(repository, stage, start, rows);
+}
+
+struct ufa_list *ufa_repo_explain_end()
+{
+	struct ufa_list *stages = ufa_list_reverse(explain_stages);
+	explain_stages = NULL;
+	explain_enabled = false;
+	return stages;
+}
+
+
+/* ========================================================================== */
+/* FUNCTIONS FROM repo_backend.h                                              */
+/* ========================================================================== */
+
+struct ufa_repo_explain *ufa_repo_explain_record(const char *repository,
+						 const char *stage,
+						 uint64_t start,
+						 long rows)
+{
+	if (!explain_enabled) {
+		return NULL;
+	}
+	struct ufa_repo_explain *explain = ufa_calloc(1, sizeof *explain);
+	explain->repository =
+	    (repository != NULL) ? ufa_str_dup(repository) : NULL;
+	explain->stage = ufa_str_dup(stage);
+	explain->rows = rows;
+	explain->ms = (ufa_stats_now() - start) / 1000.0;
+	explain_stages = ufa_list_prepend2(
+	    explain_stages, explain, (ufa_list_free_fn_t) ufa_repo_explain_free);
+	return explain;
+}
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+static const struct ufa_repo_backend *find_backend(const char *name,
+						   struct ufa_error **error)
+{
+	for (int i = 0; name != NULL && backends[i] != NULL; i++) {
+		if (ufa_str_equals(backends[i]->name, name)) {
+			return backends[i];
+		}
+	}
+	ufa_error_new(error, UFA_ERROR_ARGS, "unknown repository backend: %s",
+		      (name != NULL) ? name : "(null)");
+	return NULL;
+}
+
+static bool indicator_file_matches(const char *filepath,
+				   const char *repository)
+{
+	FILE *fp = fopen(filepath, "r");
+	if (fp == NULL) {
+		return false;
+	}
+	size_t len = strlen(repository);
+	char *buf = ufa_malloc(len + 2);
+	size_t nread = fread(buf, 1, len + 1, fp);
+	fclose(fp);
+	bool matches = (nread == len && memcmp(buf, repository, len) == 0);
+	ufa_free(buf);
+	return matches;
+}
+
+static void create_repo_indicator_file(const char *repo,
+				       struct ufa_error **error)
+{
+	ufa_return_iferror(error);
+
+	char *repository = ufa_util_abspath(repo);
+	char *filepath = ufa_util_joinpath(repository,
+					   UFA_REPO_INDICATOR_FILE_NAME,
+					   NULL);
+	char *tmppath = NULL;
+	if (indicator_file_matches(filepath, repository)) {
+		// rewriting it would only wake up inotify watchers
+		goto freeres;
+	}
+
+	// written to a unique temporary file and renamed, so that other
+	// threads (ufa_repo_getrepofolderfor) never read it half-written
+	tmppath = ufa_str_sprintf("%s.XXXXXX", filepath);
+
+	ufa_debug("Writting '%s' on file '%s' (rep ind)", repository, filepath);
+	int fd = mkstemp(tmppath);
+	if (fd < 0) {
+		ufa_error_new(error,
+			      UFA_ERROR_FILE,
+			      "error openning '%s': %s\n",
+			      tmppath,
+			      strerror(errno));
+		goto freeres;
+	}
+	FILE *fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		ufa_error_new(error,
+			      UFA_ERROR_FILE,
+			      "error openning '%s': %s\n",
+			      tmppath,
+			      strerror(errno));
+		close(fd);
+		unlink(tmppath);
+		goto freeres;
+	}
+	fprintf(fp, "%s", repository);
+	// mkstemp creates it 0600, keep it readable as fopen would
+	fchmod(fd, 0644);
+	if (fclose(fp) != 0) {
+		ufa_error_new(error,
+			      UFA_ERROR_FILE,
+			      "error writing '%s': %s\n",
+			      tmppath,
+			      strerror(errno));
+		unlink(tmppath);
+		goto freeres;
+	}
+	if (rename(tmppath, filepath) != 0) {
+		ufa_error_new(error,
+			      UFA_ERROR_FILE,
+			      "error renaming '%s': %s\n",
+			      tmppath,
+			      strerror(errno));
+		unlink(tmppath);
+	}
+freeres:
+	ufa_free(repository);
+	ufa_free(filepath);
+	ufa_free(tmppath);
+}
+
+/**
+ * Serializes the calls to the backend of repo. Repositories are shared by
+ * threads (see data.c), and state of a connection such as the changes and
+ * the id of the last insert must be read by the thread that made them.
+ */
+static void lock_repo(const ufa_repo_t *repo)
+{
+	pthread_mutex_lock((pthread_mutex_t *) &repo->lock);
+}
+
+static void unlock_repo(const ufa_repo_t *repo)
+{
+	pthread_mutex_unlock((pthread_mutex_t *) &repo->lock);
+}
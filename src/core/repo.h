@@ -13,35 +13,142 @@
 
 #include "core/errors.h"
 #include "util/error.h"
+#include "util/hashtable.h"
 #include "util/list.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 
 /* List of supported match modes */
 typedef struct ufa_repo ufa_repo_t;
 
+struct ufa_query;
+
+/*
+ * Modes other than EQUAL and WILDCARD compare values by their type (see
+ * ufa_repo_attrtype_of): numbers as numbers, timestamps as dates, and
+ * other values as text.
+ */
 enum ufa_repo_matchmode {
 	UFA_REPO_EQUAL = 0,       // =
 	UFA_REPO_WILDCARD,        // ~= (accept *)
+	UFA_REPO_LT,              // <
+	UFA_REPO_LE,              // <=
+	UFA_REPO_GT,              // >
+	UFA_REPO_GE,              // >=
+	UFA_REPO_BETWEEN,         // = with value "low..high" (inclusive)
+	UFA_REPO_FULLTEXT,        // ~~ has all the words (accept "word*")
 	UFA_REPO_MATCHMODE_TOTAL,
 };
 
+/* Types of attribute values, inferred from the value when it is set */
+enum ufa_repo_attrtype {
+	UFA_REPO_TEXT = 0,
+	UFA_REPO_INTEGER,         // e.g. 2020
+	UFA_REPO_REAL,            // e.g. 4.5
+	UFA_REPO_TIMESTAMP,       // e.g. 2020-05-01 or 2020-05-01T10:00:00Z
+};
+
 struct ufa_repo_filterattr {
 	char *attribute;
 	char *value;
 	enum ufa_repo_matchmode matchmode;
 };
 
+/* Order of search results (see struct ufa_repo_page) */
+enum ufa_repo_sort {
+	UFA_REPO_SORT_NONE = 0,   // any (UFA_REPO_FULLTEXT: by relevance)
+	UFA_REPO_SORT_NAME,       // name of the file
+	UFA_REPO_SORT_ID,         // order in which files were added
+	UFA_REPO_SORT_ATTR,       // value of an attribute (by type), then name
+	UFA_REPO_SORT_TOTAL,
+};
+
+/*
+ * A page of search results: at most 'limit' files in the order of 'sort',
+ * after the file whose key is 'after' (keyset pagination: a page starts
+ * where the previous one ended instead of skipping its files again). Files
+ * without the attribute of UFA_REPO_SORT_ATTR come last.
+ */
+struct ufa_repo_page {
+	enum ufa_repo_sort sort;
+	const char *sort_attr;    /* attribute of UFA_REPO_SORT_ATTR */
+	int limit;                /* max of files (0: no limit) */
+	const char *after;        /* key of the last file of the previous page
+				     (NULL: first page) */
+};
+
 struct ufa_repo_attr {
 	char *attribute;
 	char *value;
 };
 
+/* A tag or attribute value of the files found, and how many of them have it
+ * (see ufa_repo_facets) */
+struct ufa_repo_facet {
+	char *name;               /* tag or attribute */
+	char *value;              /* attribute value (NULL: tag) */
+	int count;                /* number of files */
+};
+
+/* Stage of a search, recorded while explaining (see ufa_repo_explain_begin) */
+struct ufa_repo_explain {
+	char *repository;         /* repository path (NULL: not of one) */
+	char *stage;              /* e.g. "open", "search" or "query" */
+	char *sql;                /* statement run (NULL: none) */
+	struct ufa_list *plan;    /* EXPLAIN QUERY PLAN of 'sql' (char *) */
+	long rows;                /* rows (or items) produced */
+	double ms;                /* wall time in milliseconds */
+};
+
 extern const enum ufa_repo_matchmode ufa_repo_matchmode_supported[];
 
 
+/**
+ * Opens the repository in a directory (creating it if needed) with the
+ * default storage backend (see ufa_repo_set_default_backend).
+ */
 ufa_repo_t *ufa_repo_init(const char *repository, struct ufa_error **error);
 
+/**
+ * Opens the repository in a directory with a storage backend (see
+ * ufa_repo_backends): "sqlite" keeps the tags and attributes in a SQLite
+ * database in the directory; "memory" keeps them in memory, shared by the
+ * repositories of the directory opened by the process, until the process
+ * exits (for tests and benchmarks).
+ *
+ * @param repository Directory of the repository
+ * @param backend Name of the backend, or NULL for the default one
+ * @param error Pointer to pointer to error structure (UFA_ERROR_ARGS for an
+ * unknown backend)
+ * @return Repository with one reference, or NULL on error
+ */
+ufa_repo_t *ufa_repo_init_backend(const char *repository,
+				  const char *backend,
+				  struct ufa_error **error);
+
+/**
+ * Sets the storage backend of the repositories opened by ufa_repo_init
+ * (initially "sqlite"). Repositories already open keep their backend.
+ *
+ * @return false (UFA_ERROR_ARGS) if there is no backend with that name
+ */
+bool ufa_repo_set_default_backend(const char *backend,
+				  struct ufa_error **error);
+
+/**
+ * Names of the storage backends.
+ *
+ * @return New list of strings (the strings must not be freed)
+ */
+struct ufa_list *ufa_repo_backends();
+
+/**
+ * Name of the storage backend of repo.
+ */
+const char *ufa_repo_backend_name(const ufa_repo_t *repo);
+
 char *ufa_repo_getrepopath(const ufa_repo_t *repo);
 
 
@@ -56,6 +163,20 @@ struct ufa_list *ufa_repo_gettags(const ufa_repo_t *repo,
                                   const char *filepath,
                                   struct ufa_error **error);
 
+/**
+ * Gets the tags of many files of the repository at once.
+ *
+ * @param repo
+ * @param filenames Names (not paths) of files in the repository, or NULL for
+ * all files
+ * @param error
+ * @return Hashtable mapping file name -> list of tags (files without tags
+ * are not included)
+ */
+ufa_hashtable_t *ufa_repo_gettags_many(const ufa_repo_t *repo,
+				       struct ufa_list *filenames,
+				       struct ufa_error **error);
+
 bool ufa_repo_settag(const ufa_repo_t *repo,
 		     const char *filepath,
 		     const char *tag,
@@ -80,6 +201,68 @@ struct ufa_list *ufa_repo_search(const ufa_repo_t *repo,
 				 struct ufa_list *tags,
 				 struct ufa_error **error);
 
+/**
+ * Same as ufa_repo_search, returning a page of the files found.
+ *
+ * @param page Sort, limit and position of the page (see struct
+ * ufa_repo_page), or NULL for all the files
+ * @param last_key If not NULL, where to store the key of the last file
+ * found, to get the next page (NULL if no file was found or the files are
+ * not sorted)
+ * @param error UFA_ERROR_ARGS for an invalid page
+ * @return List of names (not paths) of the files found
+ */
+struct ufa_list *ufa_repo_search_page(const ufa_repo_t *repo,
+				      struct ufa_list *filter_attr,
+				      struct ufa_list *tags,
+				      const struct ufa_repo_page *page,
+				      char **last_key,
+				      struct ufa_error **error);
+
+/**
+ * Searches files with a query (see query.h), executed as a single SQL
+ * statement.
+ *
+ * @param repo
+ * @param query Syntax tree of the query
+ * @param error
+ * @return List of names (not paths) of files matching the query (not
+ * ordered by relevance, as ufa_repo_search does for UFA_REPO_FULLTEXT)
+ */
+struct ufa_list *ufa_repo_query(const ufa_repo_t *repo,
+				const struct ufa_query *query,
+				struct ufa_error **error);
+
+/**
+ * Same as ufa_repo_query, returning a page of the files found (see
+ * ufa_repo_search_page).
+ */
+struct ufa_list *ufa_repo_query_page(const ufa_repo_t *repo,
+				     const struct ufa_query *query,
+				     const struct ufa_repo_page *page,
+				     char **last_key,
+				     struct ufa_error **error);
+
+/**
+ * Counts the tags and attribute values of the files found by a search
+ * (facets, to narrow the search down), with a single statement that joins
+ * the files found with their tags and attributes.
+ *
+ * @param repo
+ * @param filter_attr Filter of attributes, as in ufa_repo_search
+ * @param tags Tags of the files, as in ufa_repo_search (they are not
+ * counted). Without filter_attr and tags, every file is counted
+ * @param attrs Whether to also count the attribute values
+ * @param error
+ * @return List of struct ufa_repo_facet: tags by name, then attribute values
+ * by attribute and value
+ */
+struct ufa_list *ufa_repo_facets(const ufa_repo_t *repo,
+				 struct ufa_list *filter_attr,
+				 struct ufa_list *tags,
+				 bool attrs,
+				 struct ufa_error **error);
+
 bool ufa_repo_setattr(const ufa_repo_t *repo,
 		      const char *filepath,
 		      const char *attribute,
@@ -103,6 +286,20 @@ struct ufa_list *ufa_repo_getattr(const ufa_repo_t *repo,
 				  const char *filepath,
 				  struct ufa_error **error);
 
+/**
+ * Gets the attributes of many files of the repository at once.
+ *
+ * @param repo
+ * @param filenames Names (not paths) of files in the repository, or NULL for
+ * all files
+ * @param error
+ * @return Hashtable mapping file name -> list of struct ufa_repo_attr (files
+ * without attributes are not included)
+ */
+ufa_hashtable_t *ufa_repo_getattr_many(const ufa_repo_t *repo,
+				       struct ufa_list *filenames,
+				       struct ufa_error **error);
+
 /**
  * Checks whether a path is a tag.
  * E.g.: /tag1/tag2/tag3 or /tag1/tag2/file.
@@ -130,8 +327,91 @@ void ufa_repo_filterattr_free(struct ufa_repo_filterattr *filter);
 
 void ufa_repo_attr_free(struct ufa_repo_attr *attr);
 
+void ufa_repo_facet_free(struct ufa_repo_facet *facet);
+
+void ufa_repo_explain_free(struct ufa_repo_explain *explain);
+
+/**
+ * Infers the type of an attribute value.
+ */
+enum ufa_repo_attrtype ufa_repo_attrtype_of(const char *value);
+
+/**
+ * Checks whether a value is a range for UFA_REPO_BETWEEN: "low..high", with
+ * both limits numbers or both timestamps.
+ */
+bool ufa_repo_isrange(const char *value);
+
 char *ufa_repo_getrepofolderfor(const char *filepath, struct ufa_error **error);
 
+/**
+ * Begins a transaction. Changes made by the calling thread through repo are
+ * applied when it calls ufa_repo_commit; until then, other threads using
+ * repo wait. Transactions cannot be nested (UFA_ERROR_ARGS).
+ */
+bool ufa_repo_begin(ufa_repo_t *repo, struct ufa_error **error);
+
+/**
+ * Commits the transaction begun by the calling thread with ufa_repo_begin.
+ * The transaction ends even on error, with its changes rolled back.
+ */
+bool ufa_repo_commit(ufa_repo_t *repo, struct ufa_error **error);
+
+/**
+ * Creates or drops the trigram index of attribute values, which speeds up
+ * UFA_REPO_WILDCARD patterns that are not prefixes (e.g. "*report*"). The
+ * index is optional: it takes about three times the size of the values and
+ * needs SQLite with FTS5 (3.34 or later).
+ *
+ * @param enabled Create (true) or drop (false) the index
+ * @param error Pointer to pointer to error structure
+ * @return true if the index was created or dropped
+ */
+bool ufa_repo_set_trigram_index(ufa_repo_t *repo, bool enabled,
+				struct ufa_error **error);
+
+/**
+ * Checks whether the repository has the trigram index (see
+ * ufa_repo_set_trigram_index).
+ */
+bool ufa_repo_has_trigram_index(const ufa_repo_t *repo);
+
+/**
+ * Creates or drops the full-text index of attribute values, used by
+ * UFA_REPO_FULLTEXT. With the index, words match whole tokens (or their
+ * prefix, for "word*") regardless of case and diacritics, and
+ * ufa_repo_search returns the files in order of relevance (bm25). Without
+ * it, each word is a case-insensitive substring of the value and every
+ * value of the attribute is read. Needs SQLite with FTS5.
+ *
+ * @param enabled Create (true) or drop (false) the index
+ * @param error Pointer to pointer to error structure
+ * @return true if the index was created or dropped
+ */
+bool ufa_repo_set_fulltext_index(ufa_repo_t *repo, bool enabled,
+				 struct ufa_error **error);
+
+/**
+ * Checks whether the repository has the full-text index (see
+ * ufa_repo_set_fulltext_index).
+ */
+bool ufa_repo_has_fulltext_index(const ufa_repo_t *repo);
+
+/**
+ * Adds a reference to repo. A repository is created with one reference.
+ *
+ * @return repo
+ */
+ufa_repo_t *ufa_repo_ref(ufa_repo_t *repo);
+
+/**
+ * Number of references to repo.
+ */
+int ufa_repo_refcount(const ufa_repo_t *repo);
+
+/**
+ * Drops a reference to repo, closing it when there are no references left.
+ */
 void ufa_repo_free(ufa_repo_t *repo);
 
 
@@ -141,10 +421,91 @@ bool ufa_repo_removefile(const ufa_repo_t *repo,
 			 const char *filepath,
 			 struct ufa_error **error);
 
+/**
+ * Records the current size and modification time of a file after it was
+ * modified, so that ufa_repo_sync still recognizes it if it is renamed.
+ *
+ * @param repo Repository
+ * @param filepath File
+ * @param error Pointer to pointer to error structure
+ * @return true if the file is in repo and was updated (a file not in repo
+ * is not an error)
+ */
+bool ufa_repo_updatefile(const ufa_repo_t *repo,
+			 const char *filepath,
+			 struct ufa_error **error);
+
+/**
+ * Synchronizes repo with the contents of the repository directory (e.g.
+ * after changes that were not monitored): files renamed are found by their
+ * device and inode (with the same size and modification time, as inodes are
+ * reused: see ufa_repo_updatefile) and keep their tags and attributes; files
+ * that no longer exist are removed.
+ *
+ * Other threads using repo wait until the sync ends, and each file is checked
+ * again in the directory before its rename or removal, so files renamed or
+ * created meanwhile keep their tags.
+ *
+ * @param repo Repository
+ * @param renamed Where to store the number of files renamed (or NULL)
+ * @param removed Where to store the number of files removed (or NULL)
+ * @param error Pointer to pointer to error structure
+ * @return true if repository was synchronized
+ */
+bool ufa_repo_sync(const ufa_repo_t *repo,
+		   int *renamed,
+		   int *removed,
+		   struct ufa_error **error);
+
 bool ufa_repo_renamefile(const ufa_repo_t *repo_old,
                          const ufa_repo_t *repo_new,
 			 const char *oldfilepath,
 			 const char *newfilepath,
 			 struct ufa_error **error);
 
+/**
+ * Enables profiling of SQL statements executed on repositories opened after
+ * this call. Statements slower than threshold_ms are written to slowlog with
+ * the repository path, duration, rows returned and expanded SQL.
+ *
+ * @param threshold_ms Minimum duration (milliseconds) to log a statement
+ * @param slowlog File to write slow statements (not closed by repo module)
+ * @param explain Whether to also write EXPLAIN QUERY PLAN of slow statements
+ */
+void ufa_repo_profile_enable(unsigned long threshold_ms,
+			     FILE *slowlog,
+			     bool explain);
+
+/**
+ * Disables profiling of SQL statements.
+ */
+void ufa_repo_profile_disable();
+
+/**
+ * Starts recording the stages of the searches run by the calling thread
+ * (ufa_repo_search_page, ufa_repo_query_page and ufa_repo_facets, and the
+ * ones added with ufa_repo_explain_add) until ufa_repo_explain_end. Each
+ * statement is recorded with its SQL, plan, rows and wall time.
+ */
+void ufa_repo_explain_begin();
+
+/**
+ * Records a stage other than a statement (e.g. opening a repository) if the
+ * calling thread is recording (see ufa_repo_explain_begin).
+ *
+ * @param repository Repository path, or NULL
+ * @param stage Name of the stage
+ * @param start When the stage started (see ufa_stats_now)
+ * @param rows Items produced by the stage
+ */
+void ufa_repo_explain_add(const char *repository, const char *stage,
+			  uint64_t start, long rows);
+
+/**
+ * Stops recording the stages of searches (see ufa_repo_explain_begin).
+ *
+ * @return List of struct ufa_repo_explain, in the order they were run
+ */
+struct ufa_list *ufa_repo_explain_end();
+
 #endif /* UFA_REPO_H_ */
\ No newline at end of file
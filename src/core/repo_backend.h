@@ -0,0 +1,139 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Definitions for storage backends of the repo module (private to repo*.c)   */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#ifndef UFA_REPO_BACKEND_H_
+#define UFA_REPO_BACKEND_H_
+
+#include "core/repo.h"
+#include <pthread.h>
+
+#define UFA_REPO_INDICATOR_FILE_NAME ".ufarepo"
+
+/*
+ * Operations of a storage backend, called by the functions of repo.h with
+ * the same name (see repo.c). The functions of repo.h check the arguments
+ * common to every backend, record the metrics "repo.<op>" and handle the
+ * references to a repository, so a backend only stores and searches.
+ *
+ * Calls on a repository are serialized (see struct ufa_repo), so an
+ * operation sees no change made by other threads while it runs.
+ */
+struct ufa_repo_backend {
+	const char *name;
+
+	/* Opens the repository in 'repository' (absolute path of a dir),
+	 * returning a new struct that begins with struct ufa_repo */
+	ufa_repo_t *(*open)(const char *repository, struct ufa_error **error);
+
+	/* Closes a repository opened by 'open' and frees it */
+	void (*close)(ufa_repo_t *repo);
+
+	struct ufa_list *(*listtags)(const ufa_repo_t *repo,
+				     struct ufa_error **error);
+	struct ufa_list *(*listfiles)(const ufa_repo_t *repo,
+				      const char *dirpath,
+				      struct ufa_error **error);
+	struct ufa_list *(*gettags)(const ufa_repo_t *repo,
+				    const char *filepath,
+				    struct ufa_error **error);
+	ufa_hashtable_t *(*gettags_many)(const ufa_repo_t *repo,
+					 struct ufa_list *filenames,
+					 struct ufa_error **error);
+	bool (*settag)(const ufa_repo_t *repo, const char *filepath,
+		       const char *tag, struct ufa_error **error);
+	bool (*cleartags)(const ufa_repo_t *repo, const char *filepath,
+			  struct ufa_error **error);
+	bool (*unsettag)(const ufa_repo_t *repo, const char *filepath,
+			 const char *tag, struct ufa_error **error);
+	int (*inserttag)(const ufa_repo_t *repo, const char *tag,
+			 struct ufa_error **error);
+	bool (*isatag)(const ufa_repo_t *repo, const char *path,
+		       struct ufa_error **error);
+
+	struct ufa_list *(*search_page)(const ufa_repo_t *repo,
+					struct ufa_list *filter_attr,
+					struct ufa_list *tags,
+					const struct ufa_repo_page *page,
+					char **last_key,
+					struct ufa_error **error);
+	struct ufa_list *(*query_page)(const ufa_repo_t *repo,
+				       const struct ufa_query *query,
+				       const struct ufa_repo_page *page,
+				       char **last_key,
+				       struct ufa_error **error);
+	struct ufa_list *(*facets)(const ufa_repo_t *repo,
+				   struct ufa_list *filter_attr,
+				   struct ufa_list *tags,
+				   bool attrs,
+				   struct ufa_error **error);
+
+	bool (*setattr)(const ufa_repo_t *repo, const char *filepath,
+			const char *attribute, const char *value,
+			struct ufa_error **error);
+	bool (*unsetattr)(const ufa_repo_t *repo, const char *filepath,
+			  const char *attribute, struct ufa_error **error);
+	struct ufa_list *(*getattr)(const ufa_repo_t *repo,
+				    const char *filepath,
+				    struct ufa_error **error);
+	ufa_hashtable_t *(*getattr_many)(const ufa_repo_t *repo,
+					 struct ufa_list *filenames,
+					 struct ufa_error **error);
+
+	bool (*begin)(ufa_repo_t *repo, struct ufa_error **error);
+	/* Ends the transaction, rolling it back if it cannot be committed */
+	bool (*commit)(ufa_repo_t *repo, struct ufa_error **error);
+	bool (*set_trigram_index)(ufa_repo_t *repo, bool enabled,
+				  struct ufa_error **error);
+	bool (*has_trigram_index)(const ufa_repo_t *repo);
+	bool (*set_fulltext_index)(ufa_repo_t *repo, bool enabled,
+				   struct ufa_error **error);
+	bool (*has_fulltext_index)(const ufa_repo_t *repo);
+
+	bool (*removefile)(const ufa_repo_t *repo, const char *filepath,
+			   struct ufa_error **error);
+	bool (*updatefile)(const ufa_repo_t *repo, const char *filepath,
+			   struct ufa_error **error);
+	bool (*sync)(const ufa_repo_t *repo, int *renamed, int *removed,
+		     struct ufa_error **error);
+
+	/* Called on the backend of repo_new; repo_old may be of another
+	 * backend (use the functions of repo.h to read it) */
+	bool (*renamefile)(const ufa_repo_t *repo_old,
+			   const ufa_repo_t *repo_new,
+			   const char *oldfilepath,
+			   const char *newfilepath,
+			   struct ufa_error **error);
+};
+
+/* Part of a repository common to every backend (the first member of the
+ * struct of a backend) */
+struct ufa_repo {
+	const struct ufa_repo_backend *backend;
+	char *repository_path; /* absolute path of the repository */
+	int refs;              /* references (see ufa_repo_ref) */
+	pthread_mutex_t lock;  /* held by each call to the backend (recursive,
+				  as operations call other operations), and
+				  from ufa_repo_begin to ufa_repo_commit */
+	bool in_transaction;   /* between ufa_repo_begin and ufa_repo_commit */
+};
+
+extern const struct ufa_repo_backend ufa_repo_sqlite_backend;
+extern const struct ufa_repo_backend ufa_repo_memory_backend;
+
+/**
+ * Same as ufa_repo_explain_add, returning the stage recorded (to add its
+ * statement), or NULL if the calling thread is not recording.
+ */
+struct ufa_repo_explain *ufa_repo_explain_record(const char *repository,
+						 const char *stage,
+						 uint64_t start,
+						 long rows);
+
+#endif /* UFA_REPO_BACKEND_H_ */
@@ -0,0 +1,1310 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Implementation of repo module (repo.h) in memory, for tests and            */
+/* benchmarks (see repo_backend.h).                                           */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "core/repo.h"
+#include "core/repo_backend.h"
+#include "core/query.h"
+#include "util/error.h"
+#include "util/hashtable.h"
+#include "util/list.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/stats.h"
+#include "util/string.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+/** Characters separating the words of UFA_REPO_FULLTEXT */
+#define FULLTEXT_SPACES " \t\n\r"
+
+/* File of a repository */
+struct memory_file {
+	int id;                 /* order in which files were added */
+	char *name;
+	struct ufa_list *tags;  /* char * */
+	struct ufa_list *attrs; /* struct ufa_repo_attr */
+};
+
+/*
+ * Tags and attributes of the files of a repository directory. The
+ * repositories of a directory opened by the process share its store, so
+ * that nothing is lost when a repository is closed (e.g. by the registry of
+ * data.c) and opened again; stores are kept until the process exits.
+ */
+struct memory_store {
+	pthread_mutex_t mutex;
+	ufa_hashtable_t *files; /* name -> struct memory_file */
+	ufa_hashtable_t *tags;  /* name -> id (int *) */
+	int last_file_id;
+	int last_tag_id;
+};
+
+/* Repository of the memory backend (base is the part common to every
+ * backend, see repo_backend.h) */
+struct memory_repo {
+	struct ufa_repo base;
+	struct memory_store *store;
+};
+
+typedef struct memory_repo memory_repo_t;
+
+/** Stores by repository path */
+static ufa_hashtable_t *stores      = NULL;
+static pthread_mutex_t stores_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Files found by a search (see find_files) */
+struct found_files {
+	struct memory_file **files;
+	size_t count;
+};
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS - DECLARATION                                          */
+/* ========================================================================== */
+
+static struct memory_store *get_store(const char *repository);
+static void free_file(struct memory_file *file);
+static struct memory_file *get_file(const memory_repo_t *repo,
+				    const char *filepath,
+				    struct ufa_error **error);
+static int insert_tag(struct memory_store *store, const char *tag);
+static struct ufa_list *find_node(struct ufa_list *list, const char *str);
+static struct ufa_repo_attr *find_attr(const struct memory_file *file,
+				       const char *attribute);
+static struct ufa_list *sorted_strings(struct ufa_list *strings);
+static struct ufa_list *sorted_attrs(struct ufa_list *attrs);
+static int compare_str(const void *a, const void *b);
+static int compare_attr(const void *a, const void *b);
+
+typedef bool (*match_fn_t)(const struct memory_file *file, const void *data);
+
+static struct found_files find_files(struct memory_store *store,
+				     match_fn_t match, const void *data);
+static bool match_search(const struct memory_file *file, const void *data);
+static bool match_query(const struct memory_file *file, const void *data);
+static bool has_tags(const struct memory_file *file, struct ufa_list *tags);
+static bool match_filter(const struct memory_file *file,
+			 const char *attribute, const char *value,
+			 enum ufa_repo_matchmode matchmode);
+static bool match_value(const char *value, const char *pattern,
+			enum ufa_repo_matchmode matchmode);
+static bool match_wildcard(const char *pattern, const char *value);
+static bool match_fulltext(const char *words, const char *value);
+static enum ufa_repo_attrtype range_type(const char *value, char **low,
+					 char **high);
+static bool compare_typed(const char *value, const char *other,
+			  enum ufa_repo_attrtype type, int *cmp);
+
+static bool check_page(const struct ufa_repo_page *page, long *after_id,
+		       struct ufa_error **error);
+static struct ufa_list *read_page(struct found_files *found,
+				  const struct ufa_repo_page *page,
+				  long after_id, char **last_key);
+static int compare_file_id(const void *a, const void *b);
+static int compare_file_name(const void *a, const void *b);
+
+static int facet_hash(const struct ufa_repo_facet *facet);
+static bool facet_equals(const struct ufa_repo_facet *a,
+			 const struct ufa_repo_facet *b);
+static void count_facet(ufa_hashtable_t *counts, const char *name,
+			const char *value);
+static int compare_facet(const void *a, const void *b);
+
+/* ========================================================================== */
+/* FUNCTIONS OF THE BACKEND (repo_backend.h)                                  */
+/* ========================================================================== */
+
+static ufa_repo_t *memory_open(const char *repository, struct ufa_error **error)
+{
+	memory_repo_t *repo = ufa_calloc(1, sizeof *repo);
+	repo->store = get_store(repository);
+	return (ufa_repo_t *) repo;
+}
+
+static void memory_close(ufa_repo_t *base)
+{
+	ufa_free(base);
+}
+
+static struct ufa_list *memory_listtags(const ufa_repo_t *base,
+					struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct ufa_list *names = ufa_hashtable_keys(repo->store->tags);
+	struct ufa_list *tags = sorted_strings(names);
+	pthread_mutex_unlock(&repo->store->mutex);
+
+	ufa_list_free(names);
+	return tags;
+}
+
+static struct ufa_list *memory_listfiles(const ufa_repo_t *base,
+					 const char *dirpath,
+					 struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	struct ufa_list *list = NULL;
+
+	if (ufa_str_equals(dirpath, "/")) {
+		list = ufa_repo_listtags(base, error);
+	} else {
+		struct ufa_list *tags = ufa_str_split(dirpath, "/");
+
+		pthread_mutex_lock(&repo->store->mutex);
+		struct found_files found = find_files(repo->store, match_search,
+						      &(struct ufa_list *[]){
+							  NULL, tags});
+		qsort(found.files, found.count, sizeof *found.files,
+		      compare_file_id);
+		for (size_t i = 0; i < found.count; i++) {
+			list = ufa_list_append2(
+			    list, ufa_str_dup(found.files[i]->name), ufa_free);
+		}
+		pthread_mutex_unlock(&repo->store->mutex);
+		ufa_free(found.files);
+
+		// the other tags of the files are the subdirectories
+		struct ufa_list *facets =
+		    ufa_repo_facets(base, NULL, tags, false, error);
+		for (UFA_LIST_EACH(i, facets)) {
+			struct ufa_repo_facet *facet = i->data;
+			list = ufa_list_append2(list, ufa_str_dup(facet->name),
+						ufa_free);
+		}
+		ufa_list_free(facets);
+		ufa_list_free(tags);
+	}
+
+	list = ufa_list_append2(list, ufa_str_dup(UFA_REPO_INDICATOR_FILE_NAME),
+				ufa_free);
+	return list;
+}
+
+static struct ufa_list *memory_gettags(const ufa_repo_t *base,
+				       const char *filepath,
+				       struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	struct ufa_list *tags = NULL;
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct memory_file *file = get_file(repo, filepath, error);
+	if (file != NULL) {
+		tags = sorted_strings(file->tags);
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+	return tags;
+}
+
+static ufa_hashtable_t *memory_gettags_many(const ufa_repo_t *base,
+					    struct ufa_list *filenames,
+					    struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	ufa_hashtable_t *result = UFA_HASHTABLE_STRING();
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct ufa_list *files = (filenames == NULL)
+				     ? ufa_hashtable_values(repo->store->files)
+				     : NULL;
+	for (UFA_LIST_EACH(i, (filenames == NULL) ? files : filenames)) {
+		struct memory_file *file =
+		    (filenames == NULL)
+			? i->data
+			: ufa_hashtable_get(repo->store->files, i->data);
+		if (file != NULL && file->tags != NULL) {
+			ufa_hashtable_put_full(
+			    result, ufa_str_dup(file->name),
+			    sorted_strings(file->tags), ufa_free,
+			    (ufa_hash_free_fn_t) ufa_list_free);
+		}
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+
+	ufa_list_free(files);
+	return result;
+}
+
+/**
+ * Negative values on error
+ */
+static int memory_inserttag(const ufa_repo_t *base,
+			    const char *tag,
+			    struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+
+	pthread_mutex_lock(&repo->store->mutex);
+	int tag_id = insert_tag(repo->store, tag);
+	pthread_mutex_unlock(&repo->store->mutex);
+	return tag_id;
+}
+
+static bool memory_settag(const ufa_repo_t *base,
+			  const char *filepath,
+			  const char *tag,
+			  struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	bool status = false;
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct memory_file *file = get_file(repo, filepath, error);
+	if (file != NULL) {
+		insert_tag(repo->store, tag);
+		if (find_node(file->tags, tag) == NULL) {
+			file->tags = ufa_list_append2(
+			    file->tags, ufa_str_dup(tag), ufa_free);
+		}
+		status = true;
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+	return status;
+}
+
+static bool memory_cleartags(const ufa_repo_t *base,
+			     const char *filepath,
+			     struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	bool status = false;
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct memory_file *file = get_file(repo, filepath, error);
+	if (file != NULL) {
+		ufa_list_free(file->tags);
+		file->tags = NULL;
+		status = true;
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+	return status;
+}
+
+static bool memory_unsettag(const ufa_repo_t *base,
+			    const char *filepath,
+			    const char *tag,
+			    struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	bool status = false;
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct memory_file *file = get_file(repo, filepath, error);
+	if (file != NULL) {
+		struct ufa_list *node = find_node(file->tags, tag);
+		file->tags = ufa_list_unlink_node(file->tags, node);
+		ufa_list_free(node);
+		status = true;
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+	return status;
+}
+
+static bool memory_isatag(const ufa_repo_t *base,
+			  const char *path,
+			  struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+
+	char *filepath = ufa_repo_get_realfilepath(base, path, NULL);
+	char *last_part = ufa_util_getfilename(path);
+
+	pthread_mutex_lock(&repo->store->mutex);
+	bool ret = (filepath == NULL
+		    && ufa_hashtable_has_key(repo->store->tags, last_part));
+	pthread_mutex_unlock(&repo->store->mutex);
+
+	ufa_free(filepath);
+	ufa_free(last_part);
+	return ret;
+}
+
+static struct ufa_list *memory_search_page(const ufa_repo_t *base,
+					   struct ufa_list *filter_attr,
+					   struct ufa_list *tags,
+					   const struct ufa_repo_page *page,
+					   char **last_key,
+					   struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	uint64_t start = ufa_stats_now();
+	long after_id = 0;
+
+	const struct ufa_repo_page all = {.sort = UFA_REPO_SORT_NONE};
+	page = (page != NULL) ? page : &all;
+	if (!check_page(page, &after_id, error)) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct found_files found =
+	    find_files(repo->store, match_search,
+		       &(struct ufa_list *[]){filter_attr, tags});
+	struct ufa_list *result = read_page(&found, page, after_id, last_key);
+	pthread_mutex_unlock(&repo->store->mutex);
+
+	ufa_free(found.files);
+	ufa_repo_explain_add(repo->base.repository_path, "search", start,
+			     ufa_list_size(result));
+	return result;
+}
+
+static struct ufa_list *memory_query_page(const ufa_repo_t *base,
+					  const struct ufa_query *query,
+					  const struct ufa_repo_page *page,
+					  char **last_key,
+					  struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	uint64_t start = ufa_stats_now();
+	long after_id = 0;
+
+	const struct ufa_repo_page all = {.sort = UFA_REPO_SORT_NONE};
+	page = (page != NULL) ? page : &all;
+	if (!check_page(page, &after_id, error)) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct found_files found = find_files(repo->store, match_query, query);
+	struct ufa_list *result = read_page(&found, page, after_id, last_key);
+	pthread_mutex_unlock(&repo->store->mutex);
+
+	ufa_free(found.files);
+	ufa_repo_explain_add(repo->base.repository_path, "query", start,
+			     ufa_list_size(result));
+	return result;
+}
+
+static struct ufa_list *memory_facets(const ufa_repo_t *base,
+				      struct ufa_list *filter_attr,
+				      struct ufa_list *tags,
+				      bool attrs,
+				      struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	uint64_t start = ufa_stats_now();
+
+	// struct ufa_repo_facet -> itself (the facets go to the result)
+	ufa_hashtable_t *counts =
+	    ufa_hashtable_new((ufa_hash_fn_t) facet_hash,
+			      (ufa_hash_equal_fn_t) facet_equals, NULL, NULL);
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct found_files found =
+	    find_files(repo->store, match_search,
+		       &(struct ufa_list *[]){filter_attr, tags});
+	for (size_t f = 0; f < found.count; f++) {
+		for (UFA_LIST_EACH(i, found.files[f]->tags)) {
+			if (find_node(tags, i->data) == NULL) {
+				count_facet(counts, i->data, NULL);
+			}
+		}
+		for (UFA_LIST_EACH(i, attrs ? found.files[f]->attrs : NULL)) {
+			struct ufa_repo_attr *attr = i->data;
+			count_facet(counts, attr->attribute, attr->value);
+		}
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+	ufa_free(found.files);
+
+	struct ufa_list *values = ufa_hashtable_values(counts);
+	size_t n = ufa_list_size(values);
+	struct ufa_repo_facet **sorted = ufa_malloc((n + 1) * sizeof *sorted);
+	size_t k = 0;
+	for (UFA_LIST_EACH(i, values)) {
+		sorted[k++] = i->data;
+	}
+	ufa_list_free(values);
+	ufa_hashtable_free(counts);
+
+	qsort(sorted, n, sizeof *sorted, compare_facet);
+	struct ufa_list *result = NULL;
+	for (size_t i = n; i > 0; i--) {
+		result = ufa_list_prepend2(
+		    result, sorted[i - 1],
+		    (ufa_list_free_fn_t) ufa_repo_facet_free);
+	}
+	ufa_free(sorted);
+
+	ufa_repo_explain_add(repo->base.repository_path, "facets", start,
+			     ufa_list_size(result));
+	return result;
+}
+
+static bool memory_setattr(const ufa_repo_t *base,
+			   const char *filepath,
+			   const char *attribute,
+			   const char *value,
+			   struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	bool status = false;
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct memory_file *file = get_file(repo, filepath, error);
+	if (file != NULL) {
+		struct ufa_repo_attr *attr = find_attr(file, attribute);
+		if (attr == NULL) {
+			attr = ufa_calloc(1, sizeof *attr);
+			attr->attribute = ufa_str_dup(attribute);
+			file->attrs = ufa_list_append2(
+			    file->attrs, attr,
+			    (ufa_list_free_fn_t) ufa_repo_attr_free);
+		}
+		ufa_free(attr->value);
+		attr->value = ufa_str_dup(value);
+		status = true;
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+	return status;
+}
+
+static bool memory_unsetattr(const ufa_repo_t *base,
+			     const char *filepath,
+			     const char *attribute,
+			     struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	bool status = false;
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct memory_file *file = get_file(repo, filepath, error);
+	if (file != NULL) {
+		for (UFA_LIST_EACH(i, file->attrs)) {
+			struct ufa_repo_attr *attr = i->data;
+			if (ufa_str_equals(attr->attribute, attribute)) {
+				file->attrs =
+				    ufa_list_unlink_node(file->attrs, i);
+				ufa_list_free(i);
+				break;
+			}
+		}
+		status = true;
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+	return status;
+}
+
+static struct ufa_list *memory_getattr(const ufa_repo_t *base,
+				       const char *filepath,
+				       struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	struct ufa_list *attrs = NULL;
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct memory_file *file = get_file(repo, filepath, error);
+	if (file != NULL) {
+		attrs = sorted_attrs(file->attrs);
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+	return attrs;
+}
+
+static ufa_hashtable_t *memory_getattr_many(const ufa_repo_t *base,
+					    struct ufa_list *filenames,
+					    struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	ufa_hashtable_t *result = UFA_HASHTABLE_STRING();
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct ufa_list *files = (filenames == NULL)
+				     ? ufa_hashtable_values(repo->store->files)
+				     : NULL;
+	for (UFA_LIST_EACH(i, (filenames == NULL) ? files : filenames)) {
+		struct memory_file *file =
+		    (filenames == NULL)
+			? i->data
+			: ufa_hashtable_get(repo->store->files, i->data);
+		if (file != NULL && file->attrs != NULL) {
+			ufa_hashtable_put_full(
+			    result, ufa_str_dup(file->name),
+			    sorted_attrs(file->attrs), ufa_free,
+			    (ufa_hash_free_fn_t) ufa_list_free);
+		}
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+
+	ufa_list_free(files);
+	return result;
+}
+
+/* Changes are applied as they are made, so there is nothing to begin or to
+ * commit */
+static bool memory_begin(ufa_repo_t *base, struct ufa_error **error)
+{
+	return true;
+}
+
+static bool memory_commit(ufa_repo_t *base, struct ufa_error **error)
+{
+	return true;
+}
+
+/* Searches read every value, so there are no indexes */
+static bool memory_set_index(ufa_repo_t *base, bool enabled,
+			     struct ufa_error **error)
+{
+	ufa_error_new(error, UFA_ERROR_ARGS,
+		      "the memory backend has no optional indexes");
+	return false;
+}
+
+static bool memory_has_index(const ufa_repo_t *base)
+{
+	return false;
+}
+
+static bool memory_removefile(const ufa_repo_t *base,
+			      const char *filepath,
+			      struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	bool status = false;
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct memory_file *file = get_file(repo, filepath, error);
+	if (file != NULL) {
+		status = ufa_hashtable_remove(repo->store->files, file->name);
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+	return status;
+}
+
+/* Size and modification time of files are not kept */
+static bool memory_updatefile(const ufa_repo_t *base,
+			      const char *filepath,
+			      struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	char *filename = ufa_util_getfilename(filepath);
+
+	pthread_mutex_lock(&repo->store->mutex);
+	bool status = ufa_hashtable_has_key(repo->store->files, filename);
+	pthread_mutex_unlock(&repo->store->mutex);
+	ufa_free(filename);
+	return status;
+}
+
+/* Files are not identified by their inode, so files renamed are removed */
+static bool memory_sync(const ufa_repo_t *base,
+			int *renamed,
+			int *removed,
+			struct ufa_error **error)
+{
+	const memory_repo_t *repo = (const memory_repo_t *) base;
+	int count_removed = 0;
+
+	pthread_mutex_lock(&repo->store->mutex);
+	struct ufa_list *names = ufa_hashtable_keys(repo->store->files);
+	for (UFA_LIST_EACH(i, names)) {
+		char *filepath = ufa_util_joinpath(repo->base.repository_path,
+						   i->data, NULL);
+		if (!ufa_util_isfile(filepath)) {
+			ufa_debug("File '%s' no longer exists", filepath);
+			ufa_hashtable_remove(repo->store->files, i->data);
+			count_removed++;
+		}
+		ufa_free(filepath);
+	}
+	pthread_mutex_unlock(&repo->store->mutex);
+	ufa_list_free(names);
+
+	if (removed != NULL) {
+		*removed = count_removed;
+	}
+	return true;
+}
+
+static bool memory_renamefile(const ufa_repo_t *repo_old,
+			      const ufa_repo_t *base_new,
+			      const char *oldfilepath,
+			      const char *newfilepath,
+			      struct ufa_error **error)
+{
+	const memory_repo_t *repo_new = (const memory_repo_t *) base_new;
+	struct memory_store *store = repo_new->store;
+	bool status = false;
+	char *new_filename = ufa_util_getfilename(newfilepath);
+
+	pthread_mutex_lock(&store->mutex);
+	struct memory_file *file = get_file(repo_new, oldfilepath, error);
+	if (file != NULL && ufa_hashtable_has_key(store->files, new_filename)) {
+		ufa_error_new(error, UFA_ERROR_FILE, "file '%s' already exists",
+			      new_filename);
+	} else if (file != NULL) {
+		char *old_filename = ufa_str_dup(file->name);
+		file = ufa_hashtable_steal(store->files, old_filename);
+		ufa_free(old_filename);
+		ufa_free(file->name);
+		file->name = ufa_str_dup(new_filename);
+		ufa_hashtable_put(store->files, ufa_str_dup(new_filename),
+				  file);
+		status = true;
+	}
+	pthread_mutex_unlock(&store->mutex);
+	ufa_free(new_filename);
+
+	// Copy tags, attributes, and remove file from old repo
+	// if repo_old != repo_new
+	char *dirfileold = ufa_util_dirname(oldfilepath);
+	char *dirfilenew = ufa_util_dirname(newfilepath);
+	if (status && !ufa_str_equals(dirfilenew, dirfileold)) {
+		struct ufa_error *error2 = NULL;
+		struct ufa_list *tags =
+		    ufa_repo_gettags(repo_old, oldfilepath, &error2);
+		for (UFA_LIST_EACH(i, tags)) {
+			ufa_repo_settag(base_new, newfilepath, i->data,
+					&error2);
+		}
+		struct ufa_list *attrs =
+		    ufa_repo_getattr(repo_old, oldfilepath, &error2);
+		for (UFA_LIST_EACH(i, attrs)) {
+			struct ufa_repo_attr *attr = i->data;
+			ufa_repo_setattr(base_new, newfilepath, attr->attribute,
+					 attr->value, &error2);
+		}
+		ufa_repo_removefile(repo_old, oldfilepath, &error2);
+		ufa_error_print_and_free(error2);
+		ufa_list_free(tags);
+		ufa_list_free(attrs);
+	}
+	ufa_free(dirfileold);
+	ufa_free(dirfilenew);
+	return status;
+}
+
+const struct ufa_repo_backend ufa_repo_memory_backend = {
+	.name               = "memory",
+	.open               = memory_open,
+	.close              = memory_close,
+	.listtags           = memory_listtags,
+	.listfiles          = memory_listfiles,
+	.gettags            = memory_gettags,
+	.gettags_many       = memory_gettags_many,
+	.settag             = memory_settag,
+	.cleartags          = memory_cleartags,
+	.unsettag           = memory_unsettag,
+	.inserttag          = memory_inserttag,
+	.isatag             = memory_isatag,
+	.search_page        = memory_search_page,
+	.query_page         = memory_query_page,
+	.facets             = memory_facets,
+	.setattr            = memory_setattr,
+	.unsetattr          = memory_unsetattr,
+	.getattr            = memory_getattr,
+	.getattr_many       = memory_getattr_many,
+	.begin              = memory_begin,
+	.commit             = memory_commit,
+	.set_trigram_index  = memory_set_index,
+	.has_trigram_index  = memory_has_index,
+	.set_fulltext_index = memory_set_index,
+	.has_fulltext_index = memory_has_index,
+	.removefile         = memory_removefile,
+	.updatefile         = memory_updatefile,
+	.sync               = memory_sync,
+	.renamefile         = memory_renamefile,
+};
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+/**
+ * Store of a repository path, created on first use.
+ */
+static struct memory_store *get_store(const char *repository)
+{
+	pthread_mutex_lock(&stores_mutex);
+	if (stores == NULL) {
+		stores = ufa_hashtable_new((ufa_hash_fn_t) ufa_str_hash,
+					   (ufa_hash_equal_fn_t) ufa_str_equals,
+					   ufa_free, NULL);
+	}
+	struct memory_store *store = ufa_hashtable_get(stores, repository);
+	if (store == NULL) {
+		store = ufa_calloc(1, sizeof *store);
+		pthread_mutex_init(&store->mutex, NULL);
+		store->files = ufa_hashtable_new(
+		    (ufa_hash_fn_t) ufa_str_hash,
+		    (ufa_hash_equal_fn_t) ufa_str_equals, ufa_free,
+		    (ufa_hash_free_fn_t) free_file);
+		store->tags = UFA_HASHTABLE_STRING();
+		ufa_hashtable_put(stores, ufa_str_dup(repository), store);
+	}
+	pthread_mutex_unlock(&stores_mutex);
+	return store;
+}
+
+static void free_file(struct memory_file *file)
+{
+	if (file != NULL) {
+		ufa_free(file->name);
+		ufa_list_free(file->tags);
+		ufa_list_free(file->attrs);
+		ufa_free(file);
+	}
+}
+
+/**
+ * Gets the file of a path (with the store locked), adding it to the store if
+ * it is a file of the repository directory.
+ *
+ * @return File, or NULL (UFA_ERROR_FILE_NOT_IN_DB) if there is no such file
+ */
+static struct memory_file *get_file(const memory_repo_t *repo,
+				    const char *filepath,
+				    struct ufa_error **error)
+{
+	char *filename = ufa_util_getfilename(filepath);
+	struct memory_file *file =
+	    ufa_hashtable_get(repo->store->files, filename);
+	if (file == NULL) {
+		char *path = ufa_util_joinpath(repo->base.repository_path,
+					       filename, NULL);
+		if (ufa_util_isfile(path)) {
+			file = ufa_calloc(1, sizeof *file);
+			file->id = ++repo->store->last_file_id;
+			file->name = ufa_str_dup(filename);
+			ufa_hashtable_put(repo->store->files,
+					  ufa_str_dup(filename), file);
+		} else {
+			ufa_error_new(error, UFA_ERROR_FILE_NOT_IN_DB,
+				      "file '%s' does not exist in DB",
+				      filename);
+		}
+		ufa_free(path);
+	}
+	ufa_free(filename);
+	return file;
+}
+
+/**
+ * Id of a tag (with the store locked), adding it if it does not exist.
+ */
+static int insert_tag(struct memory_store *store, const char *tag)
+{
+	int *id = ufa_hashtable_get(store->tags, tag);
+	if (id == NULL) {
+		id = ufa_int_dup(++store->last_tag_id);
+		ufa_hashtable_put(store->tags, ufa_str_dup(tag), id);
+	}
+	return *id;
+}
+
+static struct ufa_list *find_node(struct ufa_list *list, const char *str)
+{
+	for (UFA_LIST_EACH(i, list)) {
+		if (ufa_str_equals(i->data, str)) {
+			return i;
+		}
+	}
+	return NULL;
+}
+
+static struct ufa_repo_attr *find_attr(const struct memory_file *file,
+				       const char *attribute)
+{
+	for (UFA_LIST_EACH(i, file->attrs)) {
+		struct ufa_repo_attr *attr = i->data;
+		if (ufa_str_equals(attr->attribute, attribute)) {
+			return attr;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Copies a list of strings in order.
+ *
+ * @return New list
+ */
+static struct ufa_list *sorted_strings(struct ufa_list *strings)
+{
+	size_t n = ufa_list_size(strings);
+	char **array = ufa_malloc((n + 1) * sizeof *array);
+	size_t k = 0;
+	for (UFA_LIST_EACH(i, strings)) {
+		array[k++] = i->data;
+	}
+	qsort(array, n, sizeof *array, compare_str);
+
+	struct ufa_list *sorted = NULL;
+	for (size_t i = n; i > 0; i--) {
+		sorted = ufa_list_prepend2(sorted, ufa_str_dup(array[i - 1]),
+					   ufa_free);
+	}
+	ufa_free(array);
+	return sorted;
+}
+
+/**
+ * Copies a list of struct ufa_repo_attr in order of attribute.
+ *
+ * @return New list
+ */
+static struct ufa_list *sorted_attrs(struct ufa_list *attrs)
+{
+	size_t n = ufa_list_size(attrs);
+	struct ufa_repo_attr **array = ufa_malloc((n + 1) * sizeof *array);
+	size_t k = 0;
+	for (UFA_LIST_EACH(i, attrs)) {
+		array[k++] = i->data;
+	}
+	qsort(array, n, sizeof *array, compare_attr);
+
+	struct ufa_list *sorted = NULL;
+	for (size_t i = n; i > 0; i--) {
+		struct ufa_repo_attr *attr = ufa_calloc(1, sizeof *attr);
+		attr->attribute = ufa_str_dup(array[i - 1]->attribute);
+		attr->value = ufa_str_dup(array[i - 1]->value);
+		sorted = ufa_list_prepend2(
+		    sorted, attr, (ufa_list_free_fn_t) ufa_repo_attr_free);
+	}
+	ufa_free(array);
+	return sorted;
+}
+
+static int compare_str(const void *a, const void *b)
+{
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static int compare_attr(const void *a, const void *b)
+{
+	const struct ufa_repo_attr *attr_a = *(struct ufa_repo_attr *const *) a;
+	const struct ufa_repo_attr *attr_b = *(struct ufa_repo_attr *const *) b;
+	return strcmp(attr_a->attribute, attr_b->attribute);
+}
+
+/**
+ * Files of a store (locked) that match (see match_search and match_query).
+ *
+ * @return Files found (free 'files' with ufa_free)
+ */
+static struct found_files find_files(struct memory_store *store,
+				     match_fn_t match, const void *data)
+{
+	struct found_files found = {0};
+	struct ufa_list *files = ufa_hashtable_values(store->files);
+	found.files = ufa_malloc((ufa_list_size(files) + 1)
+				 * sizeof *found.files);
+	for (UFA_LIST_EACH(i, files)) {
+		if (match(i->data, data)) {
+			found.files[found.count++] = i->data;
+		}
+	}
+	ufa_list_free(files);
+	return found;
+}
+
+/**
+ * Checks whether a file has all the tags and matches all the filters of a
+ * search ('data' is {filter_attr, tags}; without both, every file matches).
+ */
+static bool match_search(const struct memory_file *file, const void *data)
+{
+	struct ufa_list *const *search = data;
+	if (!has_tags(file, search[1])) {
+		return false;
+	}
+	for (UFA_LIST_EACH(i, search[0])) {
+		struct ufa_repo_filterattr *filter = i->data;
+		if (!match_filter(file, filter->attribute, filter->value,
+				  filter->matchmode)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Checks whether a file matches a query ('data' is a struct ufa_query).
+ */
+static bool match_query(const struct memory_file *file, const void *data)
+{
+	const struct ufa_query *query = data;
+	switch (query->type) {
+	case UFA_QUERY_TAG:
+		return find_node(file->tags, query->name) != NULL;
+	case UFA_QUERY_ATTR:
+		return match_filter(file, query->name, query->value,
+				    query->matchmode);
+	case UFA_QUERY_AND:
+		return match_query(file, query->left)
+		       && match_query(file, query->right);
+	case UFA_QUERY_OR:
+		return match_query(file, query->left)
+		       || match_query(file, query->right);
+	case UFA_QUERY_NOT:
+		return !match_query(file, query->left);
+	}
+	return false;
+}
+
+static bool has_tags(const struct memory_file *file, struct ufa_list *tags)
+{
+	for (UFA_LIST_EACH(i, tags)) {
+		if (find_node(file->tags, i->data) == NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Checks whether a file has an attribute whose value matches 'value' (NULL:
+ * any value).
+ */
+static bool match_filter(const struct memory_file *file,
+			 const char *attribute, const char *value,
+			 enum ufa_repo_matchmode matchmode)
+{
+	struct ufa_repo_attr *attr = find_attr(file, attribute);
+	if (attr == NULL) {
+		return false;
+	}
+	return value == NULL || match_value(attr->value, value, matchmode);
+}
+
+/**
+ * Compares an attribute value to the value of a filter as the SQLite
+ * backend does: EQUAL and WILDCARD compare the text, FULLTEXT the words and
+ * the other modes the value converted to the type of the filter (see
+ * ufa_repo_attrtype_of).
+ */
+static bool match_value(const char *value, const char *pattern,
+			enum ufa_repo_matchmode matchmode)
+{
+	int cmp = 0;
+	switch (matchmode) {
+	case UFA_REPO_EQUAL:
+		return ufa_str_equals(value, pattern);
+	case UFA_REPO_WILDCARD:
+		return (strchr(pattern, '*') == NULL)
+			   ? ufa_str_equals(value, pattern)
+			   : match_wildcard(pattern, value);
+	case UFA_REPO_FULLTEXT:
+		return match_fulltext(pattern, value);
+	case UFA_REPO_LT:
+	case UFA_REPO_LE:
+	case UFA_REPO_GT:
+	case UFA_REPO_GE:
+		if (!compare_typed(value, pattern,
+				   ufa_repo_attrtype_of(pattern), &cmp)) {
+			return false;
+		}
+		return (matchmode == UFA_REPO_LT && cmp < 0)
+		       || (matchmode == UFA_REPO_LE && cmp <= 0)
+		       || (matchmode == UFA_REPO_GT && cmp > 0)
+		       || (matchmode == UFA_REPO_GE && cmp >= 0);
+	case UFA_REPO_BETWEEN: {
+		char *low = NULL;
+		char *high = NULL;
+		enum ufa_repo_attrtype type = range_type(pattern, &low, &high);
+		int cmp_high = 0;
+		bool match = compare_typed(value, low, type, &cmp)
+			     && compare_typed(value, high, type, &cmp_high)
+			     && cmp >= 0 && cmp_high <= 0;
+		ufa_free(low);
+		ufa_free(high);
+		return match;
+	}
+	case UFA_REPO_MATCHMODE_TOTAL:
+		break;
+	}
+	return false;
+}
+
+/**
+ * Matches a pattern of UFA_REPO_WILDCARD ('*' is any sequence) regardless of
+ * case, as LIKE.
+ */
+static bool match_wildcard(const char *pattern, const char *value)
+{
+	const char *star = NULL;  /* pattern after the last '*' */
+	const char *retry = NULL; /* value matched by the last '*' so far */
+	while (*value != '\0') {
+		if (*pattern == '*') {
+			star = ++pattern;
+			retry = value;
+		} else if (*pattern != '\0'
+			   && tolower((unsigned char) *pattern)
+				  == tolower((unsigned char) *value)) {
+			pattern++;
+			value++;
+		} else if (star != NULL) {
+			pattern = star;
+			value = ++retry;
+		} else {
+			return false;
+		}
+	}
+	while (*pattern == '*') {
+		pattern++;
+	}
+	return *pattern == '\0';
+}
+
+/**
+ * Checks whether a value has all the words of UFA_REPO_FULLTEXT, each one a
+ * substring regardless of case ("word*" is the same as "word").
+ */
+static bool match_fulltext(const char *words, const char *value)
+{
+	bool match = true;
+	struct ufa_list *split = ufa_str_split(words, FULLTEXT_SPACES);
+	for (UFA_LIST_EACH(i, split)) {
+		char *word = i->data;
+		size_t len = strlen(word);
+		while (len > 0 && word[len - 1] == '*') {
+			len--;
+		}
+		if (len == 0) {
+			continue;
+		}
+		char *pattern = ufa_str_sprintf("*%.*s*", (int) len, word);
+		match = match_wildcard(pattern, value);
+		ufa_free(pattern);
+		if (!match) {
+			break;
+		}
+	}
+	ufa_list_free(split);
+	return match;
+}
+
+/**
+ * Splits a range "low..high" (UFA_REPO_BETWEEN) into new strings.
+ *
+ * @return UFA_REPO_REAL if both limits are numbers, UFA_REPO_TIMESTAMP if
+ * both are timestamps, or UFA_REPO_TEXT
+ */
+static enum ufa_repo_attrtype range_type(const char *value, char **low,
+					 char **high)
+{
+	const char *sep = strstr(value, "..");
+	if (sep == NULL) {
+		*low = ufa_str_dup(value);
+		*high = ufa_str_dup(value);
+	} else {
+		*low = ufa_str_sprintf("%.*s", (int) (sep - value), value);
+		*high = ufa_str_dup(sep + 2);
+	}
+
+	enum ufa_repo_attrtype type_low = ufa_repo_attrtype_of(*low);
+	enum ufa_repo_attrtype type_high = ufa_repo_attrtype_of(*high);
+	if ((type_low == UFA_REPO_INTEGER || type_low == UFA_REPO_REAL)
+	    && (type_high == UFA_REPO_INTEGER || type_high == UFA_REPO_REAL)) {
+		return UFA_REPO_REAL;
+	}
+	if (type_low == UFA_REPO_TIMESTAMP && type_high == UFA_REPO_TIMESTAMP) {
+		return UFA_REPO_TIMESTAMP;
+	}
+	return UFA_REPO_TEXT;
+}
+
+/**
+ * Compares a value to 'other' as values of 'type': numbers and timestamps
+ * only compare to values of their type, text compares to any value.
+ *
+ * @return false if value is not of the type
+ */
+static bool compare_typed(const char *value, const char *other,
+			  enum ufa_repo_attrtype type, int *cmp)
+{
+	enum ufa_repo_attrtype value_type = ufa_repo_attrtype_of(value);
+	if (type == UFA_REPO_INTEGER || type == UFA_REPO_REAL) {
+		double a, b;
+		if ((value_type != UFA_REPO_INTEGER
+		     && value_type != UFA_REPO_REAL)
+		    || !ufa_str_to_double(value, &a)
+		    || !ufa_str_to_double(other, &b)) {
+			return false;
+		}
+		*cmp = (a > b) - (a < b);
+		return true;
+	}
+	if (type == UFA_REPO_TIMESTAMP) {
+		time_t a, b;
+		if (value_type != UFA_REPO_TIMESTAMP
+		    || !ufa_str_to_time(value, &a)
+		    || !ufa_str_to_time(other, &b)) {
+			return false;
+		}
+		*cmp = (a > b) - (a < b);
+		return true;
+	}
+	*cmp = strcmp(value, other);
+	return true;
+}
+
+/**
+ * Checks a page of search results. Pages are sorted by name or id (the key
+ * of a file, as in the SQLite backend); UFA_REPO_SORT_NONE is the order of
+ * id.
+ *
+ * @param after_id Where to store the id after which the page starts
+ * (UFA_REPO_SORT_ID)
+ */
+static bool check_page(const struct ufa_repo_page *page, long *after_id,
+		       struct ufa_error **error)
+{
+	if (page->sort < 0 || page->sort >= UFA_REPO_SORT_TOTAL) {
+		ufa_error_new(error, UFA_ERROR_ARGS, "invalid sort: %d",
+			      page->sort);
+		return false;
+	}
+	if (page->sort == UFA_REPO_SORT_ATTR) {
+		ufa_error_new(error, UFA_ERROR_ARGS,
+			      "the memory backend does not sort by attribute");
+		return false;
+	}
+	if (page->limit < 0) {
+		ufa_error_new(error, UFA_ERROR_ARGS, "invalid limit: %d",
+			      page->limit);
+		return false;
+	}
+	if (page->after != NULL
+	    && (page->sort == UFA_REPO_SORT_NONE
+		|| (page->sort == UFA_REPO_SORT_ID
+		    && !ufa_str_to_long(page->after, after_id)))) {
+		ufa_error_new(error, UFA_ERROR_ARGS,
+			      "invalid position of page: '%s'", page->after);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Sorts the files found and reads the names of the files of a page.
+ *
+ * @param last_key If not NULL, where to store the key of the last file (if
+ * the page is sorted)
+ * @return List of names
+ */
+static struct ufa_list *read_page(struct found_files *found,
+				  const struct ufa_repo_page *page,
+				  long after_id, char **last_key)
+{
+	qsort(found->files, found->count, sizeof *found->files,
+	      (page->sort == UFA_REPO_SORT_NAME) ? compare_file_name
+						 : compare_file_id);
+
+	struct ufa_list *names = NULL;
+	struct memory_file *last = NULL;
+	int count = 0;
+	for (size_t i = 0; i < found->count; i++) {
+		struct memory_file *file = found->files[i];
+		if (page->after != NULL
+		    && ((page->sort == UFA_REPO_SORT_NAME
+			 && strcmp(file->name, page->after) <= 0)
+			|| (page->sort == UFA_REPO_SORT_ID
+			    && file->id <= after_id))) {
+			continue;
+		}
+		if (page->limit > 0 && count == page->limit) {
+			break;
+		}
+		names = ufa_list_prepend2(names, ufa_str_dup(file->name),
+					  ufa_free);
+		last = file;
+		count++;
+	}
+
+	if (last_key != NULL && last != NULL
+	    && page->sort != UFA_REPO_SORT_NONE) {
+		*last_key = (page->sort == UFA_REPO_SORT_ID)
+				? ufa_str_sprintf("%d", last->id)
+				: ufa_str_dup(last->name);
+	}
+	return ufa_list_reverse(names);
+}
+
+static int compare_file_id(const void *a, const void *b)
+{
+	const struct memory_file *file_a = *(struct memory_file *const *) a;
+	const struct memory_file *file_b = *(struct memory_file *const *) b;
+	return (file_a->id > file_b->id) - (file_a->id < file_b->id);
+}
+
+static int compare_file_name(const void *a, const void *b)
+{
+	const struct memory_file *file_a = *(struct memory_file *const *) a;
+	const struct memory_file *file_b = *(struct memory_file *const *) b;
+	return strcmp(file_a->name, file_b->name);
+}
+
+static int facet_hash(const struct ufa_repo_facet *facet)
+{
+	int hash = ufa_str_hash(facet->name);
+	return (facet->value == NULL) ? hash
+				      : hash * 31 + ufa_str_hash(facet->value);
+}
+
+static bool facet_equals(const struct ufa_repo_facet *a,
+			 const struct ufa_repo_facet *b)
+{
+	return ufa_str_equals(a->name, b->name)
+	       && ((a->value == NULL && b->value == NULL)
+		   || (a->value != NULL && b->value != NULL
+		       && ufa_str_equals(a->value, b->value)));
+}
+
+/**
+ * Adds one to the count of a tag (value NULL) or attribute value.
+ */
+static void count_facet(ufa_hashtable_t *counts, const char *name,
+			const char *value)
+{
+	struct ufa_repo_facet key = {.name = (char *) name,
+				     .value = (char *) value};
+	struct ufa_repo_facet *facet = ufa_hashtable_get(counts, &key);
+	if (facet == NULL) {
+		facet = ufa_calloc(1, sizeof *facet);
+		facet->name = ufa_str_dup(name);
+		facet->value = (value != NULL) ? ufa_str_dup(value) : NULL;
+		ufa_hashtable_put(counts, facet, facet);
+	}
+	facet->count++;
+}
+
+/**
+ * Order of facets: tags by name, then attribute values by attribute and
+ * value.
+ */
+static int compare_facet(const void *a, const void *b)
+{
+	const struct ufa_repo_facet *facet_a =
+	    *(struct ufa_repo_facet *const *) a;
+	const struct ufa_repo_facet *facet_b =
+	    *(struct ufa_repo_facet *const *) b;
+	if ((facet_a->value == NULL) != (facet_b->value == NULL)) {
+		return (facet_a->value == NULL) ? -1 : 1;
+	}
+	int cmp = strcmp(facet_a->name, facet_b->name);
+	if (cmp == 0 && facet_a->value != NULL) {
+		cmp = strcmp(facet_a->value, facet_b->value);
+	}
+	return cmp;
+}
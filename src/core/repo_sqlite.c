@@ -9,27 +9,60 @@
 /* ========================================================================== */
 
 #include "core/repo.h"
+#include "core/repo_backend.h"
+#include "core/query.h"
 #include "util/error.h"
+#include "util/hashtable.h"
 #include "util/list.h"
 #include "util/logging.h"
 #include "util/misc.h"
+#include "util/stats.h"
 #include "util/string.h"
 #include <errno.h>
+#include <pthread.h>
 #include <sqlite3.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
 
 /* ========================================================================== */
 /* VARIABLES AND DEFINITIONS                                                  */
 /* ========================================================================== */
 
 #define DB_VERSION_ATTR                 "db_version"
-#define DB_VERSION_VALUE                "1"
+#define DB_VERSION_VALUE                "4"
 #define REPOSITORY_FILENAME             "repo.sqlite"
-#define REPOSITORY_INDICATOR_FILE_NAME  ".ufarepo"
+#define BUSY_TIMEOUT_MS                 5000
+
+/** Max values of a list bound as an argument each (SQLITE_MAX_VARIABLE_NUMBER
+ * is 999 in older versions); longer lists are bound as an array (see
+ * sql_in_list) */
+#define MAX_SQL_ARGS                    500
+
+/* Indexes for comparisons of typed values (value_num and value_time) */
+#define STR_CREATE_ATTR_TYPED_INDEXES \
+"CREATE INDEX IF NOT EXISTS \"attribute_num\" ON \"attribute\" (\n"\
+	"\"name\","\
+	"\"value_num\""\
+"); \n"\
+"CREATE INDEX IF NOT EXISTS \"attribute_time\" ON \"attribute\" (\n"\
+	"\"name\","\
+	"\"value_time\""\
+"); \n"
+
+/* Index for wildcard patterns (case-insensitive, as LIKE; see
+ * analyse_pattern) */
+#define STR_CREATE_ATTR_VALUE_INDEX \
+"CREATE INDEX IF NOT EXISTS \"attribute_value\" ON \"attribute\" (\n"\
+	"\"name\","\
+	"\"value\" COLLATE NOCASE"\
+"); \n"
 
 // FIXME NOT NULL FOR ATTRIBUTE TABLE
 #define STR_CREATE_TABLE \
@@ -38,6 +71,8 @@
 	"\"id_file\"	INTEGER NOT NULL, \n"\
 	"\"name\"	TEXT NOT NULL, \n"\
 	"\"value\"	TEXT, \n"\
+	"\"value_num\"	NUMERIC, \n"\
+	"\"value_time\"	INTEGER, \n"\
 	"FOREIGN KEY(\"id_file\") REFERENCES \"file\"(\"id\") ON DELETE CASCADE\n"\
 ");\n"\
 "CREATE TABLE IF NOT EXISTS \"file_tag\" (\n" \
@@ -49,7 +84,15 @@
 "); \n"\
 "CREATE TABLE IF NOT EXISTS \"file\" ( \n"\
 	"\"id\"	INTEGER PRIMARY KEY AUTOINCREMENT, \n"\
-	"\"name\"	TEXT UNIQUE \n"\
+	"\"name\"	TEXT UNIQUE, \n"\
+	"\"dev\"	INTEGER, \n"\
+	"\"ino\"	INTEGER, \n"\
+	"\"mtime\"	INTEGER, \n"\
+	"\"size\"	INTEGER \n"\
+"); \n"\
+"CREATE INDEX IF NOT EXISTS \"file_inode\" ON \"file\" (\n"\
+	"\"dev\","\
+	"\"ino\""\
 "); \n"\
 "CREATE TABLE IF NOT EXISTS \"tag\" ( \n"\
 	"\"id\"	INTEGER PRIMARY KEY AUTOINCREMENT, \n"\
@@ -63,133 +106,552 @@
 	"\"id_file\","\
 	"\"name\""\
 "); \n"\
+STR_CREATE_ATTR_TYPED_INDEXES \
+STR_CREATE_ATTR_VALUE_INDEX \
 "CREATE TABLE IF NOT EXISTS \"ufa\" ( \n"\
 		"\"attr\"	TEXT PRIMARY KEY, \n"              \
 		"\"value\"	TEXT NOT NULL \n"\
 ");"
 
 
+/* Version 1 -> 2: file identity (device and inode) */
+#define STR_MIGRATE_V2 \
+"ALTER TABLE \"file\" ADD COLUMN \"dev\" INTEGER; \n"\
+"ALTER TABLE \"file\" ADD COLUMN \"ino\" INTEGER; \n"\
+"ALTER TABLE \"file\" ADD COLUMN \"mtime\" INTEGER; \n"\
+"ALTER TABLE \"file\" ADD COLUMN \"size\" INTEGER; \n"\
+"CREATE INDEX IF NOT EXISTS \"file_inode\" ON \"file\" (\n"\
+	"\"dev\","\
+	"\"ino\""\
+"); \n"\
+"UPDATE \"ufa\" SET \"value\" = '2' WHERE \"attr\" = 'db_version';"
+
+
+/* Version 2 -> 3: typed attribute values (see typed_value_of) */
+#define STR_MIGRATE_V3 \
+"ALTER TABLE \"attribute\" ADD COLUMN \"value_num\" NUMERIC; \n"\
+"ALTER TABLE \"attribute\" ADD COLUMN \"value_time\" INTEGER; \n"\
+STR_CREATE_ATTR_TYPED_INDEXES \
+"UPDATE \"attribute\" SET \"value_num\" = ufa_value_num(\"value\"), \n"\
+	"\"value_time\" = ufa_value_time(\"value\"); \n"\
+"UPDATE \"ufa\" SET \"value\" = '3' WHERE \"attr\" = 'db_version';"
+
+
+/* Version 3 -> 4: index for wildcard patterns */
+#define STR_MIGRATE_V4 \
+STR_CREATE_ATTR_VALUE_INDEX \
+"UPDATE \"ufa\" SET \"value\" = '4' WHERE \"attr\" = 'db_version';"
+
+
+/* FTS5 index of attribute values, kept by triggers (optional, see
+ * ufa_repo_set_trigram_index and ufa_repo_set_fulltext_index). setattr
+ * replaces rows, so the connection needs recursive_triggers for the delete
+ * trigger to run. */
+#define STR_CREATE_FTS_INDEX(table, tokenize) \
+"CREATE VIRTUAL TABLE IF NOT EXISTS \"" table "\" USING fts5(\n"\
+	"\"value\", content='attribute', content_rowid='id', "\
+	"tokenize='" tokenize "'"\
+"); \n"\
+"CREATE TRIGGER IF NOT EXISTS \"" table "_ai\" "\
+"AFTER INSERT ON \"attribute\" BEGIN \n"\
+	"INSERT INTO \"" table "\"(rowid, \"value\") "\
+	"VALUES (new.\"id\", new.\"value\"); \n"\
+"END; \n"\
+"CREATE TRIGGER IF NOT EXISTS \"" table "_ad\" "\
+"AFTER DELETE ON \"attribute\" BEGIN \n"\
+	"INSERT INTO \"" table "\"(\"" table "\", rowid, "\
+	"\"value\") VALUES ('delete', old.\"id\", old.\"value\"); \n"\
+"END; \n"\
+"CREATE TRIGGER IF NOT EXISTS \"" table "_au\" "\
+"AFTER UPDATE OF \"value\" ON \"attribute\" BEGIN \n"\
+	"INSERT INTO \"" table "\"(\"" table "\", rowid, "\
+	"\"value\") VALUES ('delete', old.\"id\", old.\"value\"); \n"\
+	"INSERT INTO \"" table "\"(rowid, \"value\") "\
+	"VALUES (new.\"id\", new.\"value\"); \n"\
+"END; \n"\
+"INSERT INTO \"" table "\"(\"" table "\") "\
+"VALUES ('rebuild');"
+
+#define STR_DROP_FTS_INDEX(table) \
+"DROP TRIGGER IF EXISTS \"" table "_ai\"; \n"\
+"DROP TRIGGER IF EXISTS \"" table "_ad\"; \n"\
+"DROP TRIGGER IF EXISTS \"" table "_au\"; \n"\
+"DROP TABLE IF EXISTS \"" table "\";"
+
+#define TRIGRAM_TABLE  "attribute_trigram"
+#define FULLTEXT_TABLE "attribute_fts"
+
+
 #define db_prepare(repo, stmt, sql, error)                                     \
 	_db_prepare(repo, stmt, sql, error, __func__)
 #define db_execute(repo, stmt, error) _db_execute(repo, stmt, error, __func__)
+#define db_prepare_cached(repo, stmt, sql, error)                              \
+	_db_prepare_cached(repo, stmt, sql, error, __func__)
+
+/* Entry of a directory (see read_dir_entries) */
+struct dir_entry {
+	char *name;
+	uint64_t ino;
+	bool in_db;
+	int stale_id; /* id of its row if its stat must be updated (or 0) */
+};
+
+/* Record returned by getdents64 (not declared by all libc versions) */
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
 
-struct ufa_repo {
+#define GETDENTS_BUF_SIZE (64 * 1024)
+
+/* Max of prepared statements kept by a repo (see db_prepare_cached) */
+#define STMT_CACHE_SIZE 32
+
+/*
+ * Prepared statements of searches kept for reuse, by SQL. The SQL of a search
+ * depends only on its shape (number of tags, number and kind of attribute
+ * filters, page and indexes), as every value is bound, so searches of the
+ * same shape only rebind arguments. A statement in use is out of the cache.
+ */
+struct stmt_cache {
+	pthread_mutex_t mutex;
+	char *sql[STMT_CACHE_SIZE];
+	sqlite3_stmt *stmt[STMT_CACHE_SIZE];
+	uint64_t used[STMT_CACHE_SIZE]; /* last use (see 'clock'), for LRU */
+	uint64_t clock;
+};
+
+/* Repository of the SQLite backend (base is the part common to every
+ * backend, see repo_backend.h) */
+struct sqlite_repo {
+	struct ufa_repo base;
 	sqlite3 *db; /* sqlite3 object */
 	char *name;  /* name of the file */
-	char *repository_path;
+	struct stmt_cache *cache;
+	sqlite3 *explain_db; /* read-only connection for plans of slow queries,
+				opened on first use (see write_query_plan) */
+	pthread_mutex_t explain_mutex;
 };
 
+typedef struct sqlite_repo sqlite_repo_t;
+
 const enum ufa_repo_matchmode ufa_repo_matchmode_supported[] = {
 	UFA_REPO_EQUAL,
-	UFA_REPO_WILDCARD
+	UFA_REPO_WILDCARD,
+	UFA_REPO_LT,
+	UFA_REPO_LE,
+	UFA_REPO_GT,
+	UFA_REPO_GE,
+	UFA_REPO_BETWEEN,
+	UFA_REPO_FULLTEXT
 };
 
 const static char *ufa_repo_matchmode_sql[] = {
 	"=",
-	"LIKE"
+	"LIKE",
+	"<",
+	"<=",
+	">",
+	">=",
+	"BETWEEN",
+	"MATCH"
+};
+
+/* How a pattern of UFA_REPO_WILDCARD is matched (see analyse_pattern) */
+enum pattern_kind {
+	PATTERN_ANY,    /* "*": any value */
+	PATTERN_EXACT,  /* no '*': equality */
+	PATTERN_PREFIX, /* "abc*": range on index attribute_value */
+	PATTERN_GLOB,   /* no letters, so case does not matter: GLOB */
+	PATTERN_LIKE,   /* other patterns: LIKE */
+};
+
+/** Min length of a run of characters of a pattern to use the trigram index */
+#define TRIGRAM_MIN_RUN 3
+
+/* Parts of the SQL of a page of search results (see page_sql) */
+struct page_sql {
+	const char *select; /* sort key (UFA_REPO_SORT_ATTR) */
+	const char *from;   /* join of the attribute of UFA_REPO_SORT_ATTR */
+	const char *where;  /* keyset condition, followed by AND */
+	const char *order;  /* ORDER BY */
+	const char *limit;  /* LIMIT */
+};
+
+/* Key of a file in a page of search results (see page_key) */
+struct page_key {
+	char *value; /* name, id or attribute value (NULL: first page) */
+	char type;   /* UFA_REPO_SORT_ATTR: 'i', 'r', 't' or 'n' (no value) */
+	char *name;  /* UFA_REPO_SORT_ATTR: name of the file */
+};
+
+/** Sort key of UFA_REPO_SORT_ATTR: the typed value, or an empty BLOB (after
+ * any value) for files without the attribute */
+#define SORT_ATTR_KEY "IFNULL(COALESCE(s.value_num, s.value_time, s.value), X'')"
+
+/* Optional indexes of a repository (see optional_indexes) */
+#define INDEX_TRIGRAM  1 /* TRIGRAM_TABLE */
+#define INDEX_FULLTEXT 2 /* FULLTEXT_TABLE */
+
+/** Characters separating the words of UFA_REPO_FULLTEXT */
+#define FULLTEXT_SPACES " \t\n\r"
+
+/* Value of an attribute converted to its type (see typed_value_of) */
+struct typed_value {
+	enum ufa_repo_attrtype type;
+	sqlite3_int64 integer; /* UFA_REPO_INTEGER and UFA_REPO_TIMESTAMP */
+	double real;           /* UFA_REPO_REAL */
+};
+
+/** Max of statements of a thread being stepped at the same time (profiling) */
+#define MAX_PROFILED_STMTS 8
+
+/** SQL profiling settings (see ufa_repo_profile_enable) */
+static bool profile_enabled             = false;
+static unsigned long profile_threshold  = 0;
+static bool profile_explain             = false;
+static FILE *profile_slowlog            = NULL;
+static pthread_mutex_t profile_mutex    = PTHREAD_MUTEX_INITIALIZER;
+
+/** Rows returned so far by statements of the current thread */
+struct stmt_rows {
+	sqlite3_stmt *stmt;
+	unsigned long rows;
 };
+static __thread struct stmt_rows profiled_stmts[MAX_PROFILED_STMTS];
 
 
 /* ========================================================================== */
 /* AUXILIARY FUNCTIONS - DECLARATION                                          */
 /* ========================================================================== */
 
-bool _db_prepare(const ufa_repo_t *repo, sqlite3_stmt **stmt, const char *sql,
-		 struct ufa_error **error, const char *func_name);
+bool _db_prepare(const sqlite_repo_t *repo, sqlite3_stmt **stmt,
+		 const char *sql, struct ufa_error **error,
+		 const char *func_name);
 
-static bool _db_execute(const ufa_repo_t *repo, sqlite3_stmt *stmt,
+static bool _db_execute(const sqlite_repo_t *repo, sqlite3_stmt *stmt,
 			struct ufa_error **error, const char *func_name);
 
-static void db_begin(ufa_repo_t *repo);
-static void db_commit(const ufa_repo_t *repo);
-static char *sql_arg_list(struct ufa_list *list);
-
-static struct ufa_repo *open_sqlite_conn(const char *file,
-					 const char *repo_path,
-					 struct ufa_error **error);
+static void db_begin(sqlite_repo_t *repo);
+static void db_commit(const sqlite_repo_t *repo);
+static char *sql_in_list(struct ufa_list *list);
+static int bind_in_list(sqlite3_stmt *stmt, int index, struct ufa_list *list);
+static bool _db_prepare_cached(const sqlite_repo_t *repo, sqlite3_stmt **stmt,
+			       const char *sql, struct ufa_error **error,
+			       const char *func_name);
+static void db_release(const sqlite_repo_t *repo, sqlite3_stmt *stmt,
+		       const char *sql);
+static struct stmt_cache *stmt_cache_new(void);
+static void stmt_cache_clear(struct stmt_cache *cache);
+static void stmt_cache_free(struct stmt_cache *cache);
+
+/** Adds a row of a query of ufa_repo_*_many functions to the result table */
+typedef void (*add_row_fn_t)(ufa_hashtable_t *result, sqlite3_stmt *stmt);
+
+static bool query_files_many(const sqlite_repo_t *repo,
+			     const char *sql_format,
+			     struct ufa_list *filenames,
+			     add_row_fn_t add_row,
+			     ufa_hashtable_t *result,
+			     struct ufa_error **error);
+static void append_to_key(ufa_hashtable_t *result, const char *key,
+			  void *value, ufa_list_free_fn_t free_fn);
+static void add_row_tag(ufa_hashtable_t *result, sqlite3_stmt *stmt);
+static void add_row_attr(ufa_hashtable_t *result, sqlite3_stmt *stmt);
+static bool int_equals(int *a, int *b);
+static int int_hash(int *i);
+
+static sqlite_repo_t *open_sqlite_conn(const char *file,
+				       struct ufa_error **error);
 
-static int get_tag_id_by_name(const ufa_repo_t *repo,
+static int get_tag_id_by_name(const sqlite_repo_t *repo,
 			      const char *tag,
 			      struct ufa_error **error);
 
-static struct ufa_list *get_tags_for_files_excluding(const ufa_repo_t *repo,
-						     struct ufa_list *file_ids,
-						     struct ufa_list *tags,
-						     struct ufa_error **error);
-
-static struct ufa_list *get_files_with_tags(const ufa_repo_t *repo,
+static struct ufa_list *get_files_with_tags(const sqlite_repo_t *repo,
 					    struct ufa_list *tags,
 					    struct ufa_error **error);
 
-static sqlite_int64 insert_tag(const ufa_repo_t *repo,
+static sqlite_int64 insert_tag(const sqlite_repo_t *repo,
                                const char *tag,
                                struct ufa_error **error);
-static bool insert_db_version(const ufa_repo_t *repo);
+static bool insert_db_version(const sqlite_repo_t *repo);
+
+static bool migrate_db(sqlite_repo_t *repo, struct ufa_error **error);
 
-static int insert_file(const ufa_repo_t *repo,
+static int insert_file(const sqlite_repo_t *repo,
 		       const char *filename,
 		       struct ufa_error **error);
 
-static int get_file_id_by_name(const ufa_repo_t *repo,
+static void bind_file_stat(sqlite3_stmt *stmt, int index, const char *filepath);
+
+static bool update_file_stat(const sqlite_repo_t *repo,
+			     int file_id,
+			     const char *filepath,
+			     struct ufa_error **error);
+static bool execute_file_stat(const sqlite_repo_t *repo,
+			      sqlite3_stmt *stmt,
+			      int file_id,
+			      const char *filepath,
+			      struct ufa_error **error);
+
+static struct dir_entry *read_dir_entries(const char *dirpath,
+					  size_t *count,
+					  dev_t *dev,
+					  struct ufa_error **error);
+
+static void free_dir_entries(struct dir_entry *entries, size_t count);
+static bool dir_has_entry(const char *dirpath, const char *name);
+static bool stat_changed(const char *dirpath, const char *name,
+			 sqlite3_int64 mtime, sqlite3_int64 size);
+
+static int get_file_id_by_name(const sqlite_repo_t *repo,
 			       const char *filename,
 			       struct ufa_error **error);
 
-static bool set_tag_on_file(const ufa_repo_t *repo,
+static bool set_tag_on_file(const sqlite_repo_t *repo,
 			    int file_id,
 			    int tag_id,
 			    struct ufa_error **error);
 
-static void create_repo_indicator_file(const char *repo,
-				       struct ufa_error **error);
-static int get_file_id(const ufa_repo_t *repo,
+static int get_file_id(const sqlite_repo_t *repo,
 		       const char *filepath,
 		       struct ufa_error **error);
 
-static char *generate_sql_search_attrs(struct ufa_list *filter_attr);
+static char *generate_sql_search_attrs(struct ufa_list *filter_attr,
+				       unsigned indexes);
 static char *generate_sql_search_tags(struct ufa_list *tags);
+static char *generate_sql_search_files(struct ufa_list *filter_attr,
+				       struct ufa_list *tags,
+				       unsigned indexes);
+static int bind_search(sqlite3_stmt *stmt, int index,
+		       struct ufa_list *filter_attr, struct ufa_list *tags,
+		       unsigned indexes);
+static void generate_sql_query(const struct ufa_query *query,
+			       unsigned indexes, struct ufa_str_builder *sql);
+static int bind_query(sqlite3_stmt *stmt, const struct ufa_query *query,
+		      int index, unsigned indexes);
+static bool query_uses_index(const struct ufa_query *query);
+static bool uses_index(enum ufa_repo_matchmode matchmode, const char *value);
+static unsigned optional_indexes(const sqlite_repo_t *repo);
+static bool has_table(const sqlite_repo_t *repo, const char *table);
+static bool set_optional_index(sqlite_repo_t *repo, const char *description,
+			       const char *sql, bool enabled,
+			       struct ufa_error **error);
+
+static struct typed_value typed_value_of(const char *value);
+static enum ufa_repo_attrtype range_type(const char *value, char **low,
+					 char **high);
+static char *sql_attr_value(enum ufa_repo_matchmode matchmode,
+			    const char *value, unsigned indexes);
+static int bind_attr_value(sqlite3_stmt *stmt, int index,
+			   enum ufa_repo_matchmode matchmode,
+			   const char *value, unsigned indexes);
+static enum pattern_kind analyse_pattern(const char *pattern, bool trigram,
+					 bool *use_trigram);
+static char *sql_pattern(const char *pattern, bool trigram);
+static int bind_pattern(sqlite3_stmt *stmt, int index, const char *pattern,
+			bool trigram);
+static char *pattern_to_like(const char *pattern, bool for_trigram);
+static char *pattern_to_glob(const char *pattern);
+static char *prefix_upper_bound(const char *pattern);
+static bool parse_page(const struct ufa_repo_page *page,
+		       struct page_key *key, struct ufa_error **error);
+static void page_key_clear(struct page_key *key);
+static struct page_sql page_sql(const struct ufa_repo_page *page, bool after);
+static int bind_page_from(sqlite3_stmt *stmt, int index,
+			  const struct ufa_repo_page *page);
+static int bind_page_after(sqlite3_stmt *stmt, int index,
+			   const struct ufa_repo_page *page,
+			   const struct page_key *key);
+static char *page_key(sqlite3_stmt *stmt, const struct ufa_repo_page *page);
+static struct ufa_list *read_page(sqlite3_stmt *stmt,
+				  const struct ufa_repo_page *page,
+				  char **last_key, int *rc);
+static struct ufa_list *fulltext_words(const char *value);
+static char *fulltext_query(const char *value);
+static char *fulltext_rank_query(struct ufa_list *filter_attr);
+static char *sql_fulltext(const char *value, bool fulltext);
+static int bind_fulltext(sqlite3_stmt *stmt, int index, const char *value,
+			 bool fulltext);
+static void bind_typed(sqlite3_stmt *stmt, int index,
+		       enum ufa_repo_attrtype type, const char *value);
+static void bind_typed_columns(sqlite3_stmt *stmt, int index,
+			       const char *value);
+static void sql_value_num(sqlite3_context *ctx, int argc,
+			  sqlite3_value **argv);
+static void sql_value_time(sqlite3_context *ctx, int argc,
+			   sqlite3_value **argv);
+
+static int trace_callback(unsigned type, void *ctx, void *p, void *x);
+static void count_row(sqlite3_stmt *stmt);
+static unsigned long take_rows(sqlite3_stmt *stmt);
+static void write_slow_query(const sqlite_repo_t *repo, sqlite3_stmt *stmt,
+			     double ms, unsigned long rows);
+static void write_query_plan(sqlite_repo_t *repo, const char *sql,
+			     struct ufa_str_builder *text);
+static int create_functions(sqlite3 *db);
+static void explain_statement(const sqlite_repo_t *repo, const char *stage,
+			      sqlite3_stmt *stmt, uint64_t start, long rows);
+static struct ufa_list *query_plan(const sqlite_repo_t *repo, const char *sql);
 
 /* ========================================================================== */
 /* FUNCTIONS FROM repo.h                                                      */
 /* ========================================================================== */
 
-ufa_repo_t *ufa_repo_init(const char *repository, struct ufa_error **error)
+char *ufa_repo_getrepofolderfor(const char *filepath, struct ufa_error **error)
 {
+	FILE *file_read     = NULL;
+	char *dirname       = NULL;
+	char *repodb_file   = NULL;
+	char *repo_ind_file = NULL;
+	char *repofile      = NULL;
+	char *repository    = NULL;
+
 	ufa_goto_iferror(error, end);
 
-	char *repo_abs   = NULL;
-	ufa_repo_t *repo = NULL;
+	// Get dir
+	if (ufa_util_isdir(filepath)) {
+		dirname = ufa_str_dup(filepath);
+	} else if (ufa_util_isfile(filepath)) {
+		dirname = ufa_util_dirname(filepath);
+	} else {
+		ufa_error_new(error, UFA_ERROR_FILE,
+			      "%s is not a file", filepath);
+		goto freeres;
+	}
+
+
+	repo_ind_file = ufa_util_joinpath(
+	    dirname, UFA_REPO_INDICATOR_FILE_NAME, NULL);
+
+	// Read real repo file from INDICATOR file
+	if (ufa_util_isfile(repo_ind_file)) {
+		file_read = fopen(repo_ind_file, "r");
+		char linebuf[1024];
+		if (fgets(linebuf, 1024, file_read) != NULL) {
+			char *line = ufa_str_trim(linebuf);
+			repository = ufa_str_dup(line);
+		} else {
+			ufa_error_new(error, UFA_ERROR_FILE,
+				      "could not read %s", repo_ind_file);
+			goto freeres;
+		}
+	} else {
+		// OR try get repo .db file
+		repodb_file =
+		    ufa_util_joinpath(dirname, REPOSITORY_FILENAME, NULL);
+		if (ufa_util_isfile(repodb_file)) {
+			repository = ufa_str_dup(dirname);
+		}
+	}
+
+	if (repository == NULL) {
+		ufa_error_new(error, UFA_ERROR_FILE,
+			      "not found repo for: %s", filepath);
+		goto freeres;
+	}
+
+freeres:
+	if (file_read != NULL) {
+		fclose(file_read);
+	}
+	ufa_free(repofile);
+	ufa_free(dirname);
+	ufa_free(repodb_file);
+	ufa_free(repo_ind_file);
+end:
+	return repository;
+}
+
+enum ufa_repo_attrtype ufa_repo_attrtype_of(const char *value)
+{
+	return typed_value_of(value).type;
+}
+
+bool ufa_repo_isrange(const char *value)
+{
+	char *low = NULL;
+	char *high = NULL;
+	bool isrange = (strstr(value, "..") != NULL
+			&& range_type(value, &low, &high) != UFA_REPO_TEXT);
+	ufa_free(low);
+	ufa_free(high);
+	return isrange;
+}
 
-	repo_abs = ufa_util_abspath(repository);
-	if (!ufa_util_isdir(repo_abs)) {
-		ufa_error_new(error, UFA_ERROR_NOTDIR, "%s is not a dir",
-			      repository);
+bool ufa_repo_isrepo(char *directory)
+{
+	if (!ufa_util_isdir(directory)) {
 		return false;
 	}
-	char *filepath =
-	    ufa_util_joinpath(repo_abs, REPOSITORY_FILENAME, NULL);
-	ufa_debug("Initializing repo '%s'", filepath);
-	repo = open_sqlite_conn(filepath, repo_abs, error);
-	ufa_goto_iferror(error, end);
+	char *fpath = ufa_util_joinpath(directory, REPOSITORY_FILENAME, NULL);
 
-	sqlite3_exec(repo->db, "PRAGMA foreign_keys = ON", 0, 0, 0);
+	bool ret = ufa_util_isfile(fpath);
 
-	create_repo_indicator_file(repo_abs, error);
+	ufa_free(fpath);
 
-end:
-	ufa_free(repo_abs);
+	return ret;
+}
+
+void ufa_repo_profile_enable(unsigned long threshold_ms,
+			     FILE *slowlog,
+			     bool explain)
+{
+	pthread_mutex_lock(&profile_mutex);
+	profile_threshold = threshold_ms;
+	profile_slowlog = slowlog;
+	profile_explain = explain;
+	__atomic_store_n(&profile_enabled, true, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&profile_mutex);
+}
+
+void ufa_repo_profile_disable()
+{
+	pthread_mutex_lock(&profile_mutex);
+	__atomic_store_n(&profile_enabled, false, __ATOMIC_RELEASE);
+	profile_slowlog = NULL;
+	pthread_mutex_unlock(&profile_mutex);
+}
+
+
+/* ========================================================================== */
+/* FUNCTIONS OF THE BACKEND (repo_backend.h)                                  */
+/* ========================================================================== */
+
+static ufa_repo_t *sqlite_open(const char *repository, struct ufa_error **error)
+{
+	char *filepath =
+	    ufa_util_joinpath(repository, REPOSITORY_FILENAME, NULL);
+	ufa_debug("Opening SQLite db '%s'", filepath);
+	sqlite_repo_t *repo = open_sqlite_conn(filepath, error);
+	if (repo != NULL) {
+		sqlite3_exec(repo->db, "PRAGMA foreign_keys = ON", 0, 0, 0);
+		sqlite3_exec(repo->db, "PRAGMA recursive_triggers = ON", 0, 0,
+			     0);
+	}
 	ufa_free(filepath);
-	return repo;
+	return (ufa_repo_t *) repo;
 }
 
-char *ufa_repo_getrepopath(const ufa_repo_t *repo)
+static void sqlite_close(ufa_repo_t *base)
 {
-	ufa_return_val_ifnot(repo, NULL);
-	return ufa_str_dup(repo->repository_path);
+	sqlite_repo_t *repo = (sqlite_repo_t *) base;
+	stmt_cache_free(repo->cache);
+	sqlite3_close(repo->explain_db);
+	pthread_mutex_destroy(&repo->explain_mutex);
+	sqlite3_close(repo->db);
+	ufa_free(repo->name);
+	ufa_free(repo);
 }
 
-struct ufa_list *ufa_repo_listtags(const ufa_repo_t *repo,
-                                   struct ufa_error **error)
+static struct ufa_list *sqlite_listtags(const ufa_repo_t *base,
+					struct ufa_error **error)
 {
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
 	ufa_return_val_iferror(error, NULL);
 
 	// FIXME check repo null
@@ -229,54 +691,31 @@ sqlite_error:
 }
 
 
-bool ufa_repo_isatag(const ufa_repo_t *repo,
-                     const char *path,
-                     struct ufa_error **error)
+static bool sqlite_isatag(const ufa_repo_t *base,
+			  const char *path,
+			  struct ufa_error **error)
 {
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
 	ufa_return_val_iferror(error, false);
 
 	char *last_part = ufa_util_getfilename(path);
-	bool ret = (ufa_repo_get_realfilepath(repo, path, NULL) == NULL &&
+	bool ret = (ufa_repo_get_realfilepath(base, path, NULL) == NULL &&
 		    get_tag_id_by_name(repo, last_part, error) > 0);
 	ufa_free(last_part);
 	return ret;
 }
 
-char *ufa_repo_get_realfilepath(const ufa_repo_t *repo,
-	                            const char *path,
-				                struct ufa_error **error)
-{
-	ufa_return_val_iferror(error, NULL);
-	/* FIXME remove error? */
-	// FIXME check if filepath is in repo?
-	char *result = NULL;
-	char *last_part = ufa_util_getfilename(path);
-
-	char *filepath = ufa_util_joinpath(repo->repository_path,
-					   last_part,
-					   NULL);
-
-	if (ufa_util_isfile(filepath)) {
-		result = filepath;
-	} else {
-		ufa_free(filepath);
-		result = NULL;
-	}
-
-	ufa_free(last_part);
-	return result;
-}
-
-struct ufa_list *ufa_repo_listfiles(const ufa_repo_t *repo,
-                                    const char *dirpath,
-				    struct ufa_error **error)
+static struct ufa_list *sqlite_listfiles(const ufa_repo_t *base,
+					 const char *dirpath,
+					 struct ufa_error **error)
 {
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
 	ufa_return_val_iferror(error, NULL);
 
 	struct ufa_list *list = NULL;
 	if (ufa_str_equals(dirpath, "/")) {
 		/* FIXME cache. it is better to clone all_tags */
-		list = ufa_repo_listtags(repo, error);
+		list = ufa_repo_listtags(base, error);
 	} else {
 		struct ufa_list *list_of_tags = ufa_str_split(dirpath, "/");
 		// get all files with tags
@@ -285,15 +724,16 @@ struct ufa_list *ufa_repo_listfiles(const ufa_repo_t *repo,
 	}
 
 	list = ufa_list_append2(list,
-				ufa_str_dup(REPOSITORY_INDICATOR_FILE_NAME),
+				ufa_str_dup(UFA_REPO_INDICATOR_FILE_NAME),
 				ufa_free);
 	return list;
 }
 
-struct ufa_list *ufa_repo_gettags(const ufa_repo_t *repo,
-                                  const char *filepath,
-                                  struct ufa_error **error)
+static struct ufa_list *sqlite_gettags(const ufa_repo_t *base,
+				       const char *filepath,
+				       struct ufa_error **error)
 {
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
 	ufa_goto_iferror(error, end);
 
 	ufa_debug("%s: '%s'", __func__, filepath);
@@ -332,15 +772,39 @@ end:
 	return result;
 }
 
+static ufa_hashtable_t *sqlite_gettags_many(const ufa_repo_t *base,
+					    struct ufa_list *filenames,
+					    struct ufa_error **error)
+{
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
+	ufa_return_val_iferror(error, NULL);
+
+	const char *sql = "SELECT DISTINCT f.name, t.name FROM file f "
+			  "JOIN file_tag ft ON ft.id_file = f.id "
+			  "JOIN tag t ON t.id = ft.id_tag "
+			  "%s ORDER BY f.name, t.name";
+
+	ufa_hashtable_t *result = UFA_HASHTABLE_STRING();
+	if (!query_files_many(repo, sql, filenames, add_row_tag, result,
+			      error)) {
+		ufa_hashtable_free(result);
+		result = NULL;
+	}
+
+	return result;
+}
+
 /**
  * Negative values on error
  */
-int ufa_repo_inserttag(const ufa_repo_t *repo,
-                       const char *tag,
-                       struct ufa_error **error)
+static int sqlite_inserttag(const ufa_repo_t *base,
+			    const char *tag,
+			    struct ufa_error **error)
 {
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
 	ufa_return_val_iferror(error, -1);
-	ufa_debug("insertag: repo='%s' tag='%s'", repo->repository_path, tag);
+	ufa_debug("insertag: repo='%s' tag='%s'", repo->base.repository_path,
+		  tag);
 
 	int tag_id = get_tag_id_by_name(repo, tag, error);
 	sqlite3_stmt *stmt = NULL;
@@ -356,19 +820,20 @@ int ufa_repo_inserttag(const ufa_repo_t *repo,
 	return tag_id;
 }
 
-bool ufa_repo_settag(const ufa_repo_t *repo,
-                     const char *filepath,
-                     const char *tag,
-                     struct ufa_error **error)
+static bool sqlite_settag(const ufa_repo_t *base,
+			  const char *filepath,
+			  const char *tag,
+			  struct ufa_error **error)
 {
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
 	bool status = false;
 	ufa_goto_iferror(error, end);
 
 	ufa_debug("Setting tag '%s' for file '%s' (repo: '%s')", tag,
-		filepath, repo->repository_path);
+		filepath, repo->base.repository_path);
 	char *filename = ufa_util_getfilename(filepath);
 
-	int tag_id = ufa_repo_inserttag(repo, tag, error);
+	int tag_id = ufa_repo_inserttag(base, tag, error);
 
 	if (tag_id < 0) {
 		goto freeres;
@@ -387,10 +852,11 @@ end:
 	return status;
 }
 
-bool ufa_repo_cleartags(const ufa_repo_t *repo,
-                        const char *filepath,
-                        struct ufa_error **error)
+static bool sqlite_cleartags(const ufa_repo_t *base,
+			     const char *filepath,
+			     struct ufa_error **error)
 {
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
 	ufa_return_val_iferror(error, false);
 
 	int r = 0;
@@ -415,7 +881,7 @@ bool ufa_repo_cleartags(const ufa_repo_t *repo,
 	if (r != SQLITE_DONE) {
 		ufa_error_new(error, UFA_ERROR_DATABASE,
 		             "sqlite3_step error on %s for repo '%s': %d",
-		             __func__, repo->repository_path, r);
+		             __func__, repo->base.repository_path, r);
 
 		goto freeres;
 	}
@@ -426,11 +892,12 @@ end:
 	return status;
 }
 
-bool ufa_repo_unsettag(const ufa_repo_t *repo,
-                       const char *filepath,
-                       const char *tag,
-                       struct ufa_error **error)
+static bool sqlite_unsettag(const ufa_repo_t *base,
+			    const char *filepath,
+			    const char *tag,
+			    struct ufa_error **error)
 {
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
 	bool status = 0;
 	sqlite3_stmt *stmt = NULL;
 	const char *sql_delete = "DELETE FROM file_tag WHERE id_file = ? AND "
@@ -460,201 +927,352 @@ end:
 	return status;
 }
 
-struct ufa_repo_filterattr *
-ufa_repo_filterattr_new(const char *attribute, const char *value,
-			enum ufa_repo_matchmode match_mode)
-{
-	struct ufa_repo_filterattr *ptr = ufa_calloc(1, sizeof *ptr);
-	ptr->attribute = ufa_str_dup(attribute);
-	ptr->value = (value == NULL) ? NULL : ufa_str_dup(value);
-	ptr->matchmode = match_mode;
-	return ptr;
-}
-
-void ufa_repo_filterattr_free(struct ufa_repo_filterattr *filter)
-{
-	if (filter != NULL) {
-		ufa_free(filter->attribute);
-		ufa_free(filter->value);
-		ufa_free(filter);
-	}
-}
-
-struct ufa_list *ufa_repo_search(const ufa_repo_t *repo,
-                                 struct ufa_list *filter_attr,
-				 struct ufa_list *tags,
-				 struct ufa_error **error)
+static struct ufa_list *sqlite_search_page(const ufa_repo_t *base,
+					   struct ufa_list *filter_attr,
+					   struct ufa_list *tags,
+					   const struct ufa_repo_page *page,
+					   char **last_key,
+					   struct ufa_error **error)
 {
-	ufa_debug("%s: %s",
-		  __func__,
-		  ((struct ufa_repo *) repo)->repository_path);
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
+	uint64_t start = ufa_stats_now();
 
 	struct ufa_list *result_list_names = NULL;
+	struct page_key after = {0};
 
+	if (last_key != NULL) {
+		*last_key = NULL;
+	}
 	ufa_goto_iferror(error, end);
 
 	int count_tags = ufa_list_size(tags);
 	int count_attrs = ufa_list_size(filter_attr);
 
-	if (count_tags == 0 && count_attrs == 0) {
-		ufa_error_new(error, UFA_ERROR_ARGS,
-			      "you must search for tags or attributes");
-		return NULL;
+	const struct ufa_repo_page all = {.sort = UFA_REPO_SORT_NONE};
+	page = (page != NULL) ? page : &all;
+	if (!parse_page(page, &after, error)) {
+		goto end;
+	}
+	struct page_sql sql_page = page_sql(page, after.value != NULL);
+
+	unsigned indexes = 0;
+	for (UFA_LIST_EACH(i, filter_attr)) {
+		struct ufa_repo_filterattr *attr =
+		    (struct ufa_repo_filterattr *) i->data;
+		if (uses_index(attr->matchmode, attr->value)) {
+			indexes = optional_indexes(repo);
+			break;
+		}
 	}
+
 	char *sql_search_tags = generate_sql_search_tags(tags);
-	char *sql_search_attrs = generate_sql_search_attrs(filter_attr);
+	char *sql_search_attrs = generate_sql_search_attrs(filter_attr, indexes);
+
+	// files found by UFA_REPO_FULLTEXT are ordered by relevance (bm25),
+	// unless the page has another order
+	char *rank_query = NULL;
+	const char *sql_rank = "";
+	const char *sql_order = sql_page.order;
+	if ((indexes & INDEX_FULLTEXT) && page->sort == UFA_REPO_SORT_NONE) {
+		rank_query = fulltext_rank_query(filter_attr);
+	}
+	if (rank_query != NULL) {
+		sql_rank = " LEFT JOIN (SELECT rowid AS id, "
+			   "bm25(" FULLTEXT_TABLE ") AS score "
+			   "FROM " FULLTEXT_TABLE " "
+			   "WHERE " FULLTEXT_TABLE " MATCH ?) r ON r.id = a.id";
+		sql_order = " ORDER BY MIN(r.score)";
+	}
 
 	char *full_sql = NULL;
 
 	if (count_tags && !count_attrs) {
 		ufa_debug("Searching by tags");
-		char *sql_tags = "SELECT f.id,f.name FROM file f WHERE %s";
-		full_sql = ufa_str_sprintf(sql_tags, sql_search_tags);
+		char *sql_tags = "SELECT f.id,f.name%s FROM file f%s "
+				 "WHERE %s%s%s%s";
+		full_sql = ufa_str_sprintf(sql_tags, sql_page.select,
+					   sql_page.from, sql_page.where,
+					   sql_search_tags, sql_order,
+					   sql_page.limit);
 	} else if (!count_tags && count_attrs) {
 		ufa_debug("Searching by attributes");
-		char *sql_attrs = "SELECT f.id,f.name FROM file f,attribute a "
-				  "WHERE a.id_file=f.id %s";
-		full_sql = ufa_str_sprintf(sql_attrs, sql_search_attrs);
+		char *sql_attrs = "SELECT f.id,f.name%s FROM file f%s,"
+				  "attribute a%s WHERE %sa.id_file=f.id %s%s%s";
+		full_sql = ufa_str_sprintf(sql_attrs, sql_page.select,
+					   sql_page.from, sql_rank,
+					   sql_page.where, sql_search_attrs,
+					   sql_order, sql_page.limit);
 	} else if (count_tags && count_attrs) {
 		ufa_debug("Searching by tags and attributes");
 		char *sql_tags_attrs =
-		    "SELECT f.id,f.name FROM file f,attribute a WHERE  %s  AND "
-		    "a.id_file=f.id %s";
-		full_sql = ufa_str_sprintf(sql_tags_attrs, sql_search_tags,
-					   sql_search_attrs);
+		    "SELECT f.id,f.name%s FROM file f%s,attribute a%s WHERE "
+		    "%s%s AND a.id_file=f.id %s%s%s";
+		full_sql = ufa_str_sprintf(sql_tags_attrs, sql_page.select,
+					   sql_page.from, sql_rank,
+					   sql_page.where, sql_search_tags,
+					   sql_search_attrs, sql_order,
+					   sql_page.limit);
 	}
 
 	ufa_debug("SQL: %s", full_sql);
 
 	sqlite3_stmt *stmt = NULL;
-	if (!db_prepare(repo, &stmt, full_sql, error)) {
+	if (!db_prepare_cached(repo, &stmt, full_sql, error)) {
 		goto freeres;
 	}
 
-	// filling tag parameters
-	int x = 1;
-
-	// filling tag parameters
-	if (count_tags) {
-		for (UFA_LIST_EACH(iter_tags, tags)) {
-			sqlite3_bind_text(stmt, x++, (char *)iter_tags->data,
-					  -1, NULL);
-		}
-		sqlite3_bind_int(stmt, x++, count_tags);
+	// parameters in the order of the SQL: FROM, WHERE and LIMIT
+	int x = bind_page_from(stmt, 1, page);
+	if (rank_query != NULL) {
+		sqlite3_bind_text(stmt, x++, rank_query, -1, NULL);
 	}
+	x = bind_page_after(stmt, x, page, &after);
+	x = bind_search(stmt, x, filter_attr, tags, indexes);
 
-	// filling attrs parameters
-	if (count_attrs) {
-		for (UFA_LIST_EACH(i, filter_attr)) {
-			struct ufa_repo_filterattr *attr =
-			    (struct ufa_repo_filterattr *)i->data;
-			sqlite3_bind_text(stmt, x++, attr->attribute, -1, NULL);
-			ufa_debug("Bind attr: %s", attr->attribute);
-			if (attr->value != NULL) {
-				char *value = ufa_str_dup(attr->value);
-				if (attr->matchmode == UFA_REPO_WILDCARD) {
-					ufa_str_replace(value, '*', '%');
-				}
-				sqlite3_bind_text(stmt, x++, value, -1,
-						  SQLITE_TRANSIENT);
-				ufa_debug("Bind value: %s", value);
-				ufa_free(value);
-			}
-		}
-		sqlite3_bind_int(stmt, x++, count_attrs);
-		ufa_debug("Bind count attrs: %d", count_attrs);
+	if (page->limit > 0) {
+		sqlite3_bind_int(stmt, x++, page->limit);
 	}
 
-	int r;
-	while ((r = sqlite3_step(stmt)) == SQLITE_ROW) {
-		const char *filename =
-		    ufa_str_dup((const char *) sqlite3_column_text(stmt, 1));
-		ufa_debug("found file: %s\n", filename);
-		result_list_names = ufa_list_append2(result_list_names,
-						     filename,
-						     ufa_free);
-	}
+	result_list_names = read_page(stmt, page, last_key, NULL);
 
 freeres:
-	sqlite3_finalize(stmt);
+	explain_statement(repo, "search", stmt, start,
+			  ufa_list_size(result_list_names));
+	db_release(repo, stmt, full_sql);
 	ufa_free(sql_search_tags);
 	ufa_free(sql_search_attrs);
+	ufa_free(rank_query);
 	ufa_free(full_sql);
 	ufa_debug("Search result: %p", result_list_names);
 end:
+	page_key_clear(&after);
 	return result_list_names;
 }
 
-bool ufa_repo_setattr(const ufa_repo_t *repo,
-		      const char *filepath,
-		      const char *attribute,
-		      const char *value,
-		      struct ufa_error **error)
+static struct ufa_list *sqlite_query_page(const ufa_repo_t *base,
+					  const struct ufa_query *query,
+					  const struct ufa_repo_page *page,
+					  char **last_key,
+					  struct ufa_error **error)
 {
-	sqlite3_stmt *stmt = NULL;
-	bool status = false;
-	const char *sql =
-	    "INSERT OR REPLACE INTO attribute(id, id_file, name, value) "
-	    "VALUES((SELECT id FROM attribute WHERE id_file=? AND name=?), ?, "
-	    "?, ?)";
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
+	uint64_t start = ufa_stats_now();
+	struct ufa_list *result = NULL;
+	sqlite3_stmt *stmt      = NULL;
+	char *sql               = NULL;
+	struct page_key after   = {0};
 
+	if (last_key != NULL) {
+		*last_key = NULL;
+	}
 	ufa_goto_iferror(error, end);
 
-	int file_id;
-	if (!(file_id = get_file_id(repo, filepath, error))) {
-		goto freeres;
+	const struct ufa_repo_page all = {.sort = UFA_REPO_SORT_NONE};
+	page = (page != NULL) ? page : &all;
+	if (!parse_page(page, &after, error)) {
+		goto end;
 	}
+	struct page_sql sql_page = page_sql(page, after.value != NULL);
 
-	ufa_debug("SQL for function '%s': %s", __func__, sql);
+	unsigned indexes = query_uses_index(query) ? optional_indexes(repo) : 0;
+	struct ufa_str_builder sql_query = UFA_STR_BUILDER_INIT;
+	ufa_str_builder_appendf(&sql_query, "SELECT f.id,f.name%s FROM file f%s "
+				"WHERE %s", sql_page.select, sql_page.from,
+				sql_page.where);
+	generate_sql_query(query, indexes, &sql_query);
+	ufa_str_builder_append(&sql_query, sql_page.order);
+	ufa_str_builder_append(&sql_query, sql_page.limit);
+	sql = ufa_str_builder_take(&sql_query);
+	ufa_debug("SQL: %s", sql);
 
-	if (!db_prepare(repo, &stmt, sql, error)) {
+	if (!db_prepare_cached(repo, &stmt, sql, error)) {
 		goto freeres;
 	}
-
-	sqlite3_bind_int(stmt, 1, file_id);
-	sqlite3_bind_text(stmt, 2, attribute, -1, NULL);
-	sqlite3_bind_int(stmt, 3, file_id);
-	sqlite3_bind_text(stmt, 4, attribute, -1, NULL);
-	sqlite3_bind_text(stmt, 5, value, -1, NULL);
-
-	if (!db_execute(repo, stmt, error)) {
-		goto freeres;
+	int x = bind_page_from(stmt, 1, page);
+	x = bind_page_after(stmt, x, page, &after);
+	x = bind_query(stmt, query, x, indexes);
+	if (page->limit > 0) {
+		sqlite3_bind_int(stmt, x++, page->limit);
 	}
 
-	status = true;
+	int r;
+	result = read_page(stmt, page, last_key, &r);
+	if (r != SQLITE_DONE) {
+		ufa_error_new(error, UFA_ERROR_DATABASE,
+			      "sqlite3_step error on %s for repo '%s': %d",
+			      __func__, repo->base.repository_path, r);
+		ufa_list_free(result);
+		result = NULL;
+		if (last_key != NULL) {
+			ufa_free(*last_key);
+			*last_key = NULL;
+		}
+	}
 
 freeres:
-	sqlite3_finalize(stmt);
+	explain_statement(repo, "query", stmt, start, ufa_list_size(result));
+	db_release(repo, stmt, sql);
+	ufa_free(sql);
 end:
-	return status;
+	page_key_clear(&after);
+	return result;
 }
 
-
-
-bool ufa_repo_unsetattr(const ufa_repo_t *repo,
-			const char *filepath,
-			const char *attribute,
-			struct ufa_error **error)
+static struct ufa_list *sqlite_facets(const ufa_repo_t *base,
+				      struct ufa_list *filter_attr,
+				      struct ufa_list *tags,
+				      bool attrs,
+				      struct ufa_error **error)
 {
-	sqlite3_stmt *stmt = NULL;
-	bool status = false;
-	const char *sql = "DELETE from attribute WHERE id_file=? AND name=?";
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
+	ufa_return_val_iferror(error, NULL);
+	uint64_t start = ufa_stats_now();
+
+	// files found (m), joined with their tags other than the ones searched
+	// and with their attributes
+	const char *sql = "WITH m(id) AS (%s) "
+			  "SELECT 0 AS kind, t.name AS name, NULL AS value, "
+			  "COUNT(*) FROM m, file_tag ft, tag t "
+			  "WHERE ft.id_file = m.id AND t.id = ft.id_tag%s "
+			  "GROUP BY t.id%s "
+			  "ORDER BY kind, name, value";
+	const char *sql_attrs = " UNION ALL "
+				"SELECT 1, a.name, a.value, COUNT(*) "
+				"FROM m, attribute a WHERE a.id_file = m.id "
+				"GROUP BY a.name, a.value";
 
-	ufa_goto_iferror(error, end);
+	struct ufa_list *result = NULL;
+	sqlite3_stmt *stmt = NULL;
 
-	int file_id;
-	if (!(file_id = get_file_id(repo, filepath, error))) {
-		goto freeres;
+	unsigned indexes = 0;
+	for (UFA_LIST_EACH(i, filter_attr)) {
+		struct ufa_repo_filterattr *attr = i->data;
+		if (uses_index(attr->matchmode, attr->value)) {
+			indexes = optional_indexes(repo);
+			break;
+		}
 	}
 
-	ufa_debug("SQL for function '%s': %s", __func__, sql);
+	char *sql_files = generate_sql_search_files(filter_attr, tags, indexes);
+	char *sql_tags_args = sql_in_list(tags);
+	char *sql_other_tags =
+	    (tags != NULL)
+		? ufa_str_sprintf(" AND t.name NOT IN %s", sql_tags_args)
+		: ufa_str_dup("");
+	char *full_sql = ufa_str_sprintf(sql, sql_files, sql_other_tags,
+					 attrs ? sql_attrs : "");
+	ufa_debug("SQL: %s", full_sql);
 
-	if (!db_prepare(repo, &stmt, sql, error)) {
-		goto freeres;
+	if (!db_prepare_cached(repo, &stmt, full_sql, error)) {
+		goto end;
 	}
 
-	sqlite3_bind_int(stmt, 1, file_id);
-	sqlite3_bind_text(stmt, 2, attribute, -1, NULL);
+	int x = bind_search(stmt, 1, filter_attr, tags, indexes);
+	bind_in_list(stmt, x, tags);
+
+	int rc;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		struct ufa_repo_facet *facet = ufa_calloc(1, sizeof *facet);
+		facet->name =
+		    ufa_str_dup((const char *) sqlite3_column_text(stmt, 1));
+		if (sqlite3_column_type(stmt, 2) != SQLITE_NULL) {
+			facet->value = ufa_str_dup(
+			    (const char *) sqlite3_column_text(stmt, 2));
+		}
+		facet->count = sqlite3_column_int(stmt, 3);
+		result = ufa_list_prepend2(
+		    result, facet, (ufa_list_free_fn_t) ufa_repo_facet_free);
+	}
+	if (rc != SQLITE_DONE) {
+		ufa_error_new(error, UFA_ERROR_DATABASE, "%s",
+			      sqlite3_errmsg(repo->db));
+	}
+	result = ufa_list_reverse(result);
+
+end:
+	explain_statement(repo, "facets", stmt, start, ufa_list_size(result));
+	db_release(repo, stmt, full_sql);
+	ufa_free(sql_files);
+	ufa_free(sql_tags_args);
+	ufa_free(sql_other_tags);
+	ufa_free(full_sql);
+	return result;
+}
+
+static bool sqlite_setattr(const ufa_repo_t *base,
+			   const char *filepath,
+			   const char *attribute,
+			   const char *value,
+			   struct ufa_error **error)
+{
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
+	sqlite3_stmt *stmt = NULL;
+	bool status = false;
+	const char *sql =
+	    "INSERT OR REPLACE INTO attribute(id, id_file, name, value, "
+	    "value_num, value_time) "
+	    "VALUES((SELECT id FROM attribute WHERE id_file=? AND name=?), ?, "
+	    "?, ?, ?, ?)";
+
+	ufa_goto_iferror(error, end);
+
+	int file_id;
+	if (!(file_id = get_file_id(repo, filepath, error))) {
+		goto freeres;
+	}
+
+	ufa_debug("SQL for function '%s': %s", __func__, sql);
+
+	if (!db_prepare(repo, &stmt, sql, error)) {
+		goto freeres;
+	}
+
+	sqlite3_bind_int(stmt, 1, file_id);
+	sqlite3_bind_text(stmt, 2, attribute, -1, NULL);
+	sqlite3_bind_int(stmt, 3, file_id);
+	sqlite3_bind_text(stmt, 4, attribute, -1, NULL);
+	sqlite3_bind_text(stmt, 5, value, -1, NULL);
+	bind_typed_columns(stmt, 6, value);
+
+	if (!db_execute(repo, stmt, error)) {
+		goto freeres;
+	}
+
+	status = true;
+
+freeres:
+	sqlite3_finalize(stmt);
+end:
+	return status;
+}
+
+
+
+static bool sqlite_unsetattr(const ufa_repo_t *base,
+			     const char *filepath,
+			     const char *attribute,
+			     struct ufa_error **error)
+{
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
+	sqlite3_stmt *stmt = NULL;
+	bool status = false;
+	const char *sql = "DELETE from attribute WHERE id_file=? AND name=?";
+
+	ufa_goto_iferror(error, end);
+
+	int file_id;
+	if (!(file_id = get_file_id(repo, filepath, error))) {
+		goto freeres;
+	}
+
+	ufa_debug("SQL for function '%s': %s", __func__, sql);
+
+	if (!db_prepare(repo, &stmt, sql, error)) {
+		goto freeres;
+	}
+
+	sqlite3_bind_int(stmt, 1, file_id);
+	sqlite3_bind_text(stmt, 2, attribute, -1, NULL);
 
 	if (!db_execute(repo, stmt, error)) {
 		goto freeres;
@@ -671,10 +1289,11 @@ end:
 	return status;
 }
 
-struct ufa_list *ufa_repo_getattr(const ufa_repo_t *repo,
-				  const char *filepath,
-				  struct ufa_error **error)
+static struct ufa_list *sqlite_getattr(const ufa_repo_t *base,
+				       const char *filepath,
+				       struct ufa_error **error)
 {
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
 	struct ufa_list *result_list_attrs = NULL;
 	sqlite3_stmt *stmt = NULL;
 	const char *sql = "SELECT name,value FROM attribute WHERE id_file=?";
@@ -714,111 +1333,100 @@ end:
 	return result_list_attrs;
 }
 
-// FIXME rename ?
-void ufa_repo_free(ufa_repo_t *repo)
-{
-	if (repo != NULL) {
-		sqlite3_close(repo->db);
-		ufa_free(repo->name);
-		ufa_free(repo->repository_path);
-		ufa_free(repo);
-	}
-}
-
-char *ufa_repo_getrepofolderfor(const char *filepath, struct ufa_error **error)
+static ufa_hashtable_t *sqlite_getattr_many(const ufa_repo_t *base,
+					    struct ufa_list *filenames,
+					    struct ufa_error **error)
 {
-	FILE *file_read     = NULL;
-	char *dirname       = NULL;
-	char *repodb_file   = NULL;
-	char *repo_ind_file = NULL;
-	char *repofile      = NULL;
-	char *repository    = NULL;
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
+	ufa_return_val_iferror(error, NULL);
 
-	ufa_goto_iferror(error, end);
+	const char *sql = "SELECT f.name, a.name, a.value FROM file f "
+			  "JOIN attribute a ON a.id_file = f.id "
+			  "%s ORDER BY f.name, a.name";
 
-	// Get dir
-	if (ufa_util_isdir(filepath)) {
-		dirname = ufa_str_dup(filepath);
-	} else if (ufa_util_isfile(filepath)) {
-		dirname = ufa_util_dirname(filepath);
-	} else {
-		ufa_error_new(error, UFA_ERROR_FILE,
-			      "%s is not a file", filepath);
-		goto freeres;
+	ufa_hashtable_t *result = UFA_HASHTABLE_STRING();
+	if (!query_files_many(repo, sql, filenames, add_row_attr, result,
+			      error)) {
+		ufa_hashtable_free(result);
+		result = NULL;
 	}
 
+	return result;
+}
 
-	repo_ind_file = ufa_util_joinpath(
-	    dirname, REPOSITORY_INDICATOR_FILE_NAME, NULL);
+// FIXME rename ?
+static bool sqlite_begin(ufa_repo_t *base, struct ufa_error **error)
+{
+	sqlite_repo_t *repo = (sqlite_repo_t *) base;
+	ufa_return_val_iferror(error, false);
 
-	// Read real repo file from INDICATOR file
-	if (ufa_util_isfile(repo_ind_file)) {
-		file_read = fopen(repo_ind_file, "r");
-		char linebuf[1024];
-		if (fgets(linebuf, 1024, file_read) != NULL) {
-			char *line = ufa_str_trim(linebuf);
-			repository = ufa_str_dup(line);
-		} else {
-			perror("fgets"); // FIXME
-			goto freeres;
-		}
-	} else {
-		// OR try get repo .db file
-		repodb_file =
-		    ufa_util_joinpath(dirname, REPOSITORY_FILENAME, NULL);
-		if (ufa_util_isfile(repodb_file)) {
-			repository = ufa_str_dup(dirname);
-		}
+	int rc = sqlite3_exec(repo->db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		ufa_error_new(error, UFA_ERROR_DATABASE,
+			      "could not begin transaction: %s",
+			      sqlite3_errmsg(repo->db));
+		return false;
 	}
+	return true;
+}
 
-	if (repository == NULL) {
-		ufa_error_new(error, UFA_ERROR_FILE,
-			      "not found repo for: %s", filepath);
-		goto freeres;
-	}
+static bool sqlite_commit(ufa_repo_t *base, struct ufa_error **error)
+{
+	sqlite_repo_t *repo = (sqlite_repo_t *) base;
+	ufa_return_val_iferror(error, false);
 
-freeres:
-	if (file_read != NULL) {
-		fclose(file_read);
+	int rc = sqlite3_exec(repo->db, "COMMIT;", NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		ufa_error_new(error, UFA_ERROR_DATABASE,
+			      "could not commit transaction: %s",
+			      sqlite3_errmsg(repo->db));
+		// otherwise every later write would join the open transaction
+		sqlite3_exec(repo->db, "ROLLBACK;", NULL, NULL, NULL);
+		return false;
 	}
-	ufa_free(repofile);
-	ufa_free(dirname);
-	ufa_free(repodb_file);
-	ufa_free(repo_ind_file);
-end:
-	return repository;
+	return true;
 }
 
-
-
-
-void ufa_repo_attr_free(struct ufa_repo_attr *attr)
+static bool sqlite_set_trigram_index(ufa_repo_t *base, bool enabled,
+				     struct ufa_error **error)
 {
-	if (attr) {
-		ufa_free(attr->attribute);
-		ufa_free(attr->value);
-		ufa_free(attr);
-	}
+	sqlite_repo_t *repo = (sqlite_repo_t *) base;
+	return set_optional_index(
+	    repo, "trigram index",
+	    enabled ? STR_CREATE_FTS_INDEX(TRIGRAM_TABLE, "trigram")
+		    : STR_DROP_FTS_INDEX(TRIGRAM_TABLE),
+	    enabled, error);
 }
 
-bool ufa_repo_isrepo(char *directory)
+static bool sqlite_has_trigram_index(const ufa_repo_t *base)
 {
-	if (!ufa_util_isdir(directory)) {
-		return false;
-	}
-	char *fpath = ufa_util_joinpath(directory, REPOSITORY_FILENAME, NULL);
-
-	bool ret = ufa_util_isfile(fpath);
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
+	return has_table(repo, TRIGRAM_TABLE);
+}
 
-	ufa_free(fpath);
+static bool sqlite_set_fulltext_index(ufa_repo_t *base, bool enabled,
+				      struct ufa_error **error)
+{
+	sqlite_repo_t *repo = (sqlite_repo_t *) base;
+	return set_optional_index(
+	    repo, "full-text index",
+	    enabled ? STR_CREATE_FTS_INDEX(FULLTEXT_TABLE,
+					   "unicode61 remove_diacritics 2")
+		    : STR_DROP_FTS_INDEX(FULLTEXT_TABLE),
+	    enabled, error);
+}
 
-	return ret;
+static bool sqlite_has_fulltext_index(const ufa_repo_t *base)
+{
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
+	return has_table(repo, FULLTEXT_TABLE);
 }
 
-bool ufa_repo_removefile(const ufa_repo_t *repo,
-			 const char *filepath,
-			 struct ufa_error **error)
+static bool sqlite_removefile(const ufa_repo_t *base,
+			      const char *filepath,
+			      struct ufa_error **error)
 {
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
 	sqlite3_stmt *stmt = NULL;
 	bool status = false;
 	const char *sql = "DELETE FROM file WHERE id=?";
@@ -843,54 +1451,293 @@ bool ufa_repo_removefile(const ufa_repo_t *repo,
 	int affected = sqlite3_changes(repo->db);
 	status = (affected == 1);
 end:
+	sqlite3_finalize(stmt);
+	return status;
+}
+
+static bool sqlite_updatefile(const ufa_repo_t *base,
+			      const char *filepath,
+			      struct ufa_error **error)
+{
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
+	sqlite3_stmt *stmt = NULL;
+	char *filename = NULL;
+	bool status = false;
+	// files not in db are not inserted (as get_file_id does)
+	const char *sql = "UPDATE file SET dev=?, ino=?, mtime=?, size=? "
+			  "WHERE name=?";
+
+	ufa_goto_iferror(error, end);
+
+	if (!db_prepare(repo, &stmt, sql, error)) {
+		goto end;
+	}
+	filename = ufa_util_getfilename(filepath);
+	bind_file_stat(stmt, 1, filepath);
+	sqlite3_bind_text(stmt, 5, filename, -1, NULL);
+	if (db_execute(repo, stmt, error)) {
+		status = (sqlite3_changes(repo->db) == 1);
+	}
+end:
+	sqlite3_finalize(stmt);
+	ufa_free(filename);
 	return status;
 }
 
 
-bool ufa_repo_renamefile(const ufa_repo_t *repo_old,
-                         const ufa_repo_t *repo_new,
-			 const char *oldfilepath,
-			 const char *newfilepath,
-			 struct ufa_error **error)
+static bool sqlite_sync(const ufa_repo_t *base,
+			int *renamed,
+			int *removed,
+			struct ufa_error **error)
 {
+	const sqlite_repo_t *repo = (const sqlite_repo_t *) base;
+	sqlite3_stmt *stmt        = NULL;
+	sqlite3_stmt *stmt_stat   = NULL;
+	sqlite3_stmt *stmt_rename = NULL;
+	struct dir_entry *entries = NULL;
+	ufa_hashtable_t *missing  = NULL;
+	bool status               = false;
+	bool own_transaction      = false;
+	size_t n                  = 0;
+	dev_t dev                 = 0;
+	int count_renamed         = 0;
+	int count_removed         = 0;
+	const char *sql_select    = "SELECT f.id, f.name, f.dev, f.ino, f.mtime, "
+				    "f.size FROM file f ORDER BY f.name";
+	const char *sql_inode     = "SELECT f.id, f.mtime, f.size FROM file f "
+				    "WHERE f.dev = ? AND f.ino = ?";
+	const char *sql_stat      = "UPDATE file SET dev=?, ino=?, mtime=?, "
+				    "size=? WHERE id=?";
+	const char *sql_rename    = "UPDATE file SET name=? WHERE id=?";
+	const char *sql_delete    = "DELETE FROM file WHERE id=?";
+
 	ufa_goto_iferror(error, end);
 
-	sqlite3_stmt *stmt = NULL;
-	char *new_filename = NULL;
-	bool status        = false;
-	const char *sql    = "UPDATE file SET name=? WHERE id=?";
+	entries = read_dir_entries(repo->base.repository_path, &n, &dev, error);
+	ufa_goto_iferror(error, freeres);
 
-	int file_id;
-	if (!(file_id = get_file_id(repo_new, oldfilepath, error))) {
+	// every update in one transaction, unless it is done in one already
+	// (see ufa_repo_begin)
+	if (sqlite3_get_autocommit(repo->db)) {
+		if (!sqlite_begin((ufa_repo_t *) base, error)) {
+			goto freeres;
+		}
+		own_transaction = true;
+	}
+
+	// missing files: id -> name
+	missing = ufa_hashtable_new((ufa_hash_fn_t) int_hash,
+				    (ufa_hash_equal_fn_t) int_equals,
+				    ufa_free, ufa_free);
+
+	// merge of files in db and entries, both sorted by name
+	if (!db_prepare(repo, &stmt, sql_select, error)) {
+		goto freeres;
+	}
+	size_t k = 0;
+	int r;
+	while ((r = sqlite3_step(stmt)) == SQLITE_ROW) {
+		int id = sqlite3_column_int(stmt, 0);
+		const char *name = (const char *) sqlite3_column_text(stmt, 1);
+		int cmp = 1;
+		while (k < n && (cmp = strcmp(entries[k].name, name)) < 0) {
+			k++;
+		}
+		if (k < n && cmp == 0) {
+			entries[k].in_db = true;
+			if (sqlite3_column_type(stmt, 3) == SQLITE_NULL
+			    || sqlite3_column_int64(stmt, 2) != (sqlite3_int64) dev
+			    || sqlite3_column_int64(stmt, 3)
+				   != (sqlite3_int64) entries[k].ino
+			    || stat_changed(repo->base.repository_path,
+					    entries[k].name,
+					    sqlite3_column_int64(stmt, 4),
+					    sqlite3_column_int64(stmt, 5))) {
+				// file replaced or modified (or from a db
+				// without inodes)
+				entries[k].stale_id = id;
+			}
+			k++;
+		} else {
+			ufa_debug("File '%s' no longer exists", name);
+			ufa_hashtable_put(missing, ufa_int_dup(id),
+					  ufa_str_dup(name));
+		}
+	}
+	sqlite3_finalize(stmt);
+	stmt = NULL;
+	if (r != SQLITE_DONE) {
+		ufa_error_new(error, UFA_ERROR_DATABASE,
+			      "sqlite3_step error on %s for repo '%s': %d",
+			      __func__, repo->base.repository_path, r);
 		goto freeres;
 	}
 
-	if (!db_prepare(repo_new, &stmt, sql, error)) {
+	if (!db_prepare(repo, &stmt_stat, sql_stat, error)) {
 		goto freeres;
 	}
+	for (size_t e = 0; e < n; e++) {
+		if (entries[e].stale_id <= 0) {
+			continue;
+		}
+		char *filepath = ufa_util_joinpath(repo->base.repository_path,
+						   entries[e].name, NULL);
+		execute_file_stat(repo, stmt_stat, entries[e].stale_id,
+				  filepath, error);
+		ufa_free(filepath);
+		ufa_goto_iferror(error, freeres);
+	}
 
-	new_filename = ufa_util_getfilename(newfilepath);
-	sqlite3_bind_text(stmt, 1, new_filename, -1, NULL);
-	sqlite3_bind_int(stmt, 2, file_id);
+	// entries not in db with the inode of a missing file were renamed
+	for (size_t e = 0; e < n && ufa_hashtable_size(missing) > 0; e++) {
+		if (entries[e].in_db) {
+			continue;
+		}
+		if (stmt == NULL && !db_prepare(repo, &stmt, sql_inode, error)) {
+			goto freeres;
+		}
+		sqlite3_reset(stmt);
+		sqlite3_bind_int64(stmt, 1, (sqlite3_int64) dev);
+		sqlite3_bind_int64(stmt, 2, (sqlite3_int64) entries[e].ino);
+		int id = 0;
+		sqlite3_int64 mtime = -1;
+		sqlite3_int64 size = -1;
+		if (sqlite3_step(stmt) == SQLITE_ROW) {
+			id = sqlite3_column_int(stmt, 0);
+			mtime = sqlite3_column_int64(stmt, 1);
+			size = sqlite3_column_int64(stmt, 2);
+		}
+		if (id <= 0 || !ufa_hashtable_has_key(missing, &id)) {
+			continue;
+		}
 
-	if (!db_execute(repo_new, stmt, error)) {
-		goto freeres;
+		// a rename keeps size and mtime: otherwise the inode was reused
+		// by another file, which must not get the tags of the missing
+		// one. The directory may also have changed since it was read.
+		char *filepath = ufa_util_joinpath(repo->base.repository_path,
+						   entries[e].name, NULL);
+		struct stat st;
+		if (stat(filepath, &st) != 0
+		    || (uint64_t) st.st_ino != entries[e].ino
+		    || (sqlite3_int64) st.st_mtime != mtime
+		    || (sqlite3_int64) st.st_size != size
+		    || dir_has_entry(repo->base.repository_path,
+				     ufa_hashtable_get(missing, &id))) {
+			ufa_free(filepath);
+			continue;
+		}
+
+		ufa_debug("File %d renamed to '%s'", id, filepath);
+		if (stmt_rename != NULL
+		    || db_prepare(repo, &stmt_rename, sql_rename, error)) {
+			sqlite3_reset(stmt_rename);
+			sqlite3_bind_text(stmt_rename, 1, entries[e].name, -1,
+					  NULL);
+			sqlite3_bind_int(stmt_rename, 2, id);
+			if (db_execute(repo, stmt_rename, error)
+			    && execute_file_stat(repo, stmt_stat, id, filepath,
+						 error)) {
+				ufa_hashtable_remove(missing, &id);
+				count_renamed++;
+			}
+		}
+		ufa_free(filepath);
+		ufa_goto_iferror(error, freeres);
 	}
+	sqlite3_finalize(stmt);
+	stmt = NULL;
+
+	struct ufa_list *keys = ufa_hashtable_keys(missing);
+	if (keys != NULL && db_prepare(repo, &stmt, sql_delete, error)) {
+		for (UFA_LIST_EACH(i, keys)) {
+			if (dir_has_entry(repo->base.repository_path,
+					  ufa_hashtable_get(missing, i->data))) {
+				continue;
+			}
+			sqlite3_reset(stmt);
+			sqlite3_bind_int(stmt, 1, *((int *) i->data));
+			if (!db_execute(repo, stmt, error)) {
+				break;
+			}
+			count_removed += sqlite3_changes(repo->db);
+		}
+	}
+	ufa_list_free(keys);
+	status = !HAS_ERROR(error);
 
-	int affected = sqlite3_changes(repo_new->db);
-	status = (affected == 1);
+freeres:
+	sqlite3_finalize(stmt);
+	sqlite3_finalize(stmt_stat);
+	sqlite3_finalize(stmt_rename);
+	if (own_transaction && status) {
+		status = sqlite_commit((ufa_repo_t *) base, error);
+	} else if (own_transaction) {
+		sqlite3_exec(repo->db, "ROLLBACK;", NULL, NULL, NULL);
+	}
+	if (!status) {
+		count_renamed = 0;
+		count_removed = 0;
+	}
+	free_dir_entries(entries, n);
+	ufa_hashtable_free(missing);
+	if (renamed != NULL) {
+		*renamed = count_renamed;
+	}
+	if (removed != NULL) {
+		*removed = count_removed;
+	}
+end:
+	return status;
+}
 
-	ufa_debug("Filename updated on new repo: '%s'", newfilepath);
 
-	// Copy tags, attributes, and remove file from old repo
-	// if repo_old != repo_new
+static bool sqlite_renamefile(const ufa_repo_t *repo_old,
+			      const ufa_repo_t *base_new,
+			      const char *oldfilepath,
+			      const char *newfilepath,
+			      struct ufa_error **error)
+{
+	const sqlite_repo_t *repo_new = (const sqlite_repo_t *) base_new;
+	bool status    = false;
+	ufa_goto_iferror(error, end);
+
+	sqlite3_stmt *stmt         = NULL;
+	char *new_filename         = NULL;
+	const char *sql            = "UPDATE file SET name=? WHERE id=?";
 	char *dirfileold           = NULL;
 	char *dirfilenew           = NULL;
 	struct ufa_list *tags      = NULL;
 	struct ufa_list *listattrs = NULL;
 	struct ufa_error *error2   = NULL;
 
-	dirfileold = ufa_util_dirname(oldfilepath);
+	int file_id;
+	if (!(file_id = get_file_id(repo_new, oldfilepath, error))) {
+		goto freeres;
+	}
+
+	if (!db_prepare(repo_new, &stmt, sql, error)) {
+		goto freeres;
+	}
+
+	new_filename = ufa_util_getfilename(newfilepath);
+	sqlite3_bind_text(stmt, 1, new_filename, -1, NULL);
+	sqlite3_bind_int(stmt, 2, file_id);
+
+	if (!db_execute(repo_new, stmt, error)) {
+		goto freeres;
+	}
+
+	int affected = sqlite3_changes(repo_new->db);
+	status = (affected == 1);
+	if (status) {
+		update_file_stat(repo_new, file_id, newfilepath, error);
+	}
+
+	ufa_debug("Filename updated on new repo: '%s'", newfilepath);
+
+	// Copy tags, attributes, and remove file from old repo
+	// if repo_old != repo_new
+	dirfileold = ufa_util_dirname(oldfilepath);
 	dirfilenew = ufa_util_dirname(newfilepath);
 
 	if (!ufa_str_equals(dirfilenew, dirfileold)) {
@@ -901,7 +1748,7 @@ bool ufa_repo_renamefile(const ufa_repo_t *repo_old,
 		tags = ufa_repo_gettags(repo_old, oldfilepath, &error2);
 		ufa_debug("Copying %d tags", ufa_list_size(tags));
 		for (UFA_LIST_EACH(i, tags)) {
-			ufa_repo_settag(repo_new, newfilepath,
+			ufa_repo_settag(base_new, newfilepath,
 			                i->data, &error2);
 		}
 		ufa_goto_iferror(&error2, freeres);
@@ -911,7 +1758,7 @@ bool ufa_repo_renamefile(const ufa_repo_t *repo_old,
 		ufa_debug("Copying %d attributes", ufa_list_size(listattrs));
 		for (UFA_LIST_EACH(i, listattrs)) {
 			struct ufa_repo_attr *attr = (struct ufa_repo_attr *) i->data;
-			ufa_repo_setattr(repo_new, newfilepath,
+			ufa_repo_setattr(base_new, newfilepath,
 			attr->attribute, attr->value, &error2);
 		}
 		ufa_goto_iferror(&error2, freeres);
@@ -934,13 +1781,46 @@ end:
 	return status;
 }
 
+const struct ufa_repo_backend ufa_repo_sqlite_backend = {
+	.name               = "sqlite",
+	.open               = sqlite_open,
+	.close              = sqlite_close,
+	.listtags           = sqlite_listtags,
+	.listfiles          = sqlite_listfiles,
+	.gettags            = sqlite_gettags,
+	.gettags_many       = sqlite_gettags_many,
+	.settag             = sqlite_settag,
+	.cleartags          = sqlite_cleartags,
+	.unsettag           = sqlite_unsettag,
+	.inserttag          = sqlite_inserttag,
+	.isatag             = sqlite_isatag,
+	.search_page        = sqlite_search_page,
+	.query_page         = sqlite_query_page,
+	.facets             = sqlite_facets,
+	.setattr            = sqlite_setattr,
+	.unsetattr          = sqlite_unsetattr,
+	.getattr            = sqlite_getattr,
+	.getattr_many       = sqlite_getattr_many,
+	.begin              = sqlite_begin,
+	.commit             = sqlite_commit,
+	.set_trigram_index  = sqlite_set_trigram_index,
+	.has_trigram_index  = sqlite_has_trigram_index,
+	.set_fulltext_index = sqlite_set_fulltext_index,
+	.has_fulltext_index = sqlite_has_fulltext_index,
+	.removefile         = sqlite_removefile,
+	.updatefile         = sqlite_updatefile,
+	.sync               = sqlite_sync,
+	.renamefile         = sqlite_renamefile,
+};
+
 
 /* ========================================================================== */
 /* AUXILIARY FUNCTIONS                                                        */
 /* ========================================================================== */
 
-bool _db_prepare(const ufa_repo_t *repo, sqlite3_stmt **stmt, const char *sql,
-		 struct ufa_error **error, const char *func_name)
+bool _db_prepare(const sqlite_repo_t *repo, sqlite3_stmt **stmt,
+		 const char *sql, struct ufa_error **error,
+		 const char *func_name)
 {
 	assert(repo != NULL);
 	ufa_return_val_iferror(error, false);
@@ -955,7 +1835,7 @@ bool _db_prepare(const ufa_repo_t *repo, sqlite3_stmt **stmt, const char *sql,
 	return true;
 }
 
-static bool _db_execute(const ufa_repo_t *repo, sqlite3_stmt *stmt,
+static bool _db_execute(const sqlite_repo_t *repo, sqlite3_stmt *stmt,
 			struct ufa_error **error, const char *func_name)
 {
 	ufa_return_val_iferror(error, false);
@@ -971,7 +1851,7 @@ static bool _db_execute(const ufa_repo_t *repo, sqlite3_stmt *stmt,
 	return status;
 }
 
-static void db_begin(ufa_repo_t *repo)
+static void db_begin(sqlite_repo_t *repo)
 {
 	int status = sqlite3_exec(repo->db,
 				  "BEGIN TRANSACTION;",
@@ -983,7 +1863,7 @@ static void db_begin(ufa_repo_t *repo)
 	}
 }
 
-static void db_commit(const ufa_repo_t *repo)
+static void db_commit(const sqlite_repo_t *repo)
 {
 	int status = sqlite3_exec(repo->db, "COMMIT;", NULL, NULL, NULL);
 	if (status != SQLITE_OK) {
@@ -992,38 +1872,264 @@ static void db_commit(const ufa_repo_t *repo)
 	}
 }
 
+static bool int_equals(int *a, int *b)
+{
+	return *a == *b;
+}
+
+static int int_hash(int *i)
+{
+	return *i;
+}
+
+/**
+ * Same as db_prepare, taking the statement from the cache of the repo when
+ * there is one for 'sql'. Give it back with db_release.
+ */
+static bool _db_prepare_cached(const sqlite_repo_t *repo, sqlite3_stmt **stmt,
+			       const char *sql, struct ufa_error **error,
+			       const char *func_name)
+{
+	ufa_return_val_iferror(error, false);
+
+	struct stmt_cache *cache = repo->cache;
+	*stmt = NULL;
+	pthread_mutex_lock(&cache->mutex);
+	for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+		if (cache->sql[i] != NULL && ufa_str_equals(cache->sql[i], sql)) {
+			*stmt = cache->stmt[i];
+			ufa_free(cache->sql[i]);
+			cache->sql[i] = NULL;
+			cache->stmt[i] = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return (*stmt != NULL) || _db_prepare(repo, stmt, sql, error,
+					      func_name);
+}
+
+/**
+ * Resets a statement of db_prepare_cached and puts it in the cache, in place
+ * of the least recently used one if the cache is full.
+ */
+static void db_release(const sqlite_repo_t *repo, sqlite3_stmt *stmt,
+		       const char *sql)
+{
+	if (stmt == NULL) {
+		return;
+	}
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	struct stmt_cache *cache = repo->cache;
+	sqlite3_stmt *evicted = NULL;
+	pthread_mutex_lock(&cache->mutex);
+	int slot = 0;
+	for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+		if (cache->sql[i] == NULL) {
+			slot = i;
+			break;
+		}
+		if (cache->used[i] < cache->used[slot]) {
+			slot = i;
+		}
+	}
+	if (cache->sql[slot] != NULL) {
+		evicted = cache->stmt[slot];
+		ufa_free(cache->sql[slot]);
+	}
+	cache->sql[slot] = ufa_str_dup(sql);
+	cache->stmt[slot] = stmt;
+	cache->used[slot] = ++cache->clock;
+	pthread_mutex_unlock(&cache->mutex);
+
+	sqlite3_finalize(evicted);
+}
+
+static struct stmt_cache *stmt_cache_new(void)
+{
+	struct stmt_cache *cache = ufa_calloc(1, sizeof *cache);
+	pthread_mutex_init(&cache->mutex, NULL);
+	return cache;
+}
+
+/**
+ * Finalizes the statements of a cache (e.g. before the schema changes).
+ */
+static void stmt_cache_clear(struct stmt_cache *cache)
+{
+	pthread_mutex_lock(&cache->mutex);
+	for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+		sqlite3_finalize(cache->stmt[i]);
+		ufa_free(cache->sql[i]);
+		cache->stmt[i] = NULL;
+		cache->sql[i] = NULL;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+static void stmt_cache_free(struct stmt_cache *cache)
+{
+	if (cache != NULL) {
+		stmt_cache_clear(cache);
+		pthread_mutex_destroy(&cache->mutex);
+		ufa_free(cache);
+	}
+}
+
 /**
- * Returns a newly-allocated string with characters '?' separated by ','.
- * The number of characters '?' is equal to the number of elements in list.
+ * Generates the operand of an IN operator for the values of a list, bound by
+ * bind_in_list: an argument for each value, or, for lists longer than
+ * MAX_SQL_ARGS, a JSON array bound as a single argument and read by json_each
+ * (so there is no limit of values and the SQL does not grow).
  */
-static char *sql_arg_list(struct ufa_list *list)
+static char *sql_in_list(struct ufa_list *list)
 {
 	int size = ufa_list_size(list);
-	if (size == 0) {
-		return ufa_str_dup("");
+	if (size > MAX_SQL_ARGS) {
+		return ufa_str_dup("(SELECT value FROM json_each(?))");
 	}
 	char *sql_args = ufa_str_multiply("?,", size);
-	sql_args[strlen(sql_args) - 1] = '\0';
-	return sql_args;
+	if (size > 0) {
+		sql_args[strlen(sql_args) - 1] = '\0';
+	}
+	char *sql = ufa_str_sprintf("(%s)", sql_args);
+	ufa_free(sql_args);
+	return sql;
+}
+
+/**
+ * Binds the values of a list in the SQL generated by sql_in_list.
+ *
+ * @return Index of the next argument
+ */
+static int bind_in_list(sqlite3_stmt *stmt, int index, struct ufa_list *list)
+{
+	if (ufa_list_size(list) <= MAX_SQL_ARGS) {
+		for (UFA_LIST_EACH(i, list)) {
+			sqlite3_bind_text(stmt, index++, (char *) i->data, -1,
+					  NULL);
+		}
+		return index;
+	}
+
+	struct ufa_str_builder json = UFA_STR_BUILDER_INIT;
+	ufa_str_builder_append(&json, "[");
+	for (UFA_LIST_EACH(i, list)) {
+		ufa_str_builder_append(&json, "\"");
+		for (const char *c = i->data; *c != '\0'; c++) {
+			if (*c == '"' || *c == '\\') {
+				ufa_str_builder_appendf(&json, "\\%c", *c);
+			} else if ((unsigned char) *c < 0x20) {
+				ufa_str_builder_appendf(&json, "\\u%04x",
+							(unsigned char) *c);
+			} else {
+				char str[2] = {*c, '\0'};
+				ufa_str_builder_append(&json, str);
+			}
+		}
+		ufa_str_builder_append(&json, (i->next != NULL) ? "\"," : "\"");
+	}
+	ufa_str_builder_append(&json, "]");
+	size_t len = json.len;
+	sqlite3_bind_text(stmt, index++, ufa_str_builder_take(&json), len,
+			  ufa_free);
+	return index;
+}
+
+
+/**
+ * Runs a query of ufa_repo_*_many functions. 'sql_format' has a "%s" where
+ * the filter of file names goes: without 'filenames' there is no filter
+ * (all files).
+ */
+static bool query_files_many(const sqlite_repo_t *repo,
+			     const char *sql_format,
+			     struct ufa_list *filenames,
+			     add_row_fn_t add_row,
+			     ufa_hashtable_t *result,
+			     struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+
+	char *args = sql_in_list(filenames);
+	char *filter = (filenames == NULL)
+			   ? ufa_str_dup("")
+			   : ufa_str_sprintf("WHERE f.name IN %s", args);
+	char *sql = ufa_str_sprintf(sql_format, filter);
+	ufa_free(args);
+	ufa_free(filter);
+
+	sqlite3_stmt *stmt = NULL;
+	if (db_prepare_cached(repo, &stmt, sql, error)) {
+		bind_in_list(stmt, 1, filenames);
+		int r;
+		while ((r = sqlite3_step(stmt)) == SQLITE_ROW) {
+			add_row(result, stmt);
+		}
+		if (r != SQLITE_DONE) {
+			ufa_error_new(error, UFA_ERROR_DATABASE,
+				      "sqlite3_step error on %s: %s", __func__,
+				      sqlite3_errmsg(repo->db));
+		}
+	}
+	db_release(repo, stmt, sql);
+	ufa_free(sql);
+
+	return !HAS_ERROR(error);
+}
+
+/**
+ * Appends a value to the list of 'key' in 'result' (rows are sorted by key,
+ * so lists are built in order)
+ */
+static void append_to_key(ufa_hashtable_t *result, const char *key,
+			  void *value, ufa_list_free_fn_t free_fn)
+{
+	struct ufa_list *list = ufa_hashtable_get(result, key);
+	if (list == NULL) {
+		list = ufa_list_append2(NULL, value, free_fn);
+		ufa_hashtable_put_full(result, ufa_str_dup(key), list, ufa_free,
+				       (ufa_hash_free_fn_t) ufa_list_free);
+	} else {
+		ufa_list_append2(list, value, free_fn);
+	}
+}
+
+static void add_row_tag(ufa_hashtable_t *result, sqlite3_stmt *stmt)
+{
+	const char *name = (const char *) sqlite3_column_text(stmt, 0);
+	const char *tag = (const char *) sqlite3_column_text(stmt, 1);
+	append_to_key(result, name, ufa_str_dup(tag), ufa_free);
 }
 
+static void add_row_attr(ufa_hashtable_t *result, sqlite3_stmt *stmt)
+{
+	const char *name = (const char *) sqlite3_column_text(stmt, 0);
+	struct ufa_repo_attr *attr = ufa_calloc(1, sizeof *attr);
+	attr->attribute =
+	    ufa_str_dup((const char *) sqlite3_column_text(stmt, 1));
+	attr->value = ufa_str_dup((const char *) sqlite3_column_text(stmt, 2));
+	append_to_key(result, name, attr,
+		      (ufa_list_free_fn_t) ufa_repo_attr_free);
+}
 
 /**
   * Connect to sqlite db. (it creates a DB if file does not exist)
   *
   * @param file File path
-  * @param repo_path Repository path
   * @param error Pointer to pointer to struct ufa_error
-  * @return struct ufa_repo reference
+  * @return struct sqlite_repo reference (its base is set by repo.c)
  */
-static struct ufa_repo *open_sqlite_conn(const char *file,
-					 const char *repo_path,
-					 struct ufa_error **error)
+static sqlite_repo_t *open_sqlite_conn(const char *file,
+				       struct ufa_error **error)
 {
 	ufa_return_val_iferror(error, NULL);
 
 	char *errmsg = NULL;
-	struct ufa_repo *repo = ufa_malloc(sizeof *repo);
+	sqlite_repo_t *repo = ufa_calloc(1, sizeof *repo);
 	// create file if it do not exist
 	int rc = sqlite3_open(file, &repo->db);
 	sqlite3_extended_result_codes(repo->db, 1);
@@ -1051,7 +2157,26 @@ static struct ufa_repo *open_sqlite_conn(const char *file,
 	}
 
 	repo->name = ufa_str_dup(file);
-	repo->repository_path = ufa_str_dup(repo_path);
+	repo->cache = stmt_cache_new();
+
+	// the same db may be open by more than one connection (see data.c)
+	sqlite3_busy_timeout(repo->db, BUSY_TIMEOUT_MS);
+
+	if (st.st_size != 0 && !migrate_db(repo, error)) {
+		stmt_cache_free(repo->cache);
+		sqlite3_close(repo->db);
+		ufa_free(repo->name);
+		ufa_free(repo);
+		return NULL;
+	}
+
+	pthread_mutex_init(&repo->explain_mutex, NULL);
+	if (__atomic_load_n(&profile_enabled, __ATOMIC_ACQUIRE)) {
+		sqlite3_trace_v2(repo->db,
+				 SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW,
+				 trace_callback,
+				 repo);
+	}
 	return repo;
 
 error_opening:
@@ -1077,7 +2202,7 @@ error_create_table:
  * Gets the tag id for a tag name
  * Returns negative values on error; 0 for tag not found; id of a tag when found
  */
-static int get_tag_id_by_name(const ufa_repo_t *repo,
+static int get_tag_id_by_name(const sqlite_repo_t *repo,
 			      const char *tag,
 			      struct ufa_error **error)
 {
@@ -1104,129 +2229,54 @@ end:
 }
 
 /**
- * Retrieves all tags for a list of files, excluding the list of tags passed
- * as argument.
+ * Lists a directory of tags (see ufa_repo_listfiles): the files with all the
+ * tags, then the other tags of these files.
  */
-static struct ufa_list *get_tags_for_files_excluding(const ufa_repo_t *repo,
-						     struct ufa_list *file_ids,
-						     struct ufa_list *tags,
-						     struct ufa_error **error)
-{
-	ufa_return_val_iferror(error, NULL);
-	ufa_return_val_if(file_ids == NULL, NULL);
-
-	char *sql = "SELECT DISTINCT t.name FROM tag t, file_tag ft, file f "
-		    "WHERE ft.id_tag "
-		    " = t.id AND f.id = ft.id_file AND f.id IN (%s) AND t.name "
-		    "NOT IN (%s)";
-	struct ufa_list *result = NULL;
-	char *sql_file_args = sql_arg_list(file_ids);
-	char *sql_tags_args = sql_arg_list(tags);
-	char *full_sql = ufa_str_sprintf(sql, sql_file_args, sql_tags_args);
-	ufa_debug("Query: %s", full_sql);
-
-	sqlite3_stmt *stmt = NULL;
-	if (!db_prepare(repo, &stmt, full_sql, error)) {
-		goto end;
-	}
-
-	// Setting query args
-	int x = 1;
-	for (UFA_LIST_EACH(i, file_ids)) {
-		sqlite3_bind_int(stmt, x++, *((int *) i->data));
-	}
-
-	for (UFA_LIST_EACH(i, tags)) {
-		sqlite3_bind_text(stmt, x++, (char *) i->data, -1, NULL);
-	}
-
-	// Getting result
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
-		const char *tag = (const char *) sqlite3_column_text(stmt, 0);
-		result = ufa_list_prepend2(result, ufa_str_dup(tag), ufa_free);
-	}
-end:
-	ufa_free(sql_file_args);
-	ufa_free(sql_tags_args);
-	sqlite3_finalize(stmt);
-	ufa_free(full_sql);
-	result = ufa_list_reverse(result);
-	return result;
-}
-
-static struct ufa_list *get_files_with_tags(const ufa_repo_t *repo,
+static struct ufa_list *get_files_with_tags(const sqlite_repo_t *repo,
 					    struct ufa_list *tags,
 					    struct ufa_error **error)
 {
-	ufa_goto_iferror(error, end);
+	ufa_return_val_iferror(error, NULL);
+	ufa_return_val_if(tags == NULL, NULL);
 
 	struct ufa_list *list = NULL;
-	struct ufa_list *result = NULL;
-	struct ufa_list *file_ids = NULL;
-
-	int size = ufa_list_size(tags);
-	if (size == 0) {
-		return NULL;
-	}
-	char *sql_args = sql_arg_list(tags);
-	char *full_sql =
-	    ufa_str_sprintf("SELECT id_file,(SELECT name FROM file WHERE "
-			    "id=id_file) FROM file_tag ft,tag t WHERE "
-			    "t.name IN (%s) AND id_tag = t.id GROUP BY id_file "
-			    "HAVING COUNT(id_file) = ?",
-			    sql_args);
+	sqlite3_stmt *stmt = NULL;
 
+	char *sql_search_tags = generate_sql_search_tags(tags);
+	char *full_sql = ufa_str_sprintf("SELECT f.name FROM file f WHERE %s",
+					 sql_search_tags);
 	ufa_debug("Executing query: %s", full_sql);
 
-	sqlite3_stmt *stmt = NULL;
-	if (!db_prepare(repo, &stmt, full_sql, error)) {
-		goto freeres;
-	}
-
-	int x = 1;
-	for (UFA_LIST_EACH(iter_tags, tags)) {
-		ufa_debug("Binding: %s\n", (char *) iter_tags->data);
-		sqlite3_bind_text(stmt, x++, (char *)iter_tags->data, -1, NULL);
+	if (!db_prepare_cached(repo, &stmt, full_sql, error)) {
+		goto end;
 	}
-	sqlite3_bind_int(stmt, x++, size);
+	bind_search(stmt, 1, NULL, tags, 0);
 
-	int r;
-	while ((r = sqlite3_step(stmt)) == SQLITE_ROW) {
-		int stmt_id = sqlite3_column_int(stmt, 0);
-		int *id = ufa_malloc(sizeof(int));
-		*id = stmt_id;
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
 		const char *filename =
-		    (const char *)sqlite3_column_text(stmt, 1);
+		    (const char *) sqlite3_column_text(stmt, 0);
 		list = ufa_list_prepend2(list, ufa_str_dup(filename), ufa_free);
-		file_ids = ufa_list_prepend(file_ids, id);
 	}
+	list = ufa_list_reverse(list);
 
-	// For the files selected, get all tags that are not in list 'tags' list
-	// because we need to show files with tags, and tags other than the
-	// ones in the path
-	struct ufa_list *other_tags = get_tags_for_files_excluding(repo,
-								   file_ids,
-								   tags,
-								   error);
-	if (error && *error) {
-		goto freeres;
+	// the other tags of the files are the subdirectories
+	struct ufa_list *facets = ufa_repo_facets(&repo->base, NULL, tags,
+						  false, error);
+	for (UFA_LIST_EACH(i, facets)) {
+		struct ufa_repo_facet *facet = i->data;
+		list = ufa_list_append2(list, ufa_str_dup(facet->name),
+					ufa_free);
 	}
+	ufa_list_free_full(facets, (ufa_list_free_fn_t) ufa_repo_facet_free);
 
-	list = ufa_list_reverse(list);
-	if (list && other_tags) {
-		ufa_list_get_last(list)->next = other_tags;
-	}
-	result = list;
-freeres:
-	sqlite3_finalize(stmt);
-	ufa_list_free_full(file_ids, ufa_free);
-	ufa_free(sql_args);
-	ufa_free(full_sql);
 end:
-	return result;
+	db_release(repo, stmt, full_sql);
+	ufa_free(sql_search_tags);
+	ufa_free(full_sql);
+	return list;
 }
 
-static sqlite_int64 insert_tag(const ufa_repo_t *repo,
+static sqlite_int64 insert_tag(const sqlite_repo_t *repo,
                                const char *tag,
                                struct ufa_error **error)
 {
@@ -1245,7 +2295,7 @@ static sqlite_int64 insert_tag(const ufa_repo_t *repo,
 		ufa_error_new(error,
 		              UFA_ERROR_DATABASE,
 		              "sqlite3_step error on %s for repo '%s': %d",
-		              __func__, repo->repository_path, r);
+		              __func__, repo->base.repository_path, r);
 
 		goto end;
 	}
@@ -1257,7 +2307,7 @@ end:
 	return id_tag;
 }
 
-static bool insert_db_version(const ufa_repo_t *repo)
+static bool insert_db_version(const sqlite_repo_t *repo)
 {
 	bool ret = false;
 
@@ -1282,13 +2332,96 @@ end:
 
 }
 
-static int insert_file(const ufa_repo_t *repo,
+/**
+ * Upgrades the schema of a db created by a previous version. The version is
+ * checked again inside an exclusive transaction, because another connection
+ * may be migrating the same db.
+ */
+static bool migrate_db(sqlite_repo_t *repo, struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+
+	bool status = false;
+	char *errmsg = NULL;
+	char *version = NULL;
+	sqlite3_stmt *stmt = NULL;
+	const char *sql = "SELECT value FROM ufa WHERE attr = ?";
+
+	int rc = sqlite3_exec(repo->db, "BEGIN IMMEDIATE;", NULL, NULL, &errmsg);
+	if (rc != SQLITE_OK) {
+		goto error_sql;
+	}
+
+	if (!db_prepare(repo, &stmt, sql, error)) {
+		goto rollback;
+	}
+	sqlite3_bind_text(stmt, 1, DB_VERSION_ATTR, -1, NULL);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		version = ufa_str_dup((const char *) sqlite3_column_text(stmt, 0));
+	}
+	sqlite3_finalize(stmt);
+	stmt = NULL;
+
+	if (ufa_str_equals(version, "1")) {
+		ufa_info("Migrating db %s to version 2", repo->name);
+		rc = sqlite3_exec(repo->db, STR_MIGRATE_V2, NULL, NULL, &errmsg);
+		if (rc != SQLITE_OK) {
+			goto error_sql;
+		}
+		// inodes of existing files are filled by ufa_repo_sync
+		ufa_free(version);
+		version = ufa_str_dup("2");
+	}
+
+	if (ufa_str_equals(version, "2")) {
+		ufa_info("Migrating db %s to version 3", repo->name);
+		rc = create_functions(repo->db);
+		if (rc == SQLITE_OK) {
+			rc = sqlite3_exec(repo->db, STR_MIGRATE_V3, NULL, NULL,
+					  &errmsg);
+		}
+		if (rc != SQLITE_OK) {
+			goto error_sql;
+		}
+		ufa_free(version);
+		version = ufa_str_dup("3");
+	}
+
+	if (ufa_str_equals(version, "3")) {
+		ufa_info("Migrating db %s to version 4", repo->name);
+		rc = sqlite3_exec(repo->db, STR_MIGRATE_V4, NULL, NULL, &errmsg);
+		if (rc != SQLITE_OK) {
+			goto error_sql;
+		}
+	}
+
+	rc = sqlite3_exec(repo->db, "COMMIT;", NULL, NULL, &errmsg);
+	if (rc != SQLITE_OK) {
+		goto error_sql;
+	}
+	status = true;
+	goto end;
+
+error_sql:
+	ufa_error_new(error, UFA_ERROR_DATABASE, "Could not migrate db %s: %s",
+		      repo->name, errmsg ? errmsg : sqlite3_errmsg(repo->db));
+	sqlite3_free(errmsg);
+rollback:
+	sqlite3_exec(repo->db, "ROLLBACK;", NULL, NULL, NULL);
+end:
+	ufa_free(version);
+	return status;
+}
+
+static int insert_file(const sqlite_repo_t *repo,
 		       const char *filename,
 		       struct ufa_error **error)
 {
 	sqlite_int64 id_file = -1;
 	sqlite3_stmt *stmt = NULL;
-	const char *sql_insert = "INSERT INTO file (name) values(?)";
+	char *filepath     = NULL;
+	const char *sql_insert = "INSERT INTO file (name, dev, ino, mtime, size) "
+				 "values(?, ?, ?, ?, ?)";
 
 	ufa_goto_iferror(error, end);
 
@@ -1296,7 +2429,9 @@ static int insert_file(const ufa_repo_t *repo,
 		goto freeres;
 	}
 
+	filepath = ufa_util_joinpath(repo->base.repository_path, filename, NULL);
 	sqlite3_bind_text(stmt, 1, filename, -1, NULL);
+	bind_file_stat(stmt, 2, filepath);
 	int r = sqlite3_step(stmt);
 	// FIXME use db_execute ?
 	if (r != SQLITE_DONE) {
@@ -1306,65 +2441,250 @@ static int insert_file(const ufa_repo_t *repo,
 	id_file = sqlite3_last_insert_rowid(repo->db);
 	ufa_debug("File inserted: %lld\n", id_file);
 freeres:
+	ufa_free(filepath);
 	sqlite3_finalize(stmt);
 end:
 	return id_file;
 }
 
-static int get_file_id_by_name(const ufa_repo_t *repo,
-			       const char *filename,
-			       struct ufa_error **error)
+/**
+ * Binds device, inode, mtime and size of filepath (or NULLs, if it can not
+ * be stat'ed) to parameters index .. index + 3
+ */
+static void bind_file_stat(sqlite3_stmt *stmt, int index, const char *filepath)
 {
-	ufa_debug("%s: %s", __func__, filename);
+	struct stat st;
+	if (stat(filepath, &st) != 0) {
+		for (int i = 0; i < 4; i++) {
+			sqlite3_bind_null(stmt, index + i);
+		}
+		return;
+	}
+	sqlite3_bind_int64(stmt, index, (sqlite3_int64) st.st_dev);
+	sqlite3_bind_int64(stmt, index + 1, (sqlite3_int64) st.st_ino);
+	sqlite3_bind_int64(stmt, index + 2, (sqlite3_int64) st.st_mtime);
+	sqlite3_bind_int64(stmt, index + 3, (sqlite3_int64) st.st_size);
+}
 
-	const char *sql    = "SELECT f.id FROM file f WHERE f.name = ?";
-	char *filepath     = NULL;
-	int file_id        = 0;
+static bool update_file_stat(const sqlite_repo_t *repo,
+			     int file_id,
+			     const char *filepath,
+			     struct ufa_error **error)
+{
+	bool status = false;
 	sqlite3_stmt *stmt = NULL;
+	const char *sql = "UPDATE file SET dev=?, ino=?, mtime=?, size=? "
+			  "WHERE id=?";
 
 	ufa_goto_iferror(error, end);
 
 	if (!db_prepare(repo, &stmt, sql, error)) {
-		file_id = -1;
 		goto freeres;
 	}
-
-	sqlite3_bind_text(stmt, 1, filename, -1, NULL);
-
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
-		file_id = sqlite3_column_int(stmt, 0);
-	}
-
-	if (!file_id) {
-		filepath = ufa_util_joinpath(repo->repository_path,
-					     filename,
-					     NULL);
-		if (ufa_util_isfile(filepath)) {
-			ufa_debug(
-			    "File '%s' needs to be inserted on file table",
-			    filepath);
-			file_id = insert_file(repo, filename, error);
-			if (file_id == -1) {
-				ufa_error("Error inserting on db, file '%s'");
-				goto freeres;
-			}
-		}
-	}
+	status = execute_file_stat(repo, stmt, file_id, filepath, error);
 freeres:
-	ufa_free(filepath);
 	sqlite3_finalize(stmt);
 end:
-	return file_id;
+	return status;
 }
 
-static bool set_tag_on_file(const ufa_repo_t *repo,
-			    int file_id,
-			    int tag_id,
-			    struct ufa_error **error)
+/**
+ * Runs stmt, prepared with the SQL of update_file_stat, for a file (so it
+ * can be prepared once for many files)
+ */
+static bool execute_file_stat(const sqlite_repo_t *repo,
+			      sqlite3_stmt *stmt,
+			      int file_id,
+			      const char *filepath,
+			      struct ufa_error **error)
 {
-	bool status = false;
-	const char *sql_insert =
-	    "INSERT INTO file_tag (id_file, id_tag) VALUES (?, ?)";
+	sqlite3_reset(stmt);
+	bind_file_stat(stmt, 1, filepath);
+	sqlite3_bind_int(stmt, 5, file_id);
+	return db_execute(repo, stmt, error);
+}
+
+static int compare_dir_entries(const void *a, const void *b)
+{
+	return strcmp(((const struct dir_entry *) a)->name,
+		      ((const struct dir_entry *) b)->name);
+}
+
+/**
+ * Reads the entries of a directory (except "." , ".." and the files of the
+ * repository itself) with getdents64, which also gives their inodes without
+ * a stat for each entry.
+ *
+ * @param dirpath Directory
+ * @param count Where to store the number of entries
+ * @param dev Where to store the device of the directory
+ * @param error Pointer to pointer to error structure
+ * @return Entries sorted by name (as SQLite sorts TEXT)
+ */
+static struct dir_entry *read_dir_entries(const char *dirpath,
+					  size_t *count,
+					  dev_t *dev,
+					  struct ufa_error **error)
+{
+	struct dir_entry *entries = NULL;
+	char *buf                 = NULL;
+	size_t capacity           = 0;
+	size_t n                  = 0;
+	struct stat st;
+
+	ufa_goto_iferror(error, end);
+
+	int fd = open(dirpath, O_RDONLY | O_DIRECTORY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		ufa_error_new(error, UFA_ERROR_FILE, "error reading '%s': %s",
+			      dirpath, strerror(errno));
+		goto freeres;
+	}
+	*dev = st.st_dev;
+
+	buf = ufa_malloc(GETDENTS_BUF_SIZE);
+	long nread;
+	while ((nread = syscall(SYS_getdents64, fd, buf, GETDENTS_BUF_SIZE))
+	       > 0) {
+		for (long pos = 0; pos < nread;) {
+			struct linux_dirent64 *d =
+			    (struct linux_dirent64 *) (buf + pos);
+			pos += d->d_reclen;
+			if (ufa_str_equals(d->d_name, ".")
+			    || ufa_str_equals(d->d_name, "..")
+			    || ufa_str_equals(d->d_name, REPOSITORY_FILENAME)
+			    || ufa_str_equals(d->d_name,
+					      UFA_REPO_INDICATOR_FILE_NAME)) {
+				continue;
+			}
+			if (n == capacity) {
+				capacity = (capacity == 0) ? 64 : capacity * 2;
+				entries = ufa_realloc(entries,
+						      capacity * sizeof *entries);
+			}
+			entries[n].name = ufa_str_dup(d->d_name);
+			entries[n].ino = d->d_ino;
+			entries[n].in_db = false;
+			entries[n].stale_id = 0;
+			n++;
+		}
+	}
+	if (nread < 0) {
+		ufa_error_new(error, UFA_ERROR_FILE, "error reading '%s': %s",
+			      dirpath, strerror(errno));
+		free_dir_entries(entries, n);
+		entries = NULL;
+		n = 0;
+		goto freeres;
+	}
+
+	qsort(entries, n, sizeof *entries, compare_dir_entries);
+
+freeres:
+	if (fd >= 0) {
+		close(fd);
+	}
+	ufa_free(buf);
+end:
+	*count = n;
+	return entries;
+}
+
+static void free_dir_entries(struct dir_entry *entries, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		ufa_free(entries[i].name);
+	}
+	ufa_free(entries);
+}
+
+/**
+ * Checks that a directory has an entry, when it is not enough to rely on a
+ * listing read before (e.g. by read_dir_entries).
+ *
+ * @param dirpath Directory
+ * @param name Name of the entry
+ * @return true if the entry exists
+ */
+static bool dir_has_entry(const char *dirpath, const char *name)
+{
+	struct stat st;
+	char *filepath = ufa_util_joinpath(dirpath, name, NULL);
+	bool exists = (lstat(filepath, &st) == 0);
+	ufa_free(filepath);
+	return exists;
+}
+
+/**
+ * Checks whether the modification time or size of a file in a directory
+ * differ from the ones stored (e.g. it was modified while not monitored).
+ */
+static bool stat_changed(const char *dirpath, const char *name,
+			 sqlite3_int64 mtime, sqlite3_int64 size)
+{
+	struct stat st;
+	char *filepath = ufa_util_joinpath(dirpath, name, NULL);
+	bool changed = (stat(filepath, &st) != 0
+			|| (sqlite3_int64) st.st_mtime != mtime
+			|| (sqlite3_int64) st.st_size != size);
+	ufa_free(filepath);
+	return changed;
+}
+
+static int get_file_id_by_name(const sqlite_repo_t *repo,
+			       const char *filename,
+			       struct ufa_error **error)
+{
+	ufa_debug("%s: %s", __func__, filename);
+
+	const char *sql    = "SELECT f.id FROM file f WHERE f.name = ?";
+	char *filepath     = NULL;
+	int file_id        = 0;
+	sqlite3_stmt *stmt = NULL;
+
+	ufa_goto_iferror(error, end);
+
+	if (!db_prepare(repo, &stmt, sql, error)) {
+		file_id = -1;
+		goto freeres;
+	}
+
+	sqlite3_bind_text(stmt, 1, filename, -1, NULL);
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		file_id = sqlite3_column_int(stmt, 0);
+	}
+
+	if (!file_id) {
+		filepath = ufa_util_joinpath(repo->base.repository_path,
+					     filename,
+					     NULL);
+		if (ufa_util_isfile(filepath)) {
+			ufa_debug(
+			    "File '%s' needs to be inserted on file table",
+			    filepath);
+			file_id = insert_file(repo, filename, error);
+			if (file_id == -1) {
+				ufa_error("Error inserting on db, file '%s'");
+				goto freeres;
+			}
+		}
+	}
+freeres:
+	ufa_free(filepath);
+	sqlite3_finalize(stmt);
+end:
+	return file_id;
+}
+
+static bool set_tag_on_file(const sqlite_repo_t *repo,
+			    int file_id,
+			    int tag_id,
+			    struct ufa_error **error)
+{
+	bool status = false;
+	const char *sql_insert =
+	    "INSERT INTO file_tag (id_file, id_tag) VALUES (?, ?)";
 	sqlite3_stmt *stmt = NULL;
 
 	ufa_goto_iferror(error, end);
@@ -1395,34 +2715,7 @@ end:
 	return status;
 }
 
-static void create_repo_indicator_file(const char *repo,
-				       struct ufa_error **error)
-{
-	ufa_return_iferror(error);
-
-	char *repository = ufa_util_abspath(repo);
-	char *filepath = ufa_util_joinpath(repository,
-					   REPOSITORY_INDICATOR_FILE_NAME,
-					   NULL);
-
-	ufa_debug("Writting '%s' on file '%s' (rep ind)", repository, filepath);
-	FILE *fp = fopen(filepath, "w");
-	if (fp == NULL) {
-		ufa_error_new(error,
-			      UFA_ERROR_FILE,
-			      "error openning '%s': %s\n",
-			      filepath,
-			      strerror(errno));
-		goto freeres;
-	}
-	fprintf(fp, "%s", repository);
-	fclose(fp);
-freeres:
-	ufa_free(repository);
-	ufa_free(filepath);
-}
-
-static int get_file_id(const ufa_repo_t *repo,
+static int get_file_id(const sqlite_repo_t *repo,
 		       const char *filepath,
 		       struct ufa_error **error)
 {
@@ -1444,63 +2737,46 @@ freeres:
 	return file_id;
 }
 
-static char *generate_sql_search_attrs(struct ufa_list *filter_attr)
+static char *generate_sql_search_attrs(struct ufa_list *filter_attr,
+				       unsigned indexes)
 {
-	const size_t MAX_LEN = 4096;
-
-	int count_list = ufa_list_size(filter_attr);
-	if (count_list == 0) {
+	if (filter_attr == NULL) {
 		return ufa_str_dup("");
 	}
 
-	size_t len_str = count_list * MAX_LEN * sizeof(char);
-	char *new_str = ufa_malloc(len_str);
-	new_str[0] = '\0';
-	const char *sql_with_value = "(a.name = ? AND a.value %s ?)";
-
-	const char *sql_without_value = "(a.name = ?)";
+	struct ufa_str_builder sql = UFA_STR_BUILDER_INIT;
+	ufa_str_builder_append(&sql, " AND (");
 	for (UFA_LIST_EACH(iter_attr, filter_attr)) {
-
-		if (((struct ufa_repo_filterattr *) iter_attr->data)->value ==
-		    NULL) {
-			strncat(new_str,
-				sql_without_value,
-				MAX_LEN - strlen(new_str) - 1);
+		struct ufa_repo_filterattr *filter =
+		    (struct ufa_repo_filterattr *) iter_attr->data;
+		if (filter->value == NULL) {
+			ufa_str_builder_append(&sql, "(a.name = ?)");
 		} else {
-			char *str = ufa_str_sprintf(
-			    sql_with_value,
-			    ufa_repo_matchmode_sql[
-				((struct ufa_repo_filterattr *)
-				     iter_attr->data)->matchmode]);
-			strncat(new_str, str, MAX_LEN - strlen(new_str) - 1);
-			ufa_free(str);
+			char *cond = sql_attr_value(filter->matchmode,
+						    filter->value, indexes);
+			ufa_str_builder_appendf(&sql, "(%s)", cond);
+			ufa_free(cond);
 		}
-
 		if (iter_attr->next != NULL) {
-			strncat(new_str,
-				" OR ",
-				MAX_LEN - strlen(new_str) - 1);
+			ufa_str_builder_append(&sql, " OR ");
 		}
 	}
-
-	char *ret = ufa_str_sprintf(
-	    " AND (%s) GROUP BY f.id HAVING COUNT(f.id) = ?", new_str);
-
-	ufa_free(new_str);
-	return ret;
+	ufa_str_builder_append(&sql,
+			       ") GROUP BY f.id HAVING COUNT(f.id) = ?");
+	return ufa_str_builder_take(&sql);
 }
 
 static char *generate_sql_search_tags(struct ufa_list *tags)
 {
 	int count_tags = ufa_list_size(tags);
-	char *sql_args_tags = sql_arg_list(tags);
+	char *sql_args_tags = sql_in_list(tags);
 
 	char *sql_filter_tags = NULL;
 
 	char *fixa = "f.id IN (SELECT id_file "
 		     "FROM file_tag ft,tag t "
 		     "WHERE id_tag = t.id "
-		     "AND t.name IN (%s) "
+		     "AND t.name IN %s "
 		     "GROUP BY id_file "
 		     "HAVING COUNT(id_file) = ?) ";
 	if (count_tags > 0) {
@@ -1512,3 +2788,1264 @@ static char *generate_sql_search_tags(struct ufa_list *tags)
 	ufa_free(sql_args_tags);
 	return sql_filter_tags;
 }
+
+/**
+ * Generates a statement that selects the ids of the files found by a search
+ * (see ufa_repo_search), or of every file if there are no filters. The
+ * arguments are bound by bind_search.
+ */
+static char *generate_sql_search_files(struct ufa_list *filter_attr,
+				       struct ufa_list *tags,
+				       unsigned indexes)
+{
+	if (filter_attr == NULL && tags == NULL) {
+		return ufa_str_dup("SELECT f.id FROM file f");
+	}
+
+	char *sql_search_tags = generate_sql_search_tags(tags);
+	char *sql_search_attrs = generate_sql_search_attrs(filter_attr, indexes);
+	char *sql = NULL;
+	if (filter_attr == NULL) {
+		sql = ufa_str_sprintf("SELECT f.id FROM file f WHERE %s",
+				      sql_search_tags);
+	} else {
+		sql = ufa_str_sprintf("SELECT f.id FROM file f,attribute a "
+				      "WHERE %s%sa.id_file=f.id %s",
+				      sql_search_tags,
+				      (tags != NULL) ? "AND " : "",
+				      sql_search_attrs);
+	}
+	ufa_free(sql_search_tags);
+	ufa_free(sql_search_attrs);
+	return sql;
+}
+
+/**
+ * Binds the arguments of generate_sql_search_tags and
+ * generate_sql_search_attrs, in this order.
+ *
+ * @return Index of the next argument
+ */
+static int bind_search(sqlite3_stmt *stmt, int index,
+		       struct ufa_list *filter_attr, struct ufa_list *tags,
+		       unsigned indexes)
+{
+	if (tags != NULL) {
+		index = bind_in_list(stmt, index, tags);
+		sqlite3_bind_int(stmt, index++, ufa_list_size(tags));
+	}
+
+	if (filter_attr != NULL) {
+		for (UFA_LIST_EACH(i, filter_attr)) {
+			struct ufa_repo_filterattr *attr =
+			    (struct ufa_repo_filterattr *) i->data;
+			sqlite3_bind_text(stmt, index++, attr->attribute, -1,
+					  NULL);
+			if (attr->value != NULL) {
+				index = bind_attr_value(stmt, index,
+							attr->matchmode,
+							attr->value, indexes);
+			}
+		}
+		sqlite3_bind_int(stmt, index++, ufa_list_size(filter_attr));
+	}
+	return index;
+}
+
+/**
+ * Appends the WHERE clause of a query (on table "file f") to 'sql'. Each
+ * predicate is a subquery with its arguments bound by bind_query, in the
+ * same order.
+ */
+static void generate_sql_query(const struct ufa_query *query,
+			       unsigned indexes, struct ufa_str_builder *sql)
+{
+	char *cond = NULL;
+	switch (query->type) {
+	case UFA_QUERY_TAG:
+		ufa_str_builder_append(sql, "f.id IN (SELECT ft.id_file "
+					    "FROM file_tag ft,tag t "
+					    "WHERE ft.id_tag = t.id "
+					    "AND t.name = ?)");
+		break;
+	case UFA_QUERY_ATTR:
+		cond = (query->value == NULL)
+			   ? ufa_str_dup("a.name = ?")
+			   : sql_attr_value(query->matchmode, query->value,
+					    indexes);
+		ufa_str_builder_appendf(sql, "f.id IN (SELECT a.id_file "
+					     "FROM attribute a WHERE %s)",
+					cond);
+		ufa_free(cond);
+		break;
+	case UFA_QUERY_NOT:
+		ufa_str_builder_append(sql, "NOT ");
+		generate_sql_query(query->left, indexes, sql);
+		break;
+	case UFA_QUERY_AND:
+	case UFA_QUERY_OR:
+		ufa_str_builder_append(sql, "(");
+		generate_sql_query(query->left, indexes, sql);
+		ufa_str_builder_append(sql, (query->type == UFA_QUERY_AND)
+						? " AND "
+						: " OR ");
+		generate_sql_query(query->right, indexes, sql);
+		ufa_str_builder_append(sql, ")");
+		break;
+	}
+}
+
+/**
+ * Binds the arguments of the SQL generated by generate_sql_query.
+ *
+ * @return Index of the next argument
+ */
+static int bind_query(sqlite3_stmt *stmt, const struct ufa_query *query,
+		      int index, unsigned indexes)
+{
+	switch (query->type) {
+	case UFA_QUERY_TAG:
+		sqlite3_bind_text(stmt, index++, query->name, -1, NULL);
+		break;
+	case UFA_QUERY_ATTR:
+		sqlite3_bind_text(stmt, index++, query->name, -1, NULL);
+		if (query->value != NULL) {
+			index = bind_attr_value(stmt, index, query->matchmode,
+						query->value, indexes);
+		}
+		break;
+	case UFA_QUERY_NOT:
+		index = bind_query(stmt, query->left, index, indexes);
+		break;
+	case UFA_QUERY_AND:
+	case UFA_QUERY_OR:
+		index = bind_query(stmt, query->left, index, indexes);
+		index = bind_query(stmt, query->right, index, indexes);
+		break;
+	}
+	return index;
+}
+
+static bool query_uses_index(const struct ufa_query *query)
+{
+	if (query == NULL) {
+		return false;
+	}
+	if (query->type == UFA_QUERY_ATTR) {
+		return uses_index(query->matchmode, query->value);
+	}
+	return query_uses_index(query->left) || query_uses_index(query->right);
+}
+
+/**
+ * Checks whether a filter may use an optional index (see optional_indexes).
+ */
+static bool uses_index(enum ufa_repo_matchmode matchmode, const char *value)
+{
+	return value != NULL
+	       && (matchmode == UFA_REPO_WILDCARD
+		   || matchmode == UFA_REPO_FULLTEXT);
+}
+
+/**
+ * Optional indexes of a repository (INDEX_TRIGRAM and INDEX_FULLTEXT).
+ */
+static unsigned optional_indexes(const sqlite_repo_t *repo)
+{
+	unsigned indexes = 0;
+	if (has_table(repo, TRIGRAM_TABLE)) {
+		indexes |= INDEX_TRIGRAM;
+	}
+	if (has_table(repo, FULLTEXT_TABLE)) {
+		indexes |= INDEX_FULLTEXT;
+	}
+	return indexes;
+}
+
+static bool has_table(const sqlite_repo_t *repo, const char *table)
+{
+	sqlite3_stmt *stmt = NULL;
+	const char *sql = "SELECT 1 FROM sqlite_master "
+			  "WHERE type = 'table' AND name = ?";
+	if (sqlite3_prepare_v2(repo->db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		return false;
+	}
+	sqlite3_bind_text(stmt, 1, table, -1, NULL);
+	bool exists = (sqlite3_step(stmt) == SQLITE_ROW);
+	sqlite3_finalize(stmt);
+	return exists;
+}
+
+/**
+ * Creates or drops an optional index, running 'sql' in a transaction.
+ */
+static bool set_optional_index(sqlite_repo_t *repo, const char *description,
+			       const char *sql, bool enabled,
+			       struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+
+	// cached statements may use the index
+	stmt_cache_clear(repo->cache);
+
+	char *errmsg = NULL;
+	char *sql_transaction = ufa_str_sprintf("BEGIN IMMEDIATE; %s COMMIT;",
+						sql);
+	int rc = sqlite3_exec(repo->db, sql_transaction, NULL, NULL, &errmsg);
+	ufa_free(sql_transaction);
+	if (rc != SQLITE_OK) {
+		ufa_error_new(error, UFA_ERROR_DATABASE,
+			      "could not %s %s of %s: %s",
+			      enabled ? "create" : "drop", description,
+			      repo->name, errmsg);
+		sqlite3_free(errmsg);
+		sqlite3_exec(repo->db, "ROLLBACK;", NULL, NULL, NULL);
+		return false;
+	}
+	ufa_info("%s %s of %s", enabled ? "Created" : "Dropped", description,
+		 repo->name);
+	return true;
+}
+
+/**
+ * Converts an attribute value to its type: an integer or a real number
+ * (only digits, sign, point and exponent), a timestamp (ufa_str_to_time,
+ * stored as seconds since the Epoch) or text.
+ */
+static struct typed_value typed_value_of(const char *value)
+{
+	struct typed_value typed = {.type = UFA_REPO_TEXT};
+	if (value == NULL || *value == '\0') {
+		return typed;
+	}
+
+	long integer;
+	time_t time;
+	if (strspn(value, "0123456789+-.eE") == strlen(value)) {
+		if (ufa_str_to_long(value, &integer)) {
+			typed.type = UFA_REPO_INTEGER;
+			typed.integer = integer;
+			return typed;
+		}
+		if (ufa_str_to_double(value, &typed.real)) {
+			typed.type = UFA_REPO_REAL;
+			return typed;
+		}
+	}
+	if (ufa_str_to_time(value, &time)) {
+		typed.type = UFA_REPO_TIMESTAMP;
+		typed.integer = time;
+	}
+	return typed;
+}
+
+/**
+ * Splits a range "low..high" (UFA_REPO_BETWEEN) into new strings.
+ *
+ * @return UFA_REPO_INTEGER if both limits are numbers, UFA_REPO_TIMESTAMP if
+ * both are timestamps, or UFA_REPO_TEXT
+ */
+static enum ufa_repo_attrtype range_type(const char *value, char **low,
+					 char **high)
+{
+	const char *sep = strstr(value, "..");
+	if (sep == NULL) {
+		*low = ufa_str_dup(value);
+		*high = ufa_str_dup(value);
+	} else {
+		*low = ufa_str_sprintf("%.*s", (int) (sep - value), value);
+		*high = ufa_str_dup(sep + 2);
+	}
+
+	enum ufa_repo_attrtype type_low = ufa_repo_attrtype_of(*low);
+	enum ufa_repo_attrtype type_high = ufa_repo_attrtype_of(*high);
+	bool num_low = (type_low == UFA_REPO_INTEGER || type_low == UFA_REPO_REAL);
+	bool num_high =
+	    (type_high == UFA_REPO_INTEGER || type_high == UFA_REPO_REAL);
+	if (num_low && num_high) {
+		return UFA_REPO_INTEGER;
+	}
+	if (type_low == UFA_REPO_TIMESTAMP && type_high == UFA_REPO_TIMESTAMP) {
+		return UFA_REPO_TIMESTAMP;
+	}
+	return UFA_REPO_TEXT;
+}
+
+/**
+ * Generates the condition on the name and the value of an attribute (table
+ * "attribute a"). EQUAL and WILDCARD compare the text (see sql_pattern),
+ * FULLTEXT the words (see sql_fulltext); the other modes compare the typed
+ * column (indexed) of the type of 'value'.
+ */
+static char *sql_attr_value(enum ufa_repo_matchmode matchmode,
+			    const char *value, unsigned indexes)
+{
+	const char *op = ufa_repo_matchmode_sql[matchmode];
+	if (matchmode == UFA_REPO_EQUAL) {
+		return ufa_str_sprintf("a.name = ? AND a.value %s ?", op);
+	}
+	if (matchmode == UFA_REPO_WILDCARD) {
+		return sql_pattern(value, indexes & INDEX_TRIGRAM);
+	}
+	if (matchmode == UFA_REPO_FULLTEXT) {
+		return sql_fulltext(value, indexes & INDEX_FULLTEXT);
+	}
+
+	enum ufa_repo_attrtype type;
+	if (matchmode == UFA_REPO_BETWEEN) {
+		char *low = NULL;
+		char *high = NULL;
+		type = range_type(value, &low, &high);
+		ufa_free(low);
+		ufa_free(high);
+	} else {
+		type = ufa_repo_attrtype_of(value);
+	}
+
+	const char *column = "a.value";
+	if (type == UFA_REPO_INTEGER || type == UFA_REPO_REAL) {
+		column = "a.value_num";
+	} else if (type == UFA_REPO_TIMESTAMP) {
+		column = "a.value_time";
+	}
+
+	if (matchmode == UFA_REPO_BETWEEN) {
+		return ufa_str_sprintf("a.name = ? AND %s BETWEEN ? AND ?",
+				       column);
+	}
+	return ufa_str_sprintf("a.name = ? AND %s %s ?", column, op);
+}
+
+/**
+ * Binds the arguments of the condition generated by sql_attr_value.
+ *
+ * @return Index of the next argument
+ */
+static int bind_attr_value(sqlite3_stmt *stmt, int index,
+			   enum ufa_repo_matchmode matchmode,
+			   const char *value, unsigned indexes)
+{
+	if (matchmode == UFA_REPO_EQUAL) {
+		sqlite3_bind_text(stmt, index++, value, -1, NULL);
+	} else if (matchmode == UFA_REPO_WILDCARD) {
+		index = bind_pattern(stmt, index, value,
+				      indexes & INDEX_TRIGRAM);
+	} else if (matchmode == UFA_REPO_FULLTEXT) {
+		index = bind_fulltext(stmt, index, value,
+				      indexes & INDEX_FULLTEXT);
+	} else if (matchmode == UFA_REPO_BETWEEN) {
+		char *low = NULL;
+		char *high = NULL;
+		enum ufa_repo_attrtype type = range_type(value, &low, &high);
+		bind_typed(stmt, index++, type, low);
+		bind_typed(stmt, index++, type, high);
+		ufa_free(low);
+		ufa_free(high);
+	} else {
+		bind_typed(stmt, index++, ufa_repo_attrtype_of(value), value);
+	}
+	return index;
+}
+
+/**
+ * Finds out how a pattern of UFA_REPO_WILDCARD ('*' is any sequence,
+ * case-insensitive as LIKE) can be matched using an index.
+ *
+ * @param trigram Whether the repository has a trigram index
+ * @param use_trigram Whether the trigram index narrows the match (patterns
+ * PATTERN_GLOB and PATTERN_LIKE with a run of TRIGRAM_MIN_RUN characters)
+ */
+static enum pattern_kind analyse_pattern(const char *pattern, bool trigram,
+					 bool *use_trigram)
+{
+	*use_trigram = false;
+
+	const char *wildcard = strchr(pattern, '*');
+	if (wildcard == NULL) {
+		return PATTERN_EXACT;
+	}
+	if (strspn(pattern, "*") == strlen(pattern)) {
+		return PATTERN_ANY;
+	}
+	if (wildcard != pattern
+	    && strspn(wildcard, "*") == strlen(wildcard)) {
+		return PATTERN_PREFIX;
+	}
+
+	bool letters = false;
+	size_t run = 0, max_run = 0;
+	for (const char *c = pattern; *c; c++) {
+		letters = letters || (*c >= 'a' && *c <= 'z')
+			  || (*c >= 'A' && *c <= 'Z');
+		run = (*c == '*') ? 0 : run + 1;
+		max_run = (run > max_run) ? run : max_run;
+	}
+	*use_trigram = trigram && max_run >= TRIGRAM_MIN_RUN;
+	return letters ? PATTERN_LIKE : PATTERN_GLOB;
+}
+
+/**
+ * Generates the condition of UFA_REPO_WILDCARD (see analyse_pattern). With
+ * the trigram index, the name is not compared using an index ('+'), so the
+ * rows found by the trigram index are read instead of every attribute with
+ * the name.
+ */
+static char *sql_pattern(const char *pattern, bool trigram)
+{
+	bool use_trigram;
+	enum pattern_kind kind = analyse_pattern(pattern, trigram, &use_trigram);
+	const char *sql_name =
+	    use_trigram ? "+a.name = ? AND a.id IN (SELECT rowid "
+			  "FROM attribute_trigram WHERE value LIKE ?)"
+			: "a.name = ?";
+
+	char *upper = NULL;
+	char *sql = NULL;
+	switch (kind) {
+	case PATTERN_ANY:
+		sql = ufa_str_sprintf("%s AND a.value IS NOT NULL", sql_name);
+		break;
+	case PATTERN_EXACT:
+		sql = ufa_str_sprintf("%s AND a.value = ? COLLATE NOCASE",
+				      sql_name);
+		break;
+	case PATTERN_PREFIX:
+		upper = prefix_upper_bound(pattern);
+		sql = ufa_str_sprintf("%s AND a.value >= ? COLLATE NOCASE%s",
+				      sql_name,
+				      upper ? " AND a.value < ? COLLATE NOCASE"
+					    : "");
+		break;
+	case PATTERN_GLOB:
+		sql = ufa_str_sprintf("%s AND a.value GLOB ?", sql_name);
+		break;
+	case PATTERN_LIKE:
+		sql = ufa_str_sprintf("%s AND a.value LIKE ? ESCAPE '\\'",
+				      sql_name);
+		break;
+	}
+	ufa_free(upper);
+	return sql;
+}
+
+/**
+ * Binds the arguments of the condition generated by sql_pattern.
+ *
+ * @return Index of the next argument
+ */
+static int bind_pattern(sqlite3_stmt *stmt, int index, const char *pattern,
+			bool trigram)
+{
+	bool use_trigram;
+	enum pattern_kind kind = analyse_pattern(pattern, trigram, &use_trigram);
+	if (use_trigram) {
+		char *like = pattern_to_like(pattern, true);
+		sqlite3_bind_text(stmt, index++, like, -1, SQLITE_TRANSIENT);
+		ufa_free(like);
+	}
+
+	char *str = NULL;
+	switch (kind) {
+	case PATTERN_ANY:
+		break;
+	case PATTERN_EXACT:
+		sqlite3_bind_text(stmt, index++, pattern, -1, SQLITE_TRANSIENT);
+		break;
+	case PATTERN_PREFIX:
+		str = ufa_str_sprintf("%.*s", (int) strcspn(pattern, "*"),
+				      pattern);
+		sqlite3_bind_text(stmt, index++, str, -1, SQLITE_TRANSIENT);
+		ufa_free(str);
+		str = prefix_upper_bound(pattern);
+		if (str != NULL) {
+			sqlite3_bind_text(stmt, index++, str, -1,
+					  SQLITE_TRANSIENT);
+		}
+		break;
+	case PATTERN_GLOB:
+		str = pattern_to_glob(pattern);
+		sqlite3_bind_text(stmt, index++, str, -1, SQLITE_TRANSIENT);
+		break;
+	case PATTERN_LIKE:
+		str = pattern_to_like(pattern, false);
+		sqlite3_bind_text(stmt, index++, str, -1, SQLITE_TRANSIENT);
+		break;
+	}
+	ufa_free(str);
+	return index;
+}
+
+/**
+ * Converts a pattern to LIKE, escaping '%', '_' and '\' (ESCAPE '\'). For the
+ * trigram index (where ESCAPE is not supported), '%' and '_' become '_',
+ * matching more values than the pattern.
+ */
+static char *pattern_to_like(const char *pattern, bool for_trigram)
+{
+	char *like = ufa_malloc(2 * strlen(pattern) + 1);
+	size_t len = 0;
+	for (const char *c = pattern; *c; c++) {
+		if (*c == '*') {
+			like[len++] = '%';
+		} else if (for_trigram && (*c == '%' || *c == '_')) {
+			like[len++] = '_';
+		} else if (!for_trigram
+			   && (*c == '%' || *c == '_' || *c == '\\')) {
+			like[len++] = '\\';
+			like[len++] = *c;
+		} else {
+			like[len++] = *c;
+		}
+	}
+	like[len] = '\0';
+	return like;
+}
+
+/**
+ * Converts a pattern to GLOB, escaping '?' and '['.
+ */
+static char *pattern_to_glob(const char *pattern)
+{
+	char *glob = ufa_malloc(3 * strlen(pattern) + 1);
+	size_t len = 0;
+	for (const char *c = pattern; *c; c++) {
+		if (*c == '?' || *c == '[') {
+			glob[len++] = '[';
+			glob[len++] = *c;
+			glob[len++] = ']';
+		} else {
+			glob[len++] = *c;
+		}
+	}
+	glob[len] = '\0';
+	return glob;
+}
+
+/**
+ * Upper bound (exclusive) of the values starting with the prefix of a
+ * pattern (PATTERN_PREFIX), compared with COLLATE NOCASE: the prefix in
+ * lower case with its last byte incremented.
+ *
+ * @return New string, or NULL if there is no bound (bytes 0xFF)
+ */
+static char *prefix_upper_bound(const char *pattern)
+{
+	size_t len = strcspn(pattern, "*");
+	char *upper = ufa_str_sprintf("%.*s", (int) len, pattern);
+	for (char *c = upper; *c; c++) {
+		if (*c >= 'A' && *c <= 'Z') {
+			*c = *c - 'A' + 'a';
+		}
+	}
+	while (len > 0 && (unsigned char) upper[len - 1] == 0xFF) {
+		upper[--len] = '\0';
+	}
+	if (len == 0) {
+		ufa_free(upper);
+		return NULL;
+	}
+	upper[len - 1]++;
+	// NOCASE compares 'A'-'Z' as 'a'-'z', so the byte after '@' is '['
+	if (upper[len - 1] >= 'A' && upper[len - 1] <= 'Z') {
+		upper[len - 1] = '[';
+	}
+	return upper;
+}
+
+/**
+ * Checks a page of search results, converting its position ('after') to
+ * 'key'. The key of a file (see page_key) is its name, its id or, for
+ * UFA_REPO_SORT_ATTR, "<type><length of value>:<value><name>".
+ */
+static bool parse_page(const struct ufa_repo_page *page,
+		       struct page_key *key, struct ufa_error **error)
+{
+	if (page->sort < 0 || page->sort >= UFA_REPO_SORT_TOTAL) {
+		ufa_error_new(error, UFA_ERROR_ARGS, "invalid sort: %d",
+			      page->sort);
+		return false;
+	}
+	if (page->sort == UFA_REPO_SORT_ATTR && page->sort_attr == NULL) {
+		ufa_error_new(error, UFA_ERROR_ARGS,
+			      "missing attribute to sort by");
+		return false;
+	}
+	if (page->limit < 0) {
+		ufa_error_new(error, UFA_ERROR_ARGS, "invalid limit: %d",
+			      page->limit);
+		return false;
+	}
+	if (page->after == NULL) {
+		return true;
+	}
+
+	const char *after = page->after;
+	long number;
+	double real;
+	char *end = NULL;
+	bool valid = false;
+	switch (page->sort) {
+	case UFA_REPO_SORT_NONE:
+		break;
+	case UFA_REPO_SORT_NAME:
+		key->value = ufa_str_dup(after);
+		valid = true;
+		break;
+	case UFA_REPO_SORT_ID:
+		valid = ufa_str_to_long(after, &number);
+		key->value = valid ? ufa_str_dup(after) : NULL;
+		break;
+	case UFA_REPO_SORT_ATTR:
+		if (strchr("irtn", after[0]) == NULL || after[0] == '\0') {
+			break;
+		}
+		errno = 0;
+		unsigned long len = strtoul(after + 1, &end, 10);
+		if (errno != 0 || end == after + 1 || *end != ':'
+		    || len > strlen(end + 1)) {
+			break;
+		}
+		key->type = after[0];
+		key->value = ufa_str_sprintf("%.*s", (int) len, end + 1);
+		key->name = ufa_str_dup(end + 1 + len);
+		valid = (key->type == 'i' && ufa_str_to_long(key->value, &number))
+			|| (key->type == 'r' && ufa_str_to_double(key->value, &real))
+			|| key->type == 't' || key->type == 'n';
+		break;
+	case UFA_REPO_SORT_TOTAL:
+		break;
+	}
+	if (!valid) {
+		page_key_clear(key);
+		ufa_error_new(error, UFA_ERROR_ARGS,
+			      "invalid position of page: '%s'", after);
+	}
+	return valid;
+}
+
+static void page_key_clear(struct page_key *key)
+{
+	ufa_free(key->value);
+	ufa_free(key->name);
+	key->value = NULL;
+	key->name = NULL;
+}
+
+/**
+ * Generates the SQL of a page of search results, on table "file f".
+ *
+ * @param after Whether the page has a position (keyset condition)
+ */
+static struct page_sql page_sql(const struct ufa_repo_page *page, bool after)
+{
+	struct page_sql sql = {"", "", "", "", ""};
+	switch (page->sort) {
+	case UFA_REPO_SORT_NONE:
+	case UFA_REPO_SORT_TOTAL:
+		break;
+	case UFA_REPO_SORT_NAME:
+		sql.where = after ? "f.name > ? AND " : "";
+		sql.order = " ORDER BY f.name";
+		break;
+	case UFA_REPO_SORT_ID:
+		sql.where = after ? "f.id > ? AND " : "";
+		sql.order = " ORDER BY f.id";
+		break;
+	case UFA_REPO_SORT_ATTR:
+		sql.select = "," SORT_ATTR_KEY;
+		sql.from = " LEFT JOIN attribute s "
+			   "ON s.id_file = f.id AND s.name = ?";
+		sql.where = after ? "(" SORT_ATTR_KEY ", f.name) > (?, ?) AND "
+				  : "";
+		sql.order = " ORDER BY " SORT_ATTR_KEY ", f.name";
+		break;
+	}
+	sql.limit = (page->limit > 0) ? " LIMIT ?" : "";
+	return sql;
+}
+
+/**
+ * Binds the arguments of page_sql in FROM.
+ *
+ * @return Index of the next argument
+ */
+static int bind_page_from(sqlite3_stmt *stmt, int index,
+			  const struct ufa_repo_page *page)
+{
+	if (page->sort == UFA_REPO_SORT_ATTR) {
+		sqlite3_bind_text(stmt, index++, page->sort_attr, -1,
+				  SQLITE_TRANSIENT);
+	}
+	return index;
+}
+
+/**
+ * Binds the arguments of the keyset condition of page_sql.
+ *
+ * @return Index of the next argument
+ */
+static int bind_page_after(sqlite3_stmt *stmt, int index,
+			   const struct ufa_repo_page *page,
+			   const struct page_key *key)
+{
+	if (key->value == NULL) {
+		return index;
+	}
+
+	long number;
+	double real;
+	switch (page->sort) {
+	case UFA_REPO_SORT_NAME:
+		sqlite3_bind_text(stmt, index++, key->value, -1,
+				  SQLITE_TRANSIENT);
+		break;
+	case UFA_REPO_SORT_ID:
+		ufa_str_to_long(key->value, &number);
+		sqlite3_bind_int64(stmt, index++, number);
+		break;
+	case UFA_REPO_SORT_ATTR:
+		if (key->type == 'i') {
+			ufa_str_to_long(key->value, &number);
+			sqlite3_bind_int64(stmt, index++, number);
+		} else if (key->type == 'r') {
+			ufa_str_to_double(key->value, &real);
+			sqlite3_bind_double(stmt, index++, real);
+		} else if (key->type == 't') {
+			sqlite3_bind_text(stmt, index++, key->value, -1,
+					  SQLITE_TRANSIENT);
+		} else {
+			sqlite3_bind_zeroblob(stmt, index++, 0);
+		}
+		sqlite3_bind_text(stmt, index++, key->name, -1,
+				  SQLITE_TRANSIENT);
+		break;
+	default:
+		break;
+	}
+	return index;
+}
+
+/**
+ * Key of the file of the current row of a page (see parse_page).
+ *
+ * @return New string
+ */
+static char *page_key(sqlite3_stmt *stmt, const struct ufa_repo_page *page)
+{
+	const char *name = (const char *) sqlite3_column_text(stmt, 1);
+	if (page->sort == UFA_REPO_SORT_ID) {
+		return ufa_str_sprintf("%lld", sqlite3_column_int64(stmt, 0));
+	}
+	if (page->sort != UFA_REPO_SORT_ATTR) {
+		return ufa_str_dup(name);
+	}
+
+	char *value = NULL;
+	char type = 'n';
+	switch (sqlite3_column_type(stmt, 2)) {
+	case SQLITE_INTEGER:
+		type = 'i';
+		value = ufa_str_sprintf("%lld", sqlite3_column_int64(stmt, 2));
+		break;
+	case SQLITE_FLOAT:
+		// all the digits, so the value is the same when read again
+		type = 'r';
+		value = ufa_str_sprintf("%.17g", sqlite3_column_double(stmt, 2));
+		break;
+	case SQLITE_TEXT:
+		type = 't';
+		value = ufa_str_dup((const char *) sqlite3_column_text(stmt, 2));
+		break;
+	default:
+		value = ufa_str_dup("");
+		break;
+	}
+	char *key = ufa_str_sprintf("%c%zu:%s%s", type, strlen(value), value,
+				    name);
+	ufa_free(value);
+	return key;
+}
+
+/**
+ * Reads the names of the files of a page.
+ *
+ * @param last_key If not NULL, where to store the key of the last file (if
+ * the page is sorted)
+ * @param rc If not NULL, where to store the result of the last sqlite3_step
+ * @return List of names
+ */
+static struct ufa_list *read_page(sqlite3_stmt *stmt,
+				  const struct ufa_repo_page *page,
+				  char **last_key, int *rc)
+{
+	struct ufa_list *names = NULL;
+	char *key = NULL;
+	int r;
+	while ((r = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const char *name = (const char *) sqlite3_column_text(stmt, 1);
+		ufa_debug("found file: %s", name);
+		names = ufa_list_append2(names, ufa_str_dup(name), ufa_free);
+		if (last_key != NULL && page->sort != UFA_REPO_SORT_NONE) {
+			ufa_free(key);
+			key = page_key(stmt, page);
+		}
+	}
+	if (last_key != NULL) {
+		*last_key = key;
+	}
+	if (rc != NULL) {
+		*rc = r;
+	}
+	return names;
+}
+
+/**
+ * Words of a UFA_REPO_FULLTEXT value, separated by FULLTEXT_SPACES. A word
+ * ending in '*' (a prefix) keeps one '*'; a word of only '*' is ignored.
+ *
+ * @return New list of strings
+ */
+static struct ufa_list *fulltext_words(const char *value)
+{
+	struct ufa_list *split = ufa_str_split(value, FULLTEXT_SPACES);
+	struct ufa_list *words = NULL;
+	for (UFA_LIST_EACH(i, split)) {
+		char *word = (char *) i->data;
+		size_t len = strlen(word);
+		while (len > 0 && word[len - 1] == '*') {
+			len--;
+		}
+		if (len == 0) {
+			continue;
+		}
+		char *str = ufa_str_sprintf("%.*s%s", (int) len, word,
+					    word[len] == '*' ? "*" : "");
+		words = ufa_list_append2(words, str, ufa_free);
+	}
+	ufa_list_free(split);
+	return words;
+}
+
+/**
+ * Converts a UFA_REPO_FULLTEXT value to an FTS5 query matching all its
+ * words: each word is a string (so FTS5 operators and punctuation are not
+ * special), followed by '*' if it is a prefix.
+ *
+ * @return New string, or NULL if there are no words
+ */
+static char *fulltext_query(const char *value)
+{
+	struct ufa_list *words = fulltext_words(value);
+	if (words == NULL) {
+		return NULL;
+	}
+
+	size_t size = 1;
+	for (UFA_LIST_EACH(i, words)) {
+		size += 2 * strlen((char *) i->data) + 4;
+	}
+	char *query = ufa_malloc(size);
+	size_t len = 0;
+	for (UFA_LIST_EACH(i, words)) {
+		const char *word = (char *) i->data;
+		size_t word_len = strlen(word);
+		bool prefix = (word[word_len - 1] == '*');
+		if (prefix) {
+			word_len--;
+		}
+		if (len > 0) {
+			query[len++] = ' ';
+		}
+		query[len++] = '"';
+		for (size_t c = 0; c < word_len; c++) {
+			if (word[c] == '"') {
+				query[len++] = '"';
+			}
+			query[len++] = word[c];
+		}
+		query[len++] = '"';
+		if (prefix) {
+			query[len++] = '*';
+		}
+	}
+	query[len] = '\0';
+	ufa_list_free(words);
+	return query;
+}
+
+/**
+ * FTS5 query to rank the files found by the UFA_REPO_FULLTEXT filters (any
+ * of them).
+ *
+ * @return New string, or NULL if there are no such filters
+ */
+static char *fulltext_rank_query(struct ufa_list *filter_attr)
+{
+	struct ufa_list *queries = NULL;
+	for (UFA_LIST_EACH(i, filter_attr)) {
+		struct ufa_repo_filterattr *filter =
+		    (struct ufa_repo_filterattr *) i->data;
+		if (filter->matchmode != UFA_REPO_FULLTEXT
+		    || filter->value == NULL) {
+			continue;
+		}
+		char *query = fulltext_query(filter->value);
+		if (query != NULL) {
+			queries = ufa_list_append2(queries, query, ufa_free);
+		}
+	}
+	if (queries == NULL) {
+		return NULL;
+	}
+	char *rank_query = ufa_str_join_list(queries, " OR ", "(", ")");
+	ufa_list_free(queries);
+	return rank_query;
+}
+
+/**
+ * Generates the condition of UFA_REPO_FULLTEXT: the value has all the words.
+ * With the full-text index, words match tokens (case and diacritics do not
+ * matter) and the name is not compared using an index ('+', see
+ * sql_pattern). Without it, each word is a case-insensitive LIKE on the
+ * value, which reads every attribute with the name.
+ */
+static char *sql_fulltext(const char *value, bool fulltext)
+{
+	struct ufa_list *words = fulltext_words(value);
+	char *sql = NULL;
+	if (fulltext && words != NULL) {
+		sql = ufa_str_dup("+a.name = ? AND a.id IN (SELECT rowid FROM "
+				  FULLTEXT_TABLE " WHERE " FULLTEXT_TABLE
+				  " MATCH ?)");
+	} else {
+		sql = ufa_str_multiply(" AND a.value LIKE ? ESCAPE '\\'",
+				       ufa_list_size(words));
+		char *str = ufa_str_sprintf("a.name = ?%s", sql);
+		ufa_free(sql);
+		sql = str;
+	}
+	ufa_list_free(words);
+	return sql;
+}
+
+/**
+ * Binds the arguments of the condition generated by sql_fulltext.
+ *
+ * @return Index of the next argument
+ */
+static int bind_fulltext(sqlite3_stmt *stmt, int index, const char *value,
+			 bool fulltext)
+{
+	struct ufa_list *words = fulltext_words(value);
+	if (fulltext && words != NULL) {
+		char *query = fulltext_query(value);
+		sqlite3_bind_text(stmt, index++, query, -1, SQLITE_TRANSIENT);
+		ufa_free(query);
+	} else {
+		for (UFA_LIST_EACH(i, words)) {
+			char *pattern =
+			    ufa_str_sprintf("*%s*", (char *) i->data);
+			char *like = pattern_to_like(pattern, false);
+			sqlite3_bind_text(stmt, index++, like, -1,
+					  SQLITE_TRANSIENT);
+			ufa_free(like);
+			ufa_free(pattern);
+		}
+	}
+	ufa_list_free(words);
+	return index;
+}
+
+/**
+ * Binds 'value' as the type of the column it is compared to (see
+ * sql_attr_value).
+ */
+static void bind_typed(sqlite3_stmt *stmt, int index,
+		       enum ufa_repo_attrtype type, const char *value)
+{
+	struct typed_value typed = typed_value_of(value);
+	if (type == UFA_REPO_TEXT || typed.type == UFA_REPO_TEXT) {
+		sqlite3_bind_text(stmt, index, value, -1, SQLITE_TRANSIENT);
+	} else if (typed.type == UFA_REPO_REAL) {
+		sqlite3_bind_double(stmt, index, typed.real);
+	} else {
+		sqlite3_bind_int64(stmt, index, typed.integer);
+	}
+}
+
+/**
+ * Binds the typed columns of an attribute: value_num (at 'index') and
+ * value_time (at 'index' + 1). The column of other types is NULL.
+ */
+static void bind_typed_columns(sqlite3_stmt *stmt, int index,
+			       const char *value)
+{
+	struct typed_value typed = typed_value_of(value);
+	sqlite3_bind_null(stmt, index);
+	sqlite3_bind_null(stmt, index + 1);
+	switch (typed.type) {
+	case UFA_REPO_INTEGER:
+		sqlite3_bind_int64(stmt, index, typed.integer);
+		break;
+	case UFA_REPO_REAL:
+		sqlite3_bind_double(stmt, index, typed.real);
+		break;
+	case UFA_REPO_TIMESTAMP:
+		sqlite3_bind_int64(stmt, index + 1, typed.integer);
+		break;
+	case UFA_REPO_TEXT:
+		break;
+	}
+}
+
+/**
+ * Creates the SQL functions of this module on a connection.
+ *
+ * @return SQLITE_OK or error code of sqlite3_create_function
+ */
+static int create_functions(sqlite3 *db)
+{
+	int rc = sqlite3_create_function(db, "ufa_value_num", 1,
+					 SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+					 NULL, sql_value_num, NULL, NULL);
+	if (rc == SQLITE_OK) {
+		rc = sqlite3_create_function(db, "ufa_value_time", 1,
+					     SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+					     NULL, sql_value_time, NULL, NULL);
+	}
+	return rc;
+}
+
+/**
+ * SQL function ufa_value_num(value): value_num of an attribute (used when
+ * migrating a db to version 3).
+ */
+static void sql_value_num(sqlite3_context *ctx, int argc,
+			  sqlite3_value **argv)
+{
+	struct typed_value typed =
+	    typed_value_of((const char *) sqlite3_value_text(argv[0]));
+	if (typed.type == UFA_REPO_INTEGER) {
+		sqlite3_result_int64(ctx, typed.integer);
+	} else if (typed.type == UFA_REPO_REAL) {
+		sqlite3_result_double(ctx, typed.real);
+	} else {
+		sqlite3_result_null(ctx);
+	}
+}
+
+/**
+ * SQL function ufa_value_time(value): value_time of an attribute.
+ */
+static void sql_value_time(sqlite3_context *ctx, int argc,
+			   sqlite3_value **argv)
+{
+	struct typed_value typed =
+	    typed_value_of((const char *) sqlite3_value_text(argv[0]));
+	if (typed.type == UFA_REPO_TIMESTAMP) {
+		sqlite3_result_int64(ctx, typed.integer);
+	} else {
+		sqlite3_result_null(ctx);
+	}
+}
+
+
+/* ========================================================================== */
+/* FUNCTIONS FOR SQL PROFILING                                                */
+/* ========================================================================== */
+
+/**
+ * Callback for sqlite3_trace_v2. Counts rows returned by each statement and,
+ * when it finishes, records its duration (metric "repo.sql") and writes it
+ * to the slow query log if above the threshold.
+ */
+static int trace_callback(unsigned type, void *ctx, void *p, void *x)
+{
+	sqlite3_stmt *stmt = (sqlite3_stmt *) p;
+
+	if (!__atomic_load_n(&profile_enabled, __ATOMIC_ACQUIRE)) {
+		take_rows(stmt);
+		return 0;
+	}
+
+	if (type == SQLITE_TRACE_ROW) {
+		count_row(stmt);
+	} else if (type == SQLITE_TRACE_PROFILE) {
+		sqlite3_int64 ns = *((sqlite3_int64 *) x);
+		unsigned long rows = take_rows(stmt);
+		ufa_stats_add("repo.sql", ns / 1000, false);
+
+		double ms = ns / 1000000.0;
+		if (ms >= profile_threshold) {
+			write_slow_query((const sqlite_repo_t *) ctx, stmt, ms,
+					 rows);
+		}
+	}
+	return 0;
+}
+
+static void count_row(sqlite3_stmt *stmt)
+{
+	struct stmt_rows *free_slot = NULL;
+	for (int i = 0; i < MAX_PROFILED_STMTS; i++) {
+		if (profiled_stmts[i].stmt == stmt) {
+			profiled_stmts[i].rows++;
+			return;
+		}
+		if (free_slot == NULL && profiled_stmts[i].stmt == NULL) {
+			free_slot = &profiled_stmts[i];
+		}
+	}
+	if (free_slot != NULL) {
+		free_slot->stmt = stmt;
+		free_slot->rows = 1;
+	}
+}
+
+static unsigned long take_rows(sqlite3_stmt *stmt)
+{
+	for (int i = 0; i < MAX_PROFILED_STMTS; i++) {
+		if (profiled_stmts[i].stmt == stmt) {
+			unsigned long rows = profiled_stmts[i].rows;
+			profiled_stmts[i].stmt = NULL;
+			profiled_stmts[i].rows = 0;
+			return rows;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Writes a statement to the slow query log, with its plan if enabled. The
+ * text is built first, so profile_mutex is only held to write it.
+ */
+static void write_slow_query(const sqlite_repo_t *repo, sqlite3_stmt *stmt,
+			     double ms, unsigned long rows)
+{
+	pthread_mutex_lock(&profile_mutex);
+	bool enabled = (profile_slowlog != NULL);
+	bool explain = profile_explain;
+	pthread_mutex_unlock(&profile_mutex);
+	if (!enabled) {
+		return;
+	}
+
+	char *expanded = sqlite3_expanded_sql(stmt);
+	const char *sql = (expanded != NULL) ? expanded : sqlite3_sql(stmt);
+
+	char timestamp[32] = "";
+	time_t now = time(NULL);
+	struct tm tm;
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S",
+		 localtime_r(&now, &tm));
+
+	struct ufa_str_builder text = UFA_STR_BUILDER_INIT;
+	ufa_str_builder_appendf(&text, "%s repo=%s time=%.3fms rows=%lu sql=%s\n",
+				timestamp, repo->base.repository_path, ms,
+				rows, STR_NOTNULL(sql));
+	if (explain && sql != NULL) {
+		write_query_plan((sqlite_repo_t *) repo, sql, &text);
+	}
+	char *str = ufa_str_builder_take(&text);
+
+	pthread_mutex_lock(&profile_mutex);
+	if (profile_slowlog != NULL) {
+		fputs(str, profile_slowlog);
+		fflush(profile_slowlog);
+	}
+	pthread_mutex_unlock(&profile_mutex);
+
+	ufa_free(str);
+	sqlite3_free(expanded);
+}
+
+/**
+ * Appends EXPLAIN QUERY PLAN of a statement to text. The connection that ran
+ * the statement cannot be used inside the trace callback, so a read-only
+ * connection of the repository is kept for it, with the same SQL functions.
+ */
+static void write_query_plan(sqlite_repo_t *repo, const char *sql,
+			     struct ufa_str_builder *text)
+{
+	sqlite3_stmt *stmt = NULL;
+	char *explain = NULL;
+
+	pthread_mutex_lock(&repo->explain_mutex);
+	if (repo->explain_db == NULL) {
+		if (sqlite3_open_v2(repo->name, &repo->explain_db,
+				    SQLITE_OPEN_READONLY, NULL)
+			!= SQLITE_OK
+		    || create_functions(repo->explain_db) != SQLITE_OK) {
+			ufa_str_builder_appendf(
+			    text, "    plan: (%s)\n",
+			    sqlite3_errmsg(repo->explain_db));
+			sqlite3_close(repo->explain_db);
+			repo->explain_db = NULL;
+			goto end;
+		}
+	}
+	explain = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", sql);
+	if (sqlite3_prepare_v2(repo->explain_db, explain, -1, &stmt, NULL)
+	    != SQLITE_OK) {
+		ufa_str_builder_appendf(text, "    plan: (%s)\n",
+					sqlite3_errmsg(repo->explain_db));
+		goto end;
+	}
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		// columns: id, parent, notused, detail
+		ufa_str_builder_appendf(
+		    text, "    plan: %s\n",
+		    (const char *) sqlite3_column_text(stmt, 3));
+	}
+end:
+	sqlite3_finalize(stmt);
+	sqlite3_free(explain);
+	pthread_mutex_unlock(&repo->explain_mutex);
+}
+
+/**
+ * Records a statement of a search, with its plan, if the current thread is
+ * recording (see ufa_repo_explain_begin).
+ */
+static void explain_statement(const sqlite_repo_t *repo, const char *stage,
+			      sqlite3_stmt *stmt, uint64_t start, long rows)
+{
+	if (stmt == NULL) {
+		return;
+	}
+	struct ufa_repo_explain *explain = ufa_repo_explain_record(
+	    repo->base.repository_path, stage, start, rows);
+	if (explain == NULL) {
+		return;
+	}
+	explain->sql = ufa_str_dup(sqlite3_sql(stmt));
+	explain->plan = query_plan(repo, explain->sql);
+}
+
+/**
+ * EXPLAIN QUERY PLAN of a statement, a line (char *) for each step.
+ */
+static struct ufa_list *query_plan(const sqlite_repo_t *repo, const char *sql)
+{
+	struct ufa_list *plan = NULL;
+	sqlite3_stmt *stmt = NULL;
+	char *explain = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", sql);
+
+	if (sqlite3_prepare_v2(repo->db, explain, -1, &stmt, NULL)
+	    != SQLITE_OK) {
+		char *line = ufa_str_sprintf("(%s)", sqlite3_errmsg(repo->db));
+		plan = ufa_list_append2(plan, line, ufa_free);
+		goto end;
+	}
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		// columns: id, parent, notused, detail
+		const char *detail =
+		    (const char *) sqlite3_column_text(stmt, 3);
+		plan = ufa_list_prepend2(plan, ufa_str_dup(detail), ufa_free);
+	}
+	plan = ufa_list_reverse(plan);
+end:
+	sqlite3_finalize(stmt);
+	sqlite3_free(explain);
+	return plan;
+}
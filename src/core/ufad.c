@@ -18,12 +18,14 @@
 #include "util/hashtable.h"
 #include "util/logging.h"
 #include "util/misc.h"
+#include "util/stats.h"
 #include "util/string.h"
 #include "json/jsonrpc_server.h"
 #include <assert.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <sysexits.h>
 #include <sys/stat.h>
@@ -50,6 +52,24 @@ static pthread_t thread_server;
  */
 static ufa_jsonrpc_server_t *server = NULL;
 
+/**
+ * Thread that reconciles repositories with their dirs on startup
+ */
+static pthread_t thread_reconcile;
+static bool reconcile_started = false;
+
+/**
+ * Repository dirs to reconcile and index of next one to be taken by a worker
+ */
+static char **reconcile_dirs = NULL;
+static int reconcile_count   = 0;
+static int reconcile_next    = 0;
+
+/**
+ * Max threads reconciling repositories in parallel
+ */
+#define MAX_RECONCILE_THREADS 4
+
 /**
  * Hash table mapping DIR -> WD
  */
@@ -74,7 +94,13 @@ static const enum ufa_monitor_event REPO_DIR_MASK = UFA_MONITOR_MOVE |
 
 static int start_ufad(const char *program);
 static void reload_config();
+static bool rescan_repo(const char *dir);
+static void start_reconcile(struct ufa_list *dirs);
+static void *reconcile_repos(void *thread_data);
+static void *reconcile_worker(void *thread_data);
 static void callback_event_repo(const struct ufa_event *event);
+static void begin_batch_repo(int watcher, const char *dir);
+static void end_batch_repo(int watcher, const char *dir);
 static void callback_event_config(const struct ufa_event *event);
 static void *start_server(void *thread_data);
 
@@ -99,8 +125,13 @@ int main(int argc, char *argv[])
 	bool enablelogdetails = true;
 	FILE *file_log        = NULL;
 	char *filepath_log    = NULL;
+	long slow_query_ms    = -1;
+	long read_buffer      = UFA_MONITOR_DEFAULT_READ_BUFFER;
+	long max_queued       = UFA_MONITOR_DEFAULT_MAX_QUEUED;
+	bool explain          = false;
+	FILE *file_slowlog    = NULL;
 
-	while ((opt = getopt(argc, argv, "l:FLhv")) != -1) {
+	while ((opt = getopt(argc, argv, "l:s:b:q:r:eFLhv")) != -1) {
 		switch (opt) {
 		case 'v':
 			printf("%s\n", program_version);
@@ -130,6 +161,41 @@ int main(int argc, char *argv[])
 				ufa_debug("LOG LEVEL: %s", optarg);
 			}
 			break;
+		case 's':
+			if (!ufa_str_to_long(optarg, &slow_query_ms)
+			    || slow_query_ms < 0) {
+				print_usage(stderr);
+				exit_status = EXIT_FAILURE;
+				goto end;
+			}
+			break;
+		case 'e':
+			explain = true;
+			break;
+		case 'b':
+			if (!ufa_str_to_long(optarg, &read_buffer)) {
+				print_usage(stderr);
+				exit_status = EXIT_FAILURE;
+				goto end;
+			}
+			break;
+		case 'q':
+			if (!ufa_str_to_long(optarg, &max_queued)) {
+				print_usage(stderr);
+				exit_status = EXIT_FAILURE;
+				goto end;
+			}
+			break;
+		case 'r': {
+			struct ufa_error *error = NULL;
+			if (!ufa_repo_set_default_backend(optarg, &error)) {
+				ufa_error_print_and_free(error);
+				print_usage(stderr);
+				exit_status = EXIT_FAILURE;
+				goto end;
+			}
+			break;
+		}
 		default:
 			print_usage(stderr);
 			exit_status = EXIT_FAILURE;
@@ -137,6 +203,13 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (read_buffer <= 0 || max_queued <= 0
+	    || !ufa_monitor_set_limits(read_buffer, max_queued)) {
+		print_usage(stderr);
+		exit_status = EXIT_FAILURE;
+		goto end;
+	}
+
 	bool damonize = !foreground;
 
 	// Get or create config dir
@@ -180,9 +253,32 @@ int main(int argc, char *argv[])
 		}
 
 	}
+
+	if (slow_query_ms >= 0) {
+		struct ufa_error *error = NULL;
+		char *filepath_slowlog = ufa_config_getslowlogfilepath(&error);
+		if (error) {
+			ufa_error_error(error);
+			ufa_error_free(error);
+		} else if ((file_slowlog = fopen(filepath_slowlog, "a"))) {
+			ufa_info("Logging SQL slower than %ldms to %s",
+				 slow_query_ms, filepath_slowlog);
+			ufa_repo_profile_enable(slow_query_ms, file_slowlog,
+						explain);
+		}
+		ufa_free(filepath_slowlog);
+	}
+
+	// Threads do not survive ufa_daemon, so only start logging thread here
+	ufa_log_async_start();
 	exit_status = start_ufad(program_name);
+	ufa_log_async_stop();
 
 end:
+	if (file_slowlog) {
+		ufa_repo_profile_disable();
+		fclose(file_slowlog);
+	}
 	if (file_log) {
 		fclose(file_log);
 	}
@@ -217,6 +313,18 @@ static int start_ufad(const char *program)
 	}
 	ufa_debug("Number of dirs watched: %d", ufa_list_size(list_dirs_config));
 
+	// clients can connect (and wait) while the rest is initialized
+	server = ufa_jsonrpc_server_new();
+	if (!ufa_jsonrpc_server_listen(server, &error)) {
+		ufa_fatal("Error starting JSON-RPC server");
+		ufa_error_print_and_free(error);
+		ufa_list_free(list_dirs_config);
+		return EXIT_FAILURE;
+	}
+	// changes (from clients or from the monitor) go to subscribers
+	ufa_data_set_listener((ufa_data_listener_fn_t) ufa_jsonrpc_server_notify,
+			      server);
+
 	if (!ufa_monitor_init()) {
 		return EXIT_FAILURE;
 	}
@@ -237,6 +345,8 @@ static int start_ufad(const char *program)
 		if (wd < 0) {
 			ufa_warn("Error watching %s", i->data);
 		} else {
+			ufa_monitor_set_batch_hooks(wd, begin_batch_repo,
+						    end_batch_repo);
 			bool r = ufa_hashtable_put(table_current_dirs,
 						   ufa_str_dup(i->data),
 						   ufa_int_dup(wd));
@@ -244,14 +354,15 @@ static int start_ufad(const char *program)
 		}
 	}
 
+	// files may have been renamed/removed while ufad was not running
+	start_reconcile(list_dirs_config);
+
 	ufa_list_free(list_dirs_config);
 
 	log_current_watched_dirs();
 
 	// Start JSONRPC Server here (on another thread)
 	ufa_info("Starting JSON-RPC Server ...");
-	server = ufa_jsonrpc_server_new();
-
 	int ret = pthread_create(&thread_server, NULL, start_server, NULL);
 	if (ret != 0) {
 		ufa_error("Error creating thread!");
@@ -263,6 +374,12 @@ static int start_ufad(const char *program)
 	ufa_info("Terminating %s ...", program);
 
 	ufa_jsonrpc_server_stop(server, NULL); // FIXME
+
+	if (reconcile_started) {
+		pthread_join(thread_reconcile, NULL);
+	}
+
+	ufa_data_set_listener(NULL, NULL);
 	ufa_jsonrpc_server_free(server);
 
 	ufa_info("%s terminated", program);
@@ -275,6 +392,8 @@ static void reload_config()
 {
 	ufa_debug("Changing config file");
 	struct ufa_error *error = NULL;
+
+	ufa_data_invalidate_cache(NULL);
 	struct ufa_list *list_add = NULL;
 	struct ufa_list *list_remove = NULL;
 
@@ -339,6 +458,8 @@ static void reload_config()
 			bool r = ufa_hashtable_remove(table_new_dirs, i->data);
 			assert(r == true);
 		} else {
+			ufa_monitor_set_batch_hooks(wd, begin_batch_repo,
+						    end_batch_repo);
 			bool r = ufa_hashtable_put(
 			    table_new_dirs, ufa_str_dup(i->data),
 						   ufa_int_dup(wd));
@@ -370,6 +491,17 @@ static void reload_config()
 static void callback_event_repo(const struct ufa_event *event)
 {
 	struct ufa_error *error = NULL;
+
+	// moved or removed directories may belong to another repository now
+	if (event->event & (UFA_MONITOR_MOVE | UFA_MONITOR_DELETE)) {
+		if (event->target1) {
+			ufa_data_invalidate_cache(event->target1);
+		}
+		if (event->target2) {
+			ufa_data_invalidate_cache(event->target2);
+		}
+	}
+
 	if (event->event == UFA_MONITOR_MOVE) {
 		if (event->target1 && event->target2) {
 			log_event(event);
@@ -383,6 +515,17 @@ static void callback_event_repo(const struct ufa_event *event)
 		} else {
 			assert(false);
 		}
+	} else if (event->event == UFA_MONITOR_DELETE) {
+		log_event(event);
+		ufa_data_removefile(event->target1, &error);
+	} else if (event->event == UFA_MONITOR_CLOSEWRITE) {
+		// size and mtime identify the file if renamed while not running
+		ufa_data_updatefile(event->target1, &error);
+	} else if (event->event == UFA_MONITOR_OVERFLOW) {
+		// events were lost, so database may be out of sync
+		log_event(event);
+		ufa_data_invalidate_cache(event->target1);
+		rescan_repo(event->target1);
 	}
 
 	if (error && error->code != UFA_ERROR_FILE_NOT_IN_DB) {
@@ -392,6 +535,122 @@ static void callback_event_repo(const struct ufa_event *event)
 }
 
 
+/**
+ * Synchronizes the repository of dir with its contents (changes made while
+ * ufad was not running or not monitoring the dir)
+ */
+static bool rescan_repo(const char *dir)
+{
+	struct ufa_error *error = NULL;
+	int renamed = 0;
+	int removed = 0;
+	if (ufa_data_rescan(dir, &renamed, &removed, &error)) {
+		ufa_info("Rescan of %s: %d files renamed, %d removed", dir,
+			 renamed, removed);
+		return true;
+	}
+	ufa_error_print_and_free(error);
+	return false;
+}
+
+
+/**
+ * Starts reconciliation of repositories in background, so that JSON-RPC
+ * server is available meanwhile. Progress is recorded in stats:
+ * "reconcile.repo" (one operation per repository) and "reconcile.total"
+ * (recorded when all repositories are done).
+ */
+static void start_reconcile(struct ufa_list *dirs)
+{
+	reconcile_dirs = ufa_calloc(ufa_list_size(dirs) + 1, sizeof(char *));
+	reconcile_count = 0;
+	reconcile_next = 0;
+	for (UFA_LIST_EACH(i, dirs)) {
+		if (ufa_repo_isrepo(i->data)) {
+			reconcile_dirs[reconcile_count++] = ufa_str_dup(i->data);
+		}
+	}
+
+	ufa_info("Reconciling %d repositories ...", reconcile_count);
+	int ret = pthread_create(&thread_reconcile, NULL, reconcile_repos,
+				 NULL);
+	if (ret != 0) {
+		ufa_error("Error creating reconcile thread: %s", strerror(ret));
+		return;
+	}
+	reconcile_started = true;
+}
+
+static void *reconcile_repos(void *thread_data)
+{
+	uint64_t start = ufa_stats_now();
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int n = (cpus > 0 && cpus < MAX_RECONCILE_THREADS)
+		    ? (int) cpus
+		    : MAX_RECONCILE_THREADS;
+	n = (n < reconcile_count) ? n : reconcile_count;
+
+	pthread_t workers[MAX_RECONCILE_THREADS];
+	int started = 0;
+	for (int i = 0; i < n; i++) {
+		if (pthread_create(&workers[started], NULL, reconcile_worker,
+				   NULL) == 0) {
+			started++;
+		}
+	}
+	if (started == 0) {
+		// no workers, reconcile in this thread
+		reconcile_worker(NULL);
+	}
+	for (int i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+
+	ufa_stats_record("reconcile.total", start, false);
+	ufa_info("Reconciliation of %d repositories finished", reconcile_count);
+
+	for (int i = 0; i < reconcile_count; i++) {
+		ufa_free(reconcile_dirs[i]);
+	}
+	ufa_free(reconcile_dirs);
+	reconcile_dirs = NULL;
+	return NULL;
+}
+
+static void *reconcile_worker(void *thread_data)
+{
+	int i;
+	while ((i = __atomic_fetch_add(&reconcile_next, 1, __ATOMIC_RELAXED))
+	       < reconcile_count) {
+		uint64_t start = ufa_stats_now();
+		bool ok = rescan_repo(reconcile_dirs[i]);
+		ufa_stats_record("reconcile.repo", start, !ok);
+	}
+	return NULL;
+}
+
+
+/**
+ * Events of a repo dir are applied in a single transaction
+ */
+static void begin_batch_repo(int watcher, const char *dir)
+{
+	struct ufa_error *error = NULL;
+	if (!ufa_data_begin_batch(dir, &error)) {
+		ufa_error_print_and_free(error);
+	}
+}
+
+static void end_batch_repo(int watcher, const char *dir)
+{
+	struct ufa_error *error = NULL;
+	if (!ufa_data_end_batch(dir, &error)) {
+		ufa_error_print_and_free(error);
+	}
+}
+
+
 /**
  * Handle a config change event (when config file is modified)
  *
@@ -402,6 +661,9 @@ static void callback_event_config(const struct ufa_event *event)
 	if (event->event == UFA_MONITOR_CLOSEWRITE &&
 	    ufa_str_endswith(event->target1, DIRS_FILE_NAME)) {
 		reload_config();
+	} else if (event->event == UFA_MONITOR_OVERFLOW) {
+		// a change of config file may have been lost
+		reload_config();
 	}
 }
 
@@ -409,9 +671,8 @@ static void callback_event_config(const struct ufa_event *event)
 static void *start_server(void *thread_data)
 {
 	struct ufa_error *error = NULL;
-	server = ufa_jsonrpc_server_new();
 	ufa_jsonrpc_server_start(server, &error);
-	if (!server || error) {
+	if (error) {
 		ufa_fatal("Error starting JSON-RPC server");
 		ufa_error_print_and_free(error);
 		exit(EXIT_FAILURE);
@@ -479,5 +740,11 @@ static void print_usage(FILE *stream)
 		"  -v\t\tPrint version information and quit\n"
 		"  -F\t\tRun in foreground\n"
 		"  -l LOG_LEVEL\tLog levels: debug, info, warn, error, fatal\n"
+		"  -s MS\t\tLog SQL statements slower than MS milliseconds to"
+		" slow query log\n"
+		"  -e\t\tInclude query plan in slow query log\n"
+		"  -b BYTES\tSize of buffer to read file system events\n"
+		"  -q EVENTS\tMax file system events waiting to be applied\n"
+		"  -r BACKEND\tStorage backend of repositories: sqlite, memory\n"
 		"\n");
 }
@@ -15,10 +15,12 @@
 #include "util/error.h"
 #include "util/logging.h"
 #include "util/misc.h"
+#include "util/stats.h"
 #include "util/string.h"
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -27,13 +29,15 @@
 /* VARIABLES AND DEFINITIONS                                                  */
 /* ========================================================================== */
 
-/** Max chars in a JSON-RPC response */
-#define MAX_RESPONSE_SIZE  4096
+/** MAX chars for each read operation from socket */
+#define CHUNK_SIZE  4096
 
 
 struct ufa_jsonrpc_api
 {
 	int socket_fd;
+	char *buf;      /* data read after the last message */
+	size_t buf_len;
 };
 
 
@@ -41,15 +45,29 @@ struct ufa_jsonrpc_api
 /* AUXILIARY FUNCTIONS - DECLARATION                                          */
 /* ========================================================================== */
 
-static void request_socket(struct ufa_jsonrpc_api *obj,
-			   const char *msg_to_send,
-			   char *response_buf);
+static char *request_socket(struct ufa_jsonrpc_api *obj,
+			    const char *msg_to_send,
+			    struct ufa_error **error);
+static char *read_message(struct ufa_jsonrpc_api *obj,
+			  struct ufa_error **error);
+static unsigned long get_ulong(ufa_hashtable_t *table, const char *key);
+static char *page_params(const struct ufa_repo_page *page, bool explain);
+static char *filter_attrs_json(struct ufa_list *filter_attr);
+static struct ufa_list *read_page(struct ufa_jsonrpc *rpc, char **cursor,
+				  struct ufa_list **explain);
+static struct ufa_list *read_explain(struct ufa_jsonrpc *rpc);
 
 static bool request_jsonrpc(ufa_jsonrpc_api_t *api,
 			    const char *msg,
 			    struct ufa_jsonrpc **jsonrpc,
 			    struct ufa_error **error);
 
+static ufa_hashtable_t *request_many(ufa_jsonrpc_api_t *api,
+				     const char *method,
+				     const char *dir,
+				     struct ufa_list *filepaths,
+				     struct ufa_error **error);
+
 /* ========================================================================== */
 /* FUNCTIONS FROM jsonrpc.api.h                                               */
 /* ========================================================================== */
@@ -88,6 +106,8 @@ ufa_jsonrpc_api_t *ufa_jsonrpc_api_init(struct ufa_error **error)
 
 	obj = ufa_malloc(sizeof *obj);
 	obj->socket_fd = data_socket;
+	obj->buf = NULL;
+	obj->buf_len = 0;
 	return obj;
 }
 
@@ -392,6 +412,54 @@ end:
 }
 
 
+ufa_hashtable_t *ufa_jsonrpc_api_gettags_many(ufa_jsonrpc_api_t *api,
+					      const char *dir,
+					      struct ufa_list *filepaths,
+					      struct ufa_error **error)
+{
+	return request_many(api, "gettags_many", dir, filepaths, error);
+}
+
+
+ufa_hashtable_t *ufa_jsonrpc_api_getattr_many(ufa_jsonrpc_api_t *api,
+					      const char *dir,
+					      struct ufa_list *filepaths,
+					      struct ufa_error **error)
+{
+	ufa_hashtable_t *result = NULL;
+	ufa_hashtable_t *table =
+	    request_many(api, "getattr_many", dir, filepaths, error);
+	if (table == NULL) {
+		return NULL;
+	}
+
+	// file path -> table of attributes to file path -> list of attributes
+	result = UFA_HASHTABLE_STRING();
+	struct ufa_list *files = ufa_hashtable_keys(table);
+	for (UFA_LIST_EACH(i, files)) {
+		ufa_hashtable_t *attrs = ufa_hashtable_get(table, i->data);
+		struct ufa_list *attrs_keys = ufa_hashtable_keys(attrs);
+		struct ufa_list *list = NULL;
+		for (UFA_LIST_EACH(j, attrs_keys)) {
+			struct ufa_repo_attr *attr =
+				ufa_calloc(1, sizeof *attr);
+			attr->attribute = ufa_str_dup(j->data);
+			attr->value =
+			    ufa_str_dup(ufa_hashtable_get(attrs, j->data));
+			list = ufa_list_append2(
+			    list, attr, (ufa_list_free_fn_t) ufa_repo_attr_free);
+		}
+		ufa_list_free(attrs_keys);
+		ufa_hashtable_put_full(result, ufa_str_dup(i->data), list,
+				       ufa_free,
+				       (ufa_hash_free_fn_t) ufa_list_free);
+	}
+	ufa_list_free(files);
+	ufa_hashtable_free(table);
+	return result;
+}
+
+
 bool ufa_jsonrpc_api_unsetattr(ufa_jsonrpc_api_t *api,
 			       const char *filepath,
 			       const char *attribute,
@@ -435,78 +503,327 @@ struct ufa_list *ufa_jsonrpc_api_search(ufa_jsonrpc_api_t *api,
 					bool include_repo_from_config,
 					struct ufa_error **error)
 {
+	return ufa_jsonrpc_api_search_page(api, repo_dirs, filter_attr, tags,
+					   include_repo_from_config, NULL, NULL,
+					   NULL, error);
+}
+
+struct ufa_list *ufa_jsonrpc_api_search_page(ufa_jsonrpc_api_t *api,
+					     struct ufa_list *repo_dirs,
+					     struct ufa_list *filter_attr,
+					     struct ufa_list *tags,
+					     bool include_repo_from_config,
+					     const struct ufa_repo_page *page,
+					     char **cursor,
+					     struct ufa_list **explain,
+					     struct ufa_error **error)
+{
+	if (cursor != NULL) {
+		*cursor = NULL;
+	}
+	if (explain != NULL) {
+		*explain = NULL;
+	}
 	ufa_return_val_iferror(error, NULL);
 
 	struct ufa_list *result = NULL;
 
 	// Dynamic allocated variables
-	struct ufa_list *attr_str_list = NULL;
 	struct ufa_jsonrpc *rpc        = NULL;
 	char *filter_str               = NULL;
 	char *tags_str                 = NULL;
 	char *repo_dirs_str            = NULL;
+	char *page_str                 = NULL;
 	char *msg                      = NULL;
 
-	const char *attr_format =
-	    "{ \"attribute\": \"%s\", \"value\": \"%s\", \"matchmode\": %d }";
 	const char *str_json =
 	    "{"
 	    " \"params\" : { \"repo_dirs\" : [ %s ],"
 	    "                \"filter_attrs\" : [ %s ],"
 	    "                \"tags\" : [ %s ],"
-	    "                \"include_repo_from_config\" : %s }, "
+	    "                \"include_repo_from_config\" : %s%s }, "
 	    "  \"jsonrpc\": \"2.0\","
 	    "  \"id\" : \"%s\","
 	    "   \"method\": \"search\""
 	    "}";
 
-	for (UFA_LIST_EACH(i, filter_attr)) {
-		struct ufa_repo_filterattr *f =
-		    (struct ufa_repo_filterattr *) i->data;
-		char *new_str = ufa_str_sprintf(attr_format, f->attribute,
-						f->value, f->matchmode);
-		attr_str_list =
-		    ufa_list_append2(attr_str_list, new_str, ufa_free);
-	}
-
-	filter_str = ufa_str_join_list(attr_str_list, ", ", NULL, NULL);
+	filter_str = filter_attrs_json(filter_attr);
 	tags_str = ufa_str_join_list(tags, ", ", "\"", "\"");
 	repo_dirs_str = ufa_str_join_list(repo_dirs, ", ", "\"", "\"");
+	page_str = page_params(page, explain != NULL);
 	msg = ufa_str_sprintf(str_json,
 			      repo_dirs_str,
 			      filter_str,
 			      tags_str,
 			      (include_repo_from_config) ? "true" : "false",
+			      page_str,
 			      "id-xpto-123");
 
 
 	bool ok = request_jsonrpc(api, msg, &rpc, error);
 	if_goto(!ok, end);
 
+	result = read_page(rpc, cursor, explain);
+end:
+	ufa_free(tags_str);
+	ufa_free(repo_dirs_str);
+	ufa_free(page_str);
+	ufa_free(filter_str);
+	ufa_free(msg);
+	ufa_jsonrpc_free(rpc);
+
+	return result;
+}
+
+struct ufa_list *ufa_jsonrpc_api_facets(ufa_jsonrpc_api_t *api,
+					struct ufa_list *repo_dirs,
+					struct ufa_list *filter_attr,
+					struct ufa_list *tags,
+					bool include_repo_from_config,
+					bool attrs,
+					struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+
+	struct ufa_list *result = NULL;
+	struct ufa_jsonrpc *rpc = NULL;
+
+	const char *str_json =
+	    "{"
+	    " \"params\" : { \"repo_dirs\" : [ %s ],"
+	    "                \"filter_attrs\" : [ %s ],"
+	    "                \"tags\" : [ %s ],"
+	    "                \"include_repo_from_config\" : %s,"
+	    "                \"attributes\" : %s }, "
+	    "  \"jsonrpc\": \"2.0\","
+	    "  \"id\" : \"%s\","
+	    "   \"method\": \"facets\""
+	    "}";
+
+	char *filter_str = filter_attrs_json(filter_attr);
+	char *tags_str = ufa_str_join_list(tags, ", ", "\"", "\"");
+	char *repo_dirs_str = ufa_str_join_list(repo_dirs, ", ", "\"", "\"");
+	char *msg = ufa_str_sprintf(str_json,
+				    repo_dirs_str,
+				    filter_str,
+				    tags_str,
+				    (include_repo_from_config) ? "true" : "false",
+				    (attrs) ? "true" : "false",
+				    "id-xpto-123");
+
+	bool ok = request_jsonrpc(api, msg, &rpc, error);
+	if_goto(!ok, end);
+
 	struct ufa_list *list_value =
 	    (struct ufa_list *) ufa_hashtable_get(rpc->result, "value");
 
-	if (list_value) {
-		result = ufa_list_clone(list_value,
-					(ufa_list_cpydata_fn_t) ufa_str_dup,
-					ufa_free);
+	for (UFA_LIST_EACH(i, list_value)) {
+		ufa_hashtable_t *obj = (ufa_hashtable_t *) i->data;
+		struct ufa_repo_facet *facet = ufa_calloc(1, sizeof *facet);
+		facet->name = ufa_str_dup(ufa_hashtable_get(obj, "name"));
+		char *value = ufa_hashtable_get(obj, "value");
+		facet->value = (value != NULL) ? ufa_str_dup(value) : NULL;
+		facet->count = (int) get_ulong(obj, "count");
+		result = ufa_list_append2(
+		    result, facet, (ufa_list_free_fn_t) ufa_repo_facet_free);
 	}
 end:
+	ufa_free(filter_str);
 	ufa_free(tags_str);
 	ufa_free(repo_dirs_str);
-	ufa_free(filter_str);
 	ufa_free(msg);
-	ufa_list_free(attr_str_list);
 	ufa_jsonrpc_free(rpc);
 
 	return result;
 }
 
+struct ufa_list *ufa_jsonrpc_api_query(ufa_jsonrpc_api_t *api,
+				       struct ufa_list *repo_dirs,
+				       const char *query,
+				       bool include_repo_from_config,
+				       struct ufa_error **error)
+{
+	return ufa_jsonrpc_api_query_page(api, repo_dirs, query,
+					  include_repo_from_config, NULL, NULL,
+					  NULL, error);
+}
+
+struct ufa_list *ufa_jsonrpc_api_query_page(ufa_jsonrpc_api_t *api,
+					    struct ufa_list *repo_dirs,
+					    const char *query,
+					    bool include_repo_from_config,
+					    const struct ufa_repo_page *page,
+					    char **cursor,
+					    struct ufa_list **explain,
+					    struct ufa_error **error)
+{
+	if (cursor != NULL) {
+		*cursor = NULL;
+	}
+	if (explain != NULL) {
+		*explain = NULL;
+	}
+	ufa_return_val_iferror(error, NULL);
+
+	struct ufa_list *result = NULL;
+	struct ufa_jsonrpc *rpc = NULL;
+
+	const char *str_json =
+	    "{"
+	    " \"params\" : { \"repo_dirs\" : [ %s ],"
+	    "                \"query\" : \"%s\","
+	    "                \"include_repo_from_config\" : %s%s }, "
+	    "  \"jsonrpc\": \"2.0\","
+	    "  \"id\" : \"%s\","
+	    "   \"method\": \"query\""
+	    "}";
+
+	char *query_str = ufa_jsonrpc_escape(query);
+	char *repo_dirs_str = ufa_str_join_list(repo_dirs, ", ", "\"", "\"");
+	char *page_str = page_params(page, explain != NULL);
+	char *msg = ufa_str_sprintf(str_json,
+				    repo_dirs_str,
+				    query_str,
+				    (include_repo_from_config) ? "true" : "false",
+				    page_str,
+				    "id-xpto-123");
+
+	bool ok = request_jsonrpc(api, msg, &rpc, error);
+	if_goto(!ok, end);
+
+	result = read_page(rpc, cursor, explain);
+end:
+	ufa_free(query_str);
+	ufa_free(repo_dirs_str);
+	ufa_free(page_str);
+	ufa_free(msg);
+	ufa_jsonrpc_free(rpc);
+
+	return result;
+}
+
+struct ufa_list *ufa_jsonrpc_api_stats(ufa_jsonrpc_api_t *api,
+				       struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+
+	struct ufa_list *result = NULL;
+
+	const char *str_json = "{"
+			       "    \"params\" : { }, "
+			       "    \"jsonrpc\": \"2.0\","
+			       "    \"id\" : \"%s\","
+			       "    \"method\": \"stats\""
+			       "}";
+
+	char *msg = ufa_str_sprintf(str_json, "id-xpto-123");
+
+	struct ufa_jsonrpc *rpc = NULL;
+	bool ok = request_jsonrpc(api, msg, &rpc, error);
+	if_goto(!ok, end);
+
+	struct ufa_list *list_value =
+	    (struct ufa_list *) ufa_hashtable_get(rpc->result, "value");
+
+	for (UFA_LIST_EACH(i, list_value)) {
+		ufa_hashtable_t *table = (ufa_hashtable_t *) i->data;
+		struct ufa_stats_summary *s = ufa_calloc(1, sizeof *s);
+		s->name = ufa_str_dup(ufa_hashtable_get(table, "name"));
+		s->count = get_ulong(table, "count");
+		s->errors = get_ulong(table, "errors");
+		s->mean = get_ulong(table, "mean");
+		s->p50 = get_ulong(table, "p50");
+		s->p90 = get_ulong(table, "p90");
+		s->p99 = get_ulong(table, "p99");
+		s->max = get_ulong(table, "max");
+		result = ufa_list_append2(
+		    result, s, (ufa_list_free_fn_t) ufa_stats_summary_free);
+	}
+end:
+	ufa_free(msg);
+	ufa_jsonrpc_free(rpc);
+	return result;
+}
+
+bool ufa_jsonrpc_api_subscribe(ufa_jsonrpc_api_t *api,
+			       const char *dir,
+			       struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+
+	const char *str_json = "{"
+			       "    \"params\" : { \"dir\" : \"%s\" }, "
+			       "    \"jsonrpc\": \"2.0\","
+			       "    \"id\" : \"%s\","
+			       "    \"method\": \"subscribe\""
+			       "}";
+
+	char *msg = ufa_str_sprintf(str_json, dir, "id-xpto-123");
+
+	struct ufa_jsonrpc *rpc = NULL;
+	bool ok = request_jsonrpc(api, msg, &rpc, error);
+
+	ufa_free(msg);
+	ufa_jsonrpc_free(rpc);
+	return ok;
+}
+
+bool ufa_jsonrpc_api_next_change(ufa_jsonrpc_api_t *api,
+				 enum ufa_data_change *change,
+				 char **path,
+				 char **path2,
+				 struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+
+	const char *names[] = {"tags", "attributes", "removed", "renamed",
+			       "rescan"};
+	const enum ufa_data_change changes[] = {
+	    UFA_DATA_CHANGE_TAGS, UFA_DATA_CHANGE_ATTRS,
+	    UFA_DATA_CHANGE_REMOVED, UFA_DATA_CHANGE_RENAMED,
+	    UFA_DATA_CHANGE_RESCAN};
+
+	bool result = false;
+	struct ufa_jsonrpc *rpc = NULL;
+
+	char *msg = read_message(api, error);
+	if_goto(msg == NULL, end);
+
+	if (ufa_jsonrpc_parse(msg, &rpc) != UFA_JSON_OK
+	    || !ufa_str_equals(rpc->method, "changed")) {
+		ufa_error_new(error, UFA_ERROR_INTERNAL,
+			      "Invalid notification: %s", msg);
+		goto end;
+	}
+
+	char *name = ufa_hashtable_get(rpc->params, "change");
+	for (size_t i = 0; i < sizeof(changes) / sizeof(changes[0]); i++) {
+		if (ufa_str_equals(name, names[i])) {
+			*change = changes[i];
+			result = true;
+		}
+	}
+	if (!result) {
+		ufa_error_new(error, UFA_ERROR_INTERNAL,
+			      "Unknown change: %s", STR_NOTNULL(name));
+		goto end;
+	}
+
+	*path = ufa_str_dup(ufa_hashtable_get(rpc->params, "path"));
+	char *p2 = ufa_hashtable_get(rpc->params, "path2");
+	*path2 = (p2 != NULL) ? ufa_str_dup(p2) : NULL;
+end:
+	ufa_free(msg);
+	ufa_jsonrpc_free(rpc);
+	return result;
+}
+
 void ufa_jsonrpc_api_close(ufa_jsonrpc_api_t *api, struct ufa_error **error)
 {
 	ufa_return_if(api == NULL);
 
 	close(api->socket_fd);
+	ufa_free(api->buf);
 	ufa_free(api);
 	ufa_debug("Closing JSRON-RPC API");
 }
@@ -515,28 +832,219 @@ void ufa_jsonrpc_api_close(ufa_jsonrpc_api_t *api, struct ufa_error **error)
 /* AUXILIARY FUNCTIONS                                                        */
 /* ========================================================================== */
 
-static void request_socket(struct ufa_jsonrpc_api *obj,
-			   const char *msg_to_send,
-			   char *response_buf)
+/**
+ * Sends a message and reads the response (see read_message).
+ */
+static char *request_socket(struct ufa_jsonrpc_api *obj,
+			    const char *msg_to_send,
+			    struct ufa_error **error)
 {
-	int ret;
+	ufa_return_val_iferror(error, NULL);
 
 	ufa_debug("Writting msg to socket: %s", msg_to_send);
-	ret = write(obj->socket_fd, msg_to_send, strlen(msg_to_send) + 1);
+	size_t len = strlen(msg_to_send) + 1;
+	if (write(obj->socket_fd, msg_to_send, len) != (ssize_t) len) {
+		ufa_error_new(error, UFA_ERROR_INTERNAL,
+			      "Error sending JSONRPC request: %s",
+			      strerror(errno));
+		return NULL;
+	}
+
+	return read_message(obj, error);
+}
+
+/**
+ * Reads the next message, which ends with a '\0'. Data read after it (the
+ * beginning of next messages) is kept in obj->buf.
+ */
+static char *read_message(struct ufa_jsonrpc_api *obj,
+			  struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+
+	char *end = NULL;
+	while (obj->buf_len == 0
+	       || (end = memchr(obj->buf, '\0', obj->buf_len)) == NULL) {
+		obj->buf = ufa_realloc(obj->buf, obj->buf_len + CHUNK_SIZE);
+		ssize_t ret = read(obj->socket_fd, obj->buf + obj->buf_len,
+				   CHUNK_SIZE);
+		if (ret <= 0) {
+			ufa_error_new(error, UFA_ERROR_INTERNAL,
+				      "Error reading JSONRPC response: %s",
+				      (ret == 0) ? "connection closed"
+						 : strerror(errno));
+			return NULL;
+		}
+		obj->buf_len += ret;
+	}
+
+	size_t len = end - obj->buf + 1;
+	char *msg = ufa_malloc(len);
+	memcpy(msg, obj->buf, len);
+	obj->buf_len -= len;
+	memmove(obj->buf, obj->buf + len, obj->buf_len);
+
+	ufa_debug("Received msg: %s", msg);
+	return msg;
+}
+
+/**
+ * Sends a request of gettags_many/getattr_many and returns the table in the
+ * "value" of the result (file path -> value), now owned by the caller.
+ */
+static ufa_hashtable_t *request_many(ufa_jsonrpc_api_t *api,
+				     const char *method,
+				     const char *dir,
+				     struct ufa_list *filepaths,
+				     struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, NULL);
+
+	ufa_hashtable_t *result = NULL;
+	struct ufa_jsonrpc *rpc = NULL;
+
+	const char *str_json =
+	    "{"
+	    " \"params\" : { \"dir\" : %s, \"filepaths\" : [ %s ] }, "
+	    "  \"jsonrpc\": \"2.0\","
+	    "  \"id\" : \"%s\","
+	    "  \"method\": \"%s\""
+	    "}";
+
+	char *dir_str = (dir == NULL) ? ufa_str_dup("null")
+				      : ufa_str_sprintf("\"%s\"", dir);
+	char *filepaths_str = ufa_str_join_list(filepaths, ", ", "\"", "\"");
+	char *msg = ufa_str_sprintf(str_json, dir_str, filepaths_str,
+				    "id-xpto-123", method);
 
-	if (ret < 0) {
-		// errno is set
+	bool ok = request_jsonrpc(api, msg, &rpc, error);
+	if_goto(!ok, end);
+
+	result = ufa_hashtable_steal(rpc->result, "value");
+	if (result == NULL) {
+		// no files (empty object)
+		result = UFA_HASHTABLE_STRING();
 	}
+end:
+	ufa_free(dir_str);
+	ufa_free(filepaths_str);
+	ufa_free(msg);
+	ufa_jsonrpc_free(rpc);
+	return result;
+}
 
-	ret = read(obj->socket_fd, response_buf, MAX_RESPONSE_SIZE);
-	if (ret < 0) {
-		// errno is set
+static unsigned long get_ulong(ufa_hashtable_t *table, const char *key)
+{
+	long *value = (long *) ufa_hashtable_get(table, key);
+	return (value == NULL) ? 0 : (unsigned long) *value;
+}
+
+/**
+ * Params of a page of results and "explain" (members to append to the
+ * params of search and query), or an empty string if 'page' is NULL and
+ * 'explain' is false.
+ */
+static char *page_params(const struct ufa_repo_page *page, bool explain)
+{
+	const char *explain_str = explain ? ", \"explain\" : true" : "";
+	if (page == NULL) {
+		return ufa_str_dup(explain_str);
 	}
 
-	ufa_debug("Received msg: %s", response_buf);
+	char *str = ufa_str_sprintf(", \"limit\" : %d, \"sort\" : %d%s",
+				    page->limit, page->sort, explain_str);
+	const char *names[] = {"sort_attribute", "cursor"};
+	const char *values[] = {page->sort_attr, page->after};
+	for (int i = 0; i < 2; i++) {
+		if (values[i] == NULL) {
+			continue;
+		}
+		char *escaped = ufa_jsonrpc_escape(values[i]);
+		char *tmp = ufa_str_sprintf("%s, \"%s\" : \"%s\"", str,
+					    names[i], escaped);
+		ufa_free(escaped);
+		ufa_free(str);
+		str = tmp;
+	}
+	return str;
 }
 
+/**
+ * Filter of attributes (list of struct ufa_repo_filterattr) as the elements
+ * of the JSON array of param "filter_attrs".
+ */
+static char *filter_attrs_json(struct ufa_list *filter_attr)
+{
+	const char *attr_format =
+	    "{ \"attribute\": \"%s\", \"value\": \"%s\", \"matchmode\": %d }";
+
+	struct ufa_list *attr_str_list = NULL;
+	for (UFA_LIST_EACH(i, filter_attr)) {
+		struct ufa_repo_filterattr *f =
+		    (struct ufa_repo_filterattr *) i->data;
+		char *new_str = ufa_str_sprintf(attr_format, f->attribute,
+						f->value, f->matchmode);
+		attr_str_list =
+		    ufa_list_append2(attr_str_list, new_str, ufa_free);
+	}
+
+	char *filter_str = ufa_str_join_list(attr_str_list, ", ", NULL, NULL);
+	ufa_list_free(attr_str_list);
+	return filter_str;
+}
 
+/**
+ * Reads the files of a response of search or query, and the cursor of the
+ * next page (if 'cursor' is not NULL).
+ */
+static struct ufa_list *read_page(struct ufa_jsonrpc *rpc, char **cursor,
+				  struct ufa_list **explain)
+{
+	struct ufa_list *list_value =
+	    (struct ufa_list *) ufa_hashtable_get(rpc->result, "value");
+	char *next = (char *) ufa_hashtable_get(rpc->result, "cursor");
+
+	if (cursor != NULL && next != NULL) {
+		*cursor = ufa_str_dup(next);
+	}
+	if (explain != NULL) {
+		*explain = read_explain(rpc);
+	}
+	return ufa_list_clone(list_value, (ufa_list_cpydata_fn_t) ufa_str_dup,
+			      ufa_free);
+}
+
+/**
+ * Reads the stages of a search from the member "explain" of a response.
+ *
+ * @return List of struct ufa_repo_explain
+ */
+static struct ufa_list *read_explain(struct ufa_jsonrpc *rpc)
+{
+	struct ufa_list *result = NULL;
+	struct ufa_list *stages =
+	    (struct ufa_list *) ufa_hashtable_get(rpc->result, "explain");
+
+	for (UFA_LIST_EACH(i, stages)) {
+		ufa_hashtable_t *obj = (ufa_hashtable_t *) i->data;
+		struct ufa_repo_explain *e = ufa_calloc(1, sizeof *e);
+		char *repository = ufa_hashtable_get(obj, "repository");
+		char *stage = ufa_hashtable_get(obj, "stage");
+		char *sql = ufa_hashtable_get(obj, "sql");
+		double *ms = ufa_hashtable_get(obj, "time_ms");
+		e->repository = repository ? ufa_str_dup(repository) : NULL;
+		e->stage = ufa_str_dup(STR_NOTNULL(stage));
+		e->sql = sql ? ufa_str_dup(sql) : NULL;
+		e->plan = ufa_list_clone(ufa_hashtable_get(obj, "plan"),
+					 (ufa_list_cpydata_fn_t) ufa_str_dup,
+					 ufa_free);
+		e->rows = (long) get_ulong(obj, "rows");
+		e->ms = (ms != NULL) ? *ms : 0;
+		result = ufa_list_append2(
+		    result, e, (ufa_list_free_fn_t) ufa_repo_explain_free);
+	}
+	return result;
+}
 
 static bool request_jsonrpc(ufa_jsonrpc_api_t *api,
 			    const char *msg,
@@ -545,11 +1053,14 @@ static bool request_jsonrpc(ufa_jsonrpc_api_t *api,
 {
 	ufa_return_val_iferror(error, false);
 
-	char response[MAX_RESPONSE_SIZE] = "";
-	request_socket(api, msg, response);
+	char *response = request_socket(api, msg, error);
+	if (response == NULL) {
+		return false;
+	}
 
-	enum ufa_parser_result r;
-	if ((r = ufa_jsonrpc_parse(response, jsonrpc)) != UFA_JSON_OK) {
+	enum ufa_parser_result r = ufa_jsonrpc_parse(response, jsonrpc);
+	ufa_free(response);
+	if (r != UFA_JSON_OK) {
 		ufa_error_new(error,
 			      UFA_ERROR_INTERNAL,
 			      "Error parsing JSONRPC response: %d", r);
@@ -571,7 +1082,7 @@ static bool request_jsonrpc(ufa_jsonrpc_api_t *api,
 		}
 
 		ufa_error_new(error, code, message, code);
-		if (*error) {
+		if (HAS_ERROR(error)) {
 			ufa_error((*error)->message);
 		}
 
@@ -1,7 +1,9 @@
 #ifndef UFA_JSONRPC_API_H_
 #define UFA_JSONRPC_API_H_
 
+#include "core/data.h"
 #include "util/error.h"
+#include "util/hashtable.h"
 #include <stdbool.h>
 
 typedef struct ufa_jsonrpc_api ufa_jsonrpc_api_t;
@@ -50,6 +52,32 @@ struct ufa_list *ufa_jsonrpc_api_getattr(ufa_jsonrpc_api_t *api,
 					 const char *filepath,
 					 struct ufa_error **error);
 
+/**
+ * Gets the tags of the files of 'dir' and of the files in 'filepaths' (either
+ * may be NULL) with a single request.
+ *
+ * @param api
+ * @param dir Directory
+ * @param filepaths List of file paths
+ * @param error
+ * @return Hashtable mapping file path -> list of tags (files without tags
+ * are not included)
+ */
+ufa_hashtable_t *ufa_jsonrpc_api_gettags_many(ufa_jsonrpc_api_t *api,
+					      const char *dir,
+					      struct ufa_list *filepaths,
+					      struct ufa_error **error);
+
+/**
+ * Same as ufa_jsonrpc_api_gettags_many for attributes.
+ *
+ * @return Hashtable mapping file path -> list of struct ufa_repo_attr
+ */
+ufa_hashtable_t *ufa_jsonrpc_api_getattr_many(ufa_jsonrpc_api_t *api,
+					      const char *dir,
+					      struct ufa_list *filepaths,
+					      struct ufa_error **error);
+
 bool ufa_jsonrpc_api_unsetattr(ufa_jsonrpc_api_t *api,
 			       const char *filepath,
 			       const char *attribute,
@@ -62,4 +90,116 @@ struct ufa_list *ufa_jsonrpc_api_search(ufa_jsonrpc_api_t *api,
 					bool include_repo_from_config,
 					struct ufa_error **error);
 
+/**
+ * Same as ufa_jsonrpc_api_search, for a page of results (see
+ * ufa_data_search_page).
+ *
+ * @param page Limit, sort (in each repository) and cursor of the previous
+ * page (page->after), or NULL for all the results
+ * @param cursor Where to store the cursor of the next page (new string, or
+ * NULL if it is the last page); may be NULL
+ * @param explain If not NULL, where to store how the server ran the search:
+ * list of struct ufa_repo_explain (see ufa_repo_explain_begin), the last
+ * one being the "total" of the search
+ */
+struct ufa_list *ufa_jsonrpc_api_search_page(ufa_jsonrpc_api_t *api,
+					     struct ufa_list *repo_dirs,
+					     struct ufa_list *filter_attr,
+					     struct ufa_list *tags,
+					     bool include_repo_from_config,
+					     const struct ufa_repo_page *page,
+					     char **cursor,
+					     struct ufa_list **explain,
+					     struct ufa_error **error);
+
+/**
+ * Counts the tags and attribute values of the files found by a search (see
+ * ufa_data_facets).
+ *
+ * @param attrs Whether to also count the attribute values
+ * @return List of struct ufa_repo_facet
+ */
+struct ufa_list *ufa_jsonrpc_api_facets(ufa_jsonrpc_api_t *api,
+					struct ufa_list *repo_dirs,
+					struct ufa_list *filter_attr,
+					struct ufa_list *tags,
+					bool include_repo_from_config,
+					bool attrs,
+					struct ufa_error **error);
+
+/**
+ * Searches files with a query (see core/query.h), parsed by the server.
+ *
+ * @param api
+ * @param repo_dirs Repositories
+ * @param query Query, e.g. "(math OR physics) AND NOT @year=2020"
+ * @param include_repo_from_config Whether to also search the repositories
+ * of the config file
+ * @param error
+ * @return List of paths of the files found
+ */
+struct ufa_list *ufa_jsonrpc_api_query(ufa_jsonrpc_api_t *api,
+				       struct ufa_list *repo_dirs,
+				       const char *query,
+				       bool include_repo_from_config,
+				       struct ufa_error **error);
+
+/**
+ * Same as ufa_jsonrpc_api_query, for a page of results (see
+ * ufa_jsonrpc_api_search_page).
+ */
+struct ufa_list *ufa_jsonrpc_api_query_page(ufa_jsonrpc_api_t *api,
+					    struct ufa_list *repo_dirs,
+					    const char *query,
+					    bool include_repo_from_config,
+					    const struct ufa_repo_page *page,
+					    char **cursor,
+					    struct ufa_list **explain,
+					    struct ufa_error **error);
+
+/**
+ * Retrieves runtime statistics of the server.
+ *
+ * @param api
+ * @param error
+ * @return List of struct ufa_stats_summary
+ */
+struct ufa_list *ufa_jsonrpc_api_stats(ufa_jsonrpc_api_t *api,
+				       struct ufa_error **error);
+
+/**
+ * Subscribes to changes of tags and attributes of the files under 'dir' (a
+ * directory or repository). After that, the connection is only used to
+ * receive notifications (see ufa_jsonrpc_api_next_change), so other requests
+ * need another connection.
+ *
+ * @param api
+ * @param dir Directory
+ * @param error
+ * @return true if subscribed
+ */
+bool ufa_jsonrpc_api_subscribe(ufa_jsonrpc_api_t *api,
+			       const char *dir,
+			       struct ufa_error **error);
+
+/**
+ * Waits for the next change notification of a subscribed connection.
+ * UFA_DATA_CHANGE_RESCAN means any file under 'path' may have changed (it is
+ * also received when notifications were dropped because they were not read
+ * fast enough).
+ *
+ * @param api
+ * @param change Where to store the kind of change
+ * @param path Where to store the path (newly-allocated)
+ * @param path2 Where to store the new path of a renamed file
+ * (newly-allocated), or NULL for other changes
+ * @param error
+ * @return true if a notification was received
+ */
+bool ufa_jsonrpc_api_next_change(ufa_jsonrpc_api_t *api,
+				 enum ufa_data_change *change,
+				 char **path,
+				 char **path2,
+				 struct ufa_error **error);
+
 #endif // UFA_JSONRPC_API_H_
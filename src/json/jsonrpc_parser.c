@@ -13,6 +13,8 @@
 #include "util/logging.h"
 #include "util/misc.h"
 #include "util/string.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -22,6 +24,9 @@
 
 
 #define MAX_STR_SIZE 1024
+
+/** Tokens on stack. Bigger messages (e.g. responses of *_many methods) use
+ * a heap array, doubled until they fit */
 #define MAX_TOKENS   4096
 
 /**
@@ -43,6 +48,8 @@ struct parser_context {
 
 static struct ufa_jsonrpc *jsonrpc_new();
 static void fill_buf_from_token_str(jsmntok_t *tok, const char *json, char *buf);
+static char *token_to_str(jsmntok_t *tok, const char *json);
+static size_t encode_utf8(unsigned long codepoint, char *buf);
 static bool read_string(struct parser_context *ctx, void **value);
 static bool read_primitive(struct parser_context *ctx, void **value);
 static bool read_object(struct parser_context *ctx, ufa_hashtable_t **table);
@@ -62,17 +69,29 @@ enum ufa_parser_result ufa_jsonrpc_parse(const char *json,
 					 struct ufa_jsonrpc **jsonrpc)
 {
 	jsmn_parser parser;
-	jsmn_init(&parser);
-	jsmntok_t tokens[MAX_TOKENS];
+	jsmntok_t stack_tokens[MAX_TOKENS];
+	jsmntok_t *tokens = stack_tokens;
+	size_t max_tokens = MAX_TOKENS;
+	size_t len = strlen(json);
 	int num_tokens = 0;
 
-	num_tokens = jsmn_parse(&parser,
-				json,
-				strlen(json),
-				tokens,
-				MAX_TOKENS);
+	for (;;) {
+		jsmn_init(&parser);
+		num_tokens = jsmn_parse(&parser, json, len, tokens, max_tokens);
+		if (num_tokens != JSMN_ERROR_NOMEM) {
+			break;
+		}
+		max_tokens *= 2;
+		if (tokens == stack_tokens) {
+			tokens = NULL;
+		}
+		tokens = ufa_realloc(tokens, max_tokens * sizeof *tokens);
+	}
 
 	if (num_tokens < 0) {
+		if (tokens != stack_tokens) {
+			ufa_free(tokens);
+		}
 		return num_tokens;
 	}
 
@@ -93,10 +112,31 @@ enum ufa_parser_result ufa_jsonrpc_parse(const char *json,
 		  context.cursor,
 		  context.size);
 
+	if (tokens != stack_tokens) {
+		ufa_free(tokens);
+	}
 	return result;
 }
 
 
+char *ufa_jsonrpc_escape(const char *str)
+{
+	char *escaped = ufa_malloc(6 * strlen(str) + 1);
+	char *dst = escaped;
+	for (const char *c = str; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			*dst++ = '\\';
+			*dst++ = *c;
+		} else if ((unsigned char) *c < 0x20) {
+			dst += sprintf(dst, "\\u%04x", (unsigned char) *c);
+		} else {
+			*dst++ = *c;
+		}
+	}
+	*dst = '\0';
+	return escaped;
+}
+
 void ufa_jsonrpc_free(struct ufa_jsonrpc *p)
 {
 	if (p != NULL) {
@@ -133,14 +173,14 @@ static struct ufa_jsonrpc *jsonrpc_new()
 
 static void fill_buf_from_token_str(jsmntok_t *tok, const char *json, char *buf)
 {
+	int len = tok->end - tok->start;
 	buf[0] = '\0';
-	strncat(buf, json + tok->start, tok->end - tok->start);
+	strncat(buf, json + tok->start,
+		(len < MAX_STR_SIZE) ? len : MAX_STR_SIZE - 1);
 }
 
 static bool read_string(struct parser_context *ctx, void **value)
 {
-	char value_as_str[MAX_STR_SIZE] = "";
-
 	jsmntok_t *tokens = ctx->tokens;
 	const char *json  = ctx->json;
 	jsmntok_t *tok    = &tokens[ctx->cursor];
@@ -149,12 +189,96 @@ static bool read_string(struct parser_context *ctx, void **value)
 
 	ctx->cursor++;
 
-	strncat(value_as_str, json + tok->start, tok->end - tok->start);
-	*value = ufa_str_dup(value_as_str);
+	*value = token_to_str(tok, json);
 
 	return true;
 }
 
+/**
+ * Copies the value of a string token, replacing escape sequences (\uXXXX
+ * is written as UTF-8).
+ */
+static char *token_to_str(jsmntok_t *tok, const char *json)
+{
+	const char *src = json + tok->start;
+	const char *end = json + tok->end;
+	char *str = ufa_malloc(tok->end - tok->start + 1);
+	char *dst = str;
+
+	while (src < end) {
+		if (*src != '\\' || src + 1 == end) {
+			*dst++ = *src++;
+			continue;
+		}
+		src++;
+		switch (*src) {
+		case 'b':
+			*dst++ = '\b';
+			break;
+		case 'f':
+			*dst++ = '\f';
+			break;
+		case 'n':
+			*dst++ = '\n';
+			break;
+		case 'r':
+			*dst++ = '\r';
+			break;
+		case 't':
+			*dst++ = '\t';
+			break;
+		case 'u':
+			if (end - src > 4) {
+				char hex[5] = "";
+				strncat(hex, src + 1, 4);
+				unsigned long cp = strtoul(hex, NULL, 16);
+				src += 4;
+				// surrogate pair (two escapes)
+				if (cp >= 0xD800 && cp < 0xDC00 && end - src > 6
+				    && src[1] == '\\' && src[2] == 'u') {
+					hex[0] = '\0';
+					strncat(hex, src + 3, 4);
+					unsigned long low = strtoul(hex, NULL, 16);
+					if (low >= 0xDC00 && low < 0xE000) {
+						cp = 0x10000 + ((cp - 0xD800) << 10)
+						     + (low - 0xDC00);
+						src += 6;
+					}
+				}
+				dst += encode_utf8(cp, dst);
+			}
+			break;
+		default: // '"', '\\' and '/'
+			*dst++ = *src;
+		}
+		src++;
+	}
+	*dst = '\0';
+	return str;
+}
+
+static size_t encode_utf8(unsigned long codepoint, char *buf)
+{
+	if (codepoint < 0x80) {
+		buf[0] = (char) codepoint;
+		return 1;
+	} else if (codepoint < 0x800) {
+		buf[0] = (char) (0xC0 | (codepoint >> 6));
+		buf[1] = (char) (0x80 | (codepoint & 0x3F));
+		return 2;
+	} else if (codepoint < 0x10000) {
+		buf[0] = (char) (0xE0 | (codepoint >> 12));
+		buf[1] = (char) (0x80 | ((codepoint >> 6) & 0x3F));
+		buf[2] = (char) (0x80 | (codepoint & 0x3F));
+		return 3;
+	}
+	buf[0] = (char) (0xF0 | (codepoint >> 18));
+	buf[1] = (char) (0x80 | ((codepoint >> 12) & 0x3F));
+	buf[2] = (char) (0x80 | ((codepoint >> 6) & 0x3F));
+	buf[3] = (char) (0x80 | (codepoint & 0x3F));
+	return 4;
+}
+
 static bool read_primitive(struct parser_context *ctx, void **value)
 {
 	char value_as_str[255] = "";
@@ -275,8 +399,7 @@ static bool read_array(struct parser_context *ctx, size_t size,
 
 static bool parse_param(struct parser_context *ctx, ufa_hashtable_t *values)
 {
-	char attr[MAX_STR_SIZE]         = "";
-	char value_as_str[MAX_STR_SIZE] = "";
+	char attr[MAX_STR_SIZE] = "";
 
 	jsmntok_t *tokens = ctx->tokens;
 	const char *json  = ctx->json;
@@ -293,12 +416,9 @@ static bool parse_param(struct parser_context *ctx, ufa_hashtable_t *values)
 	ufa_debug("Parsing param '%s', type: %d", attr, tok_value->type);
 
 	if (tok_value->type == JSMN_STRING) {
-		fill_buf_from_token_str(tok_value, json, value_as_str);
-		ufa_debug("Saving on param table: %s=%s",
-			  attr,
-			  value_as_str);
-		ufa_hashtable_put(values, ufa_str_dup(attr),
-				  ufa_str_dup(value_as_str));
+		char *value = token_to_str(tok_value, json);
+		ufa_debug("Saving on param table: %s=%s", attr, value);
+		ufa_hashtable_put(values, ufa_str_dup(attr), value);
 		ctx->cursor += tok_attr->size;
 
 	} else if (tok_value->type == JSMN_ARRAY) {
@@ -345,7 +465,6 @@ static bool parse_param(struct parser_context *ctx, ufa_hashtable_t *values)
 				       obj,
 				       ufa_free,
 				       (ufa_hash_free_fn_t) ufa_hashtable_free);
-		ctx->cursor += tok_attr->size;
 	} else {
 		ufa_debug("Type %d not expected here", tok_value->type);
 		return false;
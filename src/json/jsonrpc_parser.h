@@ -69,4 +69,10 @@ enum ufa_parser_result ufa_jsonrpc_parse(const char *json,
  */
 void ufa_jsonrpc_free(struct ufa_jsonrpc *p);
 
+/**
+ * Escapes a string to be written between double quotes in a JSON message.
+ * @return New string
+ */
+char *ufa_jsonrpc_escape(const char *str);
+
 #endif // UFA_JSONRPC_PARSER_H_
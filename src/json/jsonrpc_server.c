@@ -14,13 +14,23 @@
 #include "util/misc.h"
 #include "util/string.h"
 #include "core/data.h"
+#include "core/errors.h"
+#include "core/query.h"
 #include "core/repo.h"
 #include "util/logging.h"
+#include "util/stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -32,21 +42,70 @@
 /** MAX chars for each read operation from socket */
 #define CHUNK_SIZE 1024
 
-static bool jsonrpc_server(int *fd);
+/** Max chars in a metric name for a method */
+#define MAX_METRIC_NAME 64
+
+/** First fd passed by socket activation (sd_listen_fds(3)) */
+#define LISTEN_FDS_START 3
+
+/** Max notifications waiting to be sent to a subscriber. When it is
+ * exceeded, they are replaced by a single "rescan" of the subscribed dir */
+#define MAX_QUEUED_NOTIFICATIONS 1024
+
+/** Whether an error response was sent for the current request */
+static __thread bool request_failed = false;
+
+/**
+ * A connection that subscribed to changes of files under 'dir'.
+ * Notifications are queued by the thread that made the change and sent by
+ * the thread of the connection, so a slow subscriber only delays itself.
+ */
+struct subscriber {
+	int fd;
+	int efd;     /* eventfd signaled when notifications are queued */
+	char *dir;
+	pthread_mutex_t mutex;
+	struct ufa_list *queue; /* notifications (JSON) not sent yet, newest
+				   first */
+	size_t queued;
+	bool overflow; /* queue was dropped */
+};
+
+/** Subscriber of the connection handled by the current thread */
+static __thread struct subscriber *subscription = NULL;
 
 struct ufa_jsonrpc_server {
 	int socket_fd;
+	bool inherited; /* socket_fd received from service manager */
+	int stop_efd;   /* eventfd signaled by ufa_jsonrpc_server_stop */
+	pthread_mutex_t subscribers_mutex;
+	pthread_cond_t subscribers_cond; /* signaled when one is removed */
+	struct ufa_list *subscribers;
+};
+
+/** Data passed to the thread of a connection */
+struct connection {
+	ufa_jsonrpc_server_t *server;
+	int fd;
 };
 
 /* ========================================================================== */
 /* AUXILIARY FUNCTIONS - DECLARATION                                          */
 /* ========================================================================== */
 
-static bool jsonrpc_server(int *fd);
+static int inherited_socket();
+static int bind_socket(struct ufa_error **error);
+static void jsonrpc_server(ufa_jsonrpc_server_t *server);
 static void *handle_connection(void *thread_data);
-static void process_request(int fd, struct ufa_jsonrpc *rpc);
+static void process_request(ufa_jsonrpc_server_t *server, int fd,
+			    struct ufa_jsonrpc *rpc);
 static void *get_param(struct ufa_jsonrpc *rpc, const char *param,
 		       struct ufa_error **error);
+static bool get_page(struct ufa_jsonrpc *rpc, struct ufa_repo_page *page,
+		     struct ufa_error **error);
+static bool get_explain(struct ufa_jsonrpc *rpc);
+static struct ufa_list *get_filter_attrs(struct ufa_jsonrpc *rpc,
+					 struct ufa_error **error);
 
 static void handle_listtags(int fd, struct ufa_jsonrpc *rpc);
 static void handle_settag(int fd, struct ufa_jsonrpc *rpc);
@@ -57,14 +116,40 @@ static void handle_unsettag(int fd, struct ufa_jsonrpc *rpc);
 static void handle_setattr(int fd, struct ufa_jsonrpc *rpc);
 static void handle_unsetattr(int fd, struct ufa_jsonrpc *rpc);
 static void handle_getattr(int fd, struct ufa_jsonrpc *rpc);
+static void handle_gettags_many(int fd, struct ufa_jsonrpc *rpc);
+static void handle_getattr_many(int fd, struct ufa_jsonrpc *rpc);
 static void handle_search(int fd, struct ufa_jsonrpc *rpc);
+static void handle_query(int fd, struct ufa_jsonrpc *rpc);
+static void handle_facets(int fd, struct ufa_jsonrpc *rpc);
+static void handle_stats(int fd, struct ufa_jsonrpc *rpc);
+static void handle_subscribe(ufa_jsonrpc_server_t *server, int fd,
+			     struct ufa_jsonrpc *rpc);
+
+static void serve_subscriber(ufa_jsonrpc_server_t *server,
+			     struct subscriber *sub);
+static bool is_under(const char *path, const char *dir);
+static bool matches(struct subscriber *sub, enum ufa_data_change change,
+		    const char *path, const char *path2);
+static char *notification_new(enum ufa_data_change change, const char *path,
+			      const char *path2);
+static void subscriber_free(struct subscriber *sub);
 
 static void send_response_list_str(int fd, const char *id,
 				   struct ufa_list *elements);
+static void send_response_page(int fd, const char *id,
+			       struct ufa_list *elements, const char *cursor,
+			       struct ufa_list *explain);
+static char *explain_json(struct ufa_list *explain);
+static void send_response_facets(int fd, const char *id,
+				 struct ufa_list *elements);
 static void send_response_bool(int fd, const char *id, bool value);
 static void send_response_int(int fd, const char *id, int value);
 static void send_response_objs_attr(int fd, const char *id,
 				    struct ufa_list *elements);
+static void send_response_stats(int fd, const char *id,
+				struct ufa_list *elements);
+static void send_response_many(int fd, const char *id, ufa_hashtable_t *table,
+			       bool attrs);
 static void send_error_response(int fd, const char *id, int code,
 				const char *message);
 
@@ -78,16 +163,42 @@ ufa_jsonrpc_server_t *ufa_jsonrpc_server_new()
 	struct ufa_jsonrpc_server *obj = NULL;
 	obj = ufa_malloc(sizeof *obj);
 	obj->socket_fd = -1;
+	obj->inherited = false;
+	obj->stop_efd = eventfd(0, EFD_CLOEXEC);
+	pthread_mutex_init(&obj->subscribers_mutex, NULL);
+	pthread_cond_init(&obj->subscribers_cond, NULL);
+	obj->subscribers = NULL;
 	return obj;
 }
 
+bool ufa_jsonrpc_server_listen(ufa_jsonrpc_server_t *server,
+			       struct ufa_error **error)
+{
+	ufa_return_val_iferror(error, false);
+	ufa_return_val_ifnot(server, false);
+
+	if (server->socket_fd != -1) {
+		return true;
+	}
+
+	int fd = inherited_socket();
+	if (fd != -1) {
+		ufa_info("Using listen socket from service manager: %d", fd);
+		server->inherited = true;
+	} else {
+		fd = bind_socket(error);
+	}
+	server->socket_fd = fd;
+	return fd != -1;
+}
+
 void ufa_jsonrpc_server_start(ufa_jsonrpc_server_t *server,
 			      struct ufa_error **error)
 {
 	ufa_return_iferror(error);
 
-	if (server) {
-		jsonrpc_server(&server->socket_fd);
+	if (server && ufa_jsonrpc_server_listen(server, error)) {
+		jsonrpc_server(server);
 	}
 }
 
@@ -96,13 +207,85 @@ void ufa_jsonrpc_server_stop(ufa_jsonrpc_server_t *server,
 {
 	ufa_return_iferror(error);
 
-	shutdown(server->socket_fd, SHUT_RDWR);
-	close(server->socket_fd);
-	// FIXME check errors
+	// the socket is closed by ufa_jsonrpc_server_free: a socket from the
+	// service manager must not be shut down, as it is still used to
+	// activate the next instance
+	uint64_t one = 1;
+	if (write(server->stop_efd, &one, sizeof(one)) != sizeof(one)) {
+		ufa_error("Error stopping JSON-RPC server: %s", strerror(errno));
+	}
+	if (!server->inherited && server->socket_fd != -1) {
+		unlink(SOCKET_PATH);
+	}
+
+	// threads of subscribers see the end of the connection and exit
+	pthread_mutex_lock(&server->subscribers_mutex);
+	for (UFA_LIST_EACH(i, server->subscribers)) {
+		shutdown(((struct subscriber *) i->data)->fd, SHUT_RDWR);
+	}
+	pthread_mutex_unlock(&server->subscribers_mutex);
+}
+
+void ufa_jsonrpc_server_notify(ufa_jsonrpc_server_t *server,
+			       enum ufa_data_change change,
+			       const char *path,
+			       const char *path2)
+{
+	ufa_return_if(server == NULL || path == NULL);
+
+	char *msg = NULL;
+	pthread_mutex_lock(&server->subscribers_mutex);
+	for (UFA_LIST_EACH(i, server->subscribers)) {
+		struct subscriber *sub = (struct subscriber *) i->data;
+		if (!matches(sub, change, path, path2)) {
+			continue;
+		}
+		if (msg == NULL) {
+			msg = notification_new(change, path, path2);
+		}
+		pthread_mutex_lock(&sub->mutex);
+		if (sub->queued >= MAX_QUEUED_NOTIFICATIONS) {
+			ufa_warn("Too many notifications queued for %d. "
+				 "Dropping them",
+				 sub->fd);
+			ufa_list_free_full(sub->queue, ufa_free);
+			sub->queue = NULL;
+			sub->queued = 0;
+			sub->overflow = true;
+		} else {
+			sub->queue = ufa_list_prepend(sub->queue,
+						      ufa_str_dup(msg));
+			sub->queued++;
+		}
+		pthread_mutex_unlock(&sub->mutex);
+
+		uint64_t one = 1;
+		write(sub->efd, &one, sizeof(one));
+	}
+	pthread_mutex_unlock(&server->subscribers_mutex);
+	ufa_free(msg);
 }
 
 void ufa_jsonrpc_server_free(ufa_jsonrpc_server_t *server)
 {
+	ufa_return_if(server == NULL);
+
+	// threads of subscribers use the server until they exit
+	pthread_mutex_lock(&server->subscribers_mutex);
+	while (server->subscribers != NULL) {
+		pthread_cond_wait(&server->subscribers_cond,
+				  &server->subscribers_mutex);
+	}
+	pthread_mutex_unlock(&server->subscribers_mutex);
+
+	if (server->socket_fd != -1) {
+		close(server->socket_fd);
+	}
+	if (server->stop_efd != -1) {
+		close(server->stop_efd);
+	}
+	pthread_cond_destroy(&server->subscribers_cond);
+	pthread_mutex_destroy(&server->subscribers_mutex);
 	ufa_free(server);
 }
 
@@ -110,21 +293,50 @@ void ufa_jsonrpc_server_free(ufa_jsonrpc_server_t *server)
 /* AUXILIARY FUNCTIONS                                                        */
 /* ========================================================================== */
 
-static bool jsonrpc_server(int *fd)
+/**
+ * Returns the listen socket passed by the service manager (socket activation,
+ * see sd_listen_fds(3)), or -1 if there is none
+ */
+static int inherited_socket()
+{
+	const char *pid = getenv("LISTEN_PID");
+	const char *fds = getenv("LISTEN_FDS");
+	if (pid == NULL || fds == NULL || atol(pid) != (long) getpid()) {
+		return -1;
+	}
+	int n = atoi(fds);
+
+	// environment is not passed to children
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+
+	if (n < 1) {
+		return -1;
+	}
+	if (n > 1) {
+		ufa_warn("%d sockets received, using only the first", n);
+	}
+	fcntl(LISTEN_FDS_START, F_SETFD, FD_CLOEXEC);
+	return LISTEN_FDS_START;
+}
+
+/**
+ * Creates the listen socket on SOCKET_PATH
+ */
+static int bind_socket(struct ufa_error **error)
 {
 	struct sockaddr_un addr;
-	int ret = -1;
 	int listen_socket;
 
 	unlink(SOCKET_PATH);
 
-	listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
-	*fd = listen_socket;
-
+	listen_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
 	ufa_debug("JSONRPC Server Listen Socket: %d", listen_socket);
 	if (listen_socket == -1) {
-		perror("socket");
-		return false;
+		ufa_error_new(error, UFA_ERROR_FILE, "socket: %s",
+			      strerror(errno));
+		return -1;
 	}
 
 	memset(&addr, 0, sizeof(struct sockaddr_un));
@@ -132,39 +344,79 @@ static bool jsonrpc_server(int *fd)
 	addr.sun_family = AF_UNIX;
 	strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
 
-	ret = bind(listen_socket, (const struct sockaddr *) &addr,
-		   sizeof(struct sockaddr_un));
-	if (ret == -1) {
-		perror("bind");
-		return false;
+	if (bind(listen_socket, (const struct sockaddr *) &addr,
+		 sizeof(struct sockaddr_un))
+	    == -1) {
+		ufa_error_new(error, UFA_ERROR_FILE, "bind '%s': %s",
+			      SOCKET_PATH, strerror(errno));
+		close(listen_socket);
+		return -1;
 	}
 
-	ret = listen(listen_socket, 20);
-	if (ret == -1) {
-		perror("listen"); // FIXME
-		return false;
+	if (listen(listen_socket, 20) == -1) {
+		ufa_error_new(error, UFA_ERROR_FILE, "listen: %s",
+			      strerror(errno));
+		close(listen_socket);
+		unlink(SOCKET_PATH);
+		return -1;
 	}
 
+	return listen_socket;
+}
+
+/**
+ * Accepts connections until ufa_jsonrpc_server_stop is called. Waiting in
+ * poll instead of accept, the server is stopped without a shutdown of the
+ * listen socket (see ufa_jsonrpc_server_stop).
+ */
+static void jsonrpc_server(ufa_jsonrpc_server_t *server)
+{
+	struct pollfd fds[2] = {
+		{.fd = server->socket_fd, .events = POLLIN},
+		{.fd = server->stop_efd, .events = POLLIN},
+	};
 	ufa_debug("JSONRPC Server Waiting for connections...");
-	int cfd;
-	while ((cfd = accept(listen_socket, NULL, NULL)) != -1) {
+	for (;;) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ufa_error("poll: %s", strerror(errno));
+			break;
+		}
+		if (fds[1].revents != 0) {
+			break;
+		}
+		if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			break;
+		}
+		int cfd = accept(fds[0].fd, NULL, NULL);
+		if (cfd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			ufa_error("accept: %s", strerror(errno));
+			break;
+		}
 		ufa_debug("New connection: %d", cfd);
+		struct connection *conn = ufa_malloc(sizeof *conn);
+		conn->server = server;
+		conn->fd = cfd;
 		pthread_t thread;
 		int ret = pthread_create(&thread,
 					 NULL,
 					 handle_connection,
-					 &cfd);
+					 conn);
 		if (ret != 0) {
 			// FIXME
 			fprintf(stderr, "Error creating thread\n");
+			close(cfd);
+			ufa_free(conn);
+		} else {
+			pthread_detach(thread);
 		}
 	}
-
-	close(listen_socket);
-
-	unlink(SOCKET_PATH);
-
-	return true;
+	ufa_debug("JSONRPC Server stopped");
 }
 
 static void *handle_connection(void *thread_data)
@@ -172,10 +424,14 @@ static void *handle_connection(void *thread_data)
 	char *buf = NULL;
 	int last_size = 0;
 
-	char part[CHUNK_SIZE] = "";
-	int fd = *((int *) thread_data);
+	char part[CHUNK_SIZE + 1] = "";
+	struct connection *conn = (struct connection *) thread_data;
+	ufa_jsonrpc_server_t *server = conn->server;
+	int fd = conn->fd;
 	int ret;
 
+	ufa_free(conn);
+
 	ufa_debug("Start reading socket: %d\n", fd);
 
 	while ((ret = read(fd, part, CHUNK_SIZE)) > 0) {
@@ -199,10 +455,17 @@ static void *handle_connection(void *thread_data)
 		if (p == UFA_JSON_OK) {
 			ufa_debug("Received the entire request: '%s'", buf);
 			ufa_debug("RPC Method: '%s'", rpc->method);
-			process_request(fd, rpc);
+			process_request(server, fd, rpc);
 			ufa_free(buf);
 			last_size = 0;
 			buf = NULL;
+			if (subscription != NULL) {
+				// connection is only used for notifications now
+				ufa_jsonrpc_free(rpc);
+				serve_subscriber(server, subscription);
+				subscription = NULL;
+				break;
+			}
 
 		} else if (p == UFA_JSON_PART) {
 			ufa_debug("Received part of request: '%s'", buf);
@@ -230,8 +493,12 @@ static void *handle_connection(void *thread_data)
 	return NULL;
 }
 
-static void process_request(int fd, struct ufa_jsonrpc *rpc)
+static void process_request(ufa_jsonrpc_server_t *server, int fd,
+			    struct ufa_jsonrpc *rpc)
 {
+	uint64_t start = ufa_stats_now();
+	request_failed = false;
+
 	if (ufa_str_equals(rpc->method, "listtags")) {
 		handle_listtags(fd, rpc);
 
@@ -259,9 +526,36 @@ static void process_request(int fd, struct ufa_jsonrpc *rpc)
 	} else if (ufa_str_equals(rpc->method, "getattr")) {
 		handle_getattr(fd, rpc);
 
+	} else if (ufa_str_equals(rpc->method, "gettags_many")) {
+		handle_gettags_many(fd, rpc);
+
+	} else if (ufa_str_equals(rpc->method, "getattr_many")) {
+		handle_getattr_many(fd, rpc);
+
 	} else if (ufa_str_equals(rpc->method, "search")) {
 		handle_search(fd, rpc);
+
+	} else if (ufa_str_equals(rpc->method, "query")) {
+		handle_query(fd, rpc);
+
+	} else if (ufa_str_equals(rpc->method, "facets")) {
+		handle_facets(fd, rpc);
+
+	} else if (ufa_str_equals(rpc->method, "stats")) {
+		handle_stats(fd, rpc);
+
+	} else if (ufa_str_equals(rpc->method, "subscribe")) {
+		handle_subscribe(server, fd, rpc);
+
+	} else {
+		send_error_response(fd, rpc->id, JSONRPC_METHOD_NOT_FOUND,
+				    "Method not found");
+		return;
 	}
+
+	char metric[MAX_METRIC_NAME];
+	snprintf(metric, sizeof(metric), "rpc.%s", rpc->method);
+	ufa_stats_record(metric, start, request_failed);
 }
 
 static void *get_param(struct ufa_jsonrpc *rpc, const char *param,
@@ -280,6 +574,88 @@ static void *get_param(struct ufa_jsonrpc *rpc, const char *param,
 	}
 }
 
+/**
+ * Reads the optional params of a page of results: "limit", "sort" (enum
+ * ufa_repo_sort, applied in each repository, see ufa_data_search_page),
+ * "sort_attribute" and "cursor" (of the previous page).
+ *
+ * @return Whether any of them was given
+ */
+static bool get_page(struct ufa_jsonrpc *rpc, struct ufa_repo_page *page,
+		     struct ufa_error **error)
+{
+	ufa_hashtable_t *table = rpc->params;
+	long *limit = (long *) ufa_hashtable_get(table, "limit");
+	long *sort = (long *) ufa_hashtable_get(table, "sort");
+
+	*page = (struct ufa_repo_page){.sort = UFA_REPO_SORT_NONE};
+	if (limit != NULL) {
+		if (*limit < 0 || *limit > INT_MAX) {
+			ufa_error_new(error, JSONRPC_INVALID_PARAMS,
+				      "invalid limit: %ld", *limit);
+			return false;
+		}
+		page->limit = (int) *limit;
+	}
+	if (sort != NULL) {
+		if (*sort < 0 || *sort >= UFA_REPO_SORT_TOTAL) {
+			ufa_error_new(error, JSONRPC_INVALID_PARAMS,
+				      "invalid sort: %ld", *sort);
+			return false;
+		}
+		page->sort = (enum ufa_repo_sort) *sort;
+	}
+	page->sort_attr = (char *) ufa_hashtable_get(table, "sort_attribute");
+	page->after = (char *) ufa_hashtable_get(table, "cursor");
+
+	return limit != NULL || sort != NULL || page->after != NULL;
+}
+
+/**
+ * Reads the optional param "explain": whether to also send how the search
+ * was run (see ufa_repo_explain_begin and send_response_page).
+ */
+static bool get_explain(struct ufa_jsonrpc *rpc)
+{
+	bool *explain = (bool *) ufa_hashtable_get(rpc->params, "explain");
+	return explain != NULL && *explain;
+}
+
+/**
+ * Reads the param "filter_attrs": list of objects with "attribute", "value"
+ * and "matchmode".
+ *
+ * @return List of struct ufa_repo_filterattr
+ */
+static struct ufa_list *get_filter_attrs(struct ufa_jsonrpc *rpc,
+					 struct ufa_error **error)
+{
+	struct ufa_list *attributes = NULL;
+
+	struct ufa_list *filter_attrs =
+	    (struct ufa_list *) get_param(rpc, "filter_attrs", error);
+	ufa_return_val_iferror(error, NULL);
+
+	for (UFA_LIST_EACH(i, filter_attrs)) {
+		ufa_hashtable_t *table = (ufa_hashtable_t *) i->data;
+		char *attr = ufa_hashtable_get(table, "attribute");
+		char *val = ufa_hashtable_get(table, "value");
+		int matchmode = *((int *) ufa_hashtable_get(table, "matchmode"));
+		if (matchmode < 0 || matchmode >= UFA_REPO_MATCHMODE_TOTAL) {
+			ufa_error_new(error, JSONRPC_INVALID_PARAMS,
+				      "invalid matchmode: %d", matchmode);
+			ufa_list_free(attributes);
+			return NULL;
+		}
+		struct ufa_repo_filterattr *fa =
+		    ufa_repo_filterattr_new(attr, val, matchmode);
+		attributes = ufa_list_append2(
+		    attributes, fa,
+		    (ufa_list_free_fn_t) ufa_repo_filterattr_free);
+	}
+	return attributes;
+}
+
 static void handle_listtags(int fd, struct ufa_jsonrpc *rpc)
 {
 	struct ufa_error *error = NULL;
@@ -477,14 +853,68 @@ error:
 	ufa_error_free(error);
 }
 
+/**
+ * Handles gettags_many and getattr_many. Params: "dir" (all files of a
+ * directory) and/or "filepaths" (list of files).
+ */
+static void handle_many(int fd, struct ufa_jsonrpc *rpc, bool attrs)
+{
+	struct ufa_error *error = NULL;
+	ufa_hashtable_t *table = NULL;
+
+	char *dir = (char *) ufa_hashtable_get(rpc->params, "dir");
+	struct ufa_list *filepaths =
+	    (struct ufa_list *) ufa_hashtable_get(rpc->params, "filepaths");
+	if (dir == NULL && !ufa_hashtable_has_key(rpc->params, "filepaths")) {
+		ufa_error_new(&error, JSONRPC_INVALID_PARAMS,
+			      "Missing parameter 'dir' or 'filepaths'");
+		goto error;
+	}
+
+	table = (attrs) ? ufa_data_getattr_many(dir, filepaths, &error)
+			: ufa_data_gettags_many(dir, filepaths, &error);
+	if (error) {
+		error->code = JSONRPC_INTERNAL_ERROR;
+		goto error;
+	}
+
+	send_response_many(fd, rpc->id, table, attrs);
+	ufa_hashtable_free(table);
+	return;
+error:
+	send_error_response(fd, rpc->id, error->code, error->message);
+	ufa_error_free(error);
+}
+
+static void handle_gettags_many(int fd, struct ufa_jsonrpc *rpc)
+{
+	handle_many(fd, rpc, false);
+}
+
+static void handle_getattr_many(int fd, struct ufa_jsonrpc *rpc)
+{
+	handle_many(fd, rpc, true);
+}
+
+/**
+ * Handles search. Params: "filter_attrs", "tags", "repo_dirs",
+ * "include_repo_from_config" and the optional params of a page (see
+ * get_page), with which the result also has the "cursor" of the next page.
+ */
 static void handle_search(int fd, struct ufa_jsonrpc *rpc)
 {
 	struct ufa_list *result = NULL;
 	struct ufa_error *error = NULL;
 	struct ufa_list *attributes = NULL;
+	struct ufa_list *explain = NULL;
+	char *cursor = NULL;
+	struct ufa_repo_page page;
 
-	struct ufa_list *filter_attrs =
-	    (struct ufa_list *) get_param(rpc, "filter_attrs", &error);
+	bool paged = get_page(rpc, &page, &error);
+	if_goto(error != NULL, end);
+	bool explaining = get_explain(rpc);
+
+	attributes = get_filter_attrs(rpc, &error);
 	if_goto(error != NULL, end);
 
 	struct ufa_list *tags =
@@ -500,46 +930,361 @@ static void handle_search(int fd, struct ufa_jsonrpc *rpc)
 	    (bool *) get_param(rpc, "include_repo_from_config", &error);
 	if_goto(error != NULL, end);
 
-	for (UFA_LIST_EACH(i, filter_attrs)) {
-		ufa_hashtable_t *table = (ufa_hashtable_t *) i->data;
-		char *attr = ufa_hashtable_get(table, "attribute");
-		char *val = ufa_hashtable_get(table, "value");
-		enum ufa_repo_matchmode matchmode =
-		    *((int *) ufa_hashtable_get(table, "matchmode"));
-		struct ufa_repo_filterattr *fa =
-		    ufa_repo_filterattr_new(attr, val, matchmode);
-		attributes = ufa_list_append2(
-		    attributes, fa,
-		    (ufa_list_free_fn_t) ufa_repo_filterattr_free);
+	uint64_t start = ufa_stats_now();
+	if (explaining) {
+		ufa_repo_explain_begin();
+	}
+	result = ufa_data_search_page(repo_dirs,
+				      attributes,
+				      tags,
+				      *include_repo_from_cofig,
+				      paged ? &page : NULL,
+				      &cursor,
+				      &error);
+	if (explaining) {
+		ufa_repo_explain_add(NULL, "total", start,
+				     ufa_list_size(result));
+		explain = ufa_repo_explain_end();
 	}
 
-	result = ufa_data_search(repo_dirs,
-				 attributes,
-				 tags,
-				 *include_repo_from_cofig,
-				 &error);
+	if (error) {
+		error->code = (error->code == UFA_ERROR_ARGS)
+				  ? JSONRPC_INVALID_PARAMS
+				  : JSONRPC_INTERNAL_ERROR;
+		goto end;
+	}
 
+
+end:
 	if (error) {
-		error->code = JSONRPC_INTERNAL_ERROR;
+		send_error_response(fd, rpc->id, error->code, error->message);
+		ufa_error_free(error);
+	} else if (paged || explain != NULL) {
+		send_response_page(fd, rpc->id, result, cursor, explain);
+	} else {
+		send_response_list_str(fd, rpc->id, result);
+	}
+
+	ufa_free(cursor);
+	ufa_list_free(attributes);
+	ufa_list_free(explain);
+	ufa_list_free(result);
+}
+
+/**
+ * Handles query. Params: "query" (see query.h), "repo_dirs",
+ * "include_repo_from_config" and the params of a page (as in search). The
+ * query is parsed once and executed on each repository.
+ */
+static void handle_query(int fd, struct ufa_jsonrpc *rpc)
+{
+	struct ufa_list *result = NULL;
+	struct ufa_error *error = NULL;
+	struct ufa_query *query = NULL;
+	struct ufa_list *explain = NULL;
+	char *cursor = NULL;
+	struct ufa_repo_page page;
+
+	bool paged = get_page(rpc, &page, &error);
+	if_goto(error != NULL, end);
+	bool explaining = get_explain(rpc);
+
+	char *str = (char *) get_param(rpc, "query", &error);
+	if_goto(error != NULL, end);
+
+	struct ufa_list *repo_dirs =
+	    (struct ufa_list *) get_param(rpc, "repo_dirs", &error);
+	if_goto(error != NULL, end);
+
+	bool *include_repo_from_config =
+	    (bool *) get_param(rpc, "include_repo_from_config", &error);
+	if_goto(error != NULL, end);
+
+	query = ufa_query_parse(str, &error);
+	if (error) {
+		error->code = JSONRPC_INVALID_PARAMS;
 		goto end;
 	}
 
+	uint64_t start = ufa_stats_now();
+	if (explaining) {
+		ufa_repo_explain_begin();
+	}
+	result = ufa_data_query_page(repo_dirs, query,
+				     *include_repo_from_config,
+				     paged ? &page : NULL, &cursor, &error);
+	if (explaining) {
+		ufa_repo_explain_add(NULL, "total", start,
+				     ufa_list_size(result));
+		explain = ufa_repo_explain_end();
+	}
+	if (error) {
+		error->code = (error->code == UFA_ERROR_ARGS)
+				  ? JSONRPC_INVALID_PARAMS
+				  : JSONRPC_INTERNAL_ERROR;
+	}
 
 end:
 	if (error) {
 		send_error_response(fd, rpc->id, error->code, error->message);
 		ufa_error_free(error);
+	} else if (paged || explain != NULL) {
+		send_response_page(fd, rpc->id, result, cursor, explain);
 	} else {
 		send_response_list_str(fd, rpc->id, result);
 	}
 
+	ufa_free(cursor);
+	ufa_list_free(explain);
+	ufa_query_free(query);
+	ufa_list_free(result);
+}
+
+/**
+ * Handles facets. Params: "filter_attrs", "tags", "repo_dirs" and
+ * "include_repo_from_config" (as in search), and "attributes" (optional:
+ * whether to also count attribute values).
+ */
+static void handle_facets(int fd, struct ufa_jsonrpc *rpc)
+{
+	struct ufa_list *result = NULL;
+	struct ufa_error *error = NULL;
+	struct ufa_list *attributes = NULL;
+
+	attributes = get_filter_attrs(rpc, &error);
+	if_goto(error != NULL, end);
+
+	struct ufa_list *tags =
+	    (struct ufa_list *) get_param(rpc, "tags", &error);
+	if_goto(error != NULL, end);
+
+	struct ufa_list *repo_dirs =
+	    (struct ufa_list *) get_param(rpc, "repo_dirs", &error);
+	if_goto(error != NULL, end);
+
+	bool *include_repo_from_config =
+	    (bool *) get_param(rpc, "include_repo_from_config", &error);
+	if_goto(error != NULL, end);
+
+	bool *attrs = (bool *) ufa_hashtable_get(rpc->params, "attributes");
+
+	result = ufa_data_facets(repo_dirs, attributes, tags,
+				 *include_repo_from_config,
+				 attrs != NULL && *attrs, &error);
+	if (error) {
+		error->code = JSONRPC_INTERNAL_ERROR;
+	}
+
+end:
+	if (error) {
+		send_error_response(fd, rpc->id, error->code, error->message);
+		ufa_error_free(error);
+	} else {
+		send_response_facets(fd, rpc->id, result);
+	}
+
 	ufa_list_free(attributes);
 	ufa_list_free(result);
 }
 
+static void handle_stats(int fd, struct ufa_jsonrpc *rpc)
+{
+	struct ufa_list *summary = ufa_stats_summary();
+	send_response_stats(fd, rpc->id, summary);
+	ufa_list_free(summary);
+}
+
+/**
+ * Handles subscribe. Param: "dir" (directory whose files are watched, may be
+ * a repository). After the response, the connection only receives
+ * notifications (see serve_subscriber).
+ */
+static void handle_subscribe(ufa_jsonrpc_server_t *server, int fd,
+			     struct ufa_jsonrpc *rpc)
+{
+	struct ufa_error *error = NULL;
+
+	char *dir = (char *) get_param(rpc, "dir", &error);
+	if_goto(error != NULL, error);
+
+	char *absdir = ufa_util_abspath(dir);
+	if (absdir == NULL || !ufa_util_isdir(absdir)) {
+		ufa_free(absdir);
+		ufa_error_new(&error, JSONRPC_INVALID_PARAMS,
+			      "'%s' is not a directory", dir);
+		goto error;
+	}
+
+	int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (efd == -1) {
+		ufa_free(absdir);
+		ufa_error_new(&error, JSONRPC_INTERNAL_ERROR, "eventfd: %s",
+			      strerror(errno));
+		goto error;
+	}
+
+	struct subscriber *sub = ufa_malloc(sizeof *sub);
+	sub->fd = fd;
+	sub->efd = efd;
+	sub->dir = absdir;
+	pthread_mutex_init(&sub->mutex, NULL);
+	sub->queue = NULL;
+	sub->queued = 0;
+	sub->overflow = false;
+
+	// response is sent before any notification
+	send_response_bool(fd, rpc->id, true);
+
+	pthread_mutex_lock(&server->subscribers_mutex);
+	server->subscribers = ufa_list_prepend(server->subscribers, sub);
+	pthread_mutex_unlock(&server->subscribers_mutex);
+
+	ufa_debug("Connection %d subscribed to '%s'", fd, absdir);
+	subscription = sub;
+	return;
+error:
+	send_error_response(fd, rpc->id, error->code, error->message);
+	ufa_error_free(error);
+}
+
+/**
+ * Sends the notifications of a subscriber until the connection is closed
+ * (anything received from the client is ignored).
+ */
+static void serve_subscriber(ufa_jsonrpc_server_t *server,
+			     struct subscriber *sub)
+{
+	char discard[CHUNK_SIZE];
+	struct pollfd fds[2] = {
+		{.fd = sub->fd, .events = POLLIN},
+		{.fd = sub->efd, .events = POLLIN},
+	};
+	bool connected = true;
+
+	while (connected) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ufa_error("poll: %s", strerror(errno));
+			break;
+		}
+		if (fds[0].revents != 0
+		    && read(sub->fd, discard, sizeof(discard)) <= 0) {
+			break;
+		}
+		if (!(fds[1].revents & POLLIN)) {
+			continue;
+		}
+
+		uint64_t count;
+		read(sub->efd, &count, sizeof(count));
+
+		pthread_mutex_lock(&sub->mutex);
+		struct ufa_list *queue = ufa_list_reverse(sub->queue);
+		bool overflow = sub->overflow;
+		sub->queue = NULL;
+		sub->queued = 0;
+		sub->overflow = false;
+		pthread_mutex_unlock(&sub->mutex);
+
+		if (overflow) {
+			queue = ufa_list_prepend(
+			    queue, notification_new(UFA_DATA_CHANGE_RESCAN,
+						    sub->dir, NULL));
+		}
+		for (UFA_LIST_EACH(i, queue)) {
+			char *msg = (char *) i->data;
+			size_t len = strlen(msg) + 1;
+			if (send(sub->fd, msg, len, MSG_NOSIGNAL)
+			    != (ssize_t) len) {
+				connected = false;
+				break;
+			}
+		}
+		ufa_list_free_full(queue, ufa_free);
+	}
+
+	ufa_debug("Subscriber %d disconnected", sub->fd);
+	pthread_mutex_lock(&server->subscribers_mutex);
+	for (UFA_LIST_EACH(i, server->subscribers)) {
+		if (i->data == sub) {
+			server->subscribers =
+			    ufa_list_unlink_node(server->subscribers, i);
+			ufa_list_free(i);
+			break;
+		}
+	}
+	pthread_cond_broadcast(&server->subscribers_cond);
+	pthread_mutex_unlock(&server->subscribers_mutex);
+	subscriber_free(sub);
+}
+
+/**
+ * Whether 'path' is 'dir' or is below it
+ */
+static bool is_under(const char *path, const char *dir)
+{
+	size_t len = strlen(dir);
+	if (len > 0 && dir[len - 1] == '/') {
+		len--;
+	}
+	return strncmp(path, dir, len) == 0
+	    && (path[len] == '\0' || path[len] == '/');
+}
+
+static bool matches(struct subscriber *sub, enum ufa_data_change change,
+		    const char *path, const char *path2)
+{
+	if (is_under(path, sub->dir)) {
+		return true;
+	}
+	switch (change) {
+	case UFA_DATA_CHANGE_RENAMED:
+		return path2 != NULL && is_under(path2, sub->dir);
+	case UFA_DATA_CHANGE_RESCAN:
+		// rescan of a repository containing dir
+		return is_under(sub->dir, path);
+	default:
+		return false;
+	}
+}
+
+/**
+ * Creates a notification (JSON-RPC request without id) of method "changed"
+ */
+static char *notification_new(enum ufa_data_change change, const char *path,
+			      const char *path2)
+{
+	const char *names[] = {"", "tags", "attributes", "removed", "renamed",
+			       "rescan"};
+	const char *notification =
+	    "{ \"jsonrpc\" : \"2.0\", \"method\" : \"changed\", "
+	    "\"params\" : { \"change\" : \"%s\", \"path\" : \"%s\"%s } }";
+
+	char *str_path2 = (path2 != NULL)
+			      ? ufa_str_sprintf(", \"path2\" : \"%s\"", path2)
+			      : ufa_str_dup("");
+	char *msg = ufa_str_sprintf(notification, names[change], path,
+				    str_path2);
+	ufa_free(str_path2);
+	return msg;
+}
+
+static void subscriber_free(struct subscriber *sub)
+{
+	close(sub->efd);
+	pthread_mutex_destroy(&sub->mutex);
+	ufa_list_free_full(sub->queue, ufa_free);
+	ufa_free(sub->dir);
+	ufa_free(sub);
+}
+
 static void send_error_response(int fd, const char *id, int code,
 				const char *message)
 {
+	request_failed = true;
+
 	const char *response =
 	    "{ \"jsonrpc\" : \"2.0\", "
 	    "\"id\" : \"%s\","
@@ -568,6 +1313,118 @@ static void send_response_list_str(int fd, const char *id,
 	ufa_free(buf);
 }
 
+/**
+ * Sends a page of search results, with the cursor of the next page (null if
+ * it is the last one) and, if not NULL, the stages of the search ("explain",
+ * see explain_json).
+ */
+static void send_response_page(int fd, const char *id,
+			       struct ufa_list *elements, const char *cursor,
+			       struct ufa_list *explain)
+{
+	const char *response = "{ \"jsonrpc\" : \"2.0\", \"id\" : \"%s\", "
+			       "\"result\" : { \"value\" : [ %s ], "
+			       "\"cursor\" : %s%s%s%s } }";
+	char *str_list = ufa_str_join_list(elements, ", ", "\"", "\"");
+	char *str_explain = explain_json(explain);
+
+	const char *i = STR_NOTNULL(id);
+	const char *quote = (cursor != NULL) ? "\"" : "";
+	char *buf = ufa_str_sprintf(response, i, str_list, quote,
+				    (cursor != NULL) ? cursor : "null", quote,
+				    str_explain);
+
+	write(fd, buf, strlen(buf) + 1);
+
+	ufa_debug("Sending response: %s", buf);
+	ufa_free(str_list);
+	ufa_free(str_explain);
+	ufa_free(buf);
+}
+
+/**
+ * Member "explain" of a response: list of struct ufa_repo_explain as objects
+ * with "repository", "stage", "sql" (null if none), "plan" (array of lines),
+ * "rows" and "time_ms"; or an empty string if 'explain' is NULL.
+ */
+static char *explain_json(struct ufa_list *explain)
+{
+	if (explain == NULL) {
+		return ufa_str_dup("");
+	}
+
+	struct ufa_str_builder json = UFA_STR_BUILDER_INIT;
+	ufa_str_builder_append(&json, ", \"explain\" : [ ");
+	for (UFA_LIST_EACH(i, explain)) {
+		struct ufa_repo_explain *e = (struct ufa_repo_explain *) i->data;
+		const char *strs[] = {e->repository, e->stage, e->sql};
+		char *escaped[3];
+		for (int x = 0; x < 3; x++) {
+			escaped[x] = (strs[x] != NULL)
+					 ? ufa_jsonrpc_escape(strs[x])
+					 : NULL;
+		}
+		ufa_str_builder_appendf(
+		    &json, "{ \"repository\" : %s%s%s, \"stage\" : \"%s\", ",
+		    escaped[0] ? "\"" : "", STR_NOTNULL(escaped[0]),
+		    escaped[0] ? "\"" : "null", escaped[1]);
+		ufa_str_builder_appendf(&json, "\"sql\" : %s%s%s, \"plan\" : [ ",
+					escaped[2] ? "\"" : "",
+					STR_NOTNULL(escaped[2]),
+					escaped[2] ? "\"" : "null");
+		for (UFA_LIST_EACH(j, e->plan)) {
+			char *line = ufa_jsonrpc_escape(j->data);
+			ufa_str_builder_appendf(&json, "\"%s\"%s", line,
+						(j->next != NULL) ? ", " : "");
+			ufa_free(line);
+		}
+		ufa_str_builder_appendf(
+		    &json, " ], \"rows\" : %ld, \"time_ms\" : %.3f }%s",
+		    e->rows, e->ms, (i->next != NULL) ? ", " : "");
+		for (int x = 0; x < 3; x++) {
+			ufa_free(escaped[x]);
+		}
+	}
+	ufa_str_builder_append(&json, " ]");
+	return ufa_str_builder_take(&json);
+}
+
+/**
+ * Sends a list of struct ufa_repo_facet, as objects with "name", "value"
+ * (null for tags) and "count".
+ */
+static void send_response_facets(int fd, const char *id,
+				 struct ufa_list *elements)
+{
+	const char *response = "{ \"jsonrpc\" : \"2.0\", \"id\" : \"%s\", "
+			       "\"result\" : { \"value\" : [ %s ] } }";
+
+	struct ufa_list *list = NULL;
+
+	for (UFA_LIST_EACH(i, elements)) {
+		struct ufa_repo_facet *f = (struct ufa_repo_facet *) i->data;
+		char *value = (f->value != NULL)
+				  ? ufa_str_sprintf("\"%s\"", f->value)
+				  : ufa_str_dup("null");
+		char *str = ufa_str_sprintf(
+		    "{ \"name\" : \"%s\", \"value\" : %s, \"count\" : %d }",
+		    f->name, value, f->count);
+		list = ufa_list_append(list, str);
+		ufa_free(value);
+	}
+
+	char *str_list = ufa_str_join_list(list, ", ", NULL, NULL);
+
+	const char *i = STR_NOTNULL(id);
+	char *buf = ufa_str_sprintf(response, i, str_list);
+
+	write(fd, buf, strlen(buf) + 1);
+
+	ufa_list_free_full(list, ufa_free);
+	ufa_free(str_list);
+	ufa_free(buf);
+}
+
 static void send_response_objs_attr(int fd, const char *id,
 				    struct ufa_list *elements)
 {
@@ -595,6 +1452,91 @@ static void send_response_objs_attr(int fd, const char *id,
 	ufa_free(buf);
 }
 
+static void send_response_stats(int fd, const char *id,
+				struct ufa_list *elements)
+{
+	const char *response = "{ \"jsonrpc\" : \"2.0\", \"id\" : \"%s\", "
+			       "\"result\" : { \"value\" : [ %s ] } }";
+	const char *metric =
+	    "{ \"name\" : \"%s\", \"count\" : %lu, \"errors\" : %lu, "
+	    "\"mean\" : %lu, \"p50\" : %lu, \"p90\" : %lu, \"p99\" : %lu, "
+	    "\"max\" : %lu }";
+
+	struct ufa_list *list = NULL;
+
+	for (UFA_LIST_EACH(i, elements)) {
+		struct ufa_stats_summary *s =
+		    (struct ufa_stats_summary *) i->data;
+		char *str = ufa_str_sprintf(metric, s->name, s->count,
+					    s->errors, s->mean, s->p50, s->p90,
+					    s->p99, s->max);
+		list = ufa_list_append(list, str);
+	}
+
+	char *str_list = ufa_str_join_list(list, ", ", NULL, NULL);
+
+	const char *i = STR_NOTNULL(id);
+	char *buf = ufa_str_sprintf(response, i, str_list);
+
+	write(fd, buf, strlen(buf) + 1);
+
+	ufa_list_free_full(list, ufa_free);
+	ufa_free(str_list);
+	ufa_free(buf);
+}
+
+/**
+ * Sends a table of file path -> list of tags (or of struct ufa_repo_attr if
+ * 'attrs' is true), as an object whose members are the files.
+ */
+static void send_response_many(int fd, const char *id, ufa_hashtable_t *table,
+			       bool attrs)
+{
+	const char *response = "{ \"jsonrpc\" : \"2.0\", \"id\" : \"%s\", "
+			       "\"result\" : { \"value\" : { %s } } }";
+
+	struct ufa_list *list = NULL;
+	struct ufa_list *files = ufa_hashtable_keys(table);
+
+	for (UFA_LIST_EACH(i, files)) {
+		struct ufa_list *values = ufa_hashtable_get(table, i->data);
+		char *str_values = NULL;
+		char *str = NULL;
+		if (attrs) {
+			struct ufa_list *pairs = NULL;
+			for (UFA_LIST_EACH(j, values)) {
+				struct ufa_repo_attr *e = j->data;
+				pairs = ufa_list_append(
+				    pairs, ufa_str_sprintf("\"%s\" : \"%s\"",
+							   e->attribute,
+							   e->value));
+			}
+			str_values = ufa_str_join_list(pairs, ", ", NULL, NULL);
+			str = ufa_str_sprintf("\"%s\" : { %s }",
+					      (char *) i->data, str_values);
+			ufa_list_free_full(pairs, ufa_free);
+		} else {
+			str_values = ufa_str_join_list(values, ", ", "\"", "\"");
+			str = ufa_str_sprintf("\"%s\" : [ %s ]",
+					      (char *) i->data, str_values);
+		}
+		list = ufa_list_append(list, str);
+		ufa_free(str_values);
+	}
+
+	char *str_list = ufa_str_join_list(list, ", ", NULL, NULL);
+
+	const char *i = STR_NOTNULL(id);
+	char *buf = ufa_str_sprintf(response, i, str_list);
+
+	write(fd, buf, strlen(buf) + 1);
+
+	ufa_list_free(files);
+	ufa_list_free_full(list, ufa_free);
+	ufa_free(str_list);
+	ufa_free(buf);
+}
+
 static void send_response_bool(int fd, const char *id, bool value)
 {
 	const char *response = "{ \"jsonrpc\" : \"2.0\", \"id\" : \"%s\", "
@@ -14,6 +14,7 @@
 #define UFA_JSONRPC_SERVER_H_
 
 #include <stdbool.h>
+#include "core/data.h"
 #include "util/error.h"
 
 #define SOCKET_PATH "/tmp/ufarpc_unix_sock.server"
@@ -30,7 +31,20 @@ typedef struct ufa_jsonrpc_server ufa_jsonrpc_server_t;
 ufa_jsonrpc_server_t *ufa_jsonrpc_server_new();
 
 /**
- * Start JSON-RPC Server.
+ * Creates the listen socket of JSON-RPC Server, or uses the one passed by the
+ * service manager (socket activation: LISTEN_PID and LISTEN_FDS). Clients may
+ * connect as soon as it returns, even before the server is started.
+ *
+ * @param server JSON-RPC Server object
+ * @param error
+ * @return true if server is listening
+ */
+bool ufa_jsonrpc_server_listen(ufa_jsonrpc_server_t *server,
+			       struct ufa_error **error);
+
+/**
+ * Start JSON-RPC Server (calls ufa_jsonrpc_server_listen if needed). Returns
+ * only when the server is stopped.
  *
  * @param server JSON-RPC Server object
  * @param error
@@ -39,7 +53,9 @@ void ufa_jsonrpc_server_start(ufa_jsonrpc_server_t *server,
 			      struct ufa_error **error);
 
 /**
- * Stop JSON-RPC Server.
+ * Stop JSON-RPC Server: ufa_jsonrpc_server_start returns and the socket is
+ * removed. A socket passed by the service manager is left open for it until
+ * ufa_jsonrpc_server_free, which closes the listen socket.
  *
  * @param server JSON-RPC Server object
  * @param error
@@ -49,7 +65,26 @@ void ufa_jsonrpc_server_stop(ufa_jsonrpc_server_t *server,
 
 
 /**
- * Free resources of JSON-RPC Server
+ * Sends a change notification to the clients subscribed to a directory
+ * containing the file (method "subscribe"). It does not block: notifications
+ * are queued for each subscriber, and if a subscriber does not read them, its
+ * queue is replaced by a single "rescan" of the subscribed directory. Has the
+ * signature of ufa_data_listener_fn_t, so it can be passed to
+ * ufa_data_set_listener with the server as user data.
+ *
+ * @param server JSON-RPC Server object
+ * @param change Kind of change
+ * @param path File (or directory for UFA_DATA_CHANGE_RESCAN)
+ * @param path2 New path of a renamed file
+ */
+void ufa_jsonrpc_server_notify(ufa_jsonrpc_server_t *server,
+			       enum ufa_data_change change,
+			       const char *path,
+			       const char *path2);
+
+/**
+ * Free resources of JSON-RPC Server. Must be called after
+ * ufa_jsonrpc_server_stop (waits for the connections of subscribers to end).
  *
  * @param server
  */
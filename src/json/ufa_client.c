@@ -0,0 +1,448 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Implementation of libufa-client (ufa_client.h)                             */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "ufa_client.h"
+#include "core/repo.h"
+#include "jsonrpc_api.h"
+#include "jsonrpc_parser.h"
+#include "util/error.h"
+#include "util/list.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/string.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+/** Range of error codes reserved by JSON-RPC */
+#define JSONRPC_MIN_ERROR_CODE -32768
+#define JSONRPC_MAX_ERROR_CODE -32000
+
+struct ufa_client {
+	ufa_jsonrpc_api_t *api; /* NULL after the connection is lost */
+	char *error;            /* message of last error */
+	pthread_mutex_t mutex;
+};
+
+struct result_entry {
+	char *path;
+	size_t size;
+	char **names;
+	char **values; /* NULL for tags */
+};
+
+struct ufa_client_result {
+	size_t count;
+	struct result_entry *entries;
+};
+
+/** Operations of ufa_jsonrpc_api called by this module */
+enum op {
+	OP_GETTAGS_MANY,
+	OP_GETATTR_MANY,
+	OP_LISTTAGS,
+	OP_SETTAG,
+	OP_UNSETTAG,
+	OP_INSERTTAG,
+	OP_SETATTR,
+	OP_UNSETATTR,
+};
+
+/** Arguments and result of a request */
+struct request {
+	enum op op;
+	const char *path;
+	const char *name;
+	const char *value;
+	struct ufa_list *paths;
+	ufa_hashtable_t *table; /* result of OP_GET*_MANY */
+	struct ufa_list *list;  /* result of OP_LISTTAGS */
+};
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS - DECLARATION                                          */
+/* ========================================================================== */
+
+static bool request(ufa_client_t *client, struct request *req);
+static bool run(ufa_jsonrpc_api_t *api, struct request *req,
+		struct ufa_error **error);
+static bool is_connection_error(const struct ufa_error *error);
+static ufa_client_result_t *get_many(ufa_client_t *client, enum op op,
+				     const char *dir,
+				     const char *const *paths, size_t npaths);
+static ufa_client_result_t *result_from_table(ufa_hashtable_t *table,
+					      bool attrs);
+static int compare_entries(const void *a, const void *b);
+static const struct result_entry *get_entry(const ufa_client_result_t *result,
+					    size_t i);
+
+/* ========================================================================== */
+/* FUNCTIONS FROM ufa_client.h                                                */
+/* ========================================================================== */
+
+int ufa_client_abi_version(void)
+{
+	return UFA_CLIENT_ABI_VERSION;
+}
+
+void ufa_client_set_log_level(const char *level)
+{
+	ufa_return_if(level == NULL);
+	ufa_log_setlevel(ufa_log_level_from_str(level));
+}
+
+ufa_client_t *ufa_client_open(void)
+{
+	struct ufa_error *error = NULL;
+	ufa_jsonrpc_api_t *api = ufa_jsonrpc_api_init(&error);
+	if (api == NULL) {
+		ufa_debug("%s: %s", __func__, error ? error->message : "");
+		ufa_error_free(error);
+		return NULL;
+	}
+
+	ufa_client_t *client = ufa_malloc(sizeof *client);
+	client->api = api;
+	client->error = NULL;
+	pthread_mutex_init(&client->mutex, NULL);
+	return client;
+}
+
+void ufa_client_close(ufa_client_t *client)
+{
+	ufa_return_if(client == NULL);
+
+	ufa_jsonrpc_api_close(client->api, NULL);
+	pthread_mutex_destroy(&client->mutex);
+	ufa_free(client->error);
+	ufa_free(client);
+}
+
+const char *ufa_client_error(ufa_client_t *client)
+{
+	return (client != NULL) ? client->error : NULL;
+}
+
+ufa_client_result_t *ufa_client_gettags_many(ufa_client_t *client,
+					     const char *dir,
+					     const char *const *paths,
+					     size_t npaths)
+{
+	return get_many(client, OP_GETTAGS_MANY, dir, paths, npaths);
+}
+
+ufa_client_result_t *ufa_client_getattr_many(ufa_client_t *client,
+					     const char *dir,
+					     const char *const *paths,
+					     size_t npaths)
+{
+	return get_many(client, OP_GETATTR_MANY, dir, paths, npaths);
+}
+
+ufa_client_result_t *ufa_client_listtags(ufa_client_t *client,
+					 const char *repodir)
+{
+	struct request req = {.op = OP_LISTTAGS, .path = repodir};
+	if (!request(client, &req)) {
+		return NULL;
+	}
+
+	ufa_client_result_t *result = ufa_malloc(sizeof *result);
+	result->count = 1;
+	result->entries = ufa_calloc(1, sizeof(struct result_entry));
+	struct result_entry *entry = &result->entries[0];
+	entry->path = ufa_str_dup(repodir);
+	entry->size = ufa_list_size(req.list);
+	entry->names = ufa_calloc(entry->size + 1, sizeof(char *));
+	size_t j = 0;
+	for (UFA_LIST_EACH(i, req.list)) {
+		entry->names[j++] = ufa_str_dup(i->data);
+	}
+	ufa_list_free(req.list);
+	return result;
+}
+
+int ufa_client_settag(ufa_client_t *client, const char *path,
+		      const char *tag)
+{
+	struct request req = {.op = OP_SETTAG, .path = path, .name = tag};
+	return request(client, &req) ? 0 : -1;
+}
+
+int ufa_client_unsettag(ufa_client_t *client, const char *path,
+			const char *tag)
+{
+	struct request req = {.op = OP_UNSETTAG, .path = path, .name = tag};
+	return request(client, &req) ? 0 : -1;
+}
+
+int ufa_client_inserttag(ufa_client_t *client, const char *repodir,
+			 const char *tag)
+{
+	struct request req = {.op = OP_INSERTTAG, .path = repodir, .name = tag};
+	return request(client, &req) ? 0 : -1;
+}
+
+int ufa_client_setattr(ufa_client_t *client, const char *path,
+		       const char *attribute, const char *value)
+{
+	struct request req = {.op = OP_SETATTR,
+			      .path = path,
+			      .name = attribute,
+			      .value = value};
+	return request(client, &req) ? 0 : -1;
+}
+
+int ufa_client_unsetattr(ufa_client_t *client, const char *path,
+			 const char *attribute)
+{
+	struct request req = {.op = OP_UNSETATTR,
+			      .path = path,
+			      .name = attribute};
+	return request(client, &req) ? 0 : -1;
+}
+
+size_t ufa_client_result_count(const ufa_client_result_t *result)
+{
+	return (result != NULL) ? result->count : 0;
+}
+
+const char *ufa_client_result_path(const ufa_client_result_t *result,
+				   size_t i)
+{
+	const struct result_entry *entry = get_entry(result, i);
+	return (entry != NULL) ? entry->path : NULL;
+}
+
+size_t ufa_client_result_size(const ufa_client_result_t *result, size_t i)
+{
+	const struct result_entry *entry = get_entry(result, i);
+	return (entry != NULL) ? entry->size : 0;
+}
+
+const char *ufa_client_result_name(const ufa_client_result_t *result,
+				   size_t i, size_t j)
+{
+	const struct result_entry *entry = get_entry(result, i);
+	if (entry == NULL || j >= entry->size) {
+		return NULL;
+	}
+	return entry->names[j];
+}
+
+const char *ufa_client_result_value(const ufa_client_result_t *result,
+				    size_t i, size_t j)
+{
+	const struct result_entry *entry = get_entry(result, i);
+	if (entry == NULL || entry->values == NULL || j >= entry->size) {
+		return NULL;
+	}
+	return entry->values[j];
+}
+
+void ufa_client_result_free(ufa_client_result_t *result)
+{
+	ufa_return_if(result == NULL);
+
+	for (size_t i = 0; i < result->count; i++) {
+		struct result_entry *entry = &result->entries[i];
+		for (size_t j = 0; j < entry->size; j++) {
+			ufa_free(entry->names[j]);
+			if (entry->values != NULL) {
+				ufa_free(entry->values[j]);
+			}
+		}
+		ufa_free(entry->names);
+		ufa_free(entry->values);
+		ufa_free(entry->path);
+	}
+	ufa_free(result->entries);
+	ufa_free(result);
+}
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+/**
+ * Runs a request, connecting again (once) if the connection was lost, and
+ * keeps the error message in client->error.
+ */
+static bool request(ufa_client_t *client, struct request *req)
+{
+	ufa_return_val_if(client == NULL, false);
+
+	struct ufa_error *error = NULL;
+	bool ok = false;
+
+	pthread_mutex_lock(&client->mutex);
+	ufa_free(client->error);
+	client->error = NULL;
+
+	for (int attempt = 0; attempt < 2 && !ok; attempt++) {
+		if (client->api == NULL) {
+			client->api = ufa_jsonrpc_api_init(&error);
+			if (client->api == NULL) {
+				break;
+			}
+		}
+		ok = run(client->api, req, &error);
+		if (!ok && is_connection_error(error)) {
+			// e.g. ufad was restarted
+			ufa_debug("Connection lost: %s", error->message);
+			ufa_jsonrpc_api_close(client->api, NULL);
+			client->api = NULL;
+			if (attempt == 0) {
+				ufa_error_free(error);
+				error = NULL;
+			}
+		} else if (!ok) {
+			break;
+		}
+	}
+
+	if (error != NULL) {
+		client->error = ufa_str_dup(error->message);
+		ufa_error_free(error);
+	}
+	pthread_mutex_unlock(&client->mutex);
+	return ok;
+}
+
+static bool run(ufa_jsonrpc_api_t *api, struct request *req,
+		struct ufa_error **error)
+{
+	switch (req->op) {
+	case OP_GETTAGS_MANY:
+		req->table = ufa_jsonrpc_api_gettags_many(api, req->path,
+							  req->paths, error);
+		break;
+	case OP_GETATTR_MANY:
+		req->table = ufa_jsonrpc_api_getattr_many(api, req->path,
+							  req->paths, error);
+		break;
+	case OP_LISTTAGS:
+		req->list = ufa_jsonrpc_api_listtags(api, req->path, error);
+		break;
+	case OP_SETTAG:
+		ufa_jsonrpc_api_settag(api, req->path, req->name, error);
+		break;
+	case OP_UNSETTAG:
+		ufa_jsonrpc_api_unsettag(api, req->path, req->name, error);
+		break;
+	case OP_INSERTTAG:
+		ufa_jsonrpc_api_inserttag(api, req->path, req->name, error);
+		break;
+	case OP_SETATTR:
+		ufa_jsonrpc_api_setattr(api, req->path, req->name, req->value,
+					error);
+		break;
+	case OP_UNSETATTR:
+		ufa_jsonrpc_api_unsetattr(api, req->path, req->name, error);
+		break;
+	}
+	return !HAS_ERROR(error);
+}
+
+/**
+ * Errors returned by the server have JSON-RPC codes; any other error comes
+ * from the connection
+ */
+static bool is_connection_error(const struct ufa_error *error)
+{
+	return error != NULL
+	    && (error->code > JSONRPC_MAX_ERROR_CODE
+		|| error->code < JSONRPC_MIN_ERROR_CODE);
+}
+
+static ufa_client_result_t *get_many(ufa_client_t *client, enum op op,
+				     const char *dir,
+				     const char *const *paths, size_t npaths)
+{
+	// prepended from the last one, so the list keeps the order of 'paths'
+	struct ufa_list *list = NULL;
+	for (size_t i = npaths; paths != NULL && i > 0; i--) {
+		list = ufa_list_prepend(list, paths[i - 1]);
+	}
+
+	struct request req = {.op = op, .path = dir, .paths = list};
+	bool ok = request(client, &req);
+	ufa_list_free(list);
+	if (!ok) {
+		return NULL;
+	}
+
+	ufa_client_result_t *result =
+	    result_from_table(req.table, op == OP_GETATTR_MANY);
+	ufa_hashtable_free(req.table);
+	return result;
+}
+
+/**
+ * Converts a table file path -> list of tags (or of struct ufa_repo_attr)
+ */
+static ufa_client_result_t *result_from_table(ufa_hashtable_t *table,
+					      bool attrs)
+{
+	ufa_client_result_t *result = ufa_malloc(sizeof *result);
+	result->count = ufa_hashtable_size(table);
+	result->entries = ufa_calloc(result->count + 1,
+				     sizeof(struct result_entry));
+
+	struct ufa_list *files = ufa_hashtable_keys(table);
+	size_t n = 0;
+	for (UFA_LIST_EACH(i, files)) {
+		struct ufa_list *values = ufa_hashtable_get(table, i->data);
+		struct result_entry *entry = &result->entries[n++];
+		entry->path = ufa_str_dup(i->data);
+		entry->size = ufa_list_size(values);
+		entry->names = ufa_calloc(entry->size + 1, sizeof(char *));
+		if (attrs) {
+			entry->values =
+			    ufa_calloc(entry->size + 1, sizeof(char *));
+		}
+		size_t j = 0;
+		for (UFA_LIST_EACH(v, values)) {
+			if (attrs) {
+				struct ufa_repo_attr *attr = v->data;
+				entry->names[j] = ufa_str_dup(attr->attribute);
+				entry->values[j] = ufa_str_dup(attr->value);
+			} else {
+				entry->names[j] = ufa_str_dup(v->data);
+			}
+			j++;
+		}
+	}
+	ufa_list_free(files);
+
+	qsort(result->entries, result->count, sizeof(struct result_entry),
+	      compare_entries);
+	return result;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	return strcmp(((const struct result_entry *) a)->path,
+		      ((const struct result_entry *) b)->path);
+}
+
+static const struct result_entry *get_entry(const ufa_client_result_t *result,
+					    size_t i)
+{
+	if (result == NULL || i >= result->count) {
+		return NULL;
+	}
+	return &result->entries[i];
+}
@@ -0,0 +1,181 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Definitions for libufa-client.                                             */
+/* Stable C interface of the JSON-RPC client (jsonrpc_api.h) for programs     */
+/* that load it dynamically (e.g. Python with ctypes): only opaque handles,   */
+/* strings and integers cross the interface.                                  */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#ifndef UFA_CLIENT_H_
+#define UFA_CLIENT_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Incremented when the interface changes in an incompatible way */
+#define UFA_CLIENT_ABI_VERSION 1
+
+#define UFA_CLIENT_API __attribute__((visibility("default")))
+
+/** A connection to ufad */
+typedef struct ufa_client ufa_client_t;
+
+/**
+ * Result of a query: a list of entries, each one with a path and a list of
+ * names (tags or attributes) and values (attribute values).
+ */
+typedef struct ufa_client_result ufa_client_result_t;
+
+/**
+ * Version of the interface implemented by the library.
+ *
+ * @return UFA_CLIENT_ABI_VERSION
+ */
+UFA_CLIENT_API int ufa_client_abi_version(void);
+
+/**
+ * Sets the log level of the library ("off", "debug", "info", "warn",
+ * "error" or "fatal").
+ */
+UFA_CLIENT_API void ufa_client_set_log_level(const char *level);
+
+/**
+ * Connects to ufad. The connection is kept open and used by every call
+ * (calls from different threads are serialized). If ufad is restarted, the
+ * next call connects again.
+ *
+ * @return New client, or NULL if ufad is not running
+ */
+UFA_CLIENT_API ufa_client_t *ufa_client_open(void);
+
+/**
+ * Closes the connection and frees the client.
+ */
+UFA_CLIENT_API void ufa_client_close(ufa_client_t *client);
+
+/**
+ * Message of the error of the last call that failed in this client.
+ *
+ * @return Message (owned by client, valid until next call), or NULL
+ */
+UFA_CLIENT_API const char *ufa_client_error(ufa_client_t *client);
+
+/**
+ * Gets the tags of the files in 'dir' and of the files in 'paths' with a
+ * single request. Entries are the files with tags and the names are the
+ * tags.
+ *
+ * @param client Client
+ * @param dir Directory (or NULL)
+ * @param paths Array of file paths (or NULL)
+ * @param npaths Number of elements in 'paths'
+ * @return Result sorted by path, or NULL on error
+ */
+UFA_CLIENT_API ufa_client_result_t *
+ufa_client_gettags_many(ufa_client_t *client, const char *dir,
+			const char *const *paths, size_t npaths);
+
+/**
+ * Same as ufa_client_gettags_many for attributes (names are attributes).
+ */
+UFA_CLIENT_API ufa_client_result_t *
+ufa_client_getattr_many(ufa_client_t *client, const char *dir,
+			const char *const *paths, size_t npaths);
+
+/**
+ * Gets all tags of a repository. The result has a single entry (the
+ * repository), whose names are the tags.
+ */
+UFA_CLIENT_API ufa_client_result_t *
+ufa_client_listtags(ufa_client_t *client, const char *repodir);
+
+/**
+ * Sets a tag on a file.
+ *
+ * @return 0 on success, -1 on error
+ */
+UFA_CLIENT_API int ufa_client_settag(ufa_client_t *client, const char *path,
+				     const char *tag);
+
+/**
+ * Removes a tag from a file.
+ *
+ * @return 0 on success, -1 on error
+ */
+UFA_CLIENT_API int ufa_client_unsettag(ufa_client_t *client, const char *path,
+				       const char *tag);
+
+/**
+ * Creates a tag in a repository.
+ *
+ * @return 0 on success, -1 on error
+ */
+UFA_CLIENT_API int ufa_client_inserttag(ufa_client_t *client,
+					const char *repodir, const char *tag);
+
+/**
+ * Sets an attribute of a file.
+ *
+ * @return 0 on success, -1 on error
+ */
+UFA_CLIENT_API int ufa_client_setattr(ufa_client_t *client, const char *path,
+				      const char *attribute,
+				      const char *value);
+
+/**
+ * Removes an attribute of a file.
+ *
+ * @return 0 on success, -1 on error
+ */
+UFA_CLIENT_API int ufa_client_unsetattr(ufa_client_t *client,
+					const char *path,
+					const char *attribute);
+
+/**
+ * Number of entries of a result.
+ */
+UFA_CLIENT_API size_t ufa_client_result_count(const ufa_client_result_t *result);
+
+/**
+ * Path of entry 'i' of a result.
+ */
+UFA_CLIENT_API const char *
+ufa_client_result_path(const ufa_client_result_t *result, size_t i);
+
+/**
+ * Number of names (tags or attributes) of entry 'i' of a result.
+ */
+UFA_CLIENT_API size_t
+ufa_client_result_size(const ufa_client_result_t *result, size_t i);
+
+/**
+ * Name 'j' (tag or attribute) of entry 'i' of a result.
+ */
+UFA_CLIENT_API const char *
+ufa_client_result_name(const ufa_client_result_t *result, size_t i, size_t j);
+
+/**
+ * Value of attribute 'j' of entry 'i' of a result (NULL for tags).
+ */
+UFA_CLIENT_API const char *
+ufa_client_result_value(const ufa_client_result_t *result, size_t i,
+			size_t j);
+
+/**
+ * Frees a result.
+ */
+UFA_CLIENT_API void ufa_client_result_free(ufa_client_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UFA_CLIENT_H_
@@ -11,8 +11,12 @@
 #include "core/data.h"
 #include "tools/cli.h"
 #include "core/config.h"
+#include "core/repo.h"
+#include "json/jsonrpc_api.h"
 #include "util/logging.h"
 #include "util/misc.h"
+#include "util/stats.h"
+#include "util/string.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <sysexits.h>
@@ -27,11 +31,17 @@ static void print_usage_add(FILE *stream);
 static void print_usage_remove(FILE *stream);
 static void print_usage_list(FILE *stream);
 static void print_usage_init(FILE *stream);
+static void print_usage_stats(FILE *stream);
+static void print_usage_trigram(FILE *stream);
+static void print_usage_fulltext(FILE *stream);
 
 static int handle_add();
 static int handle_remove();
 static int handle_list();
 static int handle_init();
+static int handle_stats();
+static int handle_trigram();
+static int handle_fulltext();
 
 /* ========================================================================== */
 /* VARIABLES AND DEFINITIONS                                                  */
@@ -43,6 +53,9 @@ char *commands[] = {
     "remove",
     "list",
     "init",
+    "stats",
+    "trigram",
+    "fulltext",
 };
 
 help_command_fn_t help_commands[] = {
@@ -50,6 +63,9 @@ help_command_fn_t help_commands[] = {
     print_usage_remove,
     print_usage_list,
     print_usage_init,
+    print_usage_stats,
+    print_usage_trigram,
+    print_usage_fulltext,
 };
 
 handle_command_fn_t handle_commands[] = {
@@ -57,6 +73,9 @@ handle_command_fn_t handle_commands[] = {
     handle_remove,
     handle_list,
     handle_init,
+    handle_stats,
+    handle_trigram,
+    handle_fulltext,
 };
 
 
@@ -79,6 +98,11 @@ static void print_usage(FILE *stream)
 		"  remove\tRemove repository directory from watching list\n"
 		"  list\t\tList current watched repositories\n"
 		"  init\t\tInitialize repository\n"
+		"  stats\t\tPrint runtime statistics of ufad\n"
+		"  trigram\tEnable or disable the trigram index of a "
+		"repository\n"
+		"  fulltext\tEnable or disable the full-text index of a "
+		"repository\n"
 		"\n"
 		"Run '%s COMMAND -h' for more information on a command.\n"
 		"\n",
@@ -110,6 +134,32 @@ static void print_usage_init(FILE *stream)
 			" \n\n");
 }
 
+static void print_usage_stats(FILE *stream)
+{
+	fprintf(stream, "\nUsage:  %s stats\n", program_name);
+	fprintf(stream, "\nPrint request counts, errors and latency percentiles"
+			" (in microseconds) of ufad\n\n");
+}
+
+static void print_usage_trigram(FILE *stream)
+{
+	fprintf(stream, "\nUsage:  %s trigram REPOSITORY [on|off]\n",
+		program_name);
+	fprintf(stream, "\nEnable or disable the trigram index of attribute "
+			"values, which speeds up\nsearches by patterns like "
+			"'*report*'. Without on|off, print whether it is "
+			"enabled\n\n");
+}
+
+static void print_usage_fulltext(FILE *stream)
+{
+	fprintf(stream, "\nUsage:  %s fulltext REPOSITORY [on|off]\n",
+		program_name);
+	fprintf(stream, "\nEnable or disable the full-text index of attribute "
+			"values, used by searches\nlike 'abstract~~word' and "
+			"ranking their results. Without on|off, print\nwhether "
+			"it is enabled\n\n");
+}
 
 
 static int handle_add()
@@ -186,6 +236,88 @@ static int handle_init()
 	return error ? EXIT_FAILURE : EX_OK;
 }
 
+static int handle_stats()
+{
+	struct ufa_error *error = NULL;
+	struct ufa_list *list = NULL;
+
+	ufa_jsonrpc_api_t *api = ufa_jsonrpc_api_init(&error);
+	ufa_error_exit(error, EX_UNAVAILABLE);
+
+	list = ufa_jsonrpc_api_stats(api, &error);
+	if_goto(error != NULL, end);
+
+	printf("%-24s %10s %8s %10s %10s %10s %10s %10s\n", "NAME", "COUNT",
+	       "ERRORS", "MEAN", "P50", "P90", "P99", "MAX");
+	for (UFA_LIST_EACH(i, list)) {
+		struct ufa_stats_summary *s =
+		    (struct ufa_stats_summary *) i->data;
+		printf("%-24s %10lu %8lu %10lu %10lu %10lu %10lu %10lu\n",
+		       s->name, s->count, s->errors, s->mean, s->p50, s->p90,
+		       s->p99, s->max);
+	}
+end:
+	ufa_error_print_and_free(error);
+	ufa_list_free(list);
+	ufa_jsonrpc_api_close(api, NULL);
+	return error ? EXIT_FAILURE : EX_OK;
+}
+
+/**
+ * Prints whether an optional index of a repository is enabled, or enables
+ * or disables it (arguments: REPOSITORY [on|off]).
+ */
+static int handle_index(help_command_fn_t usage, const char *description,
+			bool (*has_index)(const ufa_repo_t *),
+			bool (*set_index)(ufa_repo_t *, bool,
+					  struct ufa_error **))
+{
+	if (!HAS_MORE_ARGS(1)) {
+		usage(stderr);
+		return EX_USAGE;
+	}
+	char *dir = NEXT_ARG;
+	char *state = HAS_NEXT_ARG ? NEXT_ARG : NULL;
+	if (state != NULL && !ufa_str_equals(state, "on")
+	    && !ufa_str_equals(state, "off")) {
+		usage(stderr);
+		return EX_USAGE;
+	}
+
+	struct ufa_error *error = NULL;
+	ufa_repo_t *repo = NULL;
+	if (!ufa_repo_isrepo(dir)) {
+		ufa_error_new(&error, UFA_ERROR_NOTDIR,
+			      "%s is not a repository", dir);
+		goto end;
+	}
+	repo = ufa_repo_init(dir, &error);
+	if_goto(error != NULL, end);
+
+	if (state == NULL) {
+		printf("%s\n", has_index(repo) ? "on" : "off");
+	} else if (set_index(repo, ufa_str_equals(state, "on"), &error)) {
+		printf("%s %s\n", description, state);
+	}
+end:
+	ufa_error_print_and_free(error);
+	ufa_repo_free(repo);
+	return error ? EXIT_FAILURE : EX_OK;
+}
+
+static int handle_trigram()
+{
+	return handle_index(print_usage_trigram, "Trigram index",
+			    ufa_repo_has_trigram_index,
+			    ufa_repo_set_trigram_index);
+}
+
+static int handle_fulltext()
+{
+	return handle_index(print_usage_fulltext, "Full-text index",
+			    ufa_repo_has_fulltext_index,
+			    ufa_repo_set_fulltext_index);
+}
 
 int main(int argc, char *argv[])
 {
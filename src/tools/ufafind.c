@@ -15,6 +15,8 @@
 #include "util/misc.h"
 #include "util/string.h"
 #include "json/jsonrpc_api.h"
+#include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <sysexits.h>
 #include <unistd.h>
@@ -24,10 +26,17 @@
 /* VARIABLES AND DEFINITIONS                                                  */
 /* ========================================================================== */
 
-static char *match_mode_str[] = {"=", "~="};
+/* indexed as ufa_repo_matchmode_supported (BETWEEN is "=" with a range) */
+static char *match_mode_str[] = {"=", "~=", "<", "<=", ">", ">=", NULL, "~~"};
 
 static ufa_jsonrpc_api_t *api = NULL;
 
+static const struct option long_options[] = {
+	{"explain", no_argument, NULL, 'e'},
+	{"profile", no_argument, NULL, 'p'},
+	{NULL, 0, NULL, 0},
+};
+
 /* ========================================================================== */
 /* IMPLEMENTATION                                                             */
 /* ========================================================================== */
@@ -43,8 +52,23 @@ static void print_usage(FILE *stream)
 		"  -v\t\tPrint version information and quit\n"
 		"  -r DIR\tRepository dir. Default is current dir + list of "
 		"dirs on config file \n"
-		"  -a ATTRIBUTE\tFind by attribute. e.g. attribute=value\n"
+		"  -a ATTRIBUTE\tFind by attribute. e.g. attribute=value,\n"
+		"\t\tattribute~=*value*, year>=2020, year=2020..2023,\n"
+		"\t\tdate<2024-01-01, abstract~~'integral calc*'\n"
 		"  -t tag TAG\tFind by tag\n"
+		"  -q QUERY\tFind by query (instead of -a and -t). e.g.\n"
+		"\t\t'(math OR physics) AND NOT @year=2020 AND "
+		"@title~=*calculus*'\n"
+		"  -n LIMIT\tPrint at most LIMIT files; the cursor of the next\n"
+		"\t\tpage is printed to stderr\n"
+		"  -s SORT\tSort by: name, id or @ATTRIBUTE (value of the\n"
+		"\t\tattribute). Files are sorted in each repository,\n"
+		"\t\trepositories come in order of path\n"
+		"  -c CURSOR\tPrint the page after CURSOR (same -n and -s)\n"
+		"  -p, --profile\tPrint to stderr the wall time and rows of each\n"
+		"\t\tstage of the search, for each repository\n"
+		"  -e, --explain\tSame as -p, also printing the SQL and query\n"
+		"\t\tplan of each repository\n"
 		"  -l LOG_LEVEL\tLog levels: debug, info, warn, error, fatal\n"
 		"\n");
 }
@@ -56,18 +80,21 @@ static void _add_attr(char *optarg, struct ufa_list **attrs)
 
 	ufa_debug("Attribute: %s", attr);
 
-	// Finding out which matchmode was used
-	// finding by simple string comparison, so using matchmode with most
-	// characters e.g. "=" is in both matchmodes "=" and "!="
+	// Finding out which matchmode was used: the first one in the string,
+	// and the one with most characters among those at the same position
+	// e.g. "=" is in both matchmodes "=" and "<="
+	char *mm_pos = NULL;
 	for (int x = 0; x < UFA_REPO_MATCHMODE_TOTAL; x++) {
 		char *str_mm = match_mode_str[x];
-		if (strstr(attr, str_mm) != NULL) {
-			if (mm_index == -1) {
-				mm_index = x;
-			} else if (strlen(match_mode_str[x]) >
-				   strlen(match_mode_str[mm_index])) {
-				mm_index = x;
-			}
+		char *pos = str_mm ? strstr(attr, str_mm) : NULL;
+		if (pos == NULL) {
+			continue;
+		}
+		if (mm_index == -1 || pos < mm_pos
+		    || (pos == mm_pos
+			&& strlen(str_mm) > strlen(match_mode_str[mm_index]))) {
+			mm_index = x;
+			mm_pos = pos;
 		}
 	}
 
@@ -75,12 +102,15 @@ static void _add_attr(char *optarg, struct ufa_list **attrs)
 		char *str_mm = match_mode_str[mm_index];
 		enum ufa_repo_matchmode mm =
 		    ufa_repo_matchmode_supported[mm_index];
-		struct ufa_list *parts = ufa_str_split(attr, str_mm);
-		ufa_debug("Adding filter: %s / %s (matchmode: %s)",
-			  parts->data, parts->next->data, str_mm);
+		*mm_pos = '\0';
+		char *value = mm_pos + strlen(str_mm);
+		if (mm == UFA_REPO_EQUAL && ufa_repo_isrange(value)) {
+			mm = UFA_REPO_BETWEEN;
+		}
+		ufa_debug("Adding filter: %s / %s (matchmode: %s)", attr, value,
+			  str_mm);
 		struct ufa_repo_filterattr *filter =
-		    ufa_repo_filterattr_new(parts->data, parts->next->data, mm);
-		ufa_list_free(parts);
+		    ufa_repo_filterattr_new(attr, value, mm);
 		*attrs = ufa_list_append2(*attrs, filter,
 			(ufa_list_free_fn_t) ufa_repo_filterattr_free);
 	} else {
@@ -94,6 +124,44 @@ static void _add_attr(char *optarg, struct ufa_list **attrs)
 	ufa_free(attr);
 }
 
+/**
+ * Reads the sort of the results: "name", "id" or "@attribute".
+ */
+static bool _set_sort(const char *optarg, struct ufa_repo_page *page)
+{
+	if (ufa_str_equals(optarg, "name")) {
+		page->sort = UFA_REPO_SORT_NAME;
+	} else if (ufa_str_equals(optarg, "id")) {
+		page->sort = UFA_REPO_SORT_ID;
+	} else if (optarg[0] == '@' && optarg[1] != '\0') {
+		page->sort = UFA_REPO_SORT_ATTR;
+		page->sort_attr = optarg + 1;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Prints the stages of the search (list of struct ufa_repo_explain) to
+ * stderr, with their SQL and plan if 'plans' is true.
+ */
+static void _print_explain(struct ufa_list *explain, bool plans)
+{
+	for (UFA_LIST_EACH(i, explain)) {
+		struct ufa_repo_explain *e = (struct ufa_repo_explain *) i->data;
+		fprintf(stderr, "%-12s %10.3f ms %8ld rows  %s\n", e->stage,
+			e->ms, e->rows, STR_NOTNULL(e->repository));
+		if (plans && e->sql != NULL) {
+			fprintf(stderr, "    sql: %s\n", e->sql);
+			for (UFA_LIST_EACH(j, e->plan)) {
+				fprintf(stderr, "    plan: %s\n",
+					(char *) j->data);
+			}
+		}
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	program_name = argv[0];
@@ -103,20 +171,29 @@ int main(int argc, char *argv[])
 	char *repository = NULL;
 	char *cwd        = NULL;
 	char *tag        = NULL;
+	char *query      = NULL;
+	char *cursor     = NULL;
 
 	struct ufa_list *attrs        = NULL;
 	struct ufa_list *tags         = NULL;
 	struct ufa_list *result       = NULL;
 	struct ufa_list *list_dirs    = NULL;
+	struct ufa_list *explain      = NULL;
 	struct ufa_error *err_api     = NULL;
 
+	struct ufa_repo_page page = {.sort = UFA_REPO_SORT_NONE};
+	bool paged = false;
+	bool profile = false, plans = false;
+
 	bool error_usage = false;
 	int exit_status = EX_OK;
 	int r = 0, log = 0;
+	long limit = 0;
 
 	int opt;
-	while ((opt = getopt(argc, argv, ":r:hva:t:l:")) != -1 &&
-	       !error_usage) {
+	while ((opt = getopt_long(argc, argv, ":r:hva:t:q:n:s:c:epl:",
+				  long_options, NULL)) != -1
+	       && !error_usage) {
 		switch (opt) {
 		case 'r':
 			if (r) {
@@ -142,6 +219,37 @@ int main(int argc, char *argv[])
 			ufa_debug("Adding tag: %s", tag);
 			tags = ufa_list_append(tags, tag);
 			break;
+		case 'q':
+			if (query) {
+				error_usage = true;
+			} else {
+				query = ufa_str_dup(optarg);
+			}
+			break;
+		case 'n':
+			if (!ufa_str_to_long(optarg, &limit) || limit <= 0
+			    || limit > INT_MAX) {
+				error_usage = true;
+			} else {
+				page.limit = (int) limit;
+				paged = true;
+			}
+			break;
+		case 's':
+			error_usage = !_set_sort(optarg, &page);
+			paged = true;
+			break;
+		case 'c':
+			page.after = optarg;
+			paged = true;
+			break;
+		case 'e':
+			plans = true;
+			profile = true;
+			break;
+		case 'p':
+			profile = true;
+			break;
 		case 'l':
 			if (log) {
 				error_usage = true;
@@ -162,7 +270,8 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (error_usage || (tags == NULL && attrs == NULL)) {
+	if (error_usage || (tags == NULL && attrs == NULL && query == NULL)
+	    || (query != NULL && (tags != NULL || attrs != NULL))) {
 		print_usage(stderr);
 		exit_status = EX_USAGE;
 		goto end;
@@ -172,26 +281,36 @@ int main(int argc, char *argv[])
 	api = ufa_jsonrpc_api_init(&err_api);
 	ufa_error_exit(err_api, EX_UNAVAILABLE);
 
+	bool include_repo_from_config = (repository == NULL);
 	if (repository != NULL) {
 		list_dirs = ufa_list_append(list_dirs,
 					    ufa_util_abspath(repository));
-		result = ufa_jsonrpc_api_search(api,
-						list_dirs,
-						attrs,
-						tags,
-						false,
-						&err_api);
 	} else {
 		cwd = ufa_util_get_current_dir();
 		if (ufa_repo_isrepo(cwd)) {
 			list_dirs = ufa_list_append(list_dirs, ufa_str_dup(cwd));
 		}
-		result = ufa_jsonrpc_api_search(api,
-						list_dirs,
-						attrs,
-						tags,
-						true,
-						&err_api);
+	}
+
+	if (query != NULL) {
+		result = ufa_jsonrpc_api_query_page(api,
+						    list_dirs,
+						    query,
+						    include_repo_from_config,
+						    paged ? &page : NULL,
+						    &cursor,
+						    profile ? &explain : NULL,
+						    &err_api);
+	} else {
+		result = ufa_jsonrpc_api_search_page(api,
+						     list_dirs,
+						     attrs,
+						     tags,
+						     include_repo_from_config,
+						     paged ? &page : NULL,
+						     &cursor,
+						     profile ? &explain : NULL,
+						     &err_api);
 	}
 
 	if (err_api) {
@@ -204,16 +323,23 @@ int main(int argc, char *argv[])
 	for (UFA_LIST_EACH(i, result)) {
 		printf("%s\n", (char *) i->data);
 	}
+	if (cursor != NULL) {
+		fprintf(stderr, "next page: -c %s\n", cursor);
+	}
+	_print_explain(explain, plans);
 
 end:
 	ufa_error_free(err_api);
 	ufa_free(repository);
 	ufa_free(cwd);
+	ufa_free(query);
+	ufa_free(cursor);
 	ufa_list_free_full(list_dirs, ufa_free);
 	ufa_list_free_full(attrs,
 			   (ufa_list_free_fn_t) ufa_repo_filterattr_free);
 	ufa_list_free_full(tags, ufa_free);
 	ufa_list_free(result);
+	ufa_list_free(explain);
 	ufa_jsonrpc_api_close(api, NULL);
 
 	return exit_status;
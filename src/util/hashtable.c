@@ -55,6 +55,8 @@ struct ufa_hashtable {
 
 static void find_node(ufa_hashtable_t *table, const void *key,
 		      struct node **node, struct node **prev, int *bucket);
+static bool remove_node(ufa_hashtable_t *table, const void *key,
+			bool free_value, void **value);
 
 /* ========================================================================== */
 /* FUNCTIONS FROM hashtable.h                                                 */
@@ -164,32 +166,14 @@ int ufa_hashtable_has_key(ufa_hashtable_t *table, const void *key)
 
 bool ufa_hashtable_remove(ufa_hashtable_t *table, const void *key)
 {
-	struct node *to_del = NULL;
-	struct node *prev = NULL;
-	int map = -1;
-
-	find_node(table, key, &to_del, &prev, &map);
-
-	bool found = (to_del != NULL);
-
-	if (found) {
-		if (prev == NULL) {
-			table->buckets[map] = to_del->next;
-		} else {
-			prev->next = to_del->next;
-		}
-
-		if (to_del->freekey) {
-			to_del->freekey(to_del->key);
-		}
-		if (to_del->freevalue) {
-			to_del->freevalue(to_del->value);
-		}
-		ufa_free(to_del);
-		table->num_elements--;
-	}
+	return remove_node(table, key, true, NULL);
+}
 
-	return found;
+void *ufa_hashtable_steal(ufa_hashtable_t *table, const void *key)
+{
+	void *value = NULL;
+	remove_node(table, key, false, &value);
+	return value;
 }
 
 int ufa_hashtable_size(ufa_hashtable_t *table)
@@ -331,4 +315,41 @@ static void find_node(ufa_hashtable_t *table, const void *key,
 	if (prev != NULL) {
 		*prev = p;
 	}
-}
\ No newline at end of file
+}
+
+/**
+ * Removes the node of 'key'. The value is freed only if 'free_value' is true;
+ * it is stored in 'value' (if not NULL) otherwise.
+ */
+static bool remove_node(ufa_hashtable_t *table, const void *key,
+			bool free_value, void **value)
+{
+	struct node *to_del = NULL;
+	struct node *prev = NULL;
+	int map = -1;
+
+	find_node(table, key, &to_del, &prev, &map);
+
+	bool found = (to_del != NULL);
+
+	if (found) {
+		if (prev == NULL) {
+			table->buckets[map] = to_del->next;
+		} else {
+			prev->next = to_del->next;
+		}
+
+		if (to_del->freekey) {
+			to_del->freekey(to_del->key);
+		}
+		if (free_value && to_del->freevalue) {
+			to_del->freevalue(to_del->value);
+		} else if (!free_value && value != NULL) {
+			*value = to_del->value;
+		}
+		ufa_free(to_del);
+		table->num_elements--;
+	}
+
+	return found;
+}
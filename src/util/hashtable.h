@@ -53,6 +53,13 @@ int ufa_hashtable_has_key(ufa_hashtable_t *table, const void *key);
 
 bool ufa_hashtable_remove(ufa_hashtable_t *table, const void *key);
 
+/**
+ * Removes 'key' from table without freeing its value (the key is freed).
+ *
+ * @return Value of 'key' (now owned by the caller), or NULL if not found
+ */
+void *ufa_hashtable_steal(ufa_hashtable_t *table, const void *key);
+
 int ufa_hashtable_size(ufa_hashtable_t *table);
 
 void ufa_hashtable_foreach(ufa_hashtable_t *table, ufa_hash_foreach_fn_t func,
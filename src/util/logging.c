@@ -13,25 +13,45 @@
 #include "misc.h"
 #include "string.h"
 #include "util/error.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
 /* ========================================================================== */
 /* VARIABLES AND DEFINITIONS                                                  */
 /* ========================================================================== */
 
+/** Max chars of a message formatted on stack (longer ones are allocated) */
+#define MSG_SIZE                 1024
+
+/** Number of records in the ring buffer of each thread (power of two) */
+#define RING_SIZE                128
+
+/** Max chars of a message in async mode (longer ones are truncated) */
+#define RING_MSG_SIZE            512
+
+/** Interval between flushes of the background thread */
+#define FLUSH_INTERVAL_MS        100
+
 static FILE *global_file = NULL;
 
 static int loglevel = UFA_LOG_OFF;
 static int logdetails = false;
 static bool log_to_syslog = false;
 
+/** Serializes writes to the log output */
+static pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 #define IS_VALID_LOG_LEVEL(level) (level >= UFA_LOG_DEBUG \
 				   && level <= UFA_LOG_FATAL)
 
-static struct log_level_attrs {
+struct log_level_attrs {
 	const char *prefix_str;
 	const char *color;
 	const int syslog_priority;
@@ -66,15 +86,68 @@ static const struct log_level_attrs log_level_attr[5] = {
     },
 };
 
+/**
+ * A message formatted by a thread, waiting to be written
+ */
+struct log_record {
+	enum ufa_log_level level;
+	char message[RING_MSG_SIZE];
+};
+
+/**
+ * Single-producer/single-consumer ring buffer. The owner thread is the only
+ * one that writes 'head'; the flusher thread is the only one that writes
+ * 'tail'.
+ */
+struct log_ring {
+	struct log_record records[RING_SIZE];
+	unsigned long head;
+	unsigned long tail;
+	unsigned long dropped;
+	bool orphan;                  /* owner thread has exited */
+	struct log_ring *next;
+};
+
+/** Ring buffer of the current thread */
+static __thread struct log_ring *thread_ring = NULL;
+
+/** All ring buffers (protected by rings_mutex) */
+static struct log_ring *rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Key used to know when a thread that owns a ring buffer exits */
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+/** Background thread state (protected by rings_mutex) */
+static bool async_running = false;
+
+/** Whether async mode was ever started (otherwise there are no rings) */
+static bool async_started = false;
+static pthread_t flush_thread;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+
 
 /* ========================================================================== */
 /* AUXILIARY FUNCTIONS - DECLARATION                                          */
 /* ========================================================================== */
 
-static void log_syslog(enum ufa_log_level level,
-		       const char *format, va_list ap);
-static void log_file(enum ufa_log_level level, const char *format, va_list ap);
-static void write_log(enum ufa_log_level level, const char *format, va_list ap);
+static size_t format_message(char *buf, size_t size, const char *sourcefile,
+			     int line, const char *format, va_list ap);
+static void write_message(enum ufa_log_level level, const char *message);
+static void log_syslog(enum ufa_log_level level, const char *message);
+static void log_file(enum ufa_log_level level, const char *message);
+static void log_sync(enum ufa_log_level level, const char *sourcefile,
+		     int line, const char *format, va_list ap);
+static void log_async(struct log_ring *ring, enum ufa_log_level level,
+		      const char *sourcefile, int line, const char *format,
+		      va_list ap);
+static struct log_ring *get_thread_ring();
+static void create_ring_key();
+static void release_ring(void *ring);
+static void drain_rings();
+static void *flush_loop(void *arg);
+static void stop_at_exit();
 
 /* ========================================================================== */
 /* FUNCTIONS FROM logging.h                                                   */
@@ -112,36 +185,90 @@ void ufa_log_use_syslog()
 
 void ufa_log_use_file(FILE *file_log)
 {
+	ufa_log_flush();
+	pthread_mutex_lock(&write_mutex);
 	global_file = file_log;
 	log_to_syslog = false;
+	pthread_mutex_unlock(&write_mutex);
 }
 
+bool ufa_log_async_start()
+{
+	static bool atexit_registered = false;
 
-static void log_syslog(enum ufa_log_level level, const char *format, va_list ap)
+	pthread_mutex_lock(&rings_mutex);
+	if (async_running) {
+		goto end;
+	}
+	if (pthread_create(&flush_thread, NULL, flush_loop, NULL) != 0) {
+		fprintf(stderr, "Could not start log thread: %s\n",
+			strerror(errno));
+		goto end;
+	}
+	async_running = true;
+	__atomic_store_n(&async_started, true, __ATOMIC_RELEASE);
+	if (!atexit_registered) {
+		atexit(stop_at_exit);
+		atexit_registered = true;
+	}
+end:
+	pthread_mutex_unlock(&rings_mutex);
+	return async_running;
+}
+
+void ufa_log_async_stop()
 {
-	vsyslog(log_level_attr[level].syslog_priority, format, ap);
+	pthread_mutex_lock(&rings_mutex);
+	if (!async_running) {
+		pthread_mutex_unlock(&rings_mutex);
+		return;
+	}
+	async_running = false;
+	pthread_cond_signal(&flush_cond);
+	pthread_mutex_unlock(&rings_mutex);
+
+	pthread_join(flush_thread, NULL);
+
+	pthread_mutex_lock(&rings_mutex);
+	drain_rings();
+	pthread_mutex_unlock(&rings_mutex);
+}
+
+void ufa_log_flush()
+{
+	if (!__atomic_load_n(&async_started, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	pthread_mutex_lock(&rings_mutex);
+	drain_rings();
+	pthread_mutex_unlock(&rings_mutex);
 }
 
 void ufa_log_full(enum ufa_log_level level, const char *sourcefile,
 		  int line, const char *format, ...)
 {
-	if (sourcefile != NULL && loglevel <= level) {
-		char *filename = NULL;
-		char *str = ufa_str_dup(format);
+	if (sourcefile == NULL || loglevel > level
+	    || !IS_VALID_LOG_LEVEL(level)) {
+		return;
+	}
 
-		if (logdetails) {
-			filename = ufa_util_getfilename(sourcefile);
-			str = ufa_str_sprintf("(%s:%d) %s", filename,
-								  line,
-								  format);
-		}
-		va_list ap;
-		va_start(ap, str);
-		write_log(level, str, ap);
-		va_end(ap);
-		ufa_free(filename);
-		ufa_free(str);
+	va_list ap;
+	va_start(ap, format);
+
+	struct log_ring *ring = NULL;
+	if (__atomic_load_n(&async_running, __ATOMIC_ACQUIRE)
+	    && level < UFA_LOG_FATAL) {
+		ring = get_thread_ring();
+	}
+
+	if (ring) {
+		log_async(ring, level, sourcefile, line, format, ap);
+	} else {
+		// Fatal messages are written right away, after pending ones
+		ufa_log_flush();
+		log_sync(level, sourcefile, line, format, ap);
 	}
+	va_end(ap);
 }
 
 void ufa_error_error(struct ufa_error *error)
@@ -179,24 +306,205 @@ enum ufa_log_level ufa_log_level_from_str(const char *level)
 }
 
 /* ========================================================================== */
-/* AUXILIARY FUNCTIONS - DECLARATION                                          */
+/* AUXILIARY FUNCTIONS                                                        */
 /* ========================================================================== */
 
+/**
+ * Formats message (with source details when enabled) into buf.
+ * Returns the length of the full message (as vsnprintf).
+ */
+static size_t format_message(char *buf, size_t size, const char *sourcefile,
+			     int line, const char *format, va_list ap)
+{
+	int len = 0;
+	if (logdetails) {
+		const char *filename = strrchr(sourcefile, '/');
+		filename = (filename == NULL) ? sourcefile : filename + 1;
+		len = snprintf(buf, size, "(%s:%d) ", filename, line);
+		if (len < 0) {
+			len = 0;
+		}
+	}
+	size_t used = ((size_t) len < size) ? (size_t) len : size;
+	int msg_len = vsnprintf(buf + used, size - used, format, ap);
+	return len + ((msg_len < 0) ? 0 : msg_len);
+}
+
+static void log_sync(enum ufa_log_level level, const char *sourcefile,
+		     int line, const char *format, va_list ap)
+{
+	char buf[MSG_SIZE];
+	char *message = buf;
+
+	va_list ap2;
+	va_copy(ap2, ap);
+	size_t len = format_message(buf, MSG_SIZE, sourcefile, line, format,
+				    ap);
+	if (len >= MSG_SIZE) {
+		message = ufa_malloc(len + 1);
+		format_message(message, len + 1, sourcefile, line, format,
+			       ap2);
+	}
+	va_end(ap2);
+
+	pthread_mutex_lock(&write_mutex);
+	write_message(level, message);
+	pthread_mutex_unlock(&write_mutex);
 
-static void write_log(enum ufa_log_level level, const char *format, va_list ap)
+	if (message != buf) {
+		ufa_free(message);
+	}
+}
+
+static void log_async(struct log_ring *ring, enum ufa_log_level level,
+		      const char *sourcefile, int line, const char *format,
+		      va_list ap)
+{
+	unsigned long head = ring->head;
+	unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= RING_SIZE) {
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	struct log_record *record = &ring->records[head & (RING_SIZE - 1)];
+	record->level = level;
+	size_t len = format_message(record->message, RING_MSG_SIZE,
+				    sourcefile, line, format, ap);
+	if (len >= RING_MSG_SIZE) {
+		strcpy(record->message + RING_MSG_SIZE - 4, "...");
+	}
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static struct log_ring *get_thread_ring()
+{
+	if (thread_ring != NULL) {
+		return thread_ring;
+	}
+
+	pthread_once(&ring_key_once, create_ring_key);
+
+	struct log_ring *ring = ufa_calloc(1, sizeof *ring);
+	if (ring == NULL) {
+		return NULL;
+	}
+	pthread_mutex_lock(&rings_mutex);
+	ring->next = rings;
+	rings = ring;
+	pthread_mutex_unlock(&rings_mutex);
+
+	pthread_setspecific(ring_key, ring);
+	thread_ring = ring;
+	return ring;
+}
+
+static void create_ring_key()
+{
+	pthread_key_create(&ring_key, release_ring);
+}
+
+/**
+ * Called when a thread exits. The ring is freed by the flusher once drained,
+ * so messages logged later by the thread (e.g. from other destructors) go to
+ * a new ring.
+ */
+static void release_ring(void *ring)
+{
+	thread_ring = NULL;
+	__atomic_store_n(&((struct log_ring *) ring)->orphan, true,
+			 __ATOMIC_RELEASE);
+}
+
+/**
+ * Writes pending records of all rings and frees rings of exited threads.
+ * Must be called with rings_mutex locked.
+ */
+static void drain_rings()
+{
+	struct log_ring **link = &rings;
+
+	pthread_mutex_lock(&write_mutex);
+	while (*link != NULL) {
+		struct log_ring *ring = *link;
+		bool orphan = __atomic_load_n(&ring->orphan, __ATOMIC_ACQUIRE);
+		unsigned long head =
+		    __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long tail = ring->tail;
+
+		for (; tail != head; tail++) {
+			struct log_record *r =
+			    &ring->records[tail & (RING_SIZE - 1)];
+			write_message(r->level, r->message);
+		}
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+		unsigned long dropped =
+		    __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+		if (dropped > 0) {
+			char msg[64];
+			snprintf(msg, sizeof(msg),
+				 "%lu log messages dropped", dropped);
+			write_message(UFA_LOG_WARN, msg);
+		}
+
+		if (orphan) {
+			*link = ring->next;
+			ufa_free(ring);
+		} else {
+			link = &ring->next;
+		}
+	}
+	pthread_mutex_unlock(&write_mutex);
+}
+
+static void *flush_loop(void *arg)
+{
+	pthread_mutex_lock(&rings_mutex);
+	while (async_running) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += FLUSH_INTERVAL_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&flush_cond, &rings_mutex, &deadline);
+		drain_rings();
+	}
+	pthread_mutex_unlock(&rings_mutex);
+	return NULL;
+}
+
+static void stop_at_exit()
+{
+	ufa_log_async_stop();
+}
+
+/**
+ * Writes a formatted message. Must be called with write_mutex locked.
+ */
+static void write_message(enum ufa_log_level level, const char *message)
 {
 	if (!IS_VALID_LOG_LEVEL(level)) {
 		return;
 	}
 
 	if (log_to_syslog) {
-		log_syslog(level, format, ap);
+		log_syslog(level, message);
 	} else {
-		log_file(level, format, ap);
+		log_file(level, message);
 	}
 }
 
-static void log_file(enum ufa_log_level level, const char *format, va_list ap)
+static void log_syslog(enum ufa_log_level level, const char *message)
+{
+	syslog(log_level_attr[level].syslog_priority, "%s", message);
+}
+
+static void log_file(enum ufa_log_level level, const char *message)
 {
 	if (global_file == NULL) {
 		global_file = stdout;
@@ -209,13 +517,10 @@ static void log_file(enum ufa_log_level level, const char *format, va_list ap)
 		is_a_tty = isatty(fileno(file));
 	}
 
-	/* man 3 stdarg */
 	if (is_a_tty) {
 		fprintf(file, "%s", log_level_attr[level].color);
 	}
-	fprintf(file, "%s", ufa_log_level_to_str(level));
-	vfprintf(file, format, ap);
-	fprintf(file, "\n");
+	fprintf(file, "%s%s\n", ufa_log_level_to_str(level), message);
 
 	if (is_a_tty) {
 		fprintf(file, "\033[0;0m");
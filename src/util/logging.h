@@ -25,6 +25,14 @@ enum ufa_log_level {
 	UFA_LOG_OFF   = INT_MAX,
 };
 
+/**
+ * Lowest level compiled into the binary. Log calls below this level are
+ * removed by the compiler (e.g. -DUFA_LOG_COMPILE_LEVEL=1 drops debug logs).
+ */
+#ifndef UFA_LOG_COMPILE_LEVEL
+#define UFA_LOG_COMPILE_LEVEL UFA_LOG_DEBUG
+#endif
+
 void ufa_log_enablelogdetails(bool details);
 
 void ufa_error_error(struct ufa_error *error);
@@ -43,20 +51,56 @@ void ufa_log_use_file(FILE *file_log);
 
 bool ufa_log_is_logging(enum ufa_log_level level);
 
+/**
+ * Start asynchronous logging.
+ * Messages are formatted into a per-thread ring buffer (no locks taken by
+ * the caller) and written to the log output by a background thread.
+ * Messages are dropped (and counted) when the ring buffer of a thread is full.
+ *
+ * @return true if async logging is running
+ */
+bool ufa_log_async_start();
+
+/**
+ * Stop asynchronous logging, writing all pending messages.
+ * Logging becomes synchronous again.
+ */
+void ufa_log_async_stop();
+
+/**
+ * Write all pending messages of asynchronous logging.
+ */
+void ufa_log_flush();
+
 void ufa_log_full(enum ufa_log_level loglevel, const char *sourcefile,
 	          int line, const char *format, ...);
 
 /**
- * Log message
+ * Checks whether a message of a level would be logged. Levels below
+ * UFA_LOG_COMPILE_LEVEL are constant false.
+ */
+#define ufa_log_enabled(level)                                                 \
+	((level) >= UFA_LOG_COMPILE_LEVEL && ufa_log_is_logging(level))
+
+/**
+ * Log message.
+ * Arguments are not evaluated when the level is not being logged.
  *
  * @param level Level (enum ufa_log_level)
  * @param format Format (str)
  */
-#define ufa_log(level, format, ...) ufa_log_full(level, __FILE__, __LINE__, format, ##__VA_ARGS__)
-#define ufa_debug(format, ...) ufa_log_full(UFA_LOG_DEBUG, __FILE__, __LINE__, format, ##__VA_ARGS__)
-#define ufa_info(format, ...) ufa_log_full(UFA_LOG_INFO, __FILE__, __LINE__,  format, ##__VA_ARGS__)
-#define ufa_warn(format, ...) ufa_log_full(UFA_LOG_WARN, __FILE__, __LINE__,  format, ##__VA_ARGS__)
-#define ufa_error(format, ...) ufa_log_full(UFA_LOG_ERROR, __FILE__, __LINE__, format, ##__VA_ARGS__)
-#define ufa_fatal(format, ...) ufa_log_full(UFA_LOG_FATAL, __FILE__, __LINE__, format, ##__VA_ARGS__)
+#define ufa_log(level, format, ...)                                            \
+	do {                                                                   \
+		if (ufa_log_enabled(level)) {                                  \
+			ufa_log_full(level, __FILE__, __LINE__, format,        \
+				     ##__VA_ARGS__);                           \
+		}                                                              \
+	} while (0)
+
+#define ufa_debug(format, ...) ufa_log(UFA_LOG_DEBUG, format, ##__VA_ARGS__)
+#define ufa_info(format, ...) ufa_log(UFA_LOG_INFO, format, ##__VA_ARGS__)
+#define ufa_warn(format, ...) ufa_log(UFA_LOG_WARN, format, ##__VA_ARGS__)
+#define ufa_error(format, ...) ufa_log(UFA_LOG_ERROR, format, ##__VA_ARGS__)
+#define ufa_fatal(format, ...) ufa_log(UFA_LOG_FATAL, format, ##__VA_ARGS__)
 
 #endif /* LOGGING_H_ */
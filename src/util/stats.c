@@ -0,0 +1,248 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Runtime statistics (implementation of stats.h)                             */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "util/stats.h"
+#include "util/list.h"
+#include "util/misc.h"
+#include "util/string.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+/** Max chars in a metric name */
+#define MAX_NAME 64
+
+/**
+ * Number of buckets in a histogram. Bucket i holds durations d (in usec)
+ * with 2^i <= d + 1 < 2^(i + 1).
+ */
+#define NUM_BUCKETS 40
+
+/**
+ * A metric. Metrics are never removed, so readers can walk the list
+ * without locks.
+ */
+struct metric {
+	char name[MAX_NAME];
+	unsigned long count;
+	unsigned long errors;
+	unsigned long total;
+	unsigned long max;
+	unsigned long buckets[NUM_BUCKETS];
+	struct metric *next;
+};
+
+/** Head of list of metrics (new ones are pushed with CAS) */
+static struct metric *metrics = NULL;
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS - DECLARATION                                          */
+/* ========================================================================== */
+
+static struct metric *find_metric(struct metric *head, const char *name);
+static struct metric *get_metric(const char *name);
+static int bucket_of(uint64_t usec);
+static unsigned long percentile(const unsigned long *buckets,
+				unsigned long count, unsigned long max,
+				double p);
+static struct ufa_stats_summary *summarize(struct metric *m);
+static int compare_summary(const void *a, const void *b);
+
+
+/* ========================================================================== */
+/* FUNCTIONS FROM stats.h                                                     */
+/* ========================================================================== */
+
+uint64_t ufa_stats_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void ufa_stats_record(const char *name, uint64_t start, bool failed)
+{
+	uint64_t now = ufa_stats_now();
+	ufa_stats_add(name, (now > start) ? now - start : 0, failed);
+}
+
+void ufa_stats_add(const char *name, uint64_t usec, bool failed)
+{
+	struct metric *m = get_metric(name);
+	if (m == NULL) {
+		return;
+	}
+
+	__atomic_add_fetch(&m->count, 1, __ATOMIC_RELAXED);
+	if (failed) {
+		__atomic_add_fetch(&m->errors, 1, __ATOMIC_RELAXED);
+	}
+	__atomic_add_fetch(&m->total, usec, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&m->buckets[bucket_of(usec)], 1, __ATOMIC_RELAXED);
+
+	unsigned long max = __atomic_load_n(&m->max, __ATOMIC_RELAXED);
+	while (usec > max
+	       && !__atomic_compare_exchange_n(&m->max, &max, usec, true,
+					       __ATOMIC_RELAXED,
+					       __ATOMIC_RELAXED)) {
+		;
+	}
+}
+
+struct ufa_list *ufa_stats_summary()
+{
+	size_t total = 0;
+	struct metric *head = __atomic_load_n(&metrics, __ATOMIC_ACQUIRE);
+	for (struct metric *m = head; m != NULL; m = m->next) {
+		total++;
+	}
+	if (total == 0) {
+		return NULL;
+	}
+
+	struct ufa_stats_summary **all = ufa_calloc(total, sizeof *all);
+	size_t n = 0;
+	for (struct metric *m = head; m != NULL && n < total; m = m->next) {
+		all[n++] = summarize(m);
+	}
+	qsort(all, n, sizeof *all, compare_summary);
+
+	struct ufa_list *list = NULL;
+	for (size_t i = 0; i < n; i++) {
+		list = ufa_list_append2(
+		    list, all[i], (ufa_list_free_fn_t) ufa_stats_summary_free);
+	}
+	ufa_free(all);
+	return list;
+}
+
+struct ufa_stats_summary *ufa_stats_summary_of(const char *name)
+{
+	struct metric *head = __atomic_load_n(&metrics, __ATOMIC_ACQUIRE);
+	struct metric *m = find_metric(head, name);
+	return (m == NULL) ? NULL : summarize(m);
+}
+
+void ufa_stats_summary_free(struct ufa_stats_summary *summary)
+{
+	if (summary == NULL) {
+		return;
+	}
+	ufa_free(summary->name);
+	ufa_free(summary);
+}
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+static struct metric *find_metric(struct metric *head, const char *name)
+{
+	for (struct metric *m = head; m != NULL; m = m->next) {
+		if (strncmp(m->name, name, MAX_NAME - 1) == 0) {
+			return m;
+		}
+	}
+	return NULL;
+}
+
+static struct metric *get_metric(const char *name)
+{
+	struct metric *head = __atomic_load_n(&metrics, __ATOMIC_ACQUIRE);
+	struct metric *m = find_metric(head, name);
+	if (m != NULL) {
+		return m;
+	}
+
+	struct metric *new = ufa_calloc(1, sizeof *new);
+	strncpy(new->name, name, MAX_NAME - 1);
+
+	do {
+		// another thread may have added the same metric
+		struct metric *found = find_metric(head, name);
+		if (found != NULL) {
+			ufa_free(new);
+			return found;
+		}
+		new->next = head;
+	} while (!__atomic_compare_exchange_n(&metrics, &head, new, false,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_ACQUIRE));
+	return new;
+}
+
+static int bucket_of(uint64_t usec)
+{
+	int bucket = 63 - __builtin_clzll(usec + 1);
+	return (bucket < NUM_BUCKETS) ? bucket : NUM_BUCKETS - 1;
+}
+
+/**
+ * Estimates a percentile as the upper limit of the bucket where it falls.
+ */
+static unsigned long percentile(const unsigned long *buckets,
+				unsigned long count, unsigned long max,
+				double p)
+{
+	if (count == 0) {
+		return 0;
+	}
+	unsigned long rank = (unsigned long) (p * count);
+	if (rank == 0) {
+		rank = 1;
+	}
+	unsigned long acc = 0;
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		acc += buckets[i];
+		if (acc >= rank) {
+			unsigned long upper = (1UL << (i + 1)) - 2;
+			return (upper < max) ? upper : max;
+		}
+	}
+	return max;
+}
+
+static struct ufa_stats_summary *summarize(struct metric *m)
+{
+	unsigned long buckets[NUM_BUCKETS];
+	unsigned long count = 0;
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		buckets[i] = __atomic_load_n(&m->buckets[i], __ATOMIC_RELAXED);
+		count += buckets[i];
+	}
+
+	struct ufa_stats_summary *s = ufa_calloc(1, sizeof *s);
+	s->name = ufa_str_dup(m->name);
+	s->count = count;
+	s->errors = __atomic_load_n(&m->errors, __ATOMIC_RELAXED);
+	s->max = __atomic_load_n(&m->max, __ATOMIC_RELAXED);
+	if (count > 0) {
+		s->mean = __atomic_load_n(&m->total, __ATOMIC_RELAXED) / count;
+	}
+	s->p50 = percentile(buckets, count, s->max, 0.50);
+	s->p90 = percentile(buckets, count, s->max, 0.90);
+	s->p99 = percentile(buckets, count, s->max, 0.99);
+	return s;
+}
+
+static int compare_summary(const void *a, const void *b)
+{
+	const struct ufa_stats_summary *s1 =
+	    *((const struct ufa_stats_summary **) a);
+	const struct ufa_stats_summary *s2 =
+	    *((const struct ufa_stats_summary **) b);
+	return strcmp(s1->name, s2->name);
+}
@@ -0,0 +1,73 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Definitions for runtime statistics (counters and latency histograms)       */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#ifndef UFA_STATS_H_
+#define UFA_STATS_H_
+
+#include "util/list.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Summary of a metric. Times are in microseconds.
+ */
+struct ufa_stats_summary {
+	char *name;
+	unsigned long count;
+	unsigned long errors;
+	unsigned long mean;
+	unsigned long p50;
+	unsigned long p90;
+	unsigned long p99;
+	unsigned long max;
+};
+
+/**
+ * Current time (monotonic clock) in microseconds.
+ */
+uint64_t ufa_stats_now();
+
+/**
+ * Records an operation of a metric that started at 'start' (from
+ * ufa_stats_now) and ends now. The metric is created on first use.
+ * Only atomic operations are used, so it can be called from any thread.
+ *
+ * @param name Metric name (e.g. "rpc.gettags")
+ * @param start Start time of operation
+ * @param failed Whether the operation failed
+ */
+void ufa_stats_record(const char *name, uint64_t start, bool failed);
+
+/**
+ * Records an operation of a metric that took 'usec' microseconds.
+ *
+ * @param name Metric name
+ * @param usec Duration of operation
+ * @param failed Whether the operation failed
+ */
+void ufa_stats_add(const char *name, uint64_t usec, bool failed);
+
+/**
+ * Computes the summary of all metrics recorded so far.
+ *
+ * @return List of struct ufa_stats_summary, sorted by name
+ */
+struct ufa_list *ufa_stats_summary();
+
+/**
+ * Computes the summary of a single metric.
+ *
+ * @return struct ufa_stats_summary or NULL if metric does not exist
+ */
+struct ufa_stats_summary *ufa_stats_summary_of(const char *name);
+
+void ufa_stats_summary_free(struct ufa_stats_summary *summary);
+
+#endif /* UFA_STATS_H_ */
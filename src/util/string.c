@@ -12,6 +12,7 @@
 #include "util/misc.h"
 #include "util/list.h"
 #include <ctype.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -25,6 +26,15 @@
 #define IS_TRIM_CHAR(c)  (isblank((c)) || (c) == '\r' || (c) == '\n')
 
 
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS - DECLARATION                                          */
+/* ========================================================================== */
+
+static bool read_digits(const char **str, int count, int *value);
+static long days_from_civil(long year, int month, int day);
+static void grow_builder(struct ufa_str_builder *builder, size_t more);
+
+
 /* ========================================================================== */
 /* FUNCTIONS FROM string.h                                                    */
 /* ========================================================================== */
@@ -52,11 +62,12 @@ struct ufa_list *ufa_str_split(const char *str, const char *delim)
 	struct ufa_list *list = NULL;
 
 	char *s = ufa_str_dup(str);
-	char *ptr = strtok(s, delim);
+	char *saveptr = NULL;
+	char *ptr = strtok_r(s, delim, &saveptr);
 
 	while (ptr != NULL) {
 		list = ufa_list_prepend2(list, ufa_str_dup(ptr), ufa_free);
-		ptr = strtok(NULL, delim);
+		ptr = strtok_r(NULL, delim, &saveptr);
 	}
 
 	ufa_free(s);
@@ -184,14 +195,83 @@ int ufa_str_hash(const char *str)
 
 bool ufa_str_to_double(const char *str, double *number)
 {
-	int ret = sscanf(str, "%lf", number);
-	return ret > 0;
+	char *end = NULL;
+	errno = 0;
+	double value = strtod(str, &end);
+	if (end == str || errno == ERANGE) {
+		return false;
+	}
+	while (isspace((unsigned char) *end)) {
+		end++;
+	}
+	if (*end != '\0') {
+		return false;
+	}
+	*number = value;
+	return true;
 }
 
 bool ufa_str_to_long(const char *str, long *number)
 {
-	int ret = sscanf(str, "%ld", number);
-	return ret > 0;
+	char *end = NULL;
+	errno = 0;
+	long value = strtol(str, &end, 10);
+	if (end == str || errno == ERANGE) {
+		return false;
+	}
+	while (isspace((unsigned char) *end)) {
+		end++;
+	}
+	if (*end != '\0') {
+		return false;
+	}
+	*number = value;
+	return true;
+}
+
+bool ufa_str_to_time(const char *str, time_t *time)
+{
+	int year, month, day, hour = 0, min = 0, sec = 0;
+	const char *p = str;
+
+	if (!read_digits(&p, 4, &year) || *p++ != '-'
+	    || !read_digits(&p, 2, &month) || *p++ != '-'
+	    || !read_digits(&p, 2, &day)) {
+		return false;
+	}
+	if (*p == 'T' || *p == ' ') {
+		p++;
+		if (!read_digits(&p, 2, &hour) || *p++ != ':'
+		    || !read_digits(&p, 2, &min)) {
+			return false;
+		}
+		if (*p == ':') {
+			p++;
+			if (!read_digits(&p, 2, &sec)) {
+				return false;
+			}
+		}
+		if (*p == 'Z') {
+			p++;
+		}
+	}
+	if (*p != '\0') {
+		return false;
+	}
+
+	static const int days_in_month[] = {31, 29, 31, 30, 31, 30,
+					    31, 31, 30, 31, 30, 31};
+	bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+	if (month < 1 || month > 12 || day < 1
+	    || day > days_in_month[month - 1]
+	    || (month == 2 && day == 29 && !leap) || hour > 23 || min > 59
+	    || sec > 59) {
+		return false;
+	}
+
+	*time = (time_t) days_from_civil(year, month, day) * 86400
+		+ hour * 3600 + min * 60 + sec;
+	return true;
 }
 
 char *ufa_str_join_list(struct ufa_list *list, const char *delim,
@@ -233,4 +313,91 @@ char *ufa_str_join_list(struct ufa_list *list, const char *delim,
 		buffer[strlen(buffer) - len_delim] = '\0';
 	}
 	return buffer;
-}
\ No newline at end of file
+}
+
+void ufa_str_builder_append(struct ufa_str_builder *builder, const char *str)
+{
+	size_t len = strlen(str);
+	grow_builder(builder, len);
+	memcpy(builder->str + builder->len, str, len + 1);
+	builder->len += len;
+}
+
+void ufa_str_builder_appendf(struct ufa_str_builder *builder,
+			     char const *format, ...)
+{
+	va_list ap, ap2;
+	va_start(ap, format);
+	va_copy(ap2, ap);
+	int len = vsnprintf(NULL, 0, format, ap);
+	va_end(ap);
+	if (len > 0) {
+		grow_builder(builder, len);
+		vsnprintf(builder->str + builder->len, len + 1, format, ap2);
+		builder->len += len;
+	}
+	va_end(ap2);
+}
+
+char *ufa_str_builder_take(struct ufa_str_builder *builder)
+{
+	char *str = (builder->str != NULL) ? builder->str : ufa_str_dup("");
+	builder->str = NULL;
+	builder->len = 0;
+	builder->capacity = 0;
+	return str;
+}
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+/**
+ * Reads exactly 'count' decimal digits from *str (advancing it).
+ */
+static bool read_digits(const char **str, int count, int *value)
+{
+	*value = 0;
+	for (int i = 0; i < count; i++, (*str)++) {
+		if (!isdigit((unsigned char) **str)) {
+			return false;
+		}
+		*value = *value * 10 + (**str - '0');
+	}
+	return true;
+}
+
+/**
+ * Number of days from 1970-01-01 to a date (proleptic Gregorian calendar).
+ */
+static long days_from_civil(long year, int month, int day)
+{
+	year -= (month <= 2);
+	long era = (year >= 0 ? year : year - 399) / 400;
+	long yoe = year - era * 400;
+	long doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+/**
+ * Makes room for 'more' chars (and the '\0') at the end of a builder,
+ * at least doubling its capacity.
+ */
+static void grow_builder(struct ufa_str_builder *builder, size_t more)
+{
+	size_t needed = builder->len + more + 1;
+	if (needed <= builder->capacity) {
+		return;
+	}
+	size_t capacity = (builder->capacity > 0) ? builder->capacity * 2 : 64;
+	while (capacity < needed) {
+		capacity *= 2;
+	}
+	builder->str = ufa_realloc(builder->str, capacity);
+	if (builder->len == 0) {
+		builder->str[0] = '\0';
+	}
+	builder->capacity = capacity;
+}
@@ -15,6 +15,7 @@
 #include "util/error.h"
 #include <stdarg.h>
 #include <stdbool.h>
+#include <time.h>
 
 
 /**
@@ -53,12 +54,52 @@ char *ufa_str_trim(char *s);
 
 int ufa_str_hash(const char *str);
 
+/**
+ * Converts a string to a number. The whole string (except trailing spaces)
+ * must be a number.
+ *
+ * @return true if converted
+ */
 bool ufa_str_to_double(const char *str, double *number);
 
+/**
+ * Same as ufa_str_to_double for integers (base 10).
+ */
 bool ufa_str_to_long(const char *str, long *number);
 
+/**
+ * Converts a date and time in ISO 8601 format (YYYY-MM-DD, optionally
+ * followed by 'T' or ' ' and HH:MM[:SS][Z]), taken as UTC.
+ *
+ * @param str String
+ * @param time Where to store the seconds since the Epoch
+ * @return true if converted
+ */
+bool ufa_str_to_time(const char *str, time_t *time);
+
 
 char *ufa_str_join_list(struct ufa_list *list, const char *delim,
 			const char *left, const char *right);
 
+/** String that grows as text is appended (see ufa_str_builder_append) */
+struct ufa_str_builder {
+	char *str;       /* text (NULL while empty) */
+	size_t len;      /* length of 'str' */
+	size_t capacity; /* bytes allocated for 'str' */
+};
+
+#define UFA_STR_BUILDER_INIT {NULL, 0, 0}
+
+void ufa_str_builder_append(struct ufa_str_builder *builder, const char *str);
+
+void ufa_str_builder_appendf(struct ufa_str_builder *builder,
+			     char const *format, ...);
+
+/**
+ * Returns the text of a builder, which is empty again.
+ *
+ * @return New string (never NULL)
+ */
+char *ufa_str_builder_take(struct ufa_str_builder *builder);
+
 #endif /* UFA_STRING_H_ */
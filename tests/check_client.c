@@ -0,0 +1,240 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Test cases for libufa-client                                               */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "core/repo.h"
+#include "util/error.h"
+#include "util/misc.h"
+#include "json/jsonrpc_server.h"
+#include "json/ufa_client.h"
+#include <check.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+static pthread_t thread_server;
+
+static ufa_client_t *client         = NULL;
+static ufa_jsonrpc_server_t *server = NULL;
+
+char TMP_REPO_DIR[]          = "/tmp/ufa-test-XXXXXX";
+char *TMP_TEST_FILE1         = NULL;
+char *TMP_TEST_FILE2         = NULL;
+char *TMP_TEST_FILE_NOTFOUND = NULL;
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+static void create_file(const char *file)
+{
+	int fd = open(file, O_RDWR | O_CREAT, 0600);
+	if (fd != -1) {
+		close(fd);
+	}
+}
+
+static void *start_server(void *thread_data)
+{
+	struct ufa_error *error = NULL;
+	ufa_jsonrpc_server_start(server, &error);
+	if (error) {
+		fprintf(stderr, "Error starting jsonrpc server\n");
+		ufa_error_print_and_free(error);
+		exit(EXIT_FAILURE);
+	}
+	return NULL;
+}
+
+/* ========================================================================== */
+/* FIXTURE FUNCTIONS                                                          */
+/* ========================================================================== */
+
+void setup_client(void)
+{
+	mkdtemp(TMP_REPO_DIR);
+	TMP_TEST_FILE1 = ufa_util_joinpath(TMP_REPO_DIR, "testfile1", NULL);
+	TMP_TEST_FILE2 = ufa_util_joinpath(TMP_REPO_DIR, "testfile2", NULL);
+	TMP_TEST_FILE_NOTFOUND = ufa_util_joinpath(TMP_REPO_DIR, "n", NULL);
+	create_file(TMP_TEST_FILE1);
+	create_file(TMP_TEST_FILE2);
+	printf("Repo dir.........: %s\n", TMP_REPO_DIR);
+
+	ufa_repo_t *repo = ufa_repo_init(TMP_REPO_DIR, NULL);
+	ck_assert(repo != NULL);
+	ufa_repo_free(repo);
+
+	server = ufa_jsonrpc_server_new();
+	ck_assert(ufa_jsonrpc_server_listen(server, NULL));
+	int ret = pthread_create(&thread_server, NULL, start_server, NULL);
+	ck_assert_int_eq(0, ret);
+
+	ufa_client_set_log_level("off");
+	client = ufa_client_open();
+	ck_assert(client != NULL);
+}
+
+void teardown_client(void)
+{
+	ufa_client_close(client);
+	client = NULL;
+
+	ufa_jsonrpc_server_stop(server, NULL);
+	pthread_join(thread_server, NULL);
+	ufa_jsonrpc_server_free(server);
+	server = NULL;
+
+	const char *names[] = {"testfile1", "testfile2", "repo.sqlite",
+			       ".ufarepo"};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		char *path = ufa_util_joinpath(TMP_REPO_DIR, names[i], NULL);
+		ufa_util_remove_file(path, NULL);
+		ufa_free(path);
+	}
+	ufa_util_rmdir(TMP_REPO_DIR, NULL);
+	strcpy(TMP_REPO_DIR, "/tmp/ufa-test-XXXXXX");
+	ufa_free(TMP_TEST_FILE1);
+	ufa_free(TMP_TEST_FILE2);
+	ufa_free(TMP_TEST_FILE_NOTFOUND);
+}
+
+/* ========================================================================== */
+/* TEST FUNCTIONS                                                             */
+/* ========================================================================== */
+
+START_TEST(abi_version_ok)
+{
+	ck_assert_int_eq(UFA_CLIENT_ABI_VERSION, ufa_client_abi_version());
+}
+END_TEST
+
+START_TEST(gettags_many_ok)
+{
+	ck_assert_int_eq(0, ufa_client_settag(client, TMP_TEST_FILE2, "b"));
+	ck_assert_int_eq(0, ufa_client_settag(client, TMP_TEST_FILE1, "a"));
+	ck_assert_int_eq(0, ufa_client_settag(client, TMP_TEST_FILE1, "c"));
+
+	ufa_client_result_t *result =
+	    ufa_client_gettags_many(client, TMP_REPO_DIR, NULL, 0);
+	ck_assert(result != NULL);
+	ck_assert_int_eq(2, ufa_client_result_count(result));
+
+	// sorted by path
+	ck_assert_str_eq(TMP_TEST_FILE1, ufa_client_result_path(result, 0));
+	ck_assert_int_eq(2, ufa_client_result_size(result, 0));
+	ck_assert_str_eq("a", ufa_client_result_name(result, 0, 0));
+	ck_assert_str_eq("c", ufa_client_result_name(result, 0, 1));
+	ck_assert(ufa_client_result_value(result, 0, 0) == NULL);
+	ck_assert_str_eq(TMP_TEST_FILE2, ufa_client_result_path(result, 1));
+	ck_assert_str_eq("b", ufa_client_result_name(result, 1, 0));
+
+	// out of range
+	ck_assert(ufa_client_result_path(result, 2) == NULL);
+	ck_assert(ufa_client_result_name(result, 1, 1) == NULL);
+	ufa_client_result_free(result);
+
+	const char *paths[] = {TMP_TEST_FILE2};
+	result = ufa_client_gettags_many(client, NULL, paths, 1);
+	ck_assert_int_eq(1, ufa_client_result_count(result));
+	ck_assert_str_eq(TMP_TEST_FILE2, ufa_client_result_path(result, 0));
+	ufa_client_result_free(result);
+}
+END_TEST
+
+START_TEST(getattr_many_ok)
+{
+	ck_assert_int_eq(0, ufa_client_setattr(client, TMP_TEST_FILE1, "k",
+					       "v"));
+
+	ufa_client_result_t *result =
+	    ufa_client_getattr_many(client, TMP_REPO_DIR, NULL, 0);
+	ck_assert_int_eq(1, ufa_client_result_count(result));
+	ck_assert_str_eq("k", ufa_client_result_name(result, 0, 0));
+	ck_assert_str_eq("v", ufa_client_result_value(result, 0, 0));
+	ufa_client_result_free(result);
+
+	ck_assert_int_eq(0, ufa_client_unsetattr(client, TMP_TEST_FILE1, "k"));
+	result = ufa_client_getattr_many(client, TMP_REPO_DIR, NULL, 0);
+	ck_assert_int_eq(0, ufa_client_result_count(result));
+	ufa_client_result_free(result);
+}
+END_TEST
+
+START_TEST(listtags_ok)
+{
+	ck_assert_int_eq(0, ufa_client_inserttag(client, TMP_REPO_DIR, "x"));
+
+	ufa_client_result_t *result = ufa_client_listtags(client, TMP_REPO_DIR);
+	ck_assert_int_eq(1, ufa_client_result_count(result));
+	ck_assert_int_eq(1, ufa_client_result_size(result, 0));
+	ck_assert_str_eq("x", ufa_client_result_name(result, 0, 0));
+	ufa_client_result_free(result);
+}
+END_TEST
+
+START_TEST(error_ok)
+{
+	ck_assert_int_eq(-1, ufa_client_settag(client, TMP_TEST_FILE_NOTFOUND,
+					       "a"));
+	ck_assert(ufa_client_error(client) != NULL);
+
+	// connection is still usable
+	ck_assert_int_eq(0, ufa_client_settag(client, TMP_TEST_FILE1, "a"));
+	ck_assert(ufa_client_error(client) == NULL);
+}
+END_TEST
+
+/* ========================================================================== */
+/* SUITE DEFINITIONS AND MAIN FUNCTION                                        */
+/* ========================================================================== */
+
+Suite *client_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("Client");
+
+	/* Core test case */
+	tc_core = tcase_create("core");
+	tcase_add_checked_fixture(tc_core, setup_client, teardown_client);
+	tcase_add_test(tc_core, abi_version_ok);
+	tcase_add_test(tc_core, gettags_many_ok);
+	tcase_add_test(tc_core, getattr_many_ok);
+	tcase_add_test(tc_core, listtags_ok);
+	tcase_add_test(tc_core, error_ok);
+
+	/* Add test cases to suite */
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = client_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,452 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Test cases for data.c                                                      */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "core/data.h"
+#include "core/errors.h"
+#include "core/repo.h"
+#include "util/error.h"
+#include "util/list.h"
+#include "util/misc.h"
+#include "util/string.h"
+#include <check.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+#define NUM_REPOS 4
+#define FILES_PER_REPO 4
+#define NUM_FILES (NUM_REPOS * FILES_PER_REPO)
+#define NUM_THREADS 8
+#define OPS_PER_THREAD 200
+#define NEW_TAGS_PER_THREAD 40
+
+char TMP_DIR[] = "/tmp/ufa-test-XXXXXX";
+char *REPO_DIRS[NUM_REPOS];
+char *FILES[NUM_FILES];
+char *TAGS[NUM_THREADS];
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+static void create_file(const char *file)
+{
+	int fd = open(file, O_RDWR | O_CREAT, 0600);
+	if (fd != -1) {
+		close(fd);
+	}
+}
+
+static void *use_repos(void *arg)
+{
+	int id = *((int *) arg);
+	long errors = 0;
+	for (int i = 0; i < OPS_PER_THREAD; i++) {
+		struct ufa_error *error = NULL;
+		const char *file = FILES[(id + i) % NUM_FILES];
+
+		if (i < NUM_FILES) {
+			ufa_data_settag(file, TAGS[id], &error);
+		} else {
+			struct ufa_list *tags = ufa_data_gettags(file, &error);
+			ufa_list_free(tags);
+		}
+		if (error) {
+			ufa_error_print_and_free(error);
+			errors++;
+		}
+
+		if (i % 50 == id) {
+			ufa_data_invalidate_cache(NULL);
+			ufa_data_evict_idle();
+		}
+	}
+	return (void *) errors;
+}
+
+/**
+ * Sets tags that do not exist yet ("new<thread>-<n>"), so that rows of tags
+ * are inserted by threads at the same time on the same repositories.
+ */
+static void *insert_new_tags(void *arg)
+{
+	int id = *((int *) arg);
+	long errors = 0;
+	for (int i = 0; i < NEW_TAGS_PER_THREAD; i++) {
+		struct ufa_error *error = NULL;
+		char *tag = ufa_str_sprintf("new%d-%d", id, i);
+		ufa_data_settag(FILES[(id + i) % NUM_FILES], tag, &error);
+		if (error) {
+			ufa_error_print_and_free(error);
+			errors++;
+		}
+		ufa_free(tag);
+	}
+	return (void *) errors;
+}
+
+
+/* ========================================================================== */
+/* FIXTURE FUNCTIONS                                                          */
+/* ========================================================================== */
+
+void setup_repos(void)
+{
+	mkdtemp(TMP_DIR);
+	printf("Tmp dir..........: %s\n", TMP_DIR);
+
+	for (int r = 0; r < NUM_REPOS; r++) {
+		char *name = ufa_str_sprintf("repo%d", r);
+		REPO_DIRS[r] = ufa_util_joinpath(TMP_DIR, name, NULL);
+		ufa_util_mkdir(REPO_DIRS[r], NULL);
+		ufa_free(name);
+
+		for (int f = 0; f < FILES_PER_REPO; f++) {
+			char *filename = ufa_str_sprintf("file%d", f);
+			FILES[r * FILES_PER_REPO + f] =
+			    ufa_util_joinpath(REPO_DIRS[r], filename, NULL);
+			create_file(FILES[r * FILES_PER_REPO + f]);
+			ufa_free(filename);
+		}
+	}
+	for (int t = 0; t < NUM_THREADS; t++) {
+		TAGS[t] = ufa_str_sprintf("tag%d", t);
+	}
+
+	// create databases, tags and files (rows) before concurrent access
+	for (int r = 0; r < NUM_REPOS; r++) {
+		ck_assert(ufa_data_init_repo(REPO_DIRS[r], NULL));
+		for (int t = 0; t < NUM_THREADS; t++) {
+			ufa_data_inserttag(REPO_DIRS[r], TAGS[t], NULL);
+		}
+	}
+	for (int f = 0; f < NUM_FILES; f++) {
+		ufa_data_settag(FILES[f], TAGS[0], NULL);
+		ufa_data_cleartags(FILES[f], NULL);
+	}
+}
+
+void teardown_repos(void)
+{
+	ufa_data_close();
+	ufa_data_set_repo_limits(UFA_DATA_DEFAULT_MAX_OPEN_REPOS,
+				 UFA_DATA_DEFAULT_IDLE_MS);
+
+	for (int f = 0; f < NUM_FILES; f++) {
+		ufa_util_remove_file(FILES[f], NULL);
+		ufa_free(FILES[f]);
+	}
+	for (int r = 0; r < NUM_REPOS; r++) {
+		char *db = ufa_util_joinpath(REPO_DIRS[r], "repo.sqlite", NULL);
+		char *ind = ufa_util_joinpath(REPO_DIRS[r], ".ufarepo", NULL);
+		ufa_util_remove_file(db, NULL);
+		ufa_util_remove_file(ind, NULL);
+		ufa_util_rmdir(REPO_DIRS[r], NULL);
+		ufa_free(db);
+		ufa_free(ind);
+		ufa_free(REPO_DIRS[r]);
+	}
+	for (int t = 0; t < NUM_THREADS; t++) {
+		ufa_free(TAGS[t]);
+	}
+	ufa_util_rmdir(TMP_DIR, NULL);
+	strcpy(TMP_DIR, "/tmp/ufa-test-XXXXXX");
+}
+
+
+/* ========================================================================== */
+/* TEST FUNCTIONS                                                             */
+/* ========================================================================== */
+
+
+START_TEST(max_open_repos_ok)
+{
+	ufa_data_set_repo_limits(2, 0);
+	for (int f = 0; f < NUM_FILES; f++) {
+		struct ufa_error *error = NULL;
+		ck_assert(ufa_data_settag(FILES[f], TAGS[0], &error));
+		ck_assert(error == NULL);
+		ck_assert_int_le(ufa_data_open_repos(), 2);
+	}
+
+	// closed repositories are opened again when needed
+	struct ufa_list *tags = ufa_data_gettags(FILES[0], NULL);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ufa_list_free(tags);
+}
+END_TEST
+
+
+START_TEST(evict_idle_ok)
+{
+	for (int r = 0; r < NUM_REPOS; r++) {
+		ck_assert(ufa_data_init_repo(REPO_DIRS[r], NULL));
+	}
+	ck_assert_int_eq(NUM_REPOS, ufa_data_open_repos());
+
+	// not idle for long enough
+	ufa_data_set_repo_limits(UFA_DATA_DEFAULT_MAX_OPEN_REPOS, 60 * 1000L);
+	ufa_data_evict_idle();
+	ck_assert_int_eq(NUM_REPOS, ufa_data_open_repos());
+
+	// idle as soon as not in use
+	ufa_data_set_repo_limits(UFA_DATA_DEFAULT_MAX_OPEN_REPOS, -1);
+	ufa_data_evict_idle();
+	ck_assert_int_eq(0, ufa_data_open_repos());
+}
+END_TEST
+
+
+START_TEST(invalidate_cache_ok)
+{
+	ck_assert(ufa_data_settag(FILES[0], TAGS[1], NULL));
+
+	ufa_data_invalidate_cache(REPO_DIRS[0]);
+	struct ufa_list *tags = ufa_data_gettags(FILES[0], NULL);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ck_assert_str_eq(TAGS[1], (char *) tags->data);
+	ufa_list_free(tags);
+
+	ufa_data_invalidate_cache(NULL);
+	ck_assert(ufa_data_unsettag(FILES[0], TAGS[1], NULL));
+}
+END_TEST
+
+
+START_TEST(threads_ok)
+{
+	// few open repos, so repos are closed and reopened all the time
+	ufa_data_set_repo_limits(2, 0);
+
+	pthread_t threads[NUM_THREADS];
+	int ids[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		ids[i] = i;
+		pthread_create(&threads[i], NULL, use_repos, &ids[i]);
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		void *errors = NULL;
+		pthread_join(threads[i], &errors);
+		ck_assert_int_eq(0, (long) errors);
+	}
+	ufa_data_evict_idle();
+	ck_assert_int_le(ufa_data_open_repos(), 2);
+
+	// each thread set its tag on every file
+	for (int f = 0; f < NUM_FILES; f++) {
+		struct ufa_list *tags = ufa_data_gettags(FILES[f], NULL);
+		ck_assert_int_eq(NUM_THREADS, ufa_list_size(tags));
+		ufa_list_free(tags);
+	}
+}
+END_TEST
+
+
+START_TEST(threads_insert_ok)
+{
+	pthread_t threads[NUM_THREADS];
+	int ids[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		ids[i] = i;
+		pthread_create(&threads[i], NULL, insert_new_tags, &ids[i]);
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		void *errors = NULL;
+		pthread_join(threads[i], &errors);
+		ck_assert_int_eq(0, (long) errors);
+	}
+
+	// each tag is on the file it was set on, and only there
+	int expected[NUM_FILES] = {0};
+	for (int t = 0; t < NUM_THREADS; t++) {
+		for (int i = 0; i < NEW_TAGS_PER_THREAD; i++) {
+			expected[(t + i) % NUM_FILES]++;
+		}
+	}
+	for (int f = 0; f < NUM_FILES; f++) {
+		struct ufa_list *tags = ufa_data_gettags(FILES[f], NULL);
+		ck_assert_int_eq(expected[f], ufa_list_size(tags));
+		for (UFA_LIST_EACH(i, tags)) {
+			int t = -1;
+			int n = -1;
+			ck_assert_int_eq(2, sscanf(i->data, "new%d-%d", &t, &n));
+			ck_assert_int_eq(f, (t + n) % NUM_FILES);
+		}
+		ufa_list_free(tags);
+	}
+}
+END_TEST
+
+
+START_TEST(batch_ok)
+{
+	struct ufa_error *error = NULL;
+	ck_assert(ufa_data_begin_batch(REPO_DIRS[0], &error));
+	ck_assert(ufa_data_settag(FILES[0], TAGS[1], &error));
+	ck_assert(error == NULL);
+
+	// one batch at a time for a directory
+	ck_assert(!ufa_data_begin_batch(REPO_DIRS[0], &error));
+	ck_assert(error != NULL);
+	ck_assert_int_eq(UFA_ERROR_ARGS, error->code);
+	ufa_error_free(error);
+	error = NULL;
+
+	ck_assert(ufa_data_end_batch(REPO_DIRS[0], &error));
+	ck_assert(!ufa_data_end_batch(REPO_DIRS[0], &error));
+	ck_assert(error != NULL);
+	ufa_error_free(error);
+
+	struct ufa_list *tags = ufa_data_gettags(FILES[0], NULL);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ck_assert_str_eq(TAGS[1], (char *) tags->data);
+	ufa_list_free(tags);
+}
+END_TEST
+
+
+START_TEST(search_page_ok)
+{
+	for (int f = 0; f < NUM_FILES; f++) {
+		ck_assert(ufa_data_settag(FILES[f], TAGS[1], NULL));
+	}
+
+	struct ufa_list *dirs = NULL;
+	for (int r = NUM_REPOS - 1; r >= 0; r--) {
+		dirs = ufa_list_append(dirs, REPO_DIRS[r]);
+	}
+	struct ufa_list *tags = ufa_list_append(NULL, TAGS[1]);
+
+	// pages of 3 files go through the repositories in order of path
+	struct ufa_repo_page page = {.sort = UFA_REPO_SORT_NAME, .limit = 3};
+	char *cursor = NULL;
+	int count = 0, pages = 0;
+	do {
+		struct ufa_error *error = NULL;
+		struct ufa_list *result = ufa_data_search_page(
+		    dirs, NULL, tags, false, &page, &cursor, &error);
+		ck_assert(error == NULL);
+		ck_assert_int_le(ufa_list_size(result), 3);
+		for (UFA_LIST_EACH(i, result)) {
+			ck_assert_str_eq(FILES[count++], (char *) i->data);
+		}
+		ufa_list_free(result);
+		ufa_free((char *) page.after);
+		page.after = cursor;
+		pages++;
+	} while (cursor != NULL);
+	ck_assert_int_eq(NUM_FILES, count);
+	ck_assert_int_eq(NUM_FILES / 3 + 1, pages);
+
+	struct ufa_error *error = NULL;
+	page.after = "not a cursor";
+	ck_assert(ufa_data_search_page(dirs, NULL, tags, false, &page, &cursor,
+				       &error) == NULL);
+	ck_assert(error != NULL);
+	ufa_error_free(error);
+
+	ufa_list_free(tags);
+	ufa_list_free(dirs);
+}
+END_TEST
+
+
+START_TEST(facets_ok)
+{
+	// TAGS[1] and TAGS[2] on the first file of each repository
+	for (int r = 0; r < NUM_REPOS; r++) {
+		const char *file = FILES[r * FILES_PER_REPO];
+		ck_assert(ufa_data_settag(file, TAGS[1], NULL));
+		ck_assert(ufa_data_settag(file, TAGS[2], NULL));
+		ck_assert(ufa_data_setattr(file, "a", (r % 2) ? "x" : "y",
+					   NULL));
+	}
+
+	struct ufa_list *dirs = NULL;
+	for (int r = 0; r < NUM_REPOS; r++) {
+		dirs = ufa_list_append(dirs, REPO_DIRS[r]);
+	}
+	struct ufa_list *tags = ufa_list_append(NULL, TAGS[1]);
+
+	// counts of all the repositories are added up
+	struct ufa_error *error = NULL;
+	struct ufa_list *result =
+	    ufa_data_facets(dirs, NULL, tags, false, true, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(3, ufa_list_size(result));
+	struct ufa_repo_facet *facet = ufa_list_get(result, 0)->data;
+	ck_assert_str_eq(TAGS[2], facet->name);
+	ck_assert_int_eq(NUM_REPOS, facet->count);
+	facet = ufa_list_get(result, 1)->data;
+	ck_assert_str_eq("x", facet->value);
+	ck_assert_int_eq(NUM_REPOS / 2, facet->count);
+	facet = ufa_list_get(result, 2)->data;
+	ck_assert_str_eq("y", facet->value);
+	ck_assert_int_eq(NUM_REPOS / 2, facet->count);
+
+	ufa_list_free(result);
+	ufa_list_free(tags);
+	ufa_list_free(dirs);
+}
+END_TEST
+
+
+/* ========================================================================== */
+/* SUITE DEFINITIONS AND MAIN FUNCTION                                        */
+/* ========================================================================== */
+
+Suite *data_suite(void)
+{
+	Suite *s;
+	TCase *tc_registry;
+
+	s = suite_create("Data");
+
+	/* Registry test case */
+	tc_registry = tcase_create("registry");
+	tcase_add_checked_fixture(tc_registry, setup_repos, teardown_repos);
+	tcase_set_timeout(tc_registry, 60);
+	tcase_add_test(tc_registry, max_open_repos_ok);
+	tcase_add_test(tc_registry, evict_idle_ok);
+	tcase_add_test(tc_registry, invalidate_cache_ok);
+	tcase_add_test(tc_registry, threads_ok);
+	tcase_add_test(tc_registry, threads_insert_ok);
+	tcase_add_test(tc_registry, batch_ok);
+	tcase_add_test(tc_registry, search_page_ok);
+	tcase_add_test(tc_registry, facets_ok);
+
+	/* Add test cases to suite */
+	suite_add_tcase(s, tc_registry);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = data_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -79,6 +79,29 @@ START_TEST(keys_ok)
 END_TEST
 
 
+START_TEST(steal_ok)
+{
+	ufa_hashtable_t *table = ufa_hashtable_new(
+	    (ufa_hash_fn_t) ufa_str_hash,
+	    (ufa_hash_equal_fn_t) ufa_str_equals,
+	    ufa_free,
+	    ufa_free);
+
+	ufa_hashtable_put(table, ufa_str_dup("test1"), ufa_str_dup("value 1"));
+	ufa_hashtable_put(table, ufa_str_dup("test2"), ufa_str_dup("value 2"));
+
+	char *value = ufa_hashtable_steal(table, "test1");
+	ck_assert_str_eq("value 1", value);
+	ck_assert(!ufa_hashtable_has_key(table, "test1"));
+	ck_assert_int_eq(1, ufa_hashtable_size(table));
+	ck_assert(ufa_hashtable_steal(table, "test1") == NULL);
+
+	ufa_free(value);
+	ufa_hashtable_free(table);
+}
+END_TEST
+
+
 /* ========================================================================== */
 /* SUITE DEFINITIONS AND MAIN FUNCTION                                        */
 /* ========================================================================== */
@@ -94,6 +117,7 @@ Suite *repo_suite(void)
 	tc_core = tcase_create("core");
 	tcase_add_test(tc_core, values_ok);
 	tcase_add_test(tc_core, keys_ok);
+	tcase_add_test(tc_core, steal_ok);
 
 	/* Add test cases to suite */
 	suite_add_tcase(s, tc_core);
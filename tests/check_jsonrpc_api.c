@@ -11,6 +11,7 @@
 #include "core/repo.h"
 #include "util/error.h"
 #include "util/misc.h"
+#include "util/stats.h"
 #include "util/string.h"
 #include "json/jsonrpc_api.h"
 #include "json/jsonrpc_parser.h"
@@ -122,9 +123,8 @@ static void *start_server(void *thread_data)
 {
 	printf("Starting jsonrpc server ...\n");
 	struct ufa_error *error = NULL;
-	server = ufa_jsonrpc_server_new();
 	ufa_jsonrpc_server_start(server, &error);
-	if (!server || error) {
+	if (error) {
 		fprintf(stderr, "Error starting jsonrpc server\n");
 		ufa_error_print_and_free(error);
 		exit(EXIT_FAILURE);
@@ -138,12 +138,17 @@ void setup_repo(void)
 	init_files_repo_tmp();
 	global_repo = ufa_repo_init(TMP_REPO_DIR, &error);
 
+	// connections are accepted once server thread is running
+	server = ufa_jsonrpc_server_new();
+	ck_assert(ufa_jsonrpc_server_listen(server, &error));
+	ufa_data_set_listener((ufa_data_listener_fn_t) ufa_jsonrpc_server_notify,
+			      server);
+
 	int ret = pthread_create(&thread_server, NULL, start_server, NULL);
 	if (ret != 0) {
 		fprintf(stderr, "Error creating thread!\n");
 		exit(EXIT_FAILURE);
 	}
-	usleep(150 * 1000); // 150 ms
 	api = ufa_jsonrpc_api_init(NULL);
 }
 
@@ -156,10 +161,10 @@ void teardown_repo(void)
 	ufa_jsonrpc_server_stop(server, &error);
 	ufa_error_print_and_free(error);
 
-	ufa_jsonrpc_server_free(server);
-
 	// Awaiting thread_server to finish
 	pthread_join(thread_server, NULL);
+	ufa_data_set_listener(NULL, NULL);
+	ufa_jsonrpc_server_free(server);
 	server = NULL;
 	remove_files_repo_tmp();
 
@@ -291,6 +296,42 @@ START_TEST(api_gettags_ok)
 }
 END_TEST
 
+START_TEST(api_gettags_many_ok)
+{
+	struct ufa_error *error = NULL;
+
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE1, TAG1, NULL);
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE1, TAG2, NULL);
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE2, TAG3, NULL);
+
+	// all files of dir (testfile3 has no tags)
+	ufa_hashtable_t *table =
+	    ufa_jsonrpc_api_gettags_many(api, TMP_REPO_DIR, NULL, &error);
+	ufa_error_print(error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(2, ufa_hashtable_size(table));
+	struct ufa_list *tags = ufa_hashtable_get(table, TMP_TEST_FILE1);
+	ck_assert_int_eq(2, ufa_list_size(tags));
+	ck_assert_str_eq(TAG1, tags->data);
+	ck_assert_str_eq(TAG2, tags->next->data);
+	tags = ufa_hashtable_get(table, TMP_TEST_FILE2);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ck_assert_str_eq(TAG3, tags->data);
+	ufa_hashtable_free(table);
+
+	// list of files
+	struct ufa_list *files = NULL;
+	files = ufa_list_append(files, TMP_TEST_FILE2);
+	files = ufa_list_append(files, TMP_TEST_FILE3);
+	table = ufa_jsonrpc_api_gettags_many(api, NULL, files, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_hashtable_size(table));
+	ck_assert(ufa_hashtable_has_key(table, TMP_TEST_FILE2));
+	ufa_hashtable_free(table);
+	ufa_list_free(files);
+}
+END_TEST
+
 START_TEST(api_inserttag_ok)
 {
 	struct ufa_error *error = NULL;
@@ -465,6 +506,36 @@ START_TEST(api_getattr_ok)
 }
 END_TEST
 
+START_TEST(api_getattr_many_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_jsonrpc_api_setattr(api, TMP_TEST_FILE1, "author", "me", NULL);
+	ufa_jsonrpc_api_setattr(api, TMP_TEST_FILE1, "year", "2009", NULL);
+	ufa_jsonrpc_api_setattr(api, TMP_TEST_FILE3, "author", "you", NULL);
+
+	struct ufa_list *files = NULL;
+	files = ufa_list_append(files, TMP_TEST_FILE1);
+	files = ufa_list_append(files, TMP_TEST_FILE2);
+	files = ufa_list_append(files, TMP_TEST_FILE3);
+	ufa_hashtable_t *table =
+	    ufa_jsonrpc_api_getattr_many(api, NULL, files, &error);
+	ufa_error_print(error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(2, ufa_hashtable_size(table));
+
+	struct ufa_list *attrs = ufa_hashtable_get(table, TMP_TEST_FILE1);
+	ck_assert_int_eq(2, ufa_list_size(attrs));
+	attrs = ufa_hashtable_get(table, TMP_TEST_FILE3);
+	ck_assert_int_eq(1, ufa_list_size(attrs));
+	struct ufa_repo_attr *attr = attrs->data;
+	ck_assert_str_eq("author", attr->attribute);
+	ck_assert_str_eq("you", attr->value);
+
+	ufa_hashtable_free(table);
+	ufa_list_free(files);
+}
+END_TEST
+
 START_TEST(api_getattr_empty_ok)
 {
 	struct ufa_error *error = NULL;
@@ -755,6 +826,297 @@ START_TEST(api_search_tags_and_attrs_ok)
 }
 END_TEST
 
+START_TEST(api_facets_ok)
+{
+	struct ufa_error *error    = NULL;
+	struct ufa_list *repo_dirs = ufa_list_append2(NULL,
+						      ufa_str_dup(TMP_REPO_DIR),
+						      ufa_free);
+
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE1, "math", NULL);
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE1, "calculus", NULL);
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE2, "math", NULL);
+	ufa_jsonrpc_api_setattr(api, TMP_TEST_FILE2, "author", "me", NULL);
+
+	struct ufa_list *list_tags = ufa_list_append(NULL, "math");
+	struct ufa_list *result = ufa_jsonrpc_api_facets(
+	    api, repo_dirs, NULL, list_tags, false, true, &error);
+	ufa_error_print(error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(ufa_list_size(result), 2);
+
+	struct ufa_repo_facet *facet = result->data;
+	ck_assert_str_eq("calculus", facet->name);
+	ck_assert(facet->value == NULL);
+	ck_assert_int_eq(1, facet->count);
+	facet = result->next->data;
+	ck_assert_str_eq("author", facet->name);
+	ck_assert_str_eq("me", facet->value);
+	ck_assert_int_eq(1, facet->count);
+
+	ufa_list_free(result);
+	ufa_list_free(list_tags);
+	ufa_list_free(repo_dirs);
+}
+END_TEST
+
+START_TEST(api_query_ok)
+{
+	struct ufa_error *error    = NULL;
+	struct ufa_list *repo_dirs = ufa_list_append2(NULL,
+						      ufa_str_dup(TMP_REPO_DIR),
+						      ufa_free);
+
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE1, "math", NULL);
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE1, "calculus", NULL);
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE2, "physics", NULL);
+	ufa_jsonrpc_api_setattr(api, TMP_TEST_FILE2, "title", "an intro", NULL);
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE3, "math", NULL);
+	ufa_jsonrpc_api_setattr(api, TMP_TEST_FILE3, "author", "me", NULL);
+
+	struct ufa_list *result = ufa_jsonrpc_api_query(
+	    api, repo_dirs, "(math OR physics) AND NOT @author=me", false,
+	    &error);
+	ufa_error_print(error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(ufa_list_size(result), 2);
+	ck_assert(ufa_list_find_by_data(result, TMP_TEST_FILE1,
+					(ufa_list_equal_fn_t) ufa_str_equals));
+	ck_assert(ufa_list_find_by_data(result, TMP_TEST_FILE2,
+					(ufa_list_equal_fn_t) ufa_str_equals));
+	ufa_list_free(result);
+
+	// quotes are escaped in the request
+	result = ufa_jsonrpc_api_query(api, repo_dirs, "@title=\"an intro\"",
+				       false, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(ufa_list_size(result), 1);
+	ck_assert_str_eq(TMP_TEST_FILE2, (char *) result->data);
+	ufa_list_free(result);
+
+	ufa_list_free(repo_dirs);
+}
+END_TEST
+
+START_TEST(api_search_explain_ok)
+{
+	struct ufa_error *error    = NULL;
+	struct ufa_list *explain   = NULL;
+	struct ufa_list *repo_dirs = ufa_list_append2(NULL,
+						      ufa_str_dup(TMP_REPO_DIR),
+						      ufa_free);
+	struct ufa_list *tags = ufa_list_append(NULL, "tag1");
+
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE1, "tag1", NULL);
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE2, "tag2", NULL);
+
+	struct ufa_list *result = ufa_jsonrpc_api_search_page(
+	    api, repo_dirs, NULL, tags, false, NULL, NULL, &explain, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(ufa_list_size(result), 1);
+	ck_assert_str_eq(TMP_TEST_FILE1, (char *) result->data);
+
+	// stages in the order they were run
+	const char *stages[] = {"repositories", "open", "search", "total"};
+	ck_assert_int_eq(4, ufa_list_size(explain));
+	for (int i = 0; i < 4; i++) {
+		struct ufa_repo_explain *e = ufa_list_get(explain, i)->data;
+		ck_assert_str_eq(stages[i], e->stage);
+		ck_assert(e->ms >= 0);
+	}
+	struct ufa_repo_explain *e = ufa_list_get(explain, 2)->data;
+	ck_assert_str_eq(TMP_REPO_DIR, e->repository);
+	ck_assert(ufa_str_startswith(e->sql, "SELECT"));
+	ck_assert(e->plan != NULL);
+	ck_assert_int_eq(1, e->rows);
+	e = ufa_list_get(explain, 3)->data;
+	ck_assert(e->repository == NULL);
+	ck_assert(e->sql == NULL);
+	ck_assert_int_eq(1, e->rows);
+	ufa_list_free(explain);
+	ufa_list_free(result);
+
+	result = ufa_jsonrpc_api_query_page(api, repo_dirs, "tag1 OR tag2",
+					    false, NULL, NULL, &explain,
+					    &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(ufa_list_size(result), 2);
+	e = ufa_list_get(explain, 2)->data;
+	ck_assert_str_eq("query", e->stage);
+	ck_assert_int_eq(2, e->rows);
+	ufa_list_free(explain);
+	ufa_list_free(result);
+
+	ufa_list_free(tags);
+	ufa_list_free(repo_dirs);
+}
+END_TEST
+
+START_TEST(api_query_page_ok)
+{
+	struct ufa_error *error    = NULL;
+	struct ufa_list *repo_dirs = ufa_list_append2(NULL,
+						      ufa_str_dup(TMP_REPO_DIR),
+						      ufa_free);
+
+	ufa_jsonrpc_api_setattr(api, TMP_TEST_FILE1, "year", "2021", NULL);
+	ufa_jsonrpc_api_setattr(api, TMP_TEST_FILE2, "year", "2019", NULL);
+	ufa_jsonrpc_api_setattr(api, TMP_TEST_FILE3, "year", "2020", NULL);
+
+	struct ufa_repo_page page = {
+	    .sort = UFA_REPO_SORT_ATTR, .sort_attr = "year", .limit = 2};
+	char *cursor = NULL;
+	struct ufa_list *result = ufa_jsonrpc_api_query_page(
+	    api, repo_dirs, "@year", false, &page, &cursor, NULL, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(ufa_list_size(result), 2);
+	ck_assert_str_eq(TMP_TEST_FILE2, (char *) result->data);
+	ck_assert_str_eq(TMP_TEST_FILE3, (char *) result->next->data);
+	ck_assert(cursor != NULL);
+	ufa_list_free(result);
+
+	page.after = cursor;
+	char *cursor2 = NULL;
+	result = ufa_jsonrpc_api_query_page(api, repo_dirs, "@year", false,
+					    &page, &cursor2, NULL, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(ufa_list_size(result), 1);
+	ck_assert_str_eq(TMP_TEST_FILE1, (char *) result->data);
+	ck_assert(cursor2 == NULL);
+	ufa_list_free(result);
+	ufa_free(cursor);
+
+	page.after = "zz";
+	result = ufa_jsonrpc_api_query_page(api, repo_dirs, "@year", false,
+					    &page, NULL, NULL, &error);
+	ck_assert(result == NULL);
+	ck_assert(error != NULL);
+	ck_assert_int_eq(JSONRPC_INVALID_PARAMS, error->code);
+	ufa_error_free(error);
+
+	ufa_list_free(repo_dirs);
+}
+END_TEST
+
+START_TEST(api_query_invalid)
+{
+	struct ufa_error *error    = NULL;
+	struct ufa_list *repo_dirs = ufa_list_append2(NULL,
+						      ufa_str_dup(TMP_REPO_DIR),
+						      ufa_free);
+
+	struct ufa_list *result =
+	    ufa_jsonrpc_api_query(api, repo_dirs, "(math OR", false, &error);
+	ck_assert(result == NULL);
+	ck_assert(error != NULL);
+	ck_assert_int_eq(JSONRPC_INVALID_PARAMS, error->code);
+	ufa_error_free(error);
+
+	ufa_list_free(repo_dirs);
+}
+END_TEST
+
+/* ========================================================================== */
+/* TEST FUNCTIONS FOR STATS                                                   */
+/* ========================================================================== */
+
+START_TEST(api_stats_ok)
+{
+	struct ufa_error *error = NULL;
+
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE1, TAG1, NULL);
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE1, TAG2, NULL);
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE_NOTFOUND, TAG1, NULL);
+
+	struct ufa_list *result = ufa_jsonrpc_api_stats(api, &error);
+	ufa_error_print(error);
+	ck_assert(error == NULL);
+	ck_assert(result != NULL);
+
+	struct ufa_stats_summary *rpc_settag = NULL;
+	struct ufa_stats_summary *repo_settag = NULL;
+	for (UFA_LIST_EACH(i, result)) {
+		struct ufa_stats_summary *s =
+		    (struct ufa_stats_summary *) i->data;
+		if (ufa_str_equals(s->name, "rpc.settag")) {
+			rpc_settag = s;
+		} else if (ufa_str_equals(s->name, "repo.settag")) {
+			repo_settag = s;
+		}
+	}
+	ck_assert(rpc_settag != NULL);
+	ck_assert_int_eq(3, rpc_settag->count);
+	ck_assert_int_eq(1, rpc_settag->errors);
+	ck_assert(rpc_settag->p50 <= rpc_settag->p99);
+	ck_assert(rpc_settag->p99 <= rpc_settag->max);
+	// directory of nonexistent file is known, so the repo rejects it
+	ck_assert(repo_settag != NULL);
+	ck_assert_int_eq(3, repo_settag->count);
+	ck_assert_int_eq(1, repo_settag->errors);
+
+	ufa_list_free(result);
+}
+END_TEST
+
+/* ========================================================================== */
+/* TEST FUNCTIONS FOR SUBSCRIPTIONS                                           */
+/* ========================================================================== */
+
+START_TEST(api_subscribe_ok)
+{
+	struct ufa_error *error = NULL;
+	enum ufa_data_change change;
+	char *path = NULL;
+	char *path2 = NULL;
+
+	ufa_jsonrpc_api_t *sub = ufa_jsonrpc_api_init(&error);
+	ck_assert(sub != NULL);
+	ck_assert(ufa_jsonrpc_api_subscribe(sub, TMP_REPO_DIR, &error));
+
+	ck_assert(ufa_jsonrpc_api_settag(api, TMP_TEST_FILE1, TAG1, NULL));
+	ck_assert(ufa_jsonrpc_api_setattr(api, TMP_TEST_FILE2, "attr1", "v1",
+					  NULL));
+	// failed changes are not notified
+	ufa_jsonrpc_api_settag(api, TMP_TEST_FILE_NOTFOUND, TAG1, NULL);
+	ck_assert(ufa_jsonrpc_api_unsettag(api, TMP_TEST_FILE1, TAG1, NULL));
+
+	ck_assert(ufa_jsonrpc_api_next_change(sub, &change, &path, &path2,
+					      &error));
+	ck_assert_int_eq(UFA_DATA_CHANGE_TAGS, change);
+	ck_assert_str_eq(TMP_TEST_FILE1, path);
+	ck_assert(path2 == NULL);
+	ufa_free(path);
+
+	ck_assert(ufa_jsonrpc_api_next_change(sub, &change, &path, &path2,
+					      &error));
+	ck_assert_int_eq(UFA_DATA_CHANGE_ATTRS, change);
+	ck_assert_str_eq(TMP_TEST_FILE2, path);
+	ufa_free(path);
+
+	ck_assert(ufa_jsonrpc_api_next_change(sub, &change, &path, &path2,
+					      &error));
+	ck_assert_int_eq(UFA_DATA_CHANGE_TAGS, change);
+	ck_assert_str_eq(TMP_TEST_FILE1, path);
+	ufa_free(path);
+
+	ck_assert(error == NULL);
+	ufa_jsonrpc_api_close(sub, NULL);
+}
+END_TEST
+
+START_TEST(api_subscribe_not_dir)
+{
+	struct ufa_error *error = NULL;
+
+	ufa_jsonrpc_api_t *sub = ufa_jsonrpc_api_init(&error);
+	ck_assert(!ufa_jsonrpc_api_subscribe(sub, TMP_TEST_FILE_NOTFOUND,
+					     &error));
+	ck_assert(error != NULL);
+	ufa_error_free(error);
+	ufa_jsonrpc_api_close(sub, NULL);
+}
+END_TEST
+
 /* ========================================================================== */
 /* SUITE DEFINITIONS AND MAIN FUNCTION                                        */
 /* ========================================================================== */
@@ -765,6 +1127,8 @@ Suite *repo_suite(void)
 	TCase *tc_tag;
 	TCase *tc_attr;
 	TCase *tc_search;
+	TCase *tc_stats;
+	TCase *tc_subscribe;
 
 	s = suite_create("API");
 
@@ -778,6 +1142,7 @@ Suite *repo_suite(void)
 	tcase_add_test(tc_tag, api_listtags_not_dir);
 	tcase_add_test(tc_tag, api_listtags_corrupt_db);
 	tcase_add_test(tc_tag, api_gettags_ok);
+	tcase_add_test(tc_tag, api_gettags_many_ok);
 	tcase_add_test(tc_tag, api_inserttag_ok);
 	tcase_add_test(tc_tag, api_cleartags_ok);
 	tcase_add_test(tc_tag, api_unsettags_ok);
@@ -789,6 +1154,7 @@ Suite *repo_suite(void)
 	tcase_add_test(tc_attr, api_setattr_ok);
 	tcase_add_test(tc_attr, api_setattr_filenotfound);
 	tcase_add_test(tc_attr, api_getattr_ok);
+	tcase_add_test(tc_attr, api_getattr_many_ok);
 	tcase_add_test(tc_attr, api_getattr_empty_ok);
 	tcase_add_test(tc_attr, api_unsetattr_ok);
 
@@ -802,11 +1168,28 @@ Suite *repo_suite(void)
 	tcase_add_test(tc_search, api_search_tags_multiple_ok);
 	tcase_add_test(tc_search, api_search_tags_multiple_notfound_ok);
 	tcase_add_test(tc_search, api_search_tags_and_attrs_ok);
+	tcase_add_test(tc_search, api_facets_ok);
+	tcase_add_test(tc_search, api_query_ok);
+	tcase_add_test(tc_search, api_query_page_ok);
+	tcase_add_test(tc_search, api_search_explain_ok);
+	tcase_add_test(tc_search, api_query_invalid);
+
+	/* STATS test case */
+	tc_stats = tcase_create("stats");
+	tcase_add_checked_fixture(tc_stats, setup_repo, teardown_repo);
+	tcase_add_test(tc_stats, api_stats_ok);
+
+	tc_subscribe = tcase_create("subscribe");
+	tcase_add_checked_fixture(tc_subscribe, setup_repo, teardown_repo);
+	tcase_add_test(tc_subscribe, api_subscribe_ok);
+	tcase_add_test(tc_subscribe, api_subscribe_not_dir);
 
 	/* Add test cases to suite */
 	suite_add_tcase(s, tc_tag);
 	suite_add_tcase(s, tc_attr);
 	suite_add_tcase(s, tc_search);
+	suite_add_tcase(s, tc_stats);
+	suite_add_tcase(s, tc_subscribe);
 
 	return s;
 }
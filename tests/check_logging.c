@@ -0,0 +1,193 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Test cases for logging.c                                                   */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "util/logging.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+#define NUM_THREADS 4
+#define MESSAGES_PER_THREAD 100
+
+static int count_lines(FILE *file)
+{
+	char line[1024];
+	int count = 0;
+	rewind(file);
+	while (fgets(line, sizeof(line), file) != NULL) {
+		count++;
+	}
+	return count;
+}
+
+static void *log_messages(void *arg)
+{
+	int id = *((int *) arg);
+	for (int i = 0; i < MESSAGES_PER_THREAD; i++) {
+		ufa_info("thread %d message %d", id, i);
+		if (i % 20 == 0) {
+			// leave room for the flusher (ring has limited size)
+			ufa_log_flush();
+		}
+	}
+	return NULL;
+}
+
+static int evaluated = 0;
+
+static int count_evaluation()
+{
+	return ++evaluated;
+}
+
+
+/* ========================================================================== */
+/* TEST FUNCTIONS                                                             */
+/* ========================================================================== */
+
+
+START_TEST(sync_ok)
+{
+	FILE *file = tmpfile();
+	ufa_log_use_file(file);
+	ufa_log_setlevel(UFA_LOG_INFO);
+
+	ufa_info("message %s %d", "one", 1);
+	ufa_warn("message %s %d", "two", 2);
+	ck_assert_int_eq(2, count_lines(file));
+
+	char line[1024];
+	rewind(file);
+	ck_assert_ptr_nonnull(fgets(line, sizeof(line), file));
+	ck_assert_ptr_nonnull(strstr(line, "message one 1"));
+
+	ufa_log_use_file(NULL);
+	fclose(file);
+}
+END_TEST
+
+
+START_TEST(level_not_evaluated)
+{
+	FILE *file = tmpfile();
+	ufa_log_use_file(file);
+	ufa_log_setlevel(UFA_LOG_WARN);
+
+	evaluated = 0;
+	ufa_debug("not logged %d", count_evaluation());
+	ufa_info("not logged %d", count_evaluation());
+	ck_assert_int_eq(0, evaluated);
+
+	ufa_warn("logged %d", count_evaluation());
+	ck_assert_int_eq(1, evaluated);
+	ck_assert_int_eq(1, count_lines(file));
+
+	ufa_log_use_file(NULL);
+	fclose(file);
+}
+END_TEST
+
+
+START_TEST(long_message_ok)
+{
+	FILE *file = tmpfile();
+	ufa_log_use_file(file);
+	ufa_log_setlevel(UFA_LOG_INFO);
+
+	char big[4000];
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	ufa_info("%s", big);
+
+	char line[8192];
+	rewind(file);
+	ck_assert_ptr_nonnull(fgets(line, sizeof(line), file));
+	ck_assert_ptr_nonnull(strstr(line, big));
+
+	ufa_log_use_file(NULL);
+	fclose(file);
+}
+END_TEST
+
+
+START_TEST(async_threads_ok)
+{
+	FILE *file = tmpfile();
+	ufa_log_use_file(file);
+	ufa_log_setlevel(UFA_LOG_INFO);
+	ck_assert(ufa_log_async_start());
+
+	pthread_t threads[NUM_THREADS];
+	int ids[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		ids[i] = i;
+		pthread_create(&threads[i], NULL, log_messages, &ids[i]);
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	ufa_info("main thread message");
+	ufa_log_async_stop();
+
+	ck_assert_int_eq(NUM_THREADS * MESSAGES_PER_THREAD + 1,
+			 count_lines(file));
+
+	ufa_log_use_file(NULL);
+	fclose(file);
+}
+END_TEST
+
+
+/* ========================================================================== */
+/* SUITE DEFINITIONS AND MAIN FUNCTION                                        */
+/* ========================================================================== */
+
+Suite *logging_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("Logging");
+
+	/* Core test case */
+	tc_core = tcase_create("core");
+	tcase_add_test(tc_core, sync_ok);
+	tcase_add_test(tc_core, level_not_evaluated);
+	tcase_add_test(tc_core, long_message_ok);
+	tcase_add_test(tc_core, async_threads_ok);
+
+	/* Add test cases to suite */
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = logging_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
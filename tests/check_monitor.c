@@ -0,0 +1,408 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Test cases for monitor_inotify.c                                           */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "core/monitor.h"
+#include "util/list.h"
+#include "util/misc.h"
+#include "util/string.h"
+#include <check.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+#define MAX_FILES 16
+
+char TMP_DIR[] = "/tmp/ufa-test-XXXXXX";
+
+static int watcher = -1;
+
+/** Files in TMP_DIR according to the events received */
+static char *files[MAX_FILES];
+
+static int batches_begun = 0;
+static int batches_ended = 0;
+static int batches_wrong = 0;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Overflow test: worker is blocked until gate is open */
+static bool gate_open = false;
+static int overflows = 0;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+static char *tmp_path(const char *name)
+{
+	return ufa_util_joinpath(TMP_DIR, name, NULL);
+}
+
+static void create_file(const char *name)
+{
+	char *path = tmp_path(name);
+	int fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd != -1) {
+		close(fd);
+	}
+	ufa_free(path);
+}
+
+static void rename_file(const char *from, const char *to)
+{
+	char *path_from = tmp_path(from);
+	char *path_to = tmp_path(to);
+	rename(path_from, path_to);
+	ufa_free(path_from);
+	ufa_free(path_to);
+}
+
+static void remove_file(const char *name)
+{
+	char *path = tmp_path(name);
+	unlink(path);
+	ufa_free(path);
+}
+
+static int find_file(const char *path)
+{
+	for (int i = 0; i < MAX_FILES; i++) {
+		if (files[i] != NULL && ufa_str_equals(files[i], path)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Applies events to 'files', as ufad does to the database
+ */
+static void callback(const struct ufa_event *event)
+{
+	pthread_mutex_lock(&mutex);
+	int i = (event->target1 != NULL) ? find_file(event->target1) : -1;
+	if (event->event == UFA_MONITOR_MOVE && event->target2 != NULL) {
+		if (i >= 0) {
+			ufa_free(files[i]);
+			files[i] = ufa_str_dup(event->target2);
+		} else {
+			int free_slot = find_file("");
+			ufa_free(files[free_slot]);
+			files[free_slot] = ufa_str_dup(event->target2);
+		}
+	} else if (event->event != UFA_MONITOR_CLOSEWRITE && i >= 0) {
+		// deleted or moved out
+		ufa_free(files[i]);
+		files[i] = ufa_str_dup("");
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Adds file to 'files' (file created in dir, which generates no event)
+ */
+static void track_file(const char *name)
+{
+	pthread_mutex_lock(&mutex);
+	int i = find_file("");
+	ufa_free(files[i]);
+	files[i] = tmp_path(name);
+	pthread_mutex_unlock(&mutex);
+}
+
+static void begin_batch(int w, const char *dir)
+{
+	// called from the monitor thread, so no assertions here
+	pthread_mutex_lock(&mutex);
+	batches_begun++;
+	if (w != watcher || !ufa_str_equals(TMP_DIR, dir)) {
+		batches_wrong++;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+static void end_batch(int w, const char *dir)
+{
+	pthread_mutex_lock(&mutex);
+	batches_ended++;
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Blocks until gate is open and counts overflow events of TMP_DIR
+ */
+static void callback_overflow(const struct ufa_event *event)
+{
+	pthread_mutex_lock(&mutex);
+	while (!gate_open) {
+		pthread_cond_wait(&gate_cond, &mutex);
+	}
+	if (event->event == UFA_MONITOR_OVERFLOW
+	    && ufa_str_equals(event->target1, TMP_DIR)) {
+		overflows++;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+static void open_gate()
+{
+	pthread_mutex_lock(&mutex);
+	gate_open = true;
+	pthread_cond_broadcast(&gate_cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+static long max_queued_events()
+{
+	long max = 16384;
+	FILE *f = fopen("/proc/sys/fs/inotify/max_queued_events", "r");
+	if (f != NULL) {
+		if (fscanf(f, "%ld", &max) != 1) {
+			max = 16384;
+		}
+		fclose(f);
+	}
+	return max;
+}
+
+/**
+ * Waits (up to 5 seconds) until 'name' is the only file tracked
+ */
+static bool wait_only_file(const char *name)
+{
+	char *path = (name != NULL) ? tmp_path(name) : NULL;
+	bool ok = false;
+	for (int retry = 0; retry < 500 && !ok; retry++) {
+		pthread_mutex_lock(&mutex);
+		int count = 0;
+		for (int i = 0; i < MAX_FILES; i++) {
+			count += (files[i][0] != '\0');
+		}
+		ok = (path == NULL) ? count == 0
+				    : count == 1 && find_file(path) >= 0;
+		pthread_mutex_unlock(&mutex);
+		if (!ok) {
+			usleep(10 * 1000);
+		}
+	}
+	ufa_free(path);
+	return ok;
+}
+
+
+/* ========================================================================== */
+/* FIXTURE FUNCTIONS                                                          */
+/* ========================================================================== */
+
+void setup_monitor(void)
+{
+	mkdtemp(TMP_DIR);
+	printf("Tmp dir..........: %s\n", TMP_DIR);
+	for (int i = 0; i < MAX_FILES; i++) {
+		files[i] = ufa_str_dup("");
+	}
+	batches_begun = batches_ended = batches_wrong = 0;
+
+	ck_assert(ufa_monitor_init());
+	watcher = ufa_monitor_add_watcher(
+	    TMP_DIR, UFA_MONITOR_MOVE | UFA_MONITOR_DELETE, callback);
+	ck_assert_int_ge(watcher, 0);
+	ck_assert(ufa_monitor_set_batch_hooks(watcher, begin_batch, end_batch));
+}
+
+void setup_overflow(void)
+{
+	mkdtemp(TMP_DIR);
+	printf("Tmp dir..........: %s\n", TMP_DIR);
+	gate_open = false;
+	overflows = 0;
+
+	// worker blocked and only one event queued: nothing else is read
+	ck_assert(ufa_monitor_set_limits(4096, 1));
+	ck_assert(ufa_monitor_init());
+	watcher = ufa_monitor_add_watcher(TMP_DIR, UFA_MONITOR_MOVE,
+					  callback_overflow);
+	ck_assert_int_ge(watcher, 0);
+}
+
+void teardown_overflow(void)
+{
+	open_gate();
+	ufa_monitor_stop();
+	ufa_monitor_set_limits(UFA_MONITOR_DEFAULT_READ_BUFFER,
+			       UFA_MONITOR_DEFAULT_MAX_QUEUED);
+	remove_file("f");
+	remove_file("g");
+	ufa_util_rmdir(TMP_DIR, NULL);
+	strcpy(TMP_DIR, "/tmp/ufa-test-XXXXXX");
+}
+
+void teardown_monitor(void)
+{
+	ufa_monitor_stop();
+	for (int i = 0; i < MAX_FILES; i++) {
+		ufa_free(files[i]);
+	}
+	ufa_util_rmdir(TMP_DIR, NULL);
+	strcpy(TMP_DIR, "/tmp/ufa-test-XXXXXX");
+}
+
+
+/* ========================================================================== */
+/* TEST FUNCTIONS                                                             */
+/* ========================================================================== */
+
+
+START_TEST(move_chain_ok)
+{
+	create_file("a");
+	track_file("a");
+
+	rename_file("a", "b");
+	rename_file("b", "c");
+	rename_file("c", "d");
+	ck_assert(wait_only_file("d"));
+
+	pthread_mutex_lock(&mutex);
+	ck_assert_int_ge(batches_begun, 1);
+	ck_assert_int_eq(batches_begun, batches_ended);
+	ck_assert_int_eq(0, batches_wrong);
+	pthread_mutex_unlock(&mutex);
+
+	remove_file("d");
+	ck_assert(wait_only_file(NULL));
+}
+END_TEST
+
+
+START_TEST(move_then_delete_ok)
+{
+	create_file("x");
+	track_file("x");
+	create_file("other");
+	track_file("other");
+
+	rename_file("x", "y");
+	remove_file("y");
+	rename_file("other", "z");
+	ck_assert(wait_only_file("z"));
+
+	remove_file("z");
+	ck_assert(wait_only_file(NULL));
+}
+END_TEST
+
+
+START_TEST(moved_out_ok)
+{
+	// subdirs are not watched, so moving into one is moving out
+	char *out = tmp_path("out");
+	ck_assert(ufa_util_mkdir(out, NULL));
+
+	create_file("m");
+	track_file("m");
+	create_file("n");
+	track_file("n");
+
+	rename_file("m", "out/m");
+	rename_file("n", "o");
+	ck_assert(wait_only_file("o"));
+
+	remove_file("out/m");
+	remove_file("o");
+	ck_assert(wait_only_file(NULL));
+	ufa_util_rmdir(out, NULL);
+	ufa_free(out);
+}
+END_TEST
+
+
+START_TEST(overflow_ok)
+{
+	create_file("f");
+
+	// each rename generates 2 events (some are read before queue is full)
+	long renames = max_queued_events() + 256;
+	for (long i = 0; i < renames; i++) {
+		rename_file((i % 2) ? "g" : "f", (i % 2) ? "f" : "g");
+	}
+	open_gate();
+
+	bool ok = false;
+	for (int retry = 0; retry < 500 && !ok; retry++) {
+		pthread_mutex_lock(&mutex);
+		ok = overflows > 0;
+		pthread_mutex_unlock(&mutex);
+		if (!ok) {
+			usleep(10 * 1000);
+		}
+	}
+	ck_assert(ok);
+}
+END_TEST
+
+
+/* ========================================================================== */
+/* SUITE DEFINITIONS AND MAIN FUNCTION                                        */
+/* ========================================================================== */
+
+Suite *monitor_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+	TCase *tc_overflow;
+
+	s = suite_create("Monitor");
+
+	/* Core test case */
+	tc_core = tcase_create("core");
+	tcase_add_checked_fixture(tc_core, setup_monitor, teardown_monitor);
+	tcase_set_timeout(tc_core, 30);
+	tcase_add_test(tc_core, move_chain_ok);
+	tcase_add_test(tc_core, move_then_delete_ok);
+	tcase_add_test(tc_core, moved_out_ok);
+
+	/* Overflow test case */
+	tc_overflow = tcase_create("overflow");
+	tcase_add_checked_fixture(tc_overflow, setup_overflow,
+				  teardown_overflow);
+	tcase_set_timeout(tc_overflow, 60);
+	tcase_add_test(tc_overflow, overflow_ok);
+
+	/* Add test cases to suite */
+	suite_add_tcase(s, tc_core);
+	suite_add_tcase(s, tc_overflow);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = monitor_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
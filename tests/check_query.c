@@ -0,0 +1,270 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Test cases for query.c                                                     */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "core/errors.h"
+#include "core/query.h"
+#include "util/error.h"
+#include "util/misc.h"
+#include "util/string.h"
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+/**
+ * Parses 'str' and checks that the query is 'expected' (ufa_query_tostr),
+ * and that it parses back to the same query.
+ */
+static void assert_parse(const char *str, const char *expected)
+{
+	struct ufa_error *error = NULL;
+	struct ufa_query *query = ufa_query_parse(str, &error);
+	ck_assert_msg(error == NULL, "%s: %s", str,
+		      error ? error->message : "");
+	char *result = ufa_query_tostr(query);
+	ck_assert_str_eq(expected, result);
+
+	struct ufa_query *query2 = ufa_query_parse(result, &error);
+	ck_assert(error == NULL);
+	char *result2 = ufa_query_tostr(query2);
+	ck_assert_str_eq(result, result2);
+
+	ufa_free(result);
+	ufa_free(result2);
+	ufa_query_free(query);
+	ufa_query_free(query2);
+}
+
+/**
+ * Checks that 'str' is an invalid query, with error at 'position'.
+ */
+static void assert_error(const char *str, int position)
+{
+	struct ufa_error *error = NULL;
+	struct ufa_query *query = ufa_query_parse(str, &error);
+	ck_assert_msg(query == NULL, "%s", str);
+	ck_assert(error != NULL);
+	ck_assert_int_eq(UFA_ERROR_ARGS, error->code);
+
+	char *prefix = ufa_str_sprintf("invalid query at position %d:",
+				       position);
+	ck_assert_msg(ufa_str_startswith(error->message, prefix), "%s: %s",
+		      str, error->message);
+	ufa_free(prefix);
+	ufa_error_free(error);
+}
+
+
+/* ========================================================================== */
+/* TEST FUNCTIONS                                                             */
+/* ========================================================================== */
+
+START_TEST(parse_predicates_ok)
+{
+	assert_parse("math", "math");
+	assert_parse("  math  ", "math");
+	assert_parse("@author", "@author");
+	assert_parse("@year=2020", "@year=2020");
+	assert_parse("@year = 2020", "@year=2020");
+	assert_parse("@title~=*calc*", "@title~=*calc*");
+	assert_parse("@a==b", "@a==b");
+	assert_parse("NOTE", "NOTE");
+	assert_parse("ANDROID", "ANDROID");
+}
+END_TEST
+
+START_TEST(parse_operators_ok)
+{
+	// AND binds tighter than OR
+	assert_parse("a OR b AND c", "(a OR (b AND c))");
+	assert_parse("a AND b OR c", "((a AND b) OR c)");
+	assert_parse("(a OR b) AND c", "((a OR b) AND c)");
+	// AND is optional
+	assert_parse("a b c", "((a AND b) AND c)");
+	assert_parse("a NOT b", "(a AND (NOT b))");
+	assert_parse("NOT NOT a", "(NOT (NOT a))");
+	assert_parse("NOT(a OR @x)", "(NOT (a OR @x))");
+	assert_parse("((a))", "a");
+	assert_parse("a OR b OR c", "((a OR b) OR c)");
+}
+END_TEST
+
+START_TEST(parse_compare_ok)
+{
+	assert_parse("@year>=2020", "@year>=2020");
+	assert_parse("@year <= 2020", "@year<=2020");
+	assert_parse("@year<2020 OR @year>2022", "(@year<2020 OR @year>2022)");
+	assert_parse("@year=2020..2022", "@year=2020..2022");
+	assert_parse("@year=\"2020..2022\"", "@year=\"2020..2022\"");
+	assert_parse("@title=a..b", "@title=a..b");
+	assert_parse("@t~~word", "@t~~word");
+	assert_parse("@t ~~ \"two words\"", "@t~~\"two words\"");
+
+	struct ufa_error *error = NULL;
+	struct ufa_query *query = ufa_query_parse("@d=2024-01-01..2024-02-01",
+						  &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(UFA_REPO_BETWEEN, query->matchmode);
+	ck_assert_str_eq("2024-01-01..2024-02-01", query->value);
+	ufa_query_free(query);
+
+	// a range in quotes is text
+	query = ufa_query_parse("@y=\"1..2\"", &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(UFA_REPO_EQUAL, query->matchmode);
+	ufa_query_free(query);
+
+	query = ufa_query_parse("@t~~\"calc* integral\"", &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(UFA_REPO_FULLTEXT, query->matchmode);
+	ck_assert_str_eq("calc* integral", query->value);
+	ufa_query_free(query);
+
+	query = ufa_query_parse("@y>=1", &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(UFA_REPO_GE, query->matchmode);
+	ck_assert_str_eq("y", query->name);
+	ck_assert_str_eq("1", query->value);
+	ufa_query_free(query);
+}
+END_TEST
+
+START_TEST(parse_quoted_ok)
+{
+	assert_parse("\"two words\"", "\"two words\"");
+	assert_parse("\"OR\"", "\"OR\"");
+	assert_parse("\"@notattr\"", "\"@notattr\"");
+	assert_parse("\"a\\\"b\\\\c\"", "\"a\\\"b\\\\c\"");
+	assert_parse("@\"my attr\"=\"a value\"", "@\"my attr\"=\"a value\"");
+	assert_parse("@\"a=b\"", "@\"a=b\"");
+	assert_parse("\"\"", "\"\"");
+
+	struct ufa_error *error = NULL;
+	struct ufa_query *query = ufa_query_parse("@t~=\"(x y)\"", &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(UFA_QUERY_ATTR, query->type);
+	ck_assert_str_eq("t", query->name);
+	ck_assert_str_eq("(x y)", query->value);
+	ck_assert_int_eq(UFA_REPO_WILDCARD, query->matchmode);
+	ufa_query_free(query);
+}
+END_TEST
+
+START_TEST(parse_errors)
+{
+	assert_error("", 1);
+	assert_error("   ", 4);
+	assert_error("a AND", 6);
+	assert_error("a OR OR b", 6);
+	assert_error("AND a", 1);
+	assert_error("(a OR b", 8);
+	assert_error("a)", 2);
+	assert_error("()", 2);
+	assert_error("NOT", 4);
+	assert_error("@", 2);
+	assert_error("@=x", 2);
+	assert_error("@a=", 4);
+	assert_error("@a>=", 5);
+	assert_error("a \"b", 3);
+}
+END_TEST
+
+START_TEST(parse_limits)
+{
+	struct ufa_error *error = NULL;
+
+	char *nested = ufa_str_multiply("(", UFA_QUERY_MAX_DEPTH + 1);
+	struct ufa_query *query = ufa_query_parse(nested, &error);
+	ck_assert(query == NULL);
+	ck_assert(error != NULL);
+	ufa_error_free(error);
+	error = NULL;
+	ufa_free(nested);
+
+	char *many = ufa_str_multiply("a ", UFA_QUERY_MAX_PREDICATES);
+	query = ufa_query_parse(many, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(UFA_QUERY_MAX_PREDICATES,
+			 ufa_query_count_predicates(query));
+	ufa_query_free(query);
+	ufa_free(many);
+
+	many = ufa_str_multiply("a ", UFA_QUERY_MAX_PREDICATES + 1);
+	query = ufa_query_parse(many, &error);
+	ck_assert(query == NULL);
+	ck_assert(error != NULL);
+	ufa_error_free(error);
+	error = NULL;
+	ufa_free(many);
+
+	// each word of a full-text value binds an argument
+	char *words = ufa_str_multiply("w ", UFA_QUERY_MAX_PREDICATES);
+	many = ufa_str_sprintf("@t~~\"%s\"", words);
+	query = ufa_query_parse(many, &error);
+	ck_assert(error == NULL);
+	ufa_query_free(query);
+	ufa_free(many);
+
+	many = ufa_str_sprintf("a @t~~\"%s\"", words);
+	query = ufa_query_parse(many, &error);
+	ck_assert(query == NULL);
+	ck_assert(error != NULL);
+	ufa_error_free(error);
+	ufa_free(many);
+	ufa_free(words);
+}
+END_TEST
+
+
+/* ========================================================================== */
+/* SUITE DEFINITIONS AND MAIN FUNCTION                                        */
+/* ========================================================================== */
+
+Suite *query_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("Query");
+
+	/* Core test case */
+	tc_core = tcase_create("core");
+	tcase_add_test(tc_core, parse_predicates_ok);
+	tcase_add_test(tc_core, parse_operators_ok);
+	tcase_add_test(tc_core, parse_compare_ok);
+	tcase_add_test(tc_core, parse_quoted_ok);
+	tcase_add_test(tc_core, parse_errors);
+	tcase_add_test(tc_core, parse_limits);
+
+	/* Add test cases to suite */
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = query_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
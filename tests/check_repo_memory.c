@@ -0,0 +1,577 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Test cases for repo.c and repo_memory.c                                    */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "core/errors.h"
+#include "core/query.h"
+#include "core/repo.h"
+#include "util/error.h"
+#include "util/hashtable.h"
+#include "util/misc.h"
+#include "util/string.h"
+#include <check.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+static ufa_repo_t *global_repo = NULL;
+
+char TMP_REPO_DIR[] = "/tmp/ufa-test-XXXXXX";
+char *TMP_REPO_FILE = NULL;
+char *TMP_UFAREPOFILE = NULL;
+char *TMP_TEST_FILE1 = NULL;
+char *TMP_TEST_FILE2 = NULL;
+
+const char *TAG1 = "tag1";
+const char *TAG2 = "tag2";
+const char *TAG3 = "tag3";
+
+#define ASSERT_STR_IN_LIST(str, list)                                          \
+	ck_assert(ufa_list_contains(                                           \
+	    list, str, (ufa_list_equal_fn_t) ufa_str_equals))
+
+/* ========================================================================== */
+/* AUXILIARY FUNCTIONS                                                        */
+/* ========================================================================== */
+
+static void create_file(const char *file)
+{
+	int fd = open(file, O_RDWR | O_CREAT, 0600);
+	if (fd != -1) {
+		close(fd);
+	}
+}
+
+static void init_files_repo_tmp()
+{
+	mkdtemp(TMP_REPO_DIR);
+
+	TMP_REPO_FILE   = ufa_util_joinpath(TMP_REPO_DIR, "repo.sqlite", NULL);
+	TMP_UFAREPOFILE = ufa_util_joinpath(TMP_REPO_DIR, ".ufarepo", NULL);
+	TMP_TEST_FILE1  = ufa_util_joinpath(TMP_REPO_DIR, "testfile1", NULL);
+	TMP_TEST_FILE2  = ufa_util_joinpath(TMP_REPO_DIR, "testfile2", NULL);
+
+	create_file(TMP_TEST_FILE1);
+	create_file(TMP_TEST_FILE2);
+}
+
+static void remove_files_repo_tmp()
+{
+	ufa_util_remove_file(TMP_REPO_FILE, NULL);
+	ufa_util_remove_file(TMP_UFAREPOFILE, NULL);
+	ufa_util_remove_file(TMP_TEST_FILE1, NULL);
+	ufa_util_remove_file(TMP_TEST_FILE2, NULL);
+	ufa_util_rmdir(TMP_REPO_DIR, NULL);
+
+	ufa_free(TMP_REPO_FILE);
+	ufa_free(TMP_UFAREPOFILE);
+	ufa_free(TMP_TEST_FILE1);
+	ufa_free(TMP_TEST_FILE2);
+}
+
+/**
+ * Runs a query on global_repo, returning the number of files found
+ * ('expected' must be one of them, unless NULL).
+ */
+static int run_query(const char *str, const char *expected)
+{
+	struct ufa_error *error = NULL;
+	struct ufa_query *query = ufa_query_parse(str, &error);
+	ck_assert(error == NULL);
+
+	struct ufa_list *result = ufa_repo_query(global_repo, query, &error);
+	ck_assert(error == NULL);
+	if (expected != NULL) {
+		ASSERT_STR_IN_LIST(expected, result);
+	}
+	int count = ufa_list_size(result);
+
+	ufa_list_free(result);
+	ufa_query_free(query);
+	return count;
+}
+
+/**
+ * Reads the next page of the files with TAG1, checking that it has only
+ * 'expected' (NULL: no file), and moves page to the next one.
+ */
+static void assert_page(struct ufa_repo_page *page, char **key,
+			const char *expected)
+{
+	struct ufa_error *error = NULL;
+	struct ufa_list *tags = ufa_list_append(NULL, (char *) TAG1);
+	char *last_key = NULL;
+
+	struct ufa_list *result = ufa_repo_search_page(global_repo, NULL, tags,
+						       page, &last_key, &error);
+	ck_assert(error == NULL);
+	if (expected == NULL) {
+		ck_assert(result == NULL);
+		ck_assert(last_key == NULL);
+	} else {
+		ck_assert_int_eq(1, ufa_list_size(result));
+		ck_assert_str_eq(expected, result->data);
+		ck_assert(last_key != NULL);
+	}
+
+	ufa_free(*key);
+	*key = last_key;
+	page->after = last_key;
+	ufa_list_free(result);
+	ufa_list_free(tags);
+}
+
+
+/* ========================================================================== */
+/* FIXTURE FUNCTIONS                                                          */
+/* ========================================================================== */
+
+void setup_repo(void)
+{
+	struct ufa_error *error = NULL;
+	init_files_repo_tmp();
+	global_repo = ufa_repo_init_backend(TMP_REPO_DIR, "memory", &error);
+}
+
+void teardown_repo(void)
+{
+	ufa_repo_free(global_repo);
+	global_repo = NULL;
+	remove_files_repo_tmp();
+}
+
+
+/* ========================================================================== */
+/* TEST FUNCTIONS FOR backends                                                */
+/* ========================================================================== */
+
+START_TEST(backends_ok)
+{
+	struct ufa_list *backends = ufa_repo_backends();
+	ck_assert_int_eq(2, ufa_list_size(backends));
+	ASSERT_STR_IN_LIST("sqlite", backends);
+	ASSERT_STR_IN_LIST("memory", backends);
+	ufa_list_free(backends);
+}
+END_TEST
+
+START_TEST(init_ok)
+{
+	struct ufa_error *error = NULL;
+	init_files_repo_tmp();
+	ufa_repo_t *repo =
+	    ufa_repo_init_backend(TMP_REPO_DIR, "memory", &error);
+	ck_assert(repo != NULL);
+	ck_assert_str_eq("memory", ufa_repo_backend_name(repo));
+	ck_assert(!ufa_util_isfile(TMP_REPO_FILE));
+	ck_assert(ufa_util_isfile(TMP_UFAREPOFILE));
+
+	// the tags are kept when the repository is opened again
+	ck_assert(ufa_repo_settag(repo, TMP_TEST_FILE1, TAG1, &error));
+	ufa_repo_free(repo);
+	struct stat st_before, st_after;
+	ck_assert_int_eq(0, stat(TMP_UFAREPOFILE, &st_before));
+	repo = ufa_repo_init_backend(TMP_REPO_DIR, "memory", &error);
+	// ... and the unchanged indicator file is not rewritten
+	ck_assert_int_eq(0, stat(TMP_UFAREPOFILE, &st_after));
+	ck_assert(st_before.st_ino == st_after.st_ino);
+	struct ufa_list *tags = ufa_repo_gettags(repo, TMP_TEST_FILE1, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ck_assert_str_eq(TAG1, tags->data);
+	ufa_list_free(tags);
+	ufa_repo_free(repo);
+
+	// the default backend
+	ck_assert(ufa_repo_set_default_backend("memory", &error));
+	repo = ufa_repo_init(TMP_REPO_DIR, &error);
+	ck_assert_str_eq("memory", ufa_repo_backend_name(repo));
+	ufa_repo_free(repo);
+	ck_assert(ufa_repo_set_default_backend("sqlite", &error));
+	ck_assert(error == NULL);
+
+	remove_files_repo_tmp();
+}
+END_TEST
+
+START_TEST(init_error_backend)
+{
+	struct ufa_error *error = NULL;
+	init_files_repo_tmp();
+	ufa_repo_t *repo = ufa_repo_init_backend(TMP_REPO_DIR, "xyz", &error);
+	ck_assert(repo == NULL);
+	ck_assert(error != NULL);
+	ck_assert_int_eq(UFA_ERROR_ARGS, error->code);
+	ck_assert(!ufa_util_isfile(TMP_UFAREPOFILE));
+	ufa_error_free(error);
+	error = NULL;
+
+	ck_assert(!ufa_repo_set_default_backend("xyz", &error));
+	ck_assert(error != NULL);
+	ck_assert_int_eq(UFA_ERROR_ARGS, error->code);
+	ufa_error_free(error);
+
+	remove_files_repo_tmp();
+}
+END_TEST
+
+
+/* ========================================================================== */
+/* TEST FUNCTIONS FOR tag and attribute management                            */
+/* ========================================================================== */
+
+START_TEST(settag_ok)
+{
+	struct ufa_error *error = NULL;
+	ck_assert(ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG2, &error));
+	ck_assert(ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error));
+	ck_assert(ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error));
+	ck_assert(ufa_repo_inserttag(global_repo, TAG3, &error) > 0);
+	ck_assert(error == NULL);
+
+	struct ufa_list *tags = ufa_repo_gettags(global_repo, TMP_TEST_FILE1,
+						 &error);
+	ck_assert_int_eq(2, ufa_list_size(tags));
+	ck_assert_str_eq(TAG1, tags->data);
+	ck_assert_str_eq(TAG2, tags->next->data);
+	ufa_list_free(tags);
+
+	tags = ufa_repo_listtags(global_repo, &error);
+	ck_assert_int_eq(3, ufa_list_size(tags));
+	ufa_list_free(tags);
+
+	ck_assert(ufa_repo_isatag(global_repo, "/tag3", &error));
+	ck_assert(!ufa_repo_isatag(global_repo, "/testfile1", &error));
+
+	ck_assert(ufa_repo_unsettag(global_repo, TMP_TEST_FILE1, TAG2, &error));
+	tags = ufa_repo_gettags(global_repo, TMP_TEST_FILE1, &error);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ufa_list_free(tags);
+
+	ck_assert(ufa_repo_cleartags(global_repo, TMP_TEST_FILE1, &error));
+	tags = ufa_repo_gettags(global_repo, TMP_TEST_FILE1, &error);
+	ck_assert(tags == NULL);
+	ck_assert(error == NULL);
+
+	// a file that is not in the directory
+	char *other = ufa_util_joinpath(TMP_REPO_DIR, "other", NULL);
+	ck_assert(!ufa_repo_settag(global_repo, other, TAG1, &error));
+	ck_assert(error != NULL);
+	ck_assert_int_eq(UFA_ERROR_FILE_NOT_IN_DB, error->code);
+	ufa_error_free(error);
+	ufa_free(other);
+}
+END_TEST
+
+START_TEST(listfiles_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG2, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG3, &error);
+	ck_assert(error == NULL);
+
+	struct ufa_list *list = ufa_repo_listfiles(global_repo, "/", &error);
+	ASSERT_STR_IN_LIST(TAG1, list);
+	ASSERT_STR_IN_LIST(".ufarepo", list);
+	ck_assert_int_eq(4, ufa_list_size(list));
+	ufa_list_free(list);
+
+	list = ufa_repo_listfiles(global_repo, "/tag1", &error);
+	ASSERT_STR_IN_LIST("testfile1", list);
+	ASSERT_STR_IN_LIST(TAG2, list);
+	ASSERT_STR_IN_LIST(".ufarepo", list);
+	ck_assert_int_eq(3, ufa_list_size(list));
+	ufa_list_free(list);
+	ck_assert(error == NULL);
+}
+END_TEST
+
+START_TEST(setattr_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "year", "2019", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "author", "x", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "year", "2020", &error);
+	ck_assert(error == NULL);
+
+	struct ufa_list *attrs = ufa_repo_getattr(global_repo, TMP_TEST_FILE1,
+						  &error);
+	ck_assert_int_eq(2, ufa_list_size(attrs));
+	struct ufa_repo_attr *attr = attrs->next->data;
+	ck_assert_str_eq("year", attr->attribute);
+	ck_assert_str_eq("2020", attr->value);
+	ufa_list_free(attrs);
+
+	ufa_hashtable_t *many =
+	    ufa_repo_getattr_many(global_repo, NULL, &error);
+	ck_assert_int_eq(1, ufa_hashtable_size(many));
+	ck_assert(ufa_hashtable_has_key(many, "testfile1"));
+	ufa_hashtable_free(many);
+
+	ck_assert(ufa_repo_unsetattr(global_repo, TMP_TEST_FILE1, "year",
+				     &error));
+	attrs = ufa_repo_getattr(global_repo, TMP_TEST_FILE1, &error);
+	ck_assert_int_eq(1, ufa_list_size(attrs));
+	ufa_list_free(attrs);
+	ck_assert(error == NULL);
+}
+END_TEST
+
+START_TEST(sync_ok)
+{
+	struct ufa_error *error = NULL;
+	int renamed = -1;
+	int removed = -1;
+	ck_assert(ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, NULL));
+	ck_assert(ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG2, NULL));
+
+	ufa_util_remove_file(TMP_TEST_FILE2, NULL);
+	ck_assert(ufa_repo_sync(global_repo, &renamed, &removed, &error));
+	ck_assert(error == NULL);
+	ck_assert_int_eq(0, renamed);
+	ck_assert_int_eq(1, removed);
+
+	// renamed by the monitor
+	char *new_file = ufa_util_joinpath(TMP_REPO_DIR, "renamed1", NULL);
+	ck_assert_int_eq(0, rename(TMP_TEST_FILE1, new_file));
+	ck_assert(ufa_repo_renamefile(global_repo, global_repo, TMP_TEST_FILE1,
+				      new_file, &error));
+	struct ufa_list *tags = ufa_repo_gettags(global_repo, new_file, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ck_assert_str_eq(TAG1, tags->data);
+	ufa_list_free(tags);
+
+	ck_assert(ufa_repo_removefile(global_repo, new_file, &error));
+	ck_assert(ufa_repo_gettags(global_repo, new_file, &error) == NULL);
+	ck_assert(error == NULL);
+
+	ck_assert_int_eq(0, rename(new_file, TMP_TEST_FILE1));
+	ufa_free(new_file);
+}
+END_TEST
+
+
+/* ========================================================================== */
+/* TEST FUNCTIONS FOR search                                                  */
+/* ========================================================================== */
+
+START_TEST(query_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG2, &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "author", "Ann", &error);
+	ck_assert(error == NULL);
+
+	ck_assert_int_eq(2, run_query("tag1 OR tag2", NULL));
+	ck_assert_int_eq(1, run_query("tag1 @author", "testfile1"));
+	ck_assert_int_eq(1, run_query("NOT @author", "testfile2"));
+	ck_assert_int_eq(0, run_query("tag1 tag2", NULL));
+
+	struct ufa_list *tags = ufa_list_append(NULL, (char *) TAG1);
+	struct ufa_list *result =
+	    ufa_repo_search(global_repo, NULL, tags, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(result));
+	ck_assert_str_eq("testfile1", result->data);
+	ufa_list_free(result);
+	ufa_list_free(tags);
+}
+END_TEST
+
+START_TEST(query_typed_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "year", "2019", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "year", "2021", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "pages", "9", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "pages", "10.5", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "added",
+			 "2024-02-29T10:00:00Z", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "added", "2023-12-31",
+			 &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "title", "b..c", &error);
+	ck_assert(error == NULL);
+
+	// same results as the SQLite backend (see check_repo_sqlite.c)
+	ck_assert_int_eq(1, run_query("@year>=2020", "testfile2"));
+	ck_assert_int_eq(2, run_query("@year>2018", NULL));
+	ck_assert_int_eq(1, run_query("@year<=2019", "testfile1"));
+	ck_assert_int_eq(2, run_query("@year=2019..2021", NULL));
+	ck_assert_int_eq(1, run_query("@year=2020..2030", "testfile2"));
+	ck_assert_int_eq(1, run_query("@pages>9", "testfile2"));
+	ck_assert_int_eq(1, run_query("@pages<10", "testfile1"));
+	ck_assert_int_eq(1, run_query("@added>=2024-01-01", "testfile1"));
+	ck_assert_int_eq(1, run_query("@added<2024-02-29T09:00", "testfile2"));
+	ck_assert_int_eq(2, run_query("@added=2023-12-31..2024-03-01", NULL));
+	ck_assert_int_eq(1, run_query("@title=b..c", "testfile1"));
+	ck_assert_int_eq(0, run_query("@year=\"2019..2021\"", NULL));
+	ck_assert_int_eq(1, run_query("@title<c", "testfile1"));
+}
+END_TEST
+
+START_TEST(query_wildcard_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "title",
+			 "Annual Report 2023", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "title",
+			 "annual_summary", &error);
+	ck_assert(error == NULL);
+
+	ck_assert_int_eq(2, run_query("@title~=annual*", NULL));
+	ck_assert_int_eq(1, run_query("@title~=\"ANNUAL R*\"", "testfile1"));
+	ck_assert_int_eq(0, run_query("@title~=annual", NULL));
+	ck_assert_int_eq(2, run_query("@title~=*", NULL));
+	ck_assert_int_eq(1, run_query("@title~=*l_*", "testfile2"));
+	ck_assert_int_eq(1, run_query("@title~=*rep*2023", "testfile1"));
+
+	// words in any order
+	ck_assert_int_eq(1,
+			 run_query("@title~~\"report annual\"", "testfile1"));
+	ck_assert_int_eq(2, run_query("@title~~annu*", NULL));
+	ck_assert_int_eq(0, run_query("@title~~\"summary report\"", NULL));
+}
+END_TEST
+
+START_TEST(search_page_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG1, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error);
+	ck_assert(error == NULL);
+
+	char *key = NULL;
+	struct ufa_repo_page page = {.sort = UFA_REPO_SORT_NAME, .limit = 1};
+	assert_page(&page, &key, "testfile1");
+	assert_page(&page, &key, "testfile2");
+	assert_page(&page, &key, NULL);
+
+	// ids are in the order the files were added
+	page = (struct ufa_repo_page){.sort = UFA_REPO_SORT_ID, .limit = 1};
+	assert_page(&page, &key, "testfile2");
+	assert_page(&page, &key, "testfile1");
+	assert_page(&page, &key, NULL);
+
+	page = (struct ufa_repo_page){
+	    .sort = UFA_REPO_SORT_ATTR, .sort_attr = "pages", .limit = 1};
+	struct ufa_list *result = ufa_repo_search_page(global_repo, NULL, NULL,
+						       &page, NULL, &error);
+	ck_assert(result == NULL);
+	ck_assert(error != NULL);
+	ck_assert_int_eq(UFA_ERROR_ARGS, error->code);
+	ufa_error_free(error);
+}
+END_TEST
+
+START_TEST(facets_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG2, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG1, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG3, &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "year", "2020", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "year", "2020", &error);
+	ck_assert(error == NULL);
+
+	struct ufa_list *tags = ufa_list_append(NULL, (char *) TAG1);
+	struct ufa_list *result =
+	    ufa_repo_facets(global_repo, NULL, tags, true, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(3, ufa_list_size(result));
+	struct ufa_repo_facet *facet = ufa_list_get(result, 0)->data;
+	ck_assert_str_eq(TAG2, facet->name);
+	ck_assert(facet->value == NULL);
+	ck_assert_int_eq(1, facet->count);
+	facet = ufa_list_get(result, 2)->data;
+	ck_assert_str_eq("year", facet->name);
+	ck_assert_str_eq("2020", facet->value);
+	ck_assert_int_eq(2, facet->count);
+	ufa_list_free(result);
+	ufa_list_free(tags);
+
+	result = ufa_repo_facets(global_repo, NULL, NULL, false, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(3, ufa_list_size(result));
+	facet = result->data;
+	ck_assert_str_eq(TAG1, facet->name);
+	ck_assert_int_eq(2, facet->count);
+	ufa_list_free(result);
+}
+END_TEST
+
+
+/* ========================================================================== */
+/* SUITE DEFINITIONS AND MAIN FUNCTION                                        */
+/* ========================================================================== */
+
+Suite *repo_memory_suite(void)
+{
+	Suite *s;
+	TCase *tc_init;
+	TCase *tc_tag;
+	TCase *tc_query;
+
+	s = suite_create("Repo memory");
+
+	/* Backends test case */
+	tc_init = tcase_create("init");
+	tcase_add_test(tc_init, backends_ok);
+	tcase_add_test(tc_init, init_ok);
+	tcase_add_test(tc_init, init_error_backend);
+
+	/* Tags and attributes test case */
+	tc_tag = tcase_create("tags");
+	tcase_add_checked_fixture(tc_tag, setup_repo, teardown_repo);
+	tcase_add_test(tc_tag, settag_ok);
+	tcase_add_test(tc_tag, listfiles_ok);
+	tcase_add_test(tc_tag, setattr_ok);
+	tcase_add_test(tc_tag, sync_ok);
+
+	/* Search test case */
+	tc_query = tcase_create("query");
+	tcase_add_checked_fixture(tc_query, setup_repo, teardown_repo);
+	tcase_add_test(tc_query, query_ok);
+	tcase_add_test(tc_query, query_typed_ok);
+	tcase_add_test(tc_query, query_wildcard_ok);
+	tcase_add_test(tc_query, search_page_ok);
+	tcase_add_test(tc_query, facets_ok);
+
+	/* Add test cases to suite */
+	suite_add_tcase(s, tc_init);
+	suite_add_tcase(s, tc_tag);
+	suite_add_tcase(s, tc_query);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = repo_memory_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
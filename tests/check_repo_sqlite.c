@@ -8,15 +8,19 @@
 /* For the terms of usage and distribution, please see COPYING file.          */
 /* ========================================================================== */
 
+#include "core/query.h"
 #include "core/repo.h"
 #include "util/error.h"
+#include "util/hashtable.h"
 #include "util/misc.h"
 #include "util/string.h"
 #include "core/errors.h"
 #include <check.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
+#include <sqlite3.h>
 #include <unistd.h>
 
 /* ========================================================================== */
@@ -83,6 +87,28 @@ static void remove_files_repo_tmp()
 	ufa_free(TMP_TEST_FILE2);
 }
 
+/**
+ * Runs a query on global_repo, returning the number of files found
+ * ('expected' must be one of them, unless NULL).
+ */
+static int run_query(const char *str, const char *expected)
+{
+	struct ufa_error *error = NULL;
+	struct ufa_query *query = ufa_query_parse(str, &error);
+	ck_assert(error == NULL);
+
+	struct ufa_list *result = ufa_repo_query(global_repo, query, &error);
+	ck_assert(error == NULL);
+	if (expected != NULL) {
+		ASSERT_STR_IN_LIST(expected, result);
+	}
+	int count = ufa_list_size(result);
+
+	ufa_list_free(result);
+	ufa_query_free(query);
+	return count;
+}
+
 static void insert_test_tags()
 {
 	ufa_repo_inserttag(global_repo, TAG1, NULL);
@@ -303,6 +329,245 @@ START_TEST(rename_file)
 }
 END_TEST
 
+START_TEST(transaction_ok)
+{
+	struct ufa_error *error = NULL;
+	ck_assert(ufa_repo_begin(global_repo, &error));
+	ck_assert(ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error));
+
+	// transactions are not nested
+	ck_assert(!ufa_repo_begin(global_repo, &error));
+	ck_assert(error != NULL);
+	ck_assert_int_eq(UFA_ERROR_ARGS, error->code);
+	ufa_error_free(error);
+	error = NULL;
+
+	ck_assert(ufa_repo_commit(global_repo, &error));
+	ck_assert(!ufa_repo_commit(global_repo, &error));
+	ck_assert(error != NULL);
+	ufa_error_free(error);
+	error = NULL;
+
+	struct ufa_list *tags = ufa_repo_gettags(global_repo, TMP_TEST_FILE1,
+						 &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ufa_list_free(tags);
+}
+END_TEST
+
+START_TEST(sync_ok)
+{
+	struct ufa_error *error = NULL;
+	int renamed = -1;
+	int removed = -1;
+	insert_test_tags();
+	ck_assert(ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, NULL));
+	ck_assert(ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG2, NULL));
+
+	ck_assert(ufa_repo_sync(global_repo, &renamed, &removed, &error));
+	ck_assert(error == NULL);
+	ck_assert_int_eq(0, renamed);
+	ck_assert_int_eq(0, removed);
+
+	// renamed (not monitored) and removed
+	char *new_file = ufa_util_joinpath(TMP_REPO_DIR, "renamed1", NULL);
+	ck_assert_int_eq(0, rename(TMP_TEST_FILE1, new_file));
+	ufa_util_remove_file(TMP_TEST_FILE2, NULL);
+
+	ck_assert(ufa_repo_sync(global_repo, &renamed, &removed, &error));
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, renamed);
+	ck_assert_int_eq(1, removed);
+
+	struct ufa_list *tags = ufa_repo_gettags(global_repo, new_file, NULL);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ck_assert_str_eq(TAG1, tags->data);
+	ufa_list_free(tags);
+	tags = ufa_repo_gettags(global_repo, TMP_TEST_FILE2, &error);
+	ck_assert(tags == NULL);
+	ufa_error_free(error);
+
+	ck_assert_int_eq(0, rename(new_file, TMP_TEST_FILE1));
+	ufa_free(new_file);
+}
+END_TEST
+
+START_TEST(sync_modified_ok)
+{
+	struct ufa_error *error = NULL;
+	int renamed = -1;
+	int removed = -1;
+	insert_test_tags();
+	ck_assert(ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, NULL));
+	ck_assert(ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG2, NULL));
+
+	// modified while not monitored: found by the sync
+	FILE *f = fopen(TMP_TEST_FILE1, "w");
+	ck_assert(f != NULL);
+	fputs("new contents", f);
+	fclose(f);
+	ck_assert(ufa_repo_sync(global_repo, &renamed, &removed, &error));
+
+	// modified while monitored
+	f = fopen(TMP_TEST_FILE2, "w");
+	ck_assert(f != NULL);
+	fputs("new contents", f);
+	fclose(f);
+	ck_assert(ufa_repo_updatefile(global_repo, TMP_TEST_FILE2, &error));
+	ck_assert(!ufa_repo_updatefile(global_repo, TMP_REPO_FILE, &error));
+	ck_assert(error == NULL);
+
+	// then renamed while not monitored
+	char *new_file1 = ufa_util_joinpath(TMP_REPO_DIR, "renamed1", NULL);
+	char *new_file2 = ufa_util_joinpath(TMP_REPO_DIR, "renamed2", NULL);
+	ck_assert_int_eq(0, rename(TMP_TEST_FILE1, new_file1));
+	ck_assert_int_eq(0, rename(TMP_TEST_FILE2, new_file2));
+
+	ck_assert(ufa_repo_sync(global_repo, &renamed, &removed, &error));
+	ck_assert(error == NULL);
+	ck_assert_int_eq(2, renamed);
+	ck_assert_int_eq(0, removed);
+
+	struct ufa_list *tags = ufa_repo_gettags(global_repo, new_file1, NULL);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ck_assert_str_eq(TAG1, tags->data);
+	ufa_list_free(tags);
+	tags = ufa_repo_gettags(global_repo, new_file2, NULL);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ck_assert_str_eq(TAG2, tags->data);
+	ufa_list_free(tags);
+
+	ck_assert_int_eq(0, rename(new_file1, TMP_TEST_FILE1));
+	ck_assert_int_eq(0, rename(new_file2, TMP_TEST_FILE2));
+	ufa_free(new_file1);
+	ufa_free(new_file2);
+}
+END_TEST
+
+START_TEST(sync_inode_reused_ok)
+{
+	struct ufa_error *error = NULL;
+	int renamed = -1;
+	int removed = -1;
+	insert_test_tags();
+	ck_assert(ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, NULL));
+
+	// another file with the inode of the removed one (or the same file,
+	// modified and renamed while not monitored: it cannot be told apart)
+	char *new_file = ufa_util_joinpath(TMP_REPO_DIR, "other", NULL);
+	ck_assert_int_eq(0, rename(TMP_TEST_FILE1, new_file));
+	FILE *f = fopen(new_file, "w");
+	ck_assert(f != NULL);
+	fputs("other contents", f);
+	fclose(f);
+
+	ck_assert(ufa_repo_sync(global_repo, &renamed, &removed, &error));
+	ck_assert(error == NULL);
+	ck_assert_int_eq(0, renamed);
+	ck_assert_int_eq(1, removed);
+
+	struct ufa_list *tags = ufa_repo_gettags(global_repo, new_file, &error);
+	ck_assert(tags == NULL);
+	ufa_error_free(error);
+
+	ck_assert_int_eq(0, rename(new_file, TMP_TEST_FILE1));
+	ufa_free(new_file);
+}
+END_TEST
+
+START_TEST(migrate_v1_ok)
+{
+	struct ufa_error *error = NULL;
+	sqlite3 *db = NULL;
+	init_files_repo_tmp();
+
+	// database of version 1 with a tagged file
+	ck_assert_int_eq(SQLITE_OK, sqlite3_open(TMP_REPO_FILE, &db));
+	ck_assert_int_eq(SQLITE_OK, sqlite3_exec(db,
+	    "CREATE TABLE attribute (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+	    "  id_file INTEGER NOT NULL, name TEXT NOT NULL, value TEXT);"
+	    "CREATE TABLE file_tag (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+	    "  id_file INTEGER, id_tag INTEGER);"
+	    "CREATE TABLE file (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+	    "  name TEXT UNIQUE);"
+	    "CREATE TABLE tag (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+	    "  name TEXT UNIQUE);"
+	    "CREATE TABLE ufa (attr TEXT PRIMARY KEY, value TEXT NOT NULL);"
+	    "INSERT INTO ufa VALUES ('db_version', '1');"
+	    "INSERT INTO file VALUES (1, 'testfile1');"
+	    "INSERT INTO tag VALUES (1, 'tag1');"
+	    "INSERT INTO file_tag VALUES (1, 1, 1);",
+	    NULL, NULL, NULL));
+	sqlite3_close(db);
+
+	ufa_repo_t *repo = ufa_repo_init(TMP_REPO_DIR, &error);
+	ck_assert(error == NULL);
+	ck_assert(repo != NULL);
+
+	// inode is recorded by sync, then file can be renamed
+	ck_assert(ufa_repo_sync(repo, NULL, NULL, &error));
+	char *new_file = ufa_util_joinpath(TMP_REPO_DIR, "renamed1", NULL);
+	ck_assert_int_eq(0, rename(TMP_TEST_FILE1, new_file));
+	int renamed = 0;
+	ck_assert(ufa_repo_sync(repo, &renamed, NULL, &error));
+	ck_assert_int_eq(1, renamed);
+
+	struct ufa_list *tags = ufa_repo_gettags(repo, new_file, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(tags));
+	ck_assert_str_eq(TAG1, tags->data);
+	ufa_list_free(tags);
+
+	ck_assert_int_eq(0, rename(new_file, TMP_TEST_FILE1));
+	ufa_free(new_file);
+	ufa_repo_free(repo);
+	remove_files_repo_tmp();
+}
+END_TEST
+
+START_TEST(migrate_v2_ok)
+{
+	struct ufa_error *error = NULL;
+	sqlite3 *db = NULL;
+	init_files_repo_tmp();
+
+	// database of version 2 with attributes (without typed values)
+	ck_assert_int_eq(SQLITE_OK, sqlite3_open(TMP_REPO_FILE, &db));
+	ck_assert_int_eq(SQLITE_OK, sqlite3_exec(db,
+	    "CREATE TABLE attribute (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+	    "  id_file INTEGER NOT NULL, name TEXT NOT NULL, value TEXT);"
+	    "CREATE TABLE file_tag (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+	    "  id_file INTEGER, id_tag INTEGER);"
+	    "CREATE TABLE file (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+	    "  name TEXT UNIQUE, dev INTEGER, ino INTEGER, mtime INTEGER, "
+	    "  size INTEGER);"
+	    "CREATE TABLE tag (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+	    "  name TEXT UNIQUE);"
+	    "CREATE TABLE ufa (attr TEXT PRIMARY KEY, value TEXT NOT NULL);"
+	    "INSERT INTO ufa VALUES ('db_version', '2');"
+	    "INSERT INTO file (id, name) VALUES (1, 'testfile1');"
+	    "INSERT INTO file (id, name) VALUES (2, 'testfile2');"
+	    "INSERT INTO attribute VALUES (1, 1, 'size', '10');"
+	    "INSERT INTO attribute VALUES (2, 2, 'size', '9.5');"
+	    "INSERT INTO attribute VALUES (3, 1, 'date', '2024-03-01');",
+	    NULL, NULL, NULL));
+	sqlite3_close(db);
+
+	global_repo = ufa_repo_init(TMP_REPO_DIR, &error);
+	ck_assert(error == NULL);
+	ck_assert(global_repo != NULL);
+
+	ck_assert_int_eq(1, run_query("@size>9.5", "testfile1"));
+	ck_assert_int_eq(2, run_query("@size=9..10", NULL));
+	ck_assert_int_eq(1, run_query("@date>=2024-01-01", "testfile1"));
+
+	ufa_repo_free(global_repo);
+	global_repo = NULL;
+	remove_files_repo_tmp();
+}
+END_TEST
+
 
 /* ========================================================================== */
 /* TEST FUNCTIONS FOR ufa_repo_getrepopath                                    */
@@ -329,6 +594,607 @@ START_TEST(getrepopath_null)
 END_TEST
 
 
+/* ========================================================================== */
+/* TEST FUNCTIONS FOR ufa_repo_query                                          */
+/* ========================================================================== */
+
+START_TEST(query_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG2, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG2, &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "year", "2020", &error);
+	ck_assert(error == NULL);
+
+	ck_assert_int_eq(1, run_query("tag1", "testfile1"));
+	ck_assert_int_eq(2, run_query("tag2", NULL));
+	ck_assert_int_eq(1, run_query("tag1 AND tag2", "testfile1"));
+	ck_assert_int_eq(1, run_query("tag2 NOT tag1", "testfile2"));
+	ck_assert_int_eq(2, run_query("tag1 OR @year=2020", NULL));
+	ck_assert_int_eq(0, run_query("NOT tag2", NULL));
+	ck_assert_int_eq(0, run_query("tag1 AND (tag3 OR @year)", NULL));
+	ck_assert_int_eq(1, run_query("@year~=20*", "testfile2"));
+	ck_assert_int_eq(1, run_query("NOT (@year=2021 OR tag1)", "testfile2"));
+	ck_assert_int_eq(0, run_query("notag", NULL));
+}
+END_TEST
+
+START_TEST(query_typed_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "year", "2019", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "year", "2021", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "pages", "9", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "pages", "10.5", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "added",
+			 "2024-02-29T10:00:00Z", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "added", "2023-12-31",
+			 &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "title", "b..c", &error);
+	ck_assert(error == NULL);
+
+	ck_assert_int_eq(1, run_query("@year>=2020", "testfile2"));
+	ck_assert_int_eq(2, run_query("@year>2018", NULL));
+	ck_assert_int_eq(1, run_query("@year<2021", "testfile1"));
+	ck_assert_int_eq(1, run_query("@year<=2019", "testfile1"));
+	ck_assert_int_eq(2, run_query("@year=2019..2021", NULL));
+	ck_assert_int_eq(1, run_query("@year=2020..2030", "testfile2"));
+
+	// numbers are not compared as text ("9" > "10.5")
+	ck_assert_int_eq(1, run_query("@pages>9", "testfile2"));
+	ck_assert_int_eq(1, run_query("@pages<10", "testfile1"));
+	ck_assert_int_eq(1, run_query("@pages=10.5", "testfile2"));
+
+	ck_assert_int_eq(1, run_query("@added>=2024-01-01", "testfile1"));
+	ck_assert_int_eq(1, run_query("@added<2024-02-29T09:00", "testfile2"));
+	ck_assert_int_eq(2, run_query("@added=2023-12-31..2024-03-01", NULL));
+
+	// a range of text, and a range in quotes, are compared as text
+	ck_assert_int_eq(1, run_query("@title=b..c", "testfile1"));
+	ck_assert_int_eq(0, run_query("@year=\"2019..2021\"", NULL));
+	ck_assert_int_eq(1, run_query("@title<c", "testfile1"));
+}
+END_TEST
+
+START_TEST(search_typed_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "year", "2019", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "year", "2021", &error);
+	ck_assert(error == NULL);
+
+	struct ufa_list *filter = ufa_list_append2(
+	    NULL, ufa_repo_filterattr_new("year", "2020..2022", UFA_REPO_BETWEEN),
+	    (ufa_list_free_fn_t) ufa_repo_filterattr_free);
+	struct ufa_list *result =
+	    ufa_repo_search(global_repo, filter, NULL, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(result));
+	ASSERT_STR_IN_LIST("testfile2", result);
+	ufa_list_free(result);
+	ufa_list_free(filter);
+
+	filter = ufa_list_append2(
+	    NULL, ufa_repo_filterattr_new("year", "2021", UFA_REPO_LT),
+	    (ufa_list_free_fn_t) ufa_repo_filterattr_free);
+	result = ufa_repo_search(global_repo, filter, NULL, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(result));
+	ASSERT_STR_IN_LIST("testfile1", result);
+	ufa_list_free(result);
+	ufa_list_free(filter);
+}
+END_TEST
+
+/**
+ * Searches a page of the files with TAG1 on global_repo, checking that it
+ * has only 'expected' (or no file if NULL). The key of the last file
+ * replaces page->after.
+ */
+static void assert_page(struct ufa_repo_page *page, char **key,
+			const char *expected)
+{
+	struct ufa_error *error = NULL;
+	struct ufa_list *tags = ufa_list_append(NULL, (char *) TAG1);
+	char *last_key = NULL;
+
+	struct ufa_list *result = ufa_repo_search_page(global_repo, NULL, tags,
+						       page, &last_key, &error);
+	ck_assert(error == NULL);
+	if (expected == NULL) {
+		ck_assert(result == NULL);
+		ck_assert(last_key == NULL);
+	} else {
+		ck_assert_int_eq(1, ufa_list_size(result));
+		ck_assert_str_eq(expected, result->data);
+		ck_assert(last_key != NULL);
+	}
+
+	ufa_free(*key);
+	*key = last_key;
+	page->after = last_key;
+	ufa_list_free(result);
+	ufa_list_free(tags);
+}
+
+START_TEST(search_page_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG1, &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "pages", "10", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "pages", "9", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "year", "2020", &error);
+	ck_assert(error == NULL);
+
+	char *key = NULL;
+	struct ufa_repo_page page = {.sort = UFA_REPO_SORT_NAME, .limit = 1};
+	assert_page(&page, &key, "testfile1");
+	assert_page(&page, &key, "testfile2");
+	assert_page(&page, &key, NULL);
+
+	page = (struct ufa_repo_page){.sort = UFA_REPO_SORT_ID, .limit = 1};
+	assert_page(&page, &key, "testfile1");
+	assert_page(&page, &key, "testfile2");
+	assert_page(&page, &key, NULL);
+
+	// numbers are sorted as numbers ("9" < "10")
+	page = (struct ufa_repo_page){
+	    .sort = UFA_REPO_SORT_ATTR, .sort_attr = "pages", .limit = 1};
+	assert_page(&page, &key, "testfile2");
+	assert_page(&page, &key, "testfile1");
+	assert_page(&page, &key, NULL);
+
+	// files without the attribute come last
+	page = (struct ufa_repo_page){
+	    .sort = UFA_REPO_SORT_ATTR, .sort_attr = "year", .limit = 1};
+	assert_page(&page, &key, "testfile1");
+	assert_page(&page, &key, "testfile2");
+	assert_page(&page, &key, NULL);
+
+	page.after = "x";
+	struct ufa_list *result = ufa_repo_search_page(global_repo, NULL, NULL,
+						       &page, NULL, &error);
+	ck_assert(result == NULL);
+	ck_assert(error != NULL);
+	ck_assert_int_eq(UFA_ERROR_ARGS, error->code);
+	ufa_error_free(error);
+}
+END_TEST
+
+START_TEST(search_cached_ok)
+{
+	struct ufa_error *error = NULL;
+	insert_test_tags();
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG2, &error);
+	ck_assert(error == NULL);
+
+	// searches of the same shape reuse the statement with other values
+	const char *tags_searched[] = {TAG1, TAG2, TAG1, TAG3};
+	const char *expected[] = {"testfile1", "testfile2", "testfile1", NULL};
+	for (int i = 0; i < 4; i++) {
+		struct ufa_list *tags =
+		    ufa_list_append(NULL, (char *) tags_searched[i]);
+		struct ufa_list *result =
+		    ufa_repo_search(global_repo, NULL, tags, &error);
+		ck_assert(error == NULL);
+		if (expected[i] == NULL) {
+			ck_assert(result == NULL);
+		} else {
+			ck_assert_int_eq(1, ufa_list_size(result));
+			ASSERT_STR_IN_LIST(expected[i], result);
+		}
+		ufa_list_free(result);
+		ufa_list_free(tags);
+	}
+
+	// a change is seen by the next search
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG1, &error);
+	struct ufa_list *tags = ufa_list_append(NULL, (char *) TAG1);
+	struct ufa_list *result =
+	    ufa_repo_search(global_repo, NULL, tags, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(2, ufa_list_size(result));
+	ufa_list_free(result);
+	ufa_list_free(tags);
+
+	// a big filter is not truncated
+	struct ufa_list *filter = NULL;
+	for (int i = 0; i < 500; i++) {
+		char *name = ufa_str_sprintf("attribute%d", i);
+		ufa_repo_setattr(global_repo, TMP_TEST_FILE1, name, "v", &error);
+		filter = ufa_list_append2(
+		    filter, ufa_repo_filterattr_new(name, "v", UFA_REPO_EQUAL),
+		    (ufa_list_free_fn_t) ufa_repo_filterattr_free);
+		ufa_free(name);
+	}
+	ck_assert(error == NULL);
+	result = ufa_repo_search(global_repo, filter, NULL, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(result));
+	ASSERT_STR_IN_LIST("testfile1", result);
+	ufa_list_free(result);
+	ufa_list_free(filter);
+}
+END_TEST
+
+START_TEST(large_lists_ok)
+{
+	// lists longer than the max of SQL arguments
+	const int count = 100000;
+	struct ufa_error *error = NULL;
+	char *odd_file = ufa_util_joinpath(TMP_REPO_DIR, "a\"b\\c", NULL);
+	create_file(odd_file);
+	insert_test_tags();
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error);
+	ufa_repo_settag(global_repo, odd_file, TAG2, &error);
+	ck_assert(error == NULL);
+
+	struct ufa_list *names = NULL;
+	struct ufa_list *tags = NULL;
+	for (int i = 0; i < count; i++) {
+		names = ufa_list_prepend2(names,
+					  ufa_str_sprintf("missing%d", i),
+					  ufa_free);
+		tags = ufa_list_prepend2(tags, ufa_str_sprintf("tag%d", i),
+					 ufa_free);
+	}
+	names = ufa_list_prepend(names, "testfile1");
+	names = ufa_list_prepend(names, "a\"b\\c");
+
+	ufa_hashtable_t *table = ufa_repo_gettags_many(global_repo, names,
+						       &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(2, ufa_hashtable_size(table));
+	ck_assert(ufa_hashtable_has_key(table, "testfile1"));
+	ck_assert(ufa_hashtable_has_key(table, "a\"b\\c"));
+	ufa_hashtable_free(table);
+
+	struct ufa_list *result =
+	    ufa_repo_search(global_repo, NULL, tags, &error);
+	ck_assert(error == NULL);
+	ck_assert(result == NULL);
+
+	// no file has all the tags
+	tags = ufa_list_prepend(tags, (char *) TAG1);
+	result = ufa_repo_facets(global_repo, NULL, tags, false, &error);
+	ck_assert(error == NULL);
+	ck_assert(result == NULL);
+
+	ufa_list_free(names);
+	ufa_list_free(tags);
+	ufa_util_remove_file(odd_file, NULL);
+	ufa_free(odd_file);
+}
+END_TEST
+
+START_TEST(large_lists_found_ok)
+{
+	// lists longer than the max of SQL arguments, with values that exist
+	const int count = 600;
+	struct ufa_error *error = NULL;
+	insert_test_tags();
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG2, &error);
+
+	struct ufa_list *names = NULL;
+	struct ufa_list *tags = NULL;
+	ck_assert(ufa_repo_begin(global_repo, &error));
+	for (int i = 0; i < count; i++) {
+		char *tag = ufa_str_sprintf("many%d", i);
+		ufa_repo_settag(global_repo, TMP_TEST_FILE1, tag, &error);
+		tags = ufa_list_prepend2(tags, tag, ufa_free);
+		names = ufa_list_prepend2(names,
+					  ufa_str_sprintf("missing%d", i),
+					  ufa_free);
+	}
+	ck_assert(ufa_repo_commit(global_repo, &error));
+	ck_assert(error == NULL);
+	names = ufa_list_prepend(names, "testfile2");
+
+	ufa_hashtable_t *table = ufa_repo_gettags_many(global_repo, names,
+						       &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_hashtable_size(table));
+	struct ufa_list *file_tags = ufa_hashtable_get(table, "testfile2");
+	ck_assert_int_eq(1, ufa_list_size(file_tags));
+	ck_assert_str_eq(TAG2, file_tags->data);
+	ufa_hashtable_free(table);
+
+	// only testfile1 has all the tags
+	struct ufa_list *result =
+	    ufa_repo_search(global_repo, NULL, tags, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(result));
+	ck_assert_str_eq("testfile1", result->data);
+	ufa_list_free(result);
+
+	// the tags searched are not counted
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG3, &error);
+	result = ufa_repo_facets(global_repo, NULL, tags, false, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(result));
+	struct ufa_repo_facet *facet = result->data;
+	ck_assert_str_eq(TAG3, facet->name);
+	ck_assert_int_eq(1, facet->count);
+	ufa_list_free(result);
+
+	// ... and no file has all of them and TAG2
+	tags = ufa_list_prepend(tags, (char *) TAG2);
+	result = ufa_repo_search(global_repo, NULL, tags, &error);
+	ck_assert(error == NULL);
+	ck_assert(result == NULL);
+
+	ufa_list_free(names);
+	ufa_list_free(tags);
+}
+END_TEST
+
+START_TEST(facets_ok)
+{
+	struct ufa_error *error = NULL;
+	insert_test_tags();
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG1, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE1, TAG2, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG1, &error);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG3, &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "year", "2020", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "year", "2020", &error);
+	ck_assert(error == NULL);
+
+	// the tag searched is not counted
+	struct ufa_list *tags = ufa_list_append(NULL, (char *) TAG1);
+	struct ufa_list *result =
+	    ufa_repo_facets(global_repo, NULL, tags, true, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(3, ufa_list_size(result));
+	struct ufa_repo_facet *facet = ufa_list_get(result, 0)->data;
+	ck_assert_str_eq(TAG2, facet->name);
+	ck_assert(facet->value == NULL);
+	ck_assert_int_eq(1, facet->count);
+	facet = ufa_list_get(result, 1)->data;
+	ck_assert_str_eq(TAG3, facet->name);
+	facet = ufa_list_get(result, 2)->data;
+	ck_assert_str_eq("year", facet->name);
+	ck_assert_str_eq("2020", facet->value);
+	ck_assert_int_eq(2, facet->count);
+	ufa_list_free(result);
+	ufa_list_free(tags);
+
+	// without filters, every file is counted
+	result = ufa_repo_facets(global_repo, NULL, NULL, false, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(3, ufa_list_size(result));
+	facet = result->data;
+	ck_assert_str_eq(TAG1, facet->name);
+	ck_assert_int_eq(2, facet->count);
+	ufa_list_free(result);
+
+	struct ufa_list *filter = ufa_list_append2(
+	    NULL, ufa_repo_filterattr_new("year", "2020", UFA_REPO_EQUAL),
+	    (ufa_list_free_fn_t) ufa_repo_filterattr_free);
+	tags = ufa_list_append(NULL, (char *) TAG2);
+	result = ufa_repo_facets(global_repo, filter, tags, false, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(result));
+	facet = result->data;
+	ck_assert_str_eq(TAG1, facet->name);
+	ck_assert_int_eq(1, facet->count);
+	ufa_list_free(result);
+	ufa_list_free(tags);
+	ufa_list_free(filter);
+}
+END_TEST
+
+START_TEST(query_wildcard_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "title",
+			 "Annual Report 2023", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "title",
+			 "annual_summary", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "code", "12?x", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "code", "12[x", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "k", "x@1", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "k", "x_1", &error);
+	ck_assert(error == NULL);
+
+	// prefixes (case-insensitive)
+	ck_assert_int_eq(2, run_query("@title~=annual*", NULL));
+	ck_assert_int_eq(1, run_query("@title~=\"ANNUAL R*\"", "testfile1"));
+	ck_assert_int_eq(1, run_query("@title~=annual_*", "testfile2"));
+	ck_assert_int_eq(1, run_query("@k~=x@*", "testfile1"));
+	// exact values and any value
+	ck_assert_int_eq(1, run_query("@title~=ANNUAL_SUMMARY", "testfile2"));
+	ck_assert_int_eq(0, run_query("@title~=annual", NULL));
+	ck_assert_int_eq(2, run_query("@title~=*", NULL));
+	// other patterns, where '%', '_', '?' and '[' are not wildcards
+	ck_assert_int_eq(1, run_query("@title~=*REPORT*", "testfile1"));
+	ck_assert_int_eq(1, run_query("@title~=*l_*", "testfile2"));
+	ck_assert_int_eq(0, run_query("@title~=*20%*", NULL));
+	ck_assert_int_eq(1, run_query("@code~=*2?*", "testfile1"));
+	ck_assert_int_eq(1, run_query("@code~=*2[*", "testfile2"));
+	ck_assert_int_eq(2, run_query("@code~=*x", NULL));
+}
+END_TEST
+
+START_TEST(trigram_index_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "title",
+			 "Annual Report 2023", &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "title",
+			 "annual_summary", &error);
+	ck_assert(error == NULL);
+
+	ck_assert(!ufa_repo_has_trigram_index(global_repo));
+	ck_assert(ufa_repo_set_trigram_index(global_repo, true, &error));
+	ck_assert(error == NULL);
+	ck_assert(ufa_repo_has_trigram_index(global_repo));
+
+	ck_assert_int_eq(1, run_query("@title~=*report*", "testfile1"));
+	ck_assert_int_eq(1, run_query("@title~=*l_s*", "testfile2"));
+	ck_assert_int_eq(2, run_query("@title~=*nual*", NULL));
+	// run shorter than 3 characters (without the index)
+	ck_assert_int_eq(1, run_query("@title~=*23", "testfile1"));
+
+	// index follows changes
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "title", "Budget",
+			 &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(0, run_query("@title~=*report*", NULL));
+	ck_assert_int_eq(1, run_query("@title~=*udge*", "testfile1"));
+	ufa_repo_unsetattr(global_repo, TMP_TEST_FILE1, "title", &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(0, run_query("@title~=*udge*", NULL));
+
+	struct ufa_list *filter = ufa_list_append2(
+	    NULL, ufa_repo_filterattr_new("title", "*summ*", UFA_REPO_WILDCARD),
+	    (ufa_list_free_fn_t) ufa_repo_filterattr_free);
+	struct ufa_list *result =
+	    ufa_repo_search(global_repo, filter, NULL, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(result));
+	ASSERT_STR_IN_LIST("testfile2", result);
+	ufa_list_free(result);
+	ufa_list_free(filter);
+
+	ck_assert(ufa_repo_set_trigram_index(global_repo, false, &error));
+	ck_assert(!ufa_repo_has_trigram_index(global_repo));
+	ck_assert_int_eq(1, run_query("@title~=*summ*", "testfile2"));
+}
+END_TEST
+
+START_TEST(fulltext_index_ok)
+{
+	struct ufa_error *error = NULL;
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE1, "desc", "Fox, fox and fox",
+			 &error);
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "desc",
+			 "A quick résumé of the fox and other foxes", &error);
+	ck_assert(error == NULL);
+
+	// without the index, words are substrings
+	ck_assert(!ufa_repo_has_fulltext_index(global_repo));
+	ck_assert_int_eq(1, run_query("@desc~~QUICK", "testfile2"));
+	ck_assert_int_eq(2, run_query("@desc~~\"fox and\"", NULL));
+	ck_assert_int_eq(1, run_query("@desc~~\"foxe fox\"", "testfile2"));
+	ck_assert_int_eq(0, run_query("@desc~~resume", NULL));
+
+	ck_assert(ufa_repo_set_fulltext_index(global_repo, true, &error));
+	ck_assert(error == NULL);
+	ck_assert(ufa_repo_has_fulltext_index(global_repo));
+
+	// with the index, words are tokens (or prefixes)
+	ck_assert_int_eq(1, run_query("@desc~~resume", "testfile2"));
+	ck_assert_int_eq(2, run_query("@desc~~\"FOX and\"", NULL));
+	ck_assert_int_eq(0, run_query("@desc~~foxe", NULL));
+	ck_assert_int_eq(1, run_query("@desc~~foxe*", "testfile2"));
+	// FTS5 operators and punctuation are words
+	ck_assert_int_eq(0, run_query("@desc~~\"fox OR missing\"", NULL));
+	ck_assert_int_eq(2, run_query("@desc~~\"fox, ( \\\"\"", NULL));
+	ck_assert_int_eq(0, run_query("@title~~fox", NULL));
+
+	// ordered by relevance
+	struct ufa_list *filter = ufa_list_append2(
+	    NULL, ufa_repo_filterattr_new("desc", "fox", UFA_REPO_FULLTEXT),
+	    (ufa_list_free_fn_t) ufa_repo_filterattr_free);
+	struct ufa_list *result =
+	    ufa_repo_search(global_repo, filter, NULL, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(2, ufa_list_size(result));
+	ck_assert_str_eq("testfile1", (char *) result->data);
+	ck_assert_str_eq("testfile2", (char *) result->next->data);
+	ufa_list_free(result);
+
+	ufa_list_free(filter);
+	filter = ufa_list_append2(
+	    NULL, ufa_repo_filterattr_new("desc", "quick", UFA_REPO_FULLTEXT),
+	    (ufa_list_free_fn_t) ufa_repo_filterattr_free);
+	struct ufa_list *tags = ufa_list_append(NULL, TAG1);
+	ufa_repo_settag(global_repo, TMP_TEST_FILE2, TAG1, &error);
+	result = ufa_repo_search(global_repo, filter, tags, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(result));
+	ASSERT_STR_IN_LIST("testfile2", result);
+	ufa_list_free(result);
+	ufa_list_free(tags);
+
+	// index follows changes
+	ufa_repo_setattr(global_repo, TMP_TEST_FILE2, "desc", "Budget", &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(0, run_query("@desc~~quick", NULL));
+	ck_assert_int_eq(1, run_query("@desc~~budget", "testfile2"));
+	ufa_repo_removefile(global_repo, TMP_TEST_FILE2, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(0, run_query("@desc~~budget", NULL));
+
+	ck_assert(ufa_repo_set_fulltext_index(global_repo, false, &error));
+	ck_assert(!ufa_repo_has_fulltext_index(global_repo));
+	ck_assert_int_eq(1, run_query("@desc~~fox", "testfile1"));
+	ufa_list_free(filter);
+}
+END_TEST
+
+START_TEST(query_null)
+{
+	struct ufa_error *error = NULL;
+	struct ufa_list *result = ufa_repo_query(global_repo, NULL, &error);
+	ck_assert(result == NULL);
+	ck_assert(error != NULL);
+	ck_assert_int_eq(UFA_ERROR_ARGS, error->code);
+	ufa_error_free(error);
+}
+END_TEST
+
+
+/* ========================================================================== */
+/* TEST FUNCTIONS FOR SQL PROFILING                                           */
+/* ========================================================================== */
+
+START_TEST(profile_slowlog_ok)
+{
+	struct ufa_error *error = NULL;
+	FILE *slowlog = tmpfile();
+
+	init_files_repo_tmp();
+	ufa_repo_profile_enable(0, slowlog, true);
+	ufa_repo_t *repo = ufa_repo_init(TMP_REPO_DIR, &error);
+	ck_assert(error == NULL);
+
+	ufa_repo_settag(repo, TMP_TEST_FILE1, TAG1, &error);
+	struct ufa_list *tags = ufa_list_append(NULL, TAG1);
+	struct ufa_list *result = ufa_repo_search(repo, NULL, tags, &error);
+	ck_assert(error == NULL);
+	ck_assert_int_eq(1, ufa_list_size(result));
+	ufa_repo_profile_disable();
+
+	bool found_search = false;
+	bool found_plan = false;
+	char line[4096];
+	rewind(slowlog);
+	while (fgets(line, sizeof(line), slowlog) != NULL) {
+		if (strstr(line, "rows=1 sql=SELECT") && strstr(line, TAG1)) {
+			found_search = true;
+			ck_assert(strstr(line, "repo=") != NULL);
+		}
+		if (strstr(line, "plan: ") != NULL) {
+			found_plan = true;
+		}
+	}
+	ck_assert(found_search);
+	ck_assert(found_plan);
+
+	ufa_list_free(result);
+	ufa_list_free(tags);
+	ufa_repo_free(repo);
+	remove_files_repo_tmp();
+	fclose(slowlog);
+}
+END_TEST
+
+
 /* ========================================================================== */
 /* SUITE DEFINITIONS AND MAIN FUNCTION                                        */
 /* ========================================================================== */
@@ -340,6 +1206,8 @@ Suite *repo_suite(void)
 	TCase *tc_tag;
 	TCase *tc_getrepopath;
 	TCase *tc_fileops;
+	TCase *tc_query;
+	TCase *tc_profile;
 
 	s = suite_create("Repo");
 
@@ -348,6 +1216,8 @@ Suite *repo_suite(void)
 	tcase_add_test(tc_init, init_error_notdir);
 	tcase_add_test(tc_init, init_error_create_db);
 	tcase_add_test(tc_init, init_ok);
+	tcase_add_test(tc_init, migrate_v1_ok);
+	tcase_add_test(tc_init, migrate_v2_ok);
 
 	/* Tag management case */
 	tc_tag = tcase_create("tags");
@@ -369,12 +1239,38 @@ Suite *repo_suite(void)
 	tc_fileops = tcase_create("fileop");
 	tcase_add_checked_fixture(tc_fileops, setup_repo, teardown_repo);
 	tcase_add_test(tc_fileops, rename_file);
+	tcase_add_test(tc_fileops, transaction_ok);
+	tcase_add_test(tc_fileops, sync_ok);
+	tcase_add_test(tc_fileops, sync_modified_ok);
+	tcase_add_test(tc_fileops, sync_inode_reused_ok);
+
+	/* Search with query */
+	tc_query = tcase_create("query");
+	tcase_add_checked_fixture(tc_query, setup_repo, teardown_repo);
+	tcase_add_test(tc_query, query_ok);
+	tcase_add_test(tc_query, query_typed_ok);
+	tcase_add_test(tc_query, search_typed_ok);
+	tcase_add_test(tc_query, search_page_ok);
+	tcase_add_test(tc_query, search_cached_ok);
+	tcase_add_test(tc_query, facets_ok);
+	tcase_add_test(tc_query, large_lists_ok);
+	tcase_add_test(tc_query, large_lists_found_ok);
+	tcase_add_test(tc_query, query_wildcard_ok);
+	tcase_add_test(tc_query, trigram_index_ok);
+	tcase_add_test(tc_query, fulltext_index_ok);
+	tcase_add_test(tc_query, query_null);
+
+	/* SQL profiling */
+	tc_profile = tcase_create("profile");
+	tcase_add_test(tc_profile, profile_slowlog_ok);
 
 	/* Add test cases to suite */
 	suite_add_tcase(s, tc_init);
 	suite_add_tcase(s, tc_tag);
 	suite_add_tcase(s, tc_getrepopath);
 	suite_add_tcase(s, tc_fileops);
+	suite_add_tcase(s, tc_query);
+	suite_add_tcase(s, tc_profile);
 
 	return s;
 }
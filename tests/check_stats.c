@@ -0,0 +1,146 @@
+/* ========================================================================== */
+/* Copyright (c) 2024 Henrique Teófilo                                        */
+/* All rights reserved.                                                       */
+/*                                                                            */
+/* Test cases for stats.c                                                     */
+/*                                                                            */
+/* This file is part of UFA Project.                                          */
+/* For the terms of usage and distribution, please see COPYING file.          */
+/* ========================================================================== */
+
+#include "util/list.h"
+#include "util/stats.h"
+#include "util/string.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* ========================================================================== */
+/* VARIABLES AND DEFINITIONS                                                  */
+/* ========================================================================== */
+
+#define NUM_THREADS 8
+#define RECORDS_PER_THREAD 10000
+
+static void *record_metrics(void *arg)
+{
+	for (int i = 0; i < RECORDS_PER_THREAD; i++) {
+		ufa_stats_add("threads", i % 100, (i % 10) == 0);
+	}
+	return NULL;
+}
+
+
+/* ========================================================================== */
+/* TEST FUNCTIONS                                                             */
+/* ========================================================================== */
+
+
+START_TEST(percentiles_ok)
+{
+	for (int i = 1; i <= 100; i++) {
+		ufa_stats_add("percentiles", i * 10, false);
+	}
+	ufa_stats_add("percentiles", 5000, true);
+
+	struct ufa_stats_summary *s = ufa_stats_summary_of("percentiles");
+	ck_assert(s != NULL);
+	ck_assert_str_eq("percentiles", s->name);
+	ck_assert_int_eq(101, s->count);
+	ck_assert_int_eq(1, s->errors);
+	ck_assert_int_eq(5000, s->max);
+	ck_assert_int_eq((50500 + 5000) / 101, s->mean);
+
+	// Percentiles are upper limits of power of two buckets
+	ck_assert(s->p50 >= 500 && s->p50 < 1000);
+	ck_assert(s->p90 >= 900 && s->p90 < 1800);
+	ck_assert(s->p99 >= 990 && s->p99 <= s->max);
+	ufa_stats_summary_free(s);
+}
+END_TEST
+
+
+START_TEST(summary_sorted_ok)
+{
+	ufa_stats_add("b.metric", 1, false);
+	ufa_stats_add("a.metric", 1, false);
+	ufa_stats_add("c.metric", 1, false);
+
+	struct ufa_list *list = ufa_stats_summary();
+	ck_assert(ufa_list_size(list) >= 3);
+	const char *previous = "";
+	int found = 0;
+	for (UFA_LIST_EACH(i, list)) {
+		struct ufa_stats_summary *s =
+		    (struct ufa_stats_summary *) i->data;
+		ck_assert(strcmp(previous, s->name) < 0);
+		previous = s->name;
+		found += ufa_str_endswith(s->name, ".metric");
+	}
+	ck_assert_int_eq(3, found);
+	ufa_list_free(list);
+
+	ck_assert(ufa_stats_summary_of("nonexistent") == NULL);
+}
+END_TEST
+
+
+START_TEST(threads_ok)
+{
+	pthread_t threads[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_create(&threads[i], NULL, record_metrics, NULL);
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	struct ufa_stats_summary *s = ufa_stats_summary_of("threads");
+	ck_assert_int_eq(NUM_THREADS * RECORDS_PER_THREAD, s->count);
+	ck_assert_int_eq(NUM_THREADS * RECORDS_PER_THREAD / 10, s->errors);
+	ck_assert_int_eq(99, s->max);
+	ufa_stats_summary_free(s);
+}
+END_TEST
+
+
+/* ========================================================================== */
+/* SUITE DEFINITIONS AND MAIN FUNCTION                                        */
+/* ========================================================================== */
+
+Suite *stats_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("Stats");
+
+	/* Core test case */
+	tc_core = tcase_create("core");
+	tcase_add_test(tc_core, percentiles_ok);
+	tcase_add_test(tc_core, summary_sorted_ok);
+	tcase_add_test(tc_core, threads_ok);
+
+	/* Add test cases to suite */
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = stats_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -9,10 +9,12 @@
 /* ========================================================================== */
 
 #include "util/list.h"
+#include "util/misc.h"
 #include "util/string.h"
 #include <check.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* ========================================================================== */
 /* TEST FUNCTIONS                                                             */
@@ -40,6 +42,81 @@ START_TEST(str_split_ok)
 }
 END_TEST
 
+START_TEST(str_to_number_ok)
+{
+	long l = 0;
+	double d = 0;
+
+	ck_assert(ufa_str_to_long("2020", &l));
+	ck_assert_int_eq(2020, l);
+	ck_assert(ufa_str_to_long(" -7 ", &l));
+	ck_assert_int_eq(-7, l);
+	ck_assert(!ufa_str_to_long("2020abc", &l));
+	ck_assert(!ufa_str_to_long("1.5", &l));
+	ck_assert(!ufa_str_to_long("", &l));
+	ck_assert(!ufa_str_to_long("99999999999999999999", &l));
+
+	ck_assert(ufa_str_to_double("1.5", &d));
+	ck_assert(d == 1.5);
+	ck_assert(ufa_str_to_double("-2e3", &d));
+	ck_assert(d == -2000.0);
+	ck_assert(!ufa_str_to_double("1.5x", &d));
+	ck_assert(!ufa_str_to_double("2020-01-01", &d));
+}
+END_TEST
+
+START_TEST(str_to_time_ok)
+{
+	time_t t = 0;
+
+	ck_assert(ufa_str_to_time("1970-01-01", &t));
+	ck_assert_int_eq(0, t);
+	ck_assert(ufa_str_to_time("2000-03-01", &t));
+	ck_assert_int_eq(951868800, t);
+	ck_assert(ufa_str_to_time("2024-02-29T12:30:15Z", &t));
+	ck_assert_int_eq(1709209815, t);
+	ck_assert(ufa_str_to_time("2024-02-29 12:30", &t));
+	ck_assert_int_eq(1709209800, t);
+	ck_assert(ufa_str_to_time("1969-12-31", &t));
+	ck_assert_int_eq(-86400, t);
+
+	ck_assert(!ufa_str_to_time("2023-02-29", &t));
+	ck_assert(!ufa_str_to_time("2023-13-01", &t));
+	ck_assert(!ufa_str_to_time("2023-1-01", &t));
+	ck_assert(!ufa_str_to_time("2023-01-01T25:00", &t));
+	ck_assert(!ufa_str_to_time("2023-01-01x", &t));
+	ck_assert(!ufa_str_to_time("2023", &t));
+}
+END_TEST
+
+START_TEST(str_builder_ok)
+{
+	struct ufa_str_builder builder = UFA_STR_BUILDER_INIT;
+
+	char *str = ufa_str_builder_take(&builder);
+	ck_assert_str_eq("", str);
+	ufa_free(str);
+
+	ufa_str_builder_append(&builder, "a");
+	ufa_str_builder_appendf(&builder, "(%d,%s)", 10, "b");
+	ufa_str_builder_append(&builder, "");
+	str = ufa_str_builder_take(&builder);
+	ck_assert_str_eq("a(10,b)", str);
+	ck_assert(builder.str == NULL);
+	ck_assert_int_eq(0, builder.len);
+	ufa_free(str);
+
+	// grows past the first allocation
+	for (int i = 0; i < 10000; i++) {
+		ufa_str_builder_append(&builder, "? OR ");
+	}
+	ck_assert_int_eq(50000, builder.len);
+	str = ufa_str_builder_take(&builder);
+	ck_assert_int_eq(50000, strlen(str));
+	ck_assert_int_eq(10000, ufa_str_count(str, "?"));
+	ufa_free(str);
+}
+END_TEST
 
 
 /* ========================================================================== */
@@ -56,6 +133,9 @@ Suite *repo_suite(void)
 	/* Core test case */
 	tc_core = tcase_create("core");
 	tcase_add_test(tc_core, str_split_ok);
+	tcase_add_test(tc_core, str_to_number_ok);
+	tcase_add_test(tc_core, str_to_time_ok);
+	tcase_add_test(tc_core, str_builder_ok);
 
 	/* Add test cases to suite */
 	suite_add_tcase(s, tc_core);